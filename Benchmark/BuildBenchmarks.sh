@@ -0,0 +1,5 @@
+#! /bin/bash
+
+gcc -O2 -Wall -o Pipelining ../Common/LineFramer.c Pipelining.c
+gcc -O2 -Wall -o ParserBench ../Server/Parser.c ../Server/Rooms.c ParserBench.c
+gcc -O2 -Wall -o ServerBench ../Common/LineFramer.c ../Common/Histogram.c ../Client/LoadGenerator.c ServerBench.c -lm
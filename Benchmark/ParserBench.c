@@ -0,0 +1,189 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<time.h>
+#include "../Server/Parser.h"
+#include "../Server/Rooms.h"
+
+// Measures the ns per line spent by parse_request and by the parser it replaced, on chat lines and on command lines.
+// The old parser found the room of START too, so parse_request is timed together with the lookup inside the registry of the rooms
+
+#define DEFAULT_ROUNDS 200000 // How many times every set of lines is parsed
+
+// The parser used by the server before parse_request, kept here as the baseline
+int legacy_parse_client_request(const char* request_buffer);
+// What parse_request returns for a line the old parser parsed as legacy: the rooms are now looked up by the server, so every START is REQUEST_START
+int legacy_to_request(int legacy);
+// Parses every line rounds times with parse_request, looking for the room of START. Returns the ns per line
+double bench_parse_request(const char** lines, const int* lens, int n_lines, int rounds);
+// Parses every line rounds times with legacy_parse_client_request. Returns the ns per line
+double bench_legacy(const char** lines, int n_lines, int rounds);
+// Nanoseconds elapsed between two instants
+double elapsed_ns(const struct timespec* from, const struct timespec* to);
+
+const char* chat_lines[] = {
+  "hi\n",
+  "hello, how are you?\n",
+  "I watched a horror movie yesterday, it was terrible <3\n",
+  "lol\n",
+  "did you ever travel to Japan? I went there in 2019 and loved it\n",
+  "/me waves\n",
+  "http://example.com/some/long/path?with=query&and=more\n",
+  "the climate is changing faster than we thought, look at the last report > 1.5 degrees\n",
+};
+
+const char* command_lines[] = {
+  "//command:<USERS>\n",
+  "//command:<ROOMS>\n",
+  "//command:<HELP>\n",
+  "//command:<REROLL>\n",
+  "//command:<STOP>\n",
+  "//command:START<Climate change>\n",
+  "//command:START<Horror movies>\n",
+  "//command:NICKNAME<giorgio>\n",
+};
+
+// Keeps the compiler from dropping the calls whose result is not used
+volatile int sink ;
+
+int main(int argc, char* argv[]){
+
+  int rounds = argc > 1 ? atoi(argv[1]) : DEFAULT_ROUNDS ;
+  int n_chat = sizeof(chat_lines)/sizeof(chat_lines[0]) ;
+  int n_command = sizeof(command_lines)/sizeof(command_lines[0]) ;
+  int chat_lens[sizeof(chat_lines)/sizeof(chat_lines[0])];
+  int command_lens[sizeof(command_lines)/sizeof(command_lines[0])];
+  int mismatches = 0 ;
+
+  if (rounds <= 0){
+    printf("Usage : %s [rounds]\n", argv[0]);
+    return 1;
+  }
+  rooms_load_defaults();
+
+  // Both parsers must agree, or the comparison would be meaningless
+  for (int i = 0; i < n_chat; i++) {
+    chat_lens[i] = strlen(chat_lines[i]);
+    if (parse_request(chat_lines[i], chat_lens[i], NULL, NULL) != legacy_to_request(legacy_parse_client_request(chat_lines[i])))
+      mismatches++ ;
+  }
+  for (int i = 0; i < n_command; i++) {
+    command_lens[i] = strlen(command_lines[i]);
+    if (parse_request(command_lines[i], command_lens[i], NULL, NULL) != legacy_to_request(legacy_parse_client_request(command_lines[i])))
+      mismatches++ ;
+  }
+  if (mismatches > 0){
+    printf("The parsers disagree on %d lines\n", mismatches);
+    return 2;
+  }
+
+  printf("rounds=%d\n", rounds);
+  printf("chat_lines    parse_request_ns=%.2f legacy_ns=%.2f\n", bench_parse_request(chat_lines, chat_lens, n_chat, rounds), bench_legacy(chat_lines, n_chat, rounds));
+  printf("command_lines parse_request_ns=%.2f legacy_ns=%.2f\n", bench_parse_request(command_lines, command_lens, n_command, rounds), bench_legacy(command_lines, n_command, rounds));
+  return 0;
+}
+
+// What parse_request returns for a line the old parser parsed as legacy: the rooms are now looked up by the server, so every START is REQUEST_START
+int legacy_to_request(int legacy){
+  if (legacy == -2 || (legacy >= 2 && legacy <= 4))
+    return REQUEST_START;
+  return legacy;
+}
+
+// Parses every line rounds times with parse_request, looking for the room of START. Returns the ns per line
+double bench_parse_request(const char** lines, const int* lens, int n_lines, int rounds){
+  struct timespec start, end ;
+  const char* argument ;
+  int result = 0, argument_len, request ;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < n_lines; i++) {
+      request = parse_request(lines[i], lens[i], &argument, &argument_len);
+      if (request == REQUEST_START)
+        request += rooms_find(argument, argument_len) != NULL ;
+      result += request ;
+    }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  sink = result ;
+  return elapsed_ns(&start, &end) / ((double)rounds * n_lines);
+}
+
+// Parses every line rounds times with legacy_parse_client_request. Returns the ns per line
+double bench_legacy(const char** lines, int n_lines, int rounds){
+  struct timespec start, end ;
+  int result = 0 ;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < rounds; r++)
+    for (int i = 0; i < n_lines; i++)
+      result += legacy_parse_client_request(lines[i]);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  sink = result ;
+  return elapsed_ns(&start, &end) / ((double)rounds * n_lines);
+}
+
+// Nanoseconds elapsed between two instants
+double elapsed_ns(const struct timespec* from, const struct timespec* to){
+  return (to->tv_sec - from->tv_sec) * 1e9 + (to->tv_nsec - from->tv_nsec) ;
+}
+
+// The parser used by the server before parse_request, kept here as the baseline
+int legacy_parse_client_request(const char* request_buffer){
+
+  size_t less_index, major_index ;
+  char *find_less; // Less is intended to be the char '<'
+  char *find_major; // Major instead '>'
+
+  find_less = strchr(request_buffer,'<');
+  find_major = strchr(request_buffer,'>');
+  if ( find_less != NULL && find_major != NULL ){
+
+    less_index = (size_t)(find_less - request_buffer);
+    major_index = (size_t)(find_major - request_buffer);
+
+    // If after the '>' there is somethig else, then wrong syntax
+    if (request_buffer[major_index+1]!='\n' && request_buffer[major_index+1]!='\0')
+      goto invalidSyntax ;
+
+    // If the request doesn't start with //command: or //command:START , then wrong syntax
+    if (strncmp(request_buffer,"//command:",less_index)!=0){ //&& strncmp(request_buffer,"//command:START",less_index)!=0)
+      if(strncmp(request_buffer,"//command:START",less_index)!=0){
+        if(strncmp(request_buffer,"//command:NICKNAME",less_index)!=0){
+          goto invalidSyntax;
+        }else{
+          return 9;
+        }
+      }else{
+        if (strncmp(find_less,"<Climate change>", major_index-less_index+1 )==0 ){
+          return 2;
+        }else if (strncmp(find_less,"<Travel related>", major_index-less_index+1 )==0 ){
+          return 3;
+        }else if (strncmp(find_less,"<Horror movies>", major_index-less_index+1 )==0 ){
+          return 4;
+        }else{
+          return -2;
+        }
+
+      }
+    }else{
+      if (strncmp(find_less,"<USERS>", major_index-less_index+1 )==0 ){
+        return 1;
+      }else if( strncmp(find_less,"<REROLL>", major_index-less_index+1 )==0 ){
+        return 5;
+      }else if (strncmp( find_less,"<STOP>", major_index-less_index+1 )==0 ){
+        return 6;
+      }else if (strncmp( find_less,"<ROOMS>", major_index-less_index+1 )==0 ){
+        return 7;
+      }else if (strncmp( find_less,"<HELP>", major_index-less_index+1 )==0 ){
+        return 8;
+      }else{
+        return 0;
+      }
+    }
+
+  }else{
+    goto invalidSyntax;
+  }
+
+  invalidSyntax:
+  return -1 ;
+}
@@ -0,0 +1,209 @@
+#include<sys/socket.h>
+#include<arpa/inet.h>
+#include<netinet/tcp.h>
+#include<poll.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include<time.h>
+#include "../Common/LineFramer.h"
+
+// Measures how fast the server serves requests pipelined in the same segment.
+// Every connection sends a batch of //command:<ROOMS> in a single write, then waits for all the replies before sending the next batch
+
+#define DEFAULT_ADDRESS "127.0.0.1"
+#define DEFAULT_PORT 23456
+#define BUF_SIZE 1024
+#define REPLY_MARKER "*** AVAILABLE ROOMS ***"
+#define REPLY_TIMEOUT_MS 5000 // A batch whose replies don't arrive in time means that some request has been lost
+
+typedef struct bench_conn {
+  int sd ;
+  char recv_buff[BUF_SIZE];
+  lineFramer framer ;
+  int replies ; // Replies received for the current batch
+} benchConnection ;
+
+// Opens a connection and sets the nickname. Returns the socket descriptor, -1 in case of error
+int open_connection(const struct sockaddr_in* server_address, int index);
+// Writes the whole buffer, in pieces of fragment bytes if fragment > 0. Returns -1 in case of error, 0 otherwise
+int write_batch(int sd, const char* batch, int len, int fragment);
+// Counts the replies found in what the server sent. Returns -1 if the connection has been closed, 0 otherwise
+int read_replies(benchConnection* conn);
+// Milliseconds elapsed between two instants
+double elapsed_ms(const struct timespec* from, const struct timespec* to);
+// Comparator used to sort the latencies
+int compare_doubles(const void* a, const void* b);
+
+int main(int argc, char* argv[]){
+
+  // Usage : ./Pipelining [connections] [commands per segment] [batches] [fragment bytes] [address] [port]
+  int n_connections = argc > 1 ? atoi(argv[1]) : 4 ;
+  int batch_size = argc > 2 ? atoi(argv[2]) : 64 ;
+  int n_batches = argc > 3 ? atoi(argv[3]) : 200 ;
+  int fragment = argc > 4 ? atoi(argv[4]) : 0 ; // When > 0 every batch is written in pieces of this size, splitting the commands across segments
+  const char* address = argc > 5 ? argv[5] : DEFAULT_ADDRESS ;
+  int port = argc > 6 ? atoi(argv[6]) : DEFAULT_PORT ;
+
+  struct sockaddr_in server_address ;
+  struct timespec start, batch_start, now ;
+  benchConnection* conns ;
+  struct pollfd* fds ;
+  double* latencies ;
+  char* batch ;
+  int batch_len, missing ;
+
+  if (n_connections <= 0 || batch_size <= 0 || n_batches <= 0){
+    printf("Usage : %s [connections] [commands per segment] [batches] [fragment bytes] [address] [port]\n", argv[0]);
+    return 1;
+  }
+
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET ;
+  server_address.sin_port = htons(port);
+  if (inet_aton(address, &server_address.sin_addr) == 0){
+    printf("Invalid address : %s\n", address);
+    return 1;
+  }
+
+  conns = (benchConnection*)calloc(n_connections, sizeof(benchConnection));
+  fds = (struct pollfd*)calloc(n_connections, sizeof(struct pollfd));
+  latencies = (double*)calloc(n_batches, sizeof(double));
+  batch_len = batch_size * strlen("//command:<ROOMS>\n") ;
+  batch = (char*)malloc(batch_len + 1);
+  if (conns == NULL || fds == NULL || latencies == NULL || batch == NULL){
+    printf("Not enough memory\n");
+    return 1;
+  }
+  batch[0] = '\0' ;
+  for (int i = 0; i < batch_size; i++)
+    strcat(batch, "//command:<ROOMS>\n");
+
+  for (int i = 0; i < n_connections; i++) {
+    if ((conns[i].sd = open_connection(&server_address, i)) < 0){
+      printf("Connection %d failed : %s\n", i, strerror(errno));
+      return 1;
+    }
+    framer_init(&conns[i].framer, conns[i].recv_buff, BUF_SIZE-1);
+    fds[i].fd = conns[i].sd ;
+    fds[i].events = POLLIN ;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int b = 0; b < n_batches; b++) {
+
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+    for (int i = 0; i < n_connections; i++) {
+      conns[i].replies = 0 ;
+      if (write_batch(conns[i].sd, batch, batch_len, fragment) < 0){
+        printf("Error sending a batch : %s\n", strerror(errno));
+        return 1;
+      }
+    }
+
+    missing = n_connections ;
+    while (missing > 0) {
+      if (poll(fds, n_connections, REPLY_TIMEOUT_MS) <= 0){
+        printf("Timeout : some replies of batch %d never arrived, the server lost pipelined requests\n", b);
+        return 2;
+      }
+      for (int i = 0; i < n_connections; i++) {
+        if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+          continue;
+        if (read_replies(&conns[i]) < 0){
+          printf("Connection %d closed by the server\n", i);
+          return 1;
+        }
+        if (conns[i].replies >= batch_size && fds[i].events != 0){
+          // Done with this batch: the connection is not polled until the next one
+          fds[i].events = 0 ;
+          missing-- ;
+        }
+      }
+    }
+    for (int i = 0; i < n_connections; i++)
+      fds[i].events = POLLIN ;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    latencies[b] = elapsed_ms(&batch_start, &now);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  double total_ms = elapsed_ms(&start, &now);
+  long total_requests = (long)n_connections * batch_size * n_batches ;
+  qsort(latencies, n_batches, sizeof(double), compare_doubles);
+  printf("connections=%d commands_per_segment=%d batches=%d fragment=%d\n", n_connections, batch_size, n_batches, fragment);
+  printf("requests=%ld elapsed_ms=%.1f requests_per_s=%.0f\n", total_requests, total_ms, total_requests / (total_ms / 1000.0));
+  printf("batch_latency_ms p50=%.3f p99=%.3f max=%.3f\n", latencies[n_batches/2], latencies[(n_batches*99)/100], latencies[n_batches-1]);
+
+  for (int i = 0; i < n_connections; i++)
+    close(conns[i].sd);
+  return 0;
+}
+
+// Opens a connection and sets the nickname. Returns the socket descriptor, -1 in case of error
+int open_connection(const struct sockaddr_in* server_address, int index){
+  char request[64];
+  int flags = 1 ;
+  int sd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sd < 0)
+    return -1;
+  if (connect(sd, (const struct sockaddr*)server_address, sizeof(*server_address)) < 0){
+    close(sd);
+    return -1;
+  }
+  // Every fragment must leave as its own segment
+  setsockopt(sd, IPPROTO_TCP, TCP_NODELAY, &flags, sizeof(flags));
+  sprintf(request, "//command:NICKNAME<bench%d>\n", index);
+  if (write_batch(sd, request, strlen(request), 0) < 0){
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+// Writes the whole buffer, in pieces of fragment bytes if fragment > 0. Returns -1 in case of error, 0 otherwise
+int write_batch(int sd, const char* batch, int len, int fragment){
+  int n_written, piece ;
+  while (len > 0) {
+    piece = (fragment > 0 && fragment < len) ? fragment : len ;
+    n_written = write(sd, batch, piece);
+    if (n_written < 0){
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    batch += n_written ;
+    len -= n_written ;
+  }
+  return 0;
+}
+
+// Counts the replies found in what the server sent. Returns -1 if the connection has been closed, 0 otherwise
+int read_replies(benchConnection* conn){
+  char* line ;
+  int line_len ;
+  ssize_t n_read = framer_read(&conn->framer, conn->sd);
+  if (n_read == 0)
+    return -1;
+  if (n_read < 0)
+    return errno == EINTR ? 0 : -1;
+  while ((line = framer_next_line(&conn->framer, &line_len)) != NULL) {
+    if (line_len > strlen(REPLY_MARKER) && strncmp(line, REPLY_MARKER, strlen(REPLY_MARKER)) == 0)
+      conn->replies++ ;
+  }
+  return 0;
+}
+
+// Milliseconds elapsed between two instants
+double elapsed_ms(const struct timespec* from, const struct timespec* to){
+  return (to->tv_sec - from->tv_sec) * 1000.0 + (to->tv_nsec - from->tv_nsec) / 1000000.0 ;
+}
+
+// Comparator used to sort the latencies
+int compare_doubles(const void* a, const void* b){
+  double x = *(const double*)a, y = *(const double*)b ;
+  return (x > y) - (x < y);
+}
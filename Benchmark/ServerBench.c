@@ -0,0 +1,767 @@
+#define _GNU_SOURCE // Needed for IP_BIND_ADDRESS_NO_PORT
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<sys/resource.h>
+#include<sys/wait.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<signal.h>
+#include<time.h>
+#include "../Common/LineFramer.h"
+#include "../Common/Histogram.h"
+#include "../Client/LoadGenerator.h"
+
+// Starts the server on loopback and drives scripted scenarios against it, one fresh server for each scenario.
+// Every scenario appends a JSON line to the results file: throughput, latency percentiles, RSS and CPU time of the server.
+// The lines carry a label (for example the release), so the results of two releases can be compared line by line
+
+#define SERVER_PORT 23456 // MYPORT of Server.c
+#define METRICS_PORT "23457" // Where the server serves its metrics page during the scenarios
+#define METRICS_PAGE_SIZE (64*1024)
+#define BENCH_BUF_SIZE 512 // Bytes received and not consumed yet by a connection
+#define BENCH_MAX_EVENTS 1024
+#define BENCH_CONNECT_WINDOW 1000 // Connects in progress at the same time, for the scenarios which are not a storm
+#define BENCH_TIMEOUT_S 60 // A scenario whose connections are not all ready by then goes on with the ones which are
+#define BENCH_DRAIN_TIMEOUT_S 10 // Time given to the server to notice that the users of the disconnect scenario are gone
+#define BENCH_SOURCES_PER_ADDRESS 20000 // Connections sharing a source address: loopback has a /8, so more than the ephemeral ports can be opened
+#define BENCH_MAX_EXTRAS 3
+
+// A connection of the scenarios which don't need the load generator
+typedef struct bench_c {
+  int sd ;
+  int connected ;
+  int ready ; // 1 once the marker line has been received
+  uint64_t started_ns ;
+  char recv_buff[BENCH_BUF_SIZE];
+  lineFramer framer ;
+} benchClient ;
+
+// Resources used by the server process
+typedef struct process_u {
+  long rss_kb ;
+  long peak_rss_kb ;
+  double cpu_s ; // User and system time
+} processUsage ;
+
+// Outcome of a scenario, written as a JSON line
+typedef struct bench_r {
+  const char* scenario ;
+  long connections ;
+  double duration_s ;
+  double throughput ;
+  const char* throughput_unit ;
+  const char* latency_name ; // NULL if the scenario measures no latency
+  const hdrHistogram* latency ; // Microseconds
+  long errors ;
+  int n_extras ;
+  const char* extra_names[BENCH_MAX_EXTRAS];
+  double extra_values[BENCH_MAX_EXTRAS];
+  processUsage before, after ;
+} benchResult ;
+
+// Parameters of the suite, from the command line
+static const char* server_path = "../Server/Server" ;
+static const char* results_path = "bench-results.json" ;
+static const char* label = "unlabeled" ;
+static int n_connections = 10000 ; // storm and disconnect
+static int n_idle = 50000 ;
+static int n_chatters = 1000 ; // chat and reroll
+static double duration_s = 10 ;
+static const char* backend = "epoll" ; // I/O backend of the server: epoll or uring
+
+static pid_t server_pid = -1 ;
+
+// Runs a scenario against a fresh server, and writes its result. Returns -1 in case of error, 0 otherwise
+int run_scenario(const char* name);
+// Opens a connection storm: every connection sets a nickname as soon as it's connected
+int scenario_storm(benchResult* result);
+// Opens n_idle connections which set a nickname and stay idle for duration_s seconds
+int scenario_idle(benchResult* result);
+// n_chatters users chat for duration_s seconds, every message is answered by the partner
+int scenario_chat(benchResult* result);
+// n_chatters users REROLL as soon as they are matched, for duration_s seconds
+int scenario_reroll(benchResult* result);
+// Like reroll, but 80% of the users are inside the first room of the server: the matcher of that room is much busier than the others
+int scenario_hotroom(benchResult* result);
+// Pairs n_connections users, rounded down to twice the number of rooms, then closes all of them at once and waits until the server has seen every disconnection
+int scenario_disconnect(benchResult* result);
+
+// Opens n connections, window at a time (0 for all at once). On connect each one sends its nickname, and a room of mix too if it's not NULL, then waits for a line holding marker.
+// The latency from connect to marker goes in latency, if not NULL. Returns the connections which got the marker, the others are closed
+int open_clients(benchClient* clients, int n, int window, const loadConfig* mix, const char* marker, hdrHistogram* latency);
+// Closes the open connections
+void close_clients(benchClient* clients, int n);
+// Fills config with the default parameters, the address of the server and its rooms, all with the same weight. Returns -1 in case of error, 0 otherwise
+int prepare_load_config(loadConfig* config);
+// Opens a blocking connection with a nickname, used to send USERS. Returns the socket descriptor, -1 in case of error
+int open_probe();
+// Asks the server how many users are connected. Returns -1 in case of error
+int users_connected(int probe_sd);
+// Reads a counter from the metrics page of the server. Returns -1 in case of error
+double read_metric(const char* name);
+
+// Starts the server and waits until it accepts connections. Returns -1 in case of error, 0 otherwise
+int start_server();
+// Stops the server with SIGINT, as an operator would
+void stop_server();
+// Reads RSS and CPU time of a process from /proc. Returns -1 in case of error, 0 otherwise
+int read_usage(pid_t pid, processUsage* usage);
+// Appends the result of a scenario to the results file as a JSON line
+int write_result(const benchResult* result);
+void add_extra(benchResult* result, const char* name, double value);
+uint64_t now_ns();
+
+int main(int argc, char* argv[]){
+
+  const char* scenarios = "storm,idle,chat,reroll,hotroom,disconnect" ;
+  char scenario_list[128];
+  char* scenario ;
+  char* save_pointer ;
+  struct rlimit fd_limit ;
+  int option, failed = 0 ;
+
+  while ((option = getopt(argc, argv, "s:o:l:S:n:i:c:t:b:h")) != -1) {
+    switch (option) {
+      case 's': server_path = optarg ; break;
+      case 'o': results_path = optarg ; break;
+      case 'l': label = optarg ; break;
+      case 'S': scenarios = optarg ; break;
+      case 'n': n_connections = atoi(optarg) ; break;
+      case 'i': n_idle = atoi(optarg) ; break;
+      case 'c': n_chatters = atoi(optarg) ; break;
+      case 't': duration_s = atof(optarg) ; break;
+      case 'b': backend = optarg ; break;
+      default:
+        printf("Usage : %s [-s server binary] [-o results file] [-l label] [-S storm,idle,chat,reroll,hotroom,disconnect] [-n storm and disconnect connections, the latter rounded down to twice the number of rooms] [-i idle connections] [-c chatting users] [-t seconds] [-b epoll|uring]\n", argv[0]);
+        return option == 'h' ? 0 : 1;
+    }
+  }
+
+  // Both ends of every connection are inside this machine: the client side needs a descriptor too
+  if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max){
+    fd_limit.rlim_cur = fd_limit.rlim_max ;
+    setrlimit(RLIMIT_NOFILE, &fd_limit);
+  }
+  signal(SIGPIPE, SIG_IGN);
+  if (strcmp(backend, "epoll") != 0 && strcmp(backend, "uring") != 0){
+    printf("Unknown backend : %s, expected epoll or uring\n", backend);
+    return 1;
+  }
+
+  strncpy(scenario_list, scenarios, sizeof(scenario_list)-1);
+  scenario_list[sizeof(scenario_list)-1] = '\0' ;
+  for (scenario = strtok_r(scenario_list, ",", &save_pointer); scenario != NULL; scenario = strtok_r(NULL, ",", &save_pointer)) {
+    if (run_scenario(scenario) < 0)
+      failed++ ;
+  }
+  printf("Results appended to %s\n", results_path);
+  return failed > 0 ? 1 : 0;
+}
+
+// Runs a scenario against a fresh server, and writes its result. Returns -1 in case of error, 0 otherwise
+int run_scenario(const char* name){
+
+  benchResult result ;
+  uint64_t start_ns ;
+  int outcome ;
+
+  memset(&result, 0, sizeof(result));
+  result.scenario = name ;
+
+  if (start_server() < 0){
+    printf("%s : the server didn't start\n", name);
+    return -1;
+  }
+  read_usage(server_pid, &result.before);
+  start_ns = now_ns();
+
+  printf("%s ...\n", name);
+  fflush(stdout);
+  if (strcmp(name, "storm") == 0)
+    outcome = scenario_storm(&result);
+  else if (strcmp(name, "idle") == 0)
+    outcome = scenario_idle(&result);
+  else if (strcmp(name, "chat") == 0)
+    outcome = scenario_chat(&result);
+  else if (strcmp(name, "reroll") == 0)
+    outcome = scenario_reroll(&result);
+  else if (strcmp(name, "hotroom") == 0)
+    outcome = scenario_hotroom(&result);
+  else if (strcmp(name, "disconnect") == 0)
+    outcome = scenario_disconnect(&result);
+  else{
+    printf("Unknown scenario : %s\n", name);
+    outcome = -1 ;
+  }
+
+  // Usage is read before stopping the server, which would release everything
+  if (result.duration_s == 0)
+    result.duration_s = (now_ns() - start_ns) / 1e9 ;
+  read_usage(server_pid, &result.after);
+  stop_server();
+
+  if (outcome < 0)
+    return -1;
+  printf("%s : %.1f %s, errors %ld, server RSS %ld KB (peak %ld KB), server CPU %.2f s\n", name, result.throughput, result.throughput_unit,
+         result.errors, result.after.rss_kb, result.after.peak_rss_kb, result.after.cpu_s - result.before.cpu_s);
+  return write_result(&result);
+}
+
+// Opens a connection storm: every connection sets a nickname as soon as it's connected
+int scenario_storm(benchResult* result){
+
+  static hdrHistogram latency ;
+  benchClient* clients = (benchClient*)calloc(n_connections, sizeof(benchClient));
+  uint64_t start_ns ;
+  int n_ready ;
+
+  if (clients == NULL)
+    return -1;
+  memset(&latency, 0, sizeof(latency));
+
+  start_ns = now_ns();
+  n_ready = open_clients(clients, n_connections, 0, NULL, "Nickname impostato", &latency);
+  result->duration_s = (now_ns() - start_ns) / 1e9 ;
+
+  result->connections = n_connections ;
+  result->throughput = n_ready / result->duration_s ;
+  result->throughput_unit = "connections/s" ;
+  result->latency_name = "connect_to_nickname_reply" ;
+  result->latency = &latency ;
+  result->errors = n_connections - n_ready ;
+
+  close_clients(clients, n_connections);
+  free(clients);
+  return 0;
+}
+
+// Opens n_idle connections which set a nickname and stay idle for duration_s seconds
+int scenario_idle(benchResult* result){
+
+  static hdrHistogram latency ;
+  benchClient* clients = (benchClient*)calloc(n_idle, sizeof(benchClient));
+  processUsage connected, held ;
+  uint64_t start_ns, hold_start_ns ;
+  int n_ready ;
+
+  if (clients == NULL)
+    return -1;
+  memset(&latency, 0, sizeof(latency));
+
+  start_ns = now_ns();
+  n_ready = open_clients(clients, n_idle, BENCH_CONNECT_WINDOW, NULL, "Nickname impostato", &latency);
+
+  // Nothing happens now: the server should use no CPU, and its memory tells the cost of an idle user
+  read_usage(server_pid, &connected);
+  hold_start_ns = now_ns();
+  usleep((useconds_t)(duration_s * 1e6));
+  read_usage(server_pid, &held);
+  result->duration_s = (now_ns() - start_ns) / 1e9 ;
+
+  result->connections = n_idle ;
+  result->throughput = n_ready ;
+  result->throughput_unit = "connections held" ;
+  result->latency_name = "connect_to_nickname_reply" ;
+  result->latency = &latency ;
+  result->errors = n_idle - n_ready ;
+  add_extra(result, "rss_per_connection_bytes", n_ready > 0 ? (held.rss_kb - result->before.rss_kb) * 1024.0 / n_ready : 0);
+  add_extra(result, "idle_cpu_percent", (held.cpu_s - connected.cpu_s) / ((now_ns() - hold_start_ns) / 1e9) * 100);
+  // Memory the server itself accounts for, apart from the records: an idle user should hold no buffer at all
+  add_extra(result, "buffer_bytes_per_connection", n_ready > 0 ? read_metric("randomchat_buffer_bytes_in_use") / n_ready : 0);
+
+  close_clients(clients, n_idle);
+  free(clients);
+  return 0;
+}
+
+// n_chatters users chat for duration_s seconds, every message is answered by the partner
+int scenario_chat(benchResult* result){
+
+  static loadResult load_result ;
+  loadConfig config ;
+  double syscalls_before, relayed_before, syscalls_after, relayed_after ;
+
+  if (prepare_load_config(&config) < 0)
+    return -1;
+  config.n_connections = n_chatters ;
+  config.duration_s = duration_s ;
+  config.chat_rate = 10 ;
+  config.reroll_probability = 0 ;
+  config.stop_probability = 0 ;
+  free_load_result(&load_result);
+  syscalls_before = read_metric("randomchat_io_syscalls_total");
+  relayed_before = read_metric("randomchat_messages_relayed_total");
+  if (run_load_generator(&config, &load_result) < 0)
+    return -1;
+  syscalls_after = read_metric("randomchat_io_syscalls_total");
+  relayed_after = read_metric("randomchat_messages_relayed_total");
+
+  result->connections = n_chatters ;
+  result->duration_s = load_result.elapsed_s ;
+  result->throughput = load_result.stats.pongs_received * 2 / load_result.elapsed_s ;
+  result->throughput_unit = "messages relayed/s" ;
+  result->latency_name = "message_rtt" ;
+  result->latency = load_result.message_rtt ;
+  result->errors = load_result.stats.connect_errors + load_result.stats.disconnected + load_result.stats.write_errors + load_result.stats.rejected ;
+  add_extra(result, "messages_sent", load_result.stats.messages_sent);
+  // The system calls of the server for each message it relays, the whole cost of the I/O backend: waiting, reading and writing
+  if (syscalls_before >= 0 && syscalls_after >= 0 && relayed_after > relayed_before)
+    add_extra(result, "syscalls_per_message", (syscalls_after - syscalls_before) / (relayed_after - relayed_before));
+  return 0;
+}
+
+// n_chatters users REROLL as soon as they are matched, for duration_s seconds
+int scenario_reroll(benchResult* result){
+
+  static loadResult load_result ;
+  loadConfig config ;
+  double migrations_before, matches_before ;
+
+  if (prepare_load_config(&config) < 0)
+    return -1;
+  config.n_connections = n_chatters ;
+  config.duration_s = duration_s ;
+  // The first action of every conversation is a REROLL, about a millisecond after the match
+  config.chat_rate = 1000 ;
+  config.reroll_probability = 1 ;
+  config.stop_probability = 0 ;
+  free_load_result(&load_result);
+  migrations_before = read_metric("randomchat_migrations_total");
+  matches_before = read_metric("randomchat_matches_total");
+  if (run_load_generator(&config, &load_result) < 0)
+    return -1;
+
+  result->connections = n_chatters ;
+  result->duration_s = load_result.elapsed_s ;
+  result->throughput = load_result.stats.matches / load_result.elapsed_s ;
+  result->throughput_unit = "matches/s" ;
+  result->latency_name = "match" ;
+  result->latency = load_result.match_latency ;
+  result->errors = load_result.stats.connect_errors + load_result.stats.disconnected + load_result.stats.write_errors + load_result.stats.rejected ;
+  add_extra(result, "rerolls", load_result.stats.rerolls);
+  // Users moved to another reactor for every conversation: 0 with a single reactor, at most 2
+  if (read_metric("randomchat_matches_total") > matches_before)
+    add_extra(result, "migrations_per_match", (read_metric("randomchat_migrations_total") - migrations_before) / (read_metric("randomchat_matches_total") - matches_before));
+  return 0;
+}
+
+// Like reroll, but 80% of the users are inside the first room of the server: the matcher of that room is much busier than the others
+int scenario_hotroom(benchResult* result){
+
+  static loadResult load_result ;
+  loadConfig config ;
+  double run_before, stolen_before ;
+
+  if (prepare_load_config(&config) < 0)
+    return -1;
+  config.n_connections = n_chatters ;
+  config.duration_s = duration_s ;
+  config.chat_rate = 1000 ;
+  config.reroll_probability = 1 ;
+  config.stop_probability = 0 ;
+  // The first room weighs 4 times all the others together
+  if (config.n_rooms > 1)
+    config.room_weights[0] = 4 * (config.n_rooms - 1) ;
+  free_load_result(&load_result);
+  run_before = read_metric("randomchat_tasks_run_total");
+  stolen_before = read_metric("randomchat_tasks_stolen_total");
+  if (run_load_generator(&config, &load_result) < 0)
+    return -1;
+
+  result->connections = n_chatters ;
+  result->duration_s = load_result.elapsed_s ;
+  result->throughput = load_result.stats.matches / load_result.elapsed_s ;
+  result->throughput_unit = "matches/s" ;
+  result->latency_name = "match" ;
+  result->latency = load_result.match_latency ;
+  result->errors = load_result.stats.connect_errors + load_result.stats.disconnected + load_result.stats.write_errors + load_result.stats.rejected ;
+  add_extra(result, "rerolls", load_result.stats.rerolls);
+  // How often the rounds of the matchers moved to a worker other than the one of their room
+  add_extra(result, "matcher_rounds", read_metric("randomchat_tasks_run_total") - run_before);
+  add_extra(result, "matcher_rounds_stolen", read_metric("randomchat_tasks_stolen_total") - stolen_before);
+  return 0;
+}
+
+// Pairs n_connections users, rounded down to twice the number of rooms, then closes all of them at once and waits until the server has seen every disconnection
+int scenario_disconnect(benchResult* result){
+
+  loadConfig config ;
+  benchClient* clients ;
+  uint64_t close_ns, drained_ns = 0 ;
+  int n_users, n_ready, probe_sd, connected = -1 ;
+
+  if (prepare_load_config(&config) < 0)
+    return -1;
+  // The users enter the rooms two by two, see open_clients: with a multiple of twice the rooms nobody is left without a partner
+  if ((n_users = n_connections - n_connections % (2 * config.n_rooms)) == 0){
+    printf("disconnect : at least %d connections are needed\n", 2 * config.n_rooms);
+    return -1;
+  }
+  clients = (benchClient*)calloc(n_users, sizeof(benchClient));
+  if (clients == NULL || (probe_sd = open_probe()) < 0){
+    free(clients);
+    return -1;
+  }
+
+  n_ready = open_clients(clients, n_users, BENCH_CONNECT_WINDOW, &config, "SAY HI TO", NULL);
+
+  close_ns = now_ns();
+  close_clients(clients, n_users);
+  // The probe itself stays connected
+  while (now_ns() - close_ns < BENCH_DRAIN_TIMEOUT_S * 1000000000ULL) {
+    if ((connected = users_connected(probe_sd)) <= 1)
+      break;
+    usleep(10000);
+  }
+  drained_ns = now_ns();
+  close(probe_sd);
+
+  result->connections = n_users ;
+  result->duration_s = (drained_ns - close_ns) / 1e9 ;
+  result->throughput = n_ready / result->duration_s ;
+  result->throughput_unit = "disconnections/s" ;
+  // Users the server still counts after the timeout never had their disconnection noticed
+  result->errors = (n_users - n_ready) + (connected > 1 ? connected - 1 : 0) ;
+  add_extra(result, "drain_s", result->duration_s);
+  add_extra(result, "users_left", connected > 1 ? connected - 1 : 0);
+
+  free(clients);
+  return 0;
+}
+
+// Opens n connections, window at a time (0 for all at once). On connect each one sends its nickname, and a room of mix too if it's not NULL, then waits for a line holding marker.
+// The latency from connect to marker goes in latency, if not NULL. Returns the connections which got the marker, the others are closed
+int open_clients(benchClient* clients, int n, int window, const loadConfig* mix, const char* marker, hdrHistogram* latency){
+
+  struct epoll_event event, events[BENCH_MAX_EVENTS];
+  struct sockaddr_in server_address, source_address ;
+  char request[64 + LOAD_ROOM_NAME_SIZE];
+  char* line ;
+  int epoll_descriptor, opened = 0, finished = 0, ready = 0, n_events, len, flags = 1 ;
+  uint64_t deadline_ns = now_ns() + BENCH_TIMEOUT_S * 1000000000ULL ;
+
+  if ((epoll_descriptor = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return 0;
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET ;
+  server_address.sin_port = htons(SERVER_PORT);
+  server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  while (finished < n && now_ns() < deadline_ns) {
+
+    while (opened < n && (window == 0 || opened - finished < window)) {
+      benchClient* client = &clients[opened++] ;
+      framer_init(&client->framer, client->recv_buff, BENCH_BUF_SIZE-1);
+      client->started_ns = now_ns();
+      if ((client->sd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+        finished++ ;
+        continue;
+      }
+      // 127.0.0.2, 127.0.0.3, ... : the port is chosen at connect, so each source address can reach the server from every ephemeral port
+      memset(&source_address, 0, sizeof(source_address));
+      source_address.sin_family = AF_INET ;
+      source_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + 1 + (opened-1) / BENCH_SOURCES_PER_ADDRESS);
+      setsockopt(client->sd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &flags, sizeof(flags));
+      memset(&event, 0, sizeof(event));
+      event.events = EPOLLIN | EPOLLOUT | EPOLLET ;
+      event.data.ptr = client ;
+      if (bind(client->sd, (struct sockaddr*)&source_address, sizeof(source_address)) < 0 ||
+          (connect(client->sd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0 && errno != EINPROGRESS) ||
+          epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, client->sd, &event) < 0){
+        close(client->sd);
+        client->sd = -1 ;
+        finished++ ;
+      }
+    }
+
+    if ((n_events = epoll_wait(epoll_descriptor, events, BENCH_MAX_EVENTS, 100)) < 0 && errno != EINTR)
+      break;
+
+    for (int i = 0; i < n_events; i++) {
+      benchClient* client = (benchClient*)events[i].data.ptr ;
+      int error = 0, line_len ;
+      socklen_t error_len = sizeof(error);
+      ssize_t n_read ;
+
+      if (client->sd < 0 || client->ready)
+        continue;
+      if (!client->connected){
+        if (getsockopt(client->sd, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0)
+          goto failed;
+        client->connected = 1 ;
+        // Two users in a row ask for the same room, the rooms of the mix in turn, so an even number of users enters every room
+        if (mix != NULL)
+          len = sprintf(request, "//command:NICKNAME<bench%ld>\n//command:START<%s>\n", (long)(client - clients), mix->room_names[((client - clients) / 2) % mix->n_rooms]);
+        else
+          len = sprintf(request, "//command:NICKNAME<bench%ld>\n", (long)(client - clients));
+        if (write(client->sd, request, len) != len)
+          goto failed;
+      }
+      while ((n_read = framer_read(&client->framer, client->sd)) > 0) {
+        while ((line = framer_next_line(&client->framer, &line_len)) != NULL) {
+          if (!client->ready && memmem(line, line_len, marker, strlen(marker)) != NULL){
+            client->ready = 1 ;
+            if (latency != NULL)
+              hdr_record(latency, (now_ns() - client->started_ns) / 1000);
+          }
+        }
+      }
+      if (n_read == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ENOBUFS))
+        goto failed;
+      if (client->ready){
+        // Nothing else is read from a ready connection
+        epoll_ctl(epoll_descriptor, EPOLL_CTL_DEL, client->sd, NULL);
+        ready++ ;
+        finished++ ;
+      }
+      continue;
+
+      failed:
+      close(client->sd);
+      client->sd = -1 ;
+      finished++ ;
+    }
+  }
+
+  // The connections still waiting at the deadline are given up
+  for (int i = 0; i < opened; i++) {
+    if (clients[i].sd >= 0 && !clients[i].ready){
+      close(clients[i].sd);
+      clients[i].sd = -1 ;
+    }
+  }
+  close(epoll_descriptor);
+  return ready;
+}
+
+// Closes the open connections
+void close_clients(benchClient* clients, int n){
+  for (int i = 0; i < n; i++) {
+    if (clients[i].sd >= 0)
+      close(clients[i].sd);
+    clients[i].sd = -1 ;
+  }
+}
+
+// Fills config with the default parameters, the address of the server and its rooms, all with the same weight. Returns -1 in case of error, 0 otherwise
+int prepare_load_config(loadConfig* config){
+
+  load_default_config(config);
+  config->address = "127.0.0.1" ;
+  config->port = SERVER_PORT ;
+  if (load_query_rooms(config) < 0){
+    printf("Error asking the rooms to the server : %s\n", strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+// Opens a blocking connection with a nickname, used to send USERS. Returns the socket descriptor, -1 in case of error
+int open_probe(){
+
+  struct sockaddr_in server_address ;
+  struct timeval timeout = { 1, 0 };
+  const char* request = "//command:NICKNAME<probe>\n" ;
+  int sd ;
+
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET ;
+  server_address.sin_port = htons(SERVER_PORT);
+  server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if ((sd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    return -1;
+  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(sd, (struct sockaddr*)&server_address, sizeof(server_address)) < 0 || write(sd, request, strlen(request)) < 0){
+    close(sd);
+    return -1;
+  }
+  return sd;
+}
+
+// Asks the server how many users are connected. Returns -1 in case of error
+int users_connected(int probe_sd){
+
+  static char recv_buff[BENCH_BUF_SIZE];
+  static lineFramer framer ;
+  static int framer_ready = 0 ;
+  const char* request = "//command:<USERS>\n" ;
+  const char* marker = "TOTAL NUMBER OF USERS CONNECTED : " ;
+  char* line ;
+  char* found ;
+  int line_len ;
+
+  if (!framer_ready){
+    framer_init(&framer, recv_buff, BENCH_BUF_SIZE-1);
+    framer_ready = 1 ;
+  }
+  if (write(probe_sd, request, strlen(request)) < 0)
+    return -1;
+  // Lines of earlier replies, like the one to the nickname, are skipped
+  while (framer_read(&framer, probe_sd) > 0) {
+    while ((line = framer_next_line(&framer, &line_len)) != NULL) {
+      if ((found = memmem(line, line_len, marker, strlen(marker))) != NULL)
+        return atoi(found + strlen(marker));
+    }
+  }
+  return -1;
+}
+
+// Reads a counter from the metrics page of the server. Returns -1 in case of error
+double read_metric(const char* name){
+
+  static char page[METRICS_PAGE_SIZE];
+  struct sockaddr_in metrics_address ;
+  const char* request = "GET /metrics HTTP/1.0\r\n\r\n" ;
+  char* line ;
+  ssize_t n_read ;
+  int sd, len = 0 ;
+  size_t name_len = strlen(name) ;
+
+  if ((sd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    return -1;
+  memset(&metrics_address, 0, sizeof(metrics_address));
+  metrics_address.sin_family = AF_INET ;
+  metrics_address.sin_port = htons(atoi(METRICS_PORT));
+  metrics_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (connect(sd, (struct sockaddr*)&metrics_address, sizeof(metrics_address)) < 0 || write(sd, request, strlen(request)) < 0){
+    close(sd);
+    return -1;
+  }
+  // HTTP/1.0: the page ends with the connection
+  while (len < METRICS_PAGE_SIZE-1 && (n_read = read(sd, page + len, METRICS_PAGE_SIZE-1 - len)) > 0)
+    len += n_read ;
+  close(sd);
+  page[len] = '\0' ;
+
+  // The sample is the line starting with the name, the comments mention it after "# HELP " and "# TYPE "
+  for (line = page; line != NULL; line = strchr(line, '\n') != NULL ? strchr(line, '\n') + 1 : NULL) {
+    if (strncmp(line, name, name_len) == 0 && line[name_len] == ' ')
+      return atof(line + name_len + 1);
+  }
+  return -1;
+}
+
+// Starts the server and waits until it accepts connections. Returns -1 in case of error, 0 otherwise
+int start_server(){
+
+  struct sockaddr_in server_address ;
+  int sd, null_fd ;
+
+  if ((server_pid = fork()) < 0)
+    return -1;
+  if (server_pid == 0){
+    // The log would measure the terminal more than the server: only warnings, and nothing on the screen
+    setenv("RANDOMCHAT_LOG_LEVEL", "warning", 0);
+    setenv("RANDOMCHAT_IO_URING", strcmp(backend, "uring") == 0 ? "1" : "0", 1);
+    setenv("RANDOMCHAT_METRICS_ADDRESS", METRICS_PORT, 1);
+    if ((null_fd = open("/dev/null", O_WRONLY)) >= 0){
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execl(server_path, server_path, (char*)NULL);
+    _exit(127);
+  }
+
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET ;
+  server_address.sin_port = htons(SERVER_PORT);
+  server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int attempt = 0; attempt < 100; attempt++) {
+    usleep(50000);
+    if (waitpid(server_pid, NULL, WNOHANG) == server_pid){
+      server_pid = -1 ;
+      return -1;
+    }
+    if ((sd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+      continue;
+    if (connect(sd, (struct sockaddr*)&server_address, sizeof(server_address)) == 0){
+      close(sd);
+      // The server logs the probe connection and disconnection, then it's idle again
+      usleep(100000);
+      return 0;
+    }
+    close(sd);
+  }
+  stop_server();
+  return -1;
+}
+
+// Stops the server with SIGINT, as an operator would
+void stop_server(){
+  if (server_pid <= 0)
+    return;
+  kill(server_pid, SIGINT);
+  waitpid(server_pid, NULL, 0);
+  server_pid = -1 ;
+}
+
+// Reads RSS and CPU time of a process from /proc. Returns -1 in case of error, 0 otherwise
+int read_usage(pid_t pid, processUsage* usage){
+
+  char path[64], line[256];
+  unsigned long utime, stime ;
+  FILE* file ;
+
+  memset(usage, 0, sizeof(processUsage));
+  sprintf(path, "/proc/%d/status", (int)pid);
+  if ((file = fopen(path, "r")) == NULL)
+    return -1;
+  while (fgets(line, sizeof(line), file) != NULL) {
+    sscanf(line, "VmRSS: %ld", &usage->rss_kb);
+    sscanf(line, "VmHWM: %ld", &usage->peak_rss_kb);
+  }
+  fclose(file);
+
+  // utime and stime are the 14th and 15th fields, after the command name which may hold spaces
+  sprintf(path, "/proc/%d/stat", (int)pid);
+  if ((file = fopen(path, "r")) == NULL)
+    return -1;
+  if (fgets(line, sizeof(line), file) != NULL && strrchr(line, ')') != NULL &&
+      sscanf(strrchr(line, ')') + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2)
+    usage->cpu_s = (double)(utime + stime) / sysconf(_SC_CLK_TCK) ;
+  fclose(file);
+  return 0;
+}
+
+// Appends the result of a scenario to the results file as a JSON line
+int write_result(const benchResult* result){
+
+  FILE* file ;
+
+  if ((file = fopen(results_path, "a")) == NULL){
+    printf("Error opening %s : %s\n", results_path, strerror(errno));
+    return -1;
+  }
+  fprintf(file, "{\"label\":\"%s\",\"backend\":\"%s\",\"time\":%ld,\"scenario\":\"%s\",\"connections\":%ld,\"duration_s\":%.3f,\"throughput\":%.3f,\"throughput_unit\":\"%s\",\"errors\":%ld",
+          label, backend, (long)time(NULL), result->scenario, result->connections, result->duration_s, result->throughput, result->throughput_unit, result->errors);
+  if (result->latency_name != NULL && result->latency != NULL)
+    fprintf(file, ",\"latency\":{\"name\":\"%s\",\"count\":%llu,\"p50_ms\":%.3f,\"p99_ms\":%.3f,\"p999_ms\":%.3f,\"max_ms\":%.3f}", result->latency_name, (unsigned long long)result->latency->total,
+            hdr_value_at_percentile(result->latency, 50) / 1e3, hdr_value_at_percentile(result->latency, 99) / 1e3, hdr_value_at_percentile(result->latency, 99.9) / 1e3, result->latency->max / 1e3);
+  for (int i = 0; i < result->n_extras; i++)
+    fprintf(file, ",\"%s\":%.3f", result->extra_names[i], result->extra_values[i]);
+  fprintf(file, ",\"server\":{\"rss_kb\":%ld,\"peak_rss_kb\":%ld,\"cpu_s\":%.3f,\"cpu_percent\":%.1f}}\n", result->after.rss_kb, result->after.peak_rss_kb,
+          result->after.cpu_s - result->before.cpu_s, result->duration_s > 0 ? (result->after.cpu_s - result->before.cpu_s) / result->duration_s * 100 : 0);
+  fclose(file);
+  return 0;
+}
+
+void add_extra(benchResult* result, const char* name, double value){
+  if (result->n_extras == BENCH_MAX_EXTRAS)
+    return;
+  result->extra_names[result->n_extras] = name ;
+  result->extra_values[result->n_extras] = value ;
+  result->n_extras++ ;
+}
+
+// Nanoseconds of the monotonic clock
+uint64_t now_ns(){
+  struct timespec now ;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec ;
+}
@@ -1,3 +1,3 @@
 #! /bin/bash
 
-gcc -pthread -Wall -o Client Client.c ; ./Client
+gcc -pthread -Wall -o Client ../Common/LineFramer.c ../Common/Histogram.c LoadGenerator.c Client.c -lm ; ./Client "$@"
@@ -7,14 +7,20 @@
 #include<pthread.h>
 #include<signal.h>
 #include<errno.h>
+#include<getopt.h>
+#include "../Common/LineFramer.h"
+#include "LoadGenerator.h"
 
-#define MYPORT 23456
-#define SERVERADDRESS "20.19.208.169"
+#define MYPORT 23456 // Default port of the server, -p changes it
+#define SERVERADDRESS "20.19.208.169" // Default address of the server, -a changes it
 #define MAXSLEEP 8 // Used by connect_retry
 #define BUF_SIZE 1024
+#define HEARTBEAT_MESSAGE "//command:<HEARTBEAT>\n" // Sent by the server to silent clients, never shown
 
 int server_socket_descriptor;
 char nickname[32]; // Holds the nickname chosen by the the user
+const char* server_address_string = SERVERADDRESS ;
+int server_port = MYPORT ;
 
 
 // Returns -1 if the client decides not to connect, a positive socket descriptor otherwise
@@ -25,13 +31,63 @@ int connect_retry(int domain, int type, int protocol, const struct sockaddr *add
 void * receiver(void * args);
 // Handler of signals
 void signalHandler (int numSignal);
+// Prints the options of the client
+void print_usage(const char* program);
 
 int main(int argc, char* argv[]){
 
   char send_buff[BUF_SIZE];
   pthread_t receiver_thread = 0;
+  loadConfig load_config ;
+  loadResult load_result ;
+  int load_mode = 0, option ;
 
   memset(&nickname, '\0', sizeof(nickname));
+  load_default_config(&load_config);
+
+  while ((option = getopt(argc, argv, "a:p:Ln:t:c:m:r:x:s:h")) != -1) {
+    switch (option) {
+      case 'a': server_address_string = optarg ; break;
+      case 'p': server_port = atoi(optarg) ; break;
+      case 'L': load_mode = 1 ; break;
+      case 'n': load_config.n_connections = atoi(optarg) ; break;
+      case 't': load_config.duration_s = atof(optarg) ; break;
+      case 'c': load_config.connect_rate = atof(optarg) ; break;
+      case 'm':
+        if (load_parse_room_mix(&load_config, optarg) < 0){
+          printf("Mix di stanze non valido : %s\n", optarg);
+          return (-1) ;
+        }
+        break;
+      case 'r': load_config.chat_rate = atof(optarg) ; break;
+      case 'x': load_config.reroll_probability = atof(optarg) ; break;
+      case 's': load_config.stop_probability = atof(optarg) ; break;
+      default:
+        print_usage(argv[0]);
+        return (option == 'h' ? 0 : -1) ;
+    }
+  }
+  if (server_port <= 0 || server_port > 65535 || load_config.n_connections <= 0){
+    print_usage(argv[0]);
+    return (-1) ;
+  }
+
+  // Headless mode: no prompt, the bots chat by themselves and a report is printed at the end
+  if (load_mode){
+    signal(SIGPIPE, SIG_IGN);
+    load_config.address = server_address_string ;
+    load_config.port = server_port ;
+    // Without a mix the bots spread evenly among the rooms of the server
+    if (load_config.n_rooms == 0 && load_query_rooms(&load_config) < 0){
+      printf("Impossibile ottenere le stanze dal server : %s\n", strerror(errno));
+      return (-1) ;
+    }
+    if (run_load_generator(&load_config, &load_result) < 0)
+      return (-1) ;
+    print_load_report(&load_config, &load_result);
+    free_load_result(&load_result);
+    return 0 ;
+  }
 
   printf("\n---------- PROGETTO LABORATORIO DI SISTEMI OPERATIVI A.A. 21/22 ----------\n");
   printf("-                                                                        -");
@@ -124,8 +180,11 @@ int open_communication(){
 
   memset(&server_address, '\0', sizeof(server_address));
   server_address.sin_family = AF_INET;
-  server_address.sin_port = htons(MYPORT);
-  inet_aton(SERVERADDRESS, &server_address.sin_addr);
+  server_address.sin_port = htons(server_port);
+  if (inet_aton(server_address_string, &server_address.sin_addr) == 0){
+    printf("\nIndirizzo del server non valido : %s\n", server_address_string);
+    return -1;
+  }
 
   socklen_t server_addr_len = sizeof(server_address);
 
@@ -208,26 +267,36 @@ int connect_retry(int domain, int type, int protocol, const struct sockaddr *add
 void * receiver(void * args){
 
 	char recv_buff[BUF_SIZE];
-	int n_read_char, dim_recv_messagge = 0;
+	lineFramer framer ;
+	char *line, *first_line ;
+	int n_read_char, line_len, received_len ;
+
+  framer_init(&framer, recv_buff, BUF_SIZE-1);
 
-  while ( (n_read_char = read(server_socket_descriptor, recv_buff+dim_recv_messagge, BUF_SIZE-dim_recv_messagge-2)) != 0){
+  while ( (n_read_char = framer_read(&framer, server_socket_descriptor)) != 0){
      if(n_read_char < 0){
+       if (errno == EINTR)
+         continue;
        goto exit_thread;
-   	 }else{
-       dim_recv_messagge += n_read_char;
-       // If the space in the buffer has finished, or newline appears in the string then we can print the response from the server
-       if(dim_recv_messagge >= BUF_SIZE-2 || recv_buff[dim_recv_messagge-1] == '\n'){
-
-         if(dim_recv_messagge < BUF_SIZE-2)
-           recv_buff[dim_recv_messagge]='\0';
-         else // buffer is full
-           recv_buff[BUF_SIZE-1]='\0';
-
-         printf("\n-received :\n\\/ %s \n\n\\/\n ",recv_buff);
+   	 }
+     // The complete lines are contiguous inside the framer and are printed together, while an unfinished line waits for the rest of it
+     first_line = NULL ;
+     received_len = 0 ;
+     while ( (line = framer_next_line(&framer, &line_len)) != NULL ){
+       // A heartbeat splits the lines around it, which are printed on their own
+       if (line_len == strlen(HEARTBEAT_MESSAGE) && strncmp(line, HEARTBEAT_MESSAGE, line_len) == 0){
+         if (received_len > 0)
+           printf("\n-received :\n\\/ %.*s \n\n\\/\n ",received_len,first_line);
+         first_line = NULL ;
+         received_len = 0 ;
+         continue;
        }
+       if (first_line == NULL)
+         first_line = line ;
+       received_len += line_len ;
      }
-      dim_recv_messagge = 0;
-
+     if (received_len > 0)
+       printf("\n-received :\n\\/ %.*s \n\n\\/\n ",received_len,first_line);
   }
 
    if (n_read_char==0){
@@ -258,3 +327,14 @@ void signalHandler (int numSignal){
     printf("Error trying to send data...\nPlease try again and if error persists, restart the client ...\n\n");
   }
 }
+
+// Prints the options of the client
+void print_usage(const char* program){
+  printf("Usage : %s [-a address] [-p port] [-L [-n connections] [-t seconds] [-c connects per second] [-m room=weight,...] [-r messages per second] [-x reroll probability] [-s stop probability]]\n", program);
+  printf("-a, -p : address and port of the server (default %s:%d)\n", SERVERADDRESS, MYPORT);
+  printf("-L : load mode, opens n connections (default 1000) which chat by themselves for t seconds (default 30), then prints a report\n");
+  printf("-c : connections opened per second, 0 opens all of them at once (default)\n");
+  printf("-m : rooms the bots join and their relative share, such as \"Climate change=2,Travel related=1\" (default every room of the server, same share)\n");
+  printf("-r : messages per second of a bot in a conversation (default 1)\n");
+  printf("-x, -s : chance that a bot sends REROLL or STOP instead of a message (default 0.02 and 0.01)\n");
+}
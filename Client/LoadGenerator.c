@@ -0,0 +1,580 @@
+#include<sys/socket.h>
+#include<sys/epoll.h>
+#include<sys/resource.h>
+#include<sys/time.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<fcntl.h>
+#include<time.h>
+#include<math.h>
+#include "LoadGenerator.h"
+#include "../Common/Histogram.h"
+
+static const loadConfig* config ;
+static botInfo* bots ;
+static botInfo** heap ; // Min heap of the bots with an action scheduled, ordered by next_action_ns
+static int heap_size ;
+static int epoll_descriptor ;
+static struct sockaddr_in server_address ;
+static uint64_t rng_state ;
+static loadResult* run ; // Filled while the run goes on
+
+static uint64_t now_ns();
+static double next_uniform();
+static uint64_t next_interval_ns(double rate);
+static void heap_schedule(botInfo* bot, uint64_t when_ns);
+static void heap_remove(botInfo* bot);
+static void heap_swap(int i, int j);
+static void heap_sift_up(int i);
+static void heap_sift_down(int i);
+static void start_connect(botInfo* bot);
+static void finish_connect(botInfo* bot);
+static void serve_bot(botInfo* bot);
+static void serve_line(botInfo* bot, char* line, int line_len);
+static void act(botInfo* bot);
+static int send_line(botInfo* bot, const char* text, int len);
+static void close_bot(botInfo* bot);
+static void print_latency(const char* title, const hdrHistogram* histogram);
+
+// LOAD FUNCTIONS
+
+// Fills *config with the default parameters
+void load_default_config(loadConfig* config){
+  memset(config, 0, sizeof(loadConfig));
+  config->n_connections = 1000 ;
+  config->duration_s = 30 ;
+  config->connect_rate = 0 ;
+  config->chat_rate = 1 ;
+  config->reroll_probability = 0.02 ;
+  config->stop_probability = 0.01 ;
+}
+
+// Parses a room mix such as "Climate change=2,Travel related=1" inside the rooms of config. A room without a weight gets 1. Returns -1 if the mix is not valid, 0 otherwise
+int load_parse_room_mix(loadConfig* config, const char* mix){
+
+  const char* end ;
+  const char* equal ;
+  char* weight_end ;
+  double weight, total = 0 ;
+  int n_rooms = 0, name_len ;
+
+  while (1) {
+    if ((end = strchr(mix, ',')) == NULL)
+      end = mix + strlen(mix) ;
+    // The last '=' of the room splits its name from its weight: equal stops right after it, or at the start of the room if there is none
+    for (equal = end; equal > mix && equal[-1] != '='; equal--)
+      ;
+    weight = 1 ;
+    name_len = end - mix ;
+    if (equal > mix){
+      weight = strtod(equal, &weight_end);
+      if (weight_end == equal || weight_end != end || weight < 0)
+        return -1;
+      name_len = equal - 1 - mix ;
+    }
+    if (name_len == 0 || name_len >= LOAD_ROOM_NAME_SIZE || n_rooms == LOAD_ROOMS_MAX)
+      return -1;
+    memcpy(config->room_names[n_rooms], mix, name_len);
+    config->room_names[n_rooms][name_len] = '\0' ;
+    config->room_weights[n_rooms++] = weight ;
+    total += weight ;
+    if (*end == '\0')
+      break;
+    mix = end + 1 ;
+  }
+  if (total <= 0)
+    return -1;
+  config->n_rooms = n_rooms ;
+  return 0;
+}
+
+// Fills the rooms of config with every room of the server at config->address, all with the same weight, asking for them with //command:<ROOMS>.
+// Returns -1 with errno set in case of error, 0 otherwise
+int load_query_rooms(loadConfig* config){
+
+  static const char request[] = "//command:<ROOMS>\n" ;
+  static const char header[] = "*** AVAILABLE ROOMS ***\n" ;
+  struct sockaddr_in address ;
+  struct timeval timeout = { LOAD_QUERY_TIMEOUT_S, 0 };
+  char* reply = (char*)malloc(LOAD_ROOMS_REPLY_SIZE);
+  char* list = NULL ;
+  char* line ;
+  char* line_end ;
+  char* name_end ;
+  int sd = -1, len = 0, n_rooms = 0 ;
+  ssize_t n_read ;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET ;
+  address.sin_port = htons(config->port);
+  if (inet_aton(config->address, &address.sin_addr) == 0){
+    errno = EINVAL ;
+    goto errout;
+  }
+  if (reply == NULL || (sd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+    goto errout;
+  setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  if (connect(sd, (struct sockaddr*)&address, sizeof(address)) < 0 || write(sd, request, sizeof(request)-1) != sizeof(request)-1)
+    goto errout;
+
+  // The list ends with an empty line
+  while (list == NULL || strstr(list, "\n\n") == NULL) {
+    if (len == LOAD_ROOMS_REPLY_SIZE-1){
+      errno = EMSGSIZE ;
+      goto errout;
+    }
+    if ((n_read = read(sd, reply + len, LOAD_ROOMS_REPLY_SIZE-1 - len)) <= 0){
+      if (n_read == 0)
+        errno = ECONNRESET ;
+      goto errout;
+    }
+    len += n_read ;
+    reply[len] = '\0' ;
+    list = strstr(reply, header);
+  }
+
+  // A line for each room : -"name" room : description
+  for (line = list + sizeof(header)-1; line[0] == '-' && line[1] == '"'; line = line_end + 1) {
+    line_end = strchr(line, '\n');
+    if ((name_end = strstr(line + 2, "\" room : ")) == NULL || name_end > line_end || name_end - (line + 2) >= LOAD_ROOM_NAME_SIZE || n_rooms == LOAD_ROOMS_MAX){
+      errno = EPROTO ;
+      goto errout;
+    }
+    memcpy(config->room_names[n_rooms], line + 2, name_end - (line + 2));
+    config->room_names[n_rooms][name_end - (line + 2)] = '\0' ;
+    config->room_weights[n_rooms++] = 1 ;
+  }
+  if (n_rooms == 0){
+    errno = ENOENT ;
+    goto errout;
+  }
+  config->n_rooms = n_rooms ;
+  close(sd);
+  free(reply);
+  return 0;
+
+  errout:
+  if (sd >= 0)
+    close(sd);
+  free(reply);
+  return -1;
+}
+
+// Opens the bots, lets them chat for config->duration_s seconds and prints the report. Returns -1 in case of error, 0 otherwise
+int run_load_generator(const loadConfig* load_config, loadResult* result){
+
+  struct epoll_event events[LOAD_MAX_EVENTS];
+  struct rlimit fd_limit ;
+  uint64_t start_ns, end_ns, now ;
+  double total_weight = 0, draw ;
+  int n_events, timeout_ms ;
+
+  config = load_config ;
+  run = result ;
+  memset(run, 0, sizeof(loadResult));
+
+  memset(&server_address, 0, sizeof(server_address));
+  server_address.sin_family = AF_INET ;
+  server_address.sin_port = htons(config->port);
+  if (inet_aton(config->address, &server_address.sin_addr) == 0){
+    printf("Indirizzo del server non valido : %s\n", config->address);
+    return -1;
+  }
+  if (config->n_rooms == 0){
+    printf("Nessuna stanza per i bot\n");
+    return -1;
+  }
+
+  // Every bot holds a socket descriptor
+  if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max){
+    fd_limit.rlim_cur = fd_limit.rlim_max ;
+    setrlimit(RLIMIT_NOFILE, &fd_limit);
+  }
+
+  bots = (botInfo*)calloc(config->n_connections, sizeof(botInfo));
+  heap = (botInfo**)malloc(config->n_connections * sizeof(botInfo*));
+  run->connect_latency = hdr_create();
+  run->match_latency = hdr_create();
+  run->message_rtt = hdr_create();
+  if (bots == NULL || heap == NULL || run->connect_latency == NULL || run->match_latency == NULL || run->message_rtt == NULL){
+    printf("Memoria insufficiente per %d connessioni\n", config->n_connections);
+    goto errout;
+  }
+  if ((epoll_descriptor = epoll_create1(EPOLL_CLOEXEC)) < 0){
+    printf("Error calling epoll_create1 : %s\n", strerror(errno));
+    goto errout;
+  }
+
+  rng_state = ((uint64_t)time(NULL) << 32) ^ (uint64_t)getpid() ^ 0x9E3779B97F4A7C15ULL ;
+  for (int r = 0; r < config->n_rooms; r++)
+    total_weight += config->room_weights[r] ;
+
+  // Every bot gets its room from the mix, and a time to connect: all at once, or spread at connect_rate
+  start_ns = now_ns();
+  heap_size = 0 ;
+  for (int i = 0; i < config->n_connections; i++) {
+    botInfo* bot = &bots[i] ;
+    bot->id = i ;
+    bot->socket_descriptor = -1 ;
+    bot->state = BOT_IDLE ;
+    bot->heap_index = -1 ;
+    draw = next_uniform() * total_weight ;
+    for (bot->room = 0; bot->room < config->n_rooms-1 && draw >= config->room_weights[bot->room]; bot->room++)
+      draw -= config->room_weights[bot->room] ;
+    framer_init(&bot->framer, bot->recv_buff, LOAD_BUF_SIZE-1);
+    heap_schedule(bot, config->connect_rate > 0 ? start_ns + (uint64_t)(i / config->connect_rate * 1e9) : start_ns);
+  }
+
+  printf("\n%d bot verso %s:%d per %.0f secondi ...\n", config->n_connections, config->address, config->port, config->duration_s);
+  fflush(stdout);
+
+  end_ns = start_ns + (uint64_t)(config->duration_s * 1e9) ;
+  while ((now = now_ns()) < end_ns) {
+
+    // The actions due by now, then a wait for the sockets until the next one
+    while (heap_size > 0 && heap[0]->next_action_ns <= now)
+      act(heap[0]);
+
+    now = now_ns();
+    uint64_t wake_ns = heap_size > 0 && heap[0]->next_action_ns < end_ns ? heap[0]->next_action_ns : end_ns ;
+    timeout_ms = wake_ns > now ? (int)((wake_ns - now + 999999) / 1000000) : 0 ;
+
+    n_events = epoll_wait(epoll_descriptor, events, LOAD_MAX_EVENTS, timeout_ms);
+    if (n_events < 0){
+      if (errno == EINTR)
+        continue;
+      printf("Error calling epoll_wait : %s\n", strerror(errno));
+      break;
+    }
+    for (int i = 0; i < n_events; i++) {
+      botInfo* bot = (botInfo*)events[i].data.ptr ;
+      if (bot->state == BOT_CONNECTING)
+        finish_connect(bot);
+      if (bot->state != BOT_CLOSED && bot->state != BOT_CONNECTING && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+        serve_bot(bot);
+    }
+  }
+
+  run->elapsed_s = (now_ns() - start_ns) / 1e9 ;
+  for (int i = 0; i < config->n_connections; i++) {
+    if (bots[i].state == BOT_WAITING)
+      run->waiting++ ;
+    else if (bots[i].state == BOT_CHATTING)
+      run->chatting++ ;
+    if (bots[i].socket_descriptor >= 0)
+      close(bots[i].socket_descriptor);
+  }
+  close(epoll_descriptor);
+  free(bots);
+  free(heap);
+  return 0;
+
+  errout:
+  free(bots);
+  free(heap);
+  free_load_result(run);
+  return -1;
+}
+
+// Prints the report of a run, with the latencies in milliseconds
+void print_load_report(const loadConfig* config, const loadResult* result){
+  const loadStats* stats = &result->stats ;
+  printf("\n*** LOAD REPORT (%.1f s) ***\n", result->elapsed_s);
+  printf("Bots : %d, connected : %ld, waiting : %ld, chatting : %ld\n", config->n_connections, stats->connected, result->waiting, result->chatting);
+  printf("Matches : %ld (%.1f/s), messages sent : %ld (%.1f/s), pongs received : %ld\n", stats->matches, stats->matches / result->elapsed_s, stats->messages_sent, stats->messages_sent / result->elapsed_s, stats->pongs_received);
+  printf("Rerolls : %ld, stops : %ld, conversations ended by the partner : %ld\n", stats->rerolls, stats->stops, stats->partner_left);
+  printf("Errors : connect %ld, disconnected %ld, write %ld, rejected requests %ld\n", stats->connect_errors, stats->disconnected, stats->write_errors, stats->rejected);
+  print_latency("CONNECT LATENCY", result->connect_latency);
+  print_latency("MATCH LATENCY", result->match_latency);
+  print_latency("MESSAGE RTT", result->message_rtt);
+}
+
+// Releases the histograms of a result
+void free_load_result(loadResult* result){
+  free(result->connect_latency);
+  free(result->match_latency);
+  free(result->message_rtt);
+  result->connect_latency = NULL ;
+  result->match_latency = NULL ;
+  result->message_rtt = NULL ;
+}
+
+// Runs the action scheduled for a bot: connecting, or the next move of a conversation
+static void act(botInfo* bot){
+
+  char send_buff[128];
+  int len ;
+  double draw ;
+
+  heap_remove(bot);
+
+  if (bot->state == BOT_IDLE){
+    start_connect(bot);
+    return;
+  }
+  if (bot->state != BOT_CHATTING)
+    return;
+
+  draw = next_uniform();
+  if (draw < config->stop_probability){
+    // Back to the lobby, and straight into the same room again: both commands go in one segment
+    len = sprintf(send_buff, "//command:<STOP>\n//command:START<%s>\n", config->room_names[bot->room]);
+    if (send_line(bot, send_buff, len) < 0)
+      return;
+    run->stats.stops++ ;
+    bot->state = BOT_WAITING ;
+    bot->waiting_since_ns = now_ns();
+  }else if (draw < config->stop_probability + config->reroll_probability){
+    len = sprintf(send_buff, "//command:<REROLL>\n");
+    if (send_line(bot, send_buff, len) < 0)
+      return;
+    run->stats.rerolls++ ;
+    bot->state = BOT_WAITING ;
+    bot->waiting_since_ns = now_ns();
+  }else{
+    // The partner answers with a pong carrying the same id and time
+    len = sprintf(send_buff, "ping %d %llu\n", bot->id, (unsigned long long)now_ns());
+    if (send_line(bot, send_buff, len) < 0)
+      return;
+    run->stats.messages_sent++ ;
+    heap_schedule(bot, now_ns() + next_interval_ns(config->chat_rate));
+  }
+}
+
+// Starts the non blocking connection of a bot
+static void start_connect(botInfo* bot){
+
+  struct epoll_event event ;
+
+  if ((bot->socket_descriptor = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0){
+    run->stats.connect_errors++ ;
+    bot->state = BOT_CLOSED ;
+    return;
+  }
+  bot->connect_started_ns = now_ns();
+  if (connect(bot->socket_descriptor, (struct sockaddr*)&server_address, sizeof(server_address)) < 0 && errno != EINPROGRESS){
+    run->stats.connect_errors++ ;
+    close_bot(bot);
+    return;
+  }
+
+  // Edge triggered like the server: EPOLLOUT signals the end of the connect, EPOLLIN every new burst of data
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET ;
+  event.data.ptr = bot ;
+  if (epoll_ctl(epoll_descriptor, EPOLL_CTL_ADD, bot->socket_descriptor, &event) < 0){
+    run->stats.connect_errors++ ;
+    close_bot(bot);
+    return;
+  }
+  bot->state = BOT_CONNECTING ;
+}
+
+// Completes the connection of a bot, then sends its nickname and its room in a single segment
+static void finish_connect(botInfo* bot){
+
+  char send_buff[128];
+  int error = 0, len ;
+  socklen_t error_len = sizeof(error);
+
+  if (getsockopt(bot->socket_descriptor, SOL_SOCKET, SO_ERROR, &error, &error_len) < 0 || error != 0){
+    if (error == EINPROGRESS)
+      return;
+    run->stats.connect_errors++ ;
+    close_bot(bot);
+    return;
+  }
+
+  run->stats.connected++ ;
+  hdr_record(run->connect_latency, (now_ns() - bot->connect_started_ns) / 1000);
+
+  len = sprintf(send_buff, "//command:NICKNAME<bot%d>\n//command:START<%s>\n", bot->id, config->room_names[bot->room]);
+  bot->state = BOT_WAITING ;
+  bot->waiting_since_ns = now_ns();
+  send_line(bot, send_buff, len);
+}
+
+// Reads what the server sent to a bot until the socket is drained
+static void serve_bot(botInfo* bot){
+
+  char* line ;
+  int n_read_char, line_len ;
+
+  while (bot->state != BOT_CLOSED) {
+    while (bot->state != BOT_CLOSED && (line = framer_next_line(&bot->framer, &line_len)) != NULL)
+      serve_line(bot, line, line_len);
+    if (bot->state == BOT_CLOSED)
+      return;
+
+    n_read_char = framer_read(&bot->framer, bot->socket_descriptor);
+    if (n_read_char < 0){
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return;
+      if (errno == EINTR)
+        continue;
+    }
+    if (n_read_char <= 0){
+      run->stats.disconnected++ ;
+      close_bot(bot);
+      return;
+    }
+  }
+}
+
+// Reacts to a line sent by the server: the replies which change the state of the bot, and the pings and pongs relayed from the partner
+static void serve_line(botInfo* bot, char* line, int line_len){
+
+  char send_buff[128];
+  unsigned long long sent_ns ;
+  int id, len ;
+
+  // The line is parsed as a string, its newline becomes the terminator. A line without newline fills the framer, which has a spare byte after it
+  if (line_len > 0 && line[line_len-1] == '\n')
+    line[line_len-1] = '\0' ;
+  else
+    line[line_len] = '\0' ;
+
+  if (strncmp(line, "ping ", 5) == 0){
+    if (bot->state == BOT_CHATTING){
+      len = snprintf(send_buff, sizeof(send_buff), "pong %.100s\n", line + 5);
+      send_line(bot, send_buff, len);
+    }
+  }else if (strncmp(line, "pong ", 5) == 0){
+    // A pong may come from a partner of a previous conversation, it's timed only if the ping was ours
+    if (sscanf(line + 5, "%d %llu", &id, &sent_ns) == 2 && id == bot->id){
+      run->stats.pongs_received++ ;
+      hdr_record(run->message_rtt, (now_ns() - sent_ns) / 1000);
+    }
+  }else if (strstr(line, "SAY HI TO") != NULL){
+    if (bot->state == BOT_WAITING){
+      run->stats.matches++ ;
+      hdr_record(run->match_latency, (now_ns() - bot->waiting_since_ns) / 1000);
+      bot->state = BOT_CHATTING ;
+      heap_schedule(bot, now_ns() + next_interval_ns(config->chat_rate));
+    }
+  }else if (strstr(line, "has closed the conversation") != NULL || strstr(line, "Conversation is ended") != NULL){
+    // The server put the bot back in the waitlist. After our own REROLL or STOP the bot is already waiting
+    if (bot->state == BOT_CHATTING){
+      run->stats.partner_left++ ;
+      heap_remove(bot);
+      bot->state = BOT_WAITING ;
+      bot->waiting_since_ns = now_ns();
+    }
+  }else if (strstr(line, "can't be executed") != NULL){
+    run->stats.rejected++ ;
+  }
+}
+
+// Writes a few lines on the socket of a bot. They are always small, so a write the socket doesn't take at once means the server stopped reading: the bot is closed
+static int send_line(botInfo* bot, const char* text, int len){
+
+  ssize_t n_written ;
+
+  do {
+    n_written = write(bot->socket_descriptor, text, len);
+  } while (n_written < 0 && errno == EINTR);
+
+  if (n_written != len){
+    run->stats.write_errors++ ;
+    close_bot(bot);
+    return -1;
+  }
+  return 0;
+}
+
+// Closes the connection of a bot, which takes no further part in the run
+static void close_bot(botInfo* bot){
+  heap_remove(bot);
+  if (bot->socket_descriptor >= 0)
+    close(bot->socket_descriptor);
+  bot->socket_descriptor = -1 ;
+  bot->state = BOT_CLOSED ;
+}
+
+// Prints count, p50, p99, p99.9 and max of a histogram of microseconds, in milliseconds
+static void print_latency(const char* title, const hdrHistogram* histogram){
+  printf("-%s (ms) : count %llu, p50 %.3f, p99 %.3f, p99.9 %.3f, max %.3f\n", title, (unsigned long long)histogram->total,
+         hdr_value_at_percentile(histogram, 50) / 1e3, hdr_value_at_percentile(histogram, 99) / 1e3, hdr_value_at_percentile(histogram, 99.9) / 1e3, histogram->max / 1e3);
+}
+
+// Nanoseconds of the monotonic clock
+static uint64_t now_ns(){
+  struct timespec now ;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec ;
+}
+
+// Uniform number in [0,1), from a xorshift64* generator like the one of the matchers
+static double next_uniform(){
+  rng_state ^= rng_state >> 12 ;
+  rng_state ^= rng_state << 25 ;
+  rng_state ^= rng_state >> 27 ;
+  return ((rng_state * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0) ;
+}
+
+// Exponentially distributed interval between two messages, so the bots don't send in lockstep
+static uint64_t next_interval_ns(double rate){
+  if (rate <= 0)
+    return (uint64_t)-1 / 2;
+  return (uint64_t)(-log(1.0 - next_uniform()) / rate * 1e9) ;
+}
+
+// Schedules the next action of a bot, replacing the one already scheduled
+static void heap_schedule(botInfo* bot, uint64_t when_ns){
+  bot->next_action_ns = when_ns ;
+  if (bot->heap_index < 0){
+    bot->heap_index = heap_size ;
+    heap[heap_size++] = bot ;
+  }
+  heap_sift_up(bot->heap_index);
+  heap_sift_down(bot->heap_index);
+}
+
+// Cancels the action scheduled for a bot, if any
+static void heap_remove(botInfo* bot){
+  int i = bot->heap_index ;
+  if (i < 0)
+    return;
+  heap_size-- ;
+  if (i != heap_size){
+    heap_swap(i, heap_size);
+    heap_sift_up(i);
+    heap_sift_down(i);
+  }
+  bot->heap_index = -1 ;
+}
+
+static void heap_swap(int i, int j){
+  botInfo* swap = heap[i] ;
+  heap[i] = heap[j] ;
+  heap[j] = swap ;
+  heap[i]->heap_index = i ;
+  heap[j]->heap_index = j ;
+}
+
+static void heap_sift_up(int i){
+  while (i > 0 && heap[(i-1)/2]->next_action_ns > heap[i]->next_action_ns) {
+    heap_swap(i, (i-1)/2);
+    i = (i-1)/2 ;
+  }
+}
+
+static void heap_sift_down(int i){
+  int smallest ;
+  while (1) {
+    smallest = i ;
+    if (2*i+1 < heap_size && heap[2*i+1]->next_action_ns < heap[smallest]->next_action_ns)
+      smallest = 2*i+1 ;
+    if (2*i+2 < heap_size && heap[2*i+2]->next_action_ns < heap[smallest]->next_action_ns)
+      smallest = 2*i+2 ;
+    if (smallest == i)
+      return;
+    heap_swap(i, smallest);
+    i = smallest ;
+  }
+}
@@ -0,0 +1,95 @@
+#ifndef LOADGENERATOR_H
+#define LOADGENERATOR_H
+
+#include<stdint.h>
+#include "../Common/LineFramer.h"
+#include "../Common/Histogram.h"
+
+#define LOAD_ROOMS_MAX 1024 // Max number of rooms the bots join, ROOMS_MAX of the server
+#define LOAD_ROOM_NAME_SIZE 64 // Bytes of a room name, '\0' included, ROOM_NAME_SIZE of the server
+#define LOAD_ROOMS_REPLY_SIZE (256*1024) // Max size of the reply to //command:<ROOMS>
+#define LOAD_QUERY_TIMEOUT_S 5 // Time given to the server to list its rooms
+#define LOAD_BUF_SIZE 1024 // Bytes received and not consumed yet by a bot
+#define LOAD_MAX_EVENTS 1024 // Max number of readiness events served by a single epoll_wait call
+
+// Parameters of a load run, set from the command line
+typedef struct load_c {
+    const char* address ; // Server address, dotted format
+    int port ;
+    int n_connections ; // Bots opened by the process
+    double duration_s ; // How long the bots chat before the report
+    double connect_rate ; // Connections opened per second, 0 to open all of them at once
+    int n_rooms ; // Rooms the bots join, 0 until they come from a mix or from the server
+    char room_names[LOAD_ROOMS_MAX][LOAD_ROOM_NAME_SIZE];
+    double room_weights[LOAD_ROOMS_MAX]; // Relative share of the bots joining each room
+    double chat_rate ; // Messages per second sent by a bot while it's in a conversation
+    double reroll_probability ; // Chance that a bot sends REROLL instead of a message
+    double stop_probability ; // Chance that a bot sends STOP instead of a message, it then joins its room again
+} loadConfig ;
+
+// Errors and events counted during a run
+typedef struct load_s {
+    long connected ;
+    long connect_errors ;
+    long matches ;
+    long messages_sent ;
+    long pongs_received ;
+    long rerolls ;
+    long stops ;
+    long partner_left ; // Conversations ended by the partner
+    long rejected ; // Requests the server refused to execute
+    long disconnected ; // Connections closed by the server, or broken
+    long write_errors ; // Writes the socket didn't take at once, the bot is closed
+} loadStats ;
+
+// Outcome of a run
+typedef struct load_r {
+    double elapsed_s ;
+    long waiting ; // Bots waiting for a match at the end of the run
+    long chatting ; // Bots in a conversation at the end of the run
+    loadStats stats ;
+    hdrHistogram* connect_latency ; // Microseconds from connect to the connection established
+    hdrHistogram* match_latency ; // Microseconds from asking for a match to SAY HI TO
+    hdrHistogram* message_rtt ; // Microseconds from sending a ping to receiving the pong of the partner
+} loadResult ;
+
+// States of a bot, following the state of its connection inside the server
+typedef enum bot_st {
+    BOT_IDLE, // Not connected yet
+    BOT_CONNECTING, // Non blocking connect in progress
+    BOT_WAITING, // Nickname and room sent, waiting for a match
+    BOT_CHATTING, // Matched, sends messages at chat_rate
+    BOT_CLOSED // Connection closed or failed
+} botState ;
+
+// A simulated user
+typedef struct bot_inf {
+    int id ;
+    int socket_descriptor ;
+    botState state ;
+    int room ;
+    uint64_t connect_started_ns ; // CLOCK_MONOTONIC
+    uint64_t waiting_since_ns ; // When the bot asked for a match, to measure the match latency
+    uint64_t next_action_ns ; // When the bot connects or sends its next message
+    int heap_index ; // Position inside the timer heap, -1 if no action is scheduled
+    char recv_buff[LOAD_BUF_SIZE];
+    lineFramer framer ;
+} botInfo ;
+
+// LOAD FUNCTIONS
+// Fills *config with the default parameters
+void load_default_config(loadConfig* config);
+// Parses a room mix such as "Climate change=2,Travel related=1" inside the rooms of config. A room without a weight gets 1. Returns -1 if the mix is not valid, 0 otherwise
+int load_parse_room_mix(loadConfig* config, const char* mix);
+// Fills the rooms of config with every room of the server at config->address, all with the same weight, asking for them with //command:<ROOMS>.
+// Returns -1 with errno set in case of error, 0 otherwise
+int load_query_rooms(loadConfig* config);
+// Opens the bots and lets them chat for config->duration_s seconds, then closes them and fills *result. Returns -1 in case of error, 0 otherwise.
+// The histograms of the result are allocated by the run and must be released with free_load_result
+int run_load_generator(const loadConfig* config, loadResult* result);
+// Prints the report of a run, with the latencies in milliseconds
+void print_load_report(const loadConfig* config, const loadResult* result);
+// Releases the histograms of a result
+void free_load_result(loadResult* result);
+
+#endif
@@ -0,0 +1,106 @@
+#include<stdlib.h>
+#include "Histogram.h"
+
+static int bucket_of(uint64_t value);
+static uint64_t highest_value_of(int bucket);
+
+// HISTOGRAM FUNCTIONS
+
+// Allocates an empty histogram. Returns NULL in case of error
+hdrHistogram* hdr_create(){
+  return (hdrHistogram*)calloc(1, sizeof(hdrHistogram));
+}
+
+// Records a value. Lock free and thread safe
+void hdr_record(hdrHistogram* histogram, uint64_t value){
+
+  uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+  __atomic_fetch_add(&histogram->counts[bucket_of(value)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&histogram->total, 1, __ATOMIC_RELAXED);
+  // The maximum rarely changes, so the compare and swap is almost never tried
+  while (value > max && !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+}
+
+// Copies the histogram inside *copy, while other threads may still record values. Thread safe
+void hdr_copy(const hdrHistogram* histogram, hdrHistogram* copy){
+  // total is computed from the buckets, so the percentiles of the copy are always consistent
+  copy->total = 0 ;
+  for (int i = 0; i < HDR_BUCKETS; i++) {
+    copy->counts[i] = __atomic_load_n(&histogram->counts[i], __ATOMIC_RELAXED);
+    copy->total += copy->counts[i] ;
+  }
+  copy->sum = __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED);
+  copy->max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+// Smallest value v such that percentile% of the values recorded are not larger than v, up to the precision of the buckets. 0 if the histogram is empty. Not thread safe, meant for a copy
+uint64_t hdr_value_at_percentile(const hdrHistogram* histogram, double percentile){
+
+  uint64_t wanted, seen = 0 ;
+
+  if (histogram->total == 0)
+    return 0;
+  if (percentile > 100)
+    percentile = 100 ;
+  // At least one value, so the 0th percentile is the smallest value
+  wanted = (uint64_t)(percentile / 100.0 * histogram->total + 0.5) ;
+  if (wanted == 0)
+    wanted = 1 ;
+
+  for (int i = 0; i < HDR_BUCKETS; i++) {
+    seen += histogram->counts[i] ;
+    if (seen >= wanted){
+      // The bucket holding the largest value recorded can't go beyond it
+      uint64_t value = highest_value_of(i) ;
+      return value < histogram->max ? value : histogram->max ;
+    }
+  }
+  return histogram->max;
+}
+
+// Number of values not larger than value, up to the precision of the buckets. Not thread safe, meant for a copy
+uint64_t hdr_count_up_to(const hdrHistogram* histogram, uint64_t value){
+
+  uint64_t count = 0 ;
+  int last = bucket_of(value) ;
+
+  // The bucket of value may also hold some larger values, it's counted only if value is its highest one
+  for (int i = 0; i < last; i++)
+    count += histogram->counts[i] ;
+  if (highest_value_of(last) <= value)
+    count += histogram->counts[last] ;
+  return count;
+}
+
+// Position of the bucket counting value
+static int bucket_of(uint64_t value){
+
+  int magnitude, shift ;
+
+  if (value < HDR_SUB_COUNT)
+    return (int)value;
+  magnitude = 63 - __builtin_clzll(value) ;
+  if (magnitude >= HDR_MAX_MAGNITUDE)
+    return HDR_BUCKETS-1;
+  // The top HDR_SUB_BITS bits of the value select the bucket inside its power of two
+  shift = magnitude - (HDR_SUB_BITS-1) ;
+  return HDR_SUB_COUNT + (magnitude - HDR_SUB_BITS) * (HDR_SUB_COUNT/2) + (int)(value >> shift) - HDR_SUB_COUNT/2 ;
+}
+
+// Largest value counted by a bucket
+static uint64_t highest_value_of(int bucket){
+
+  int magnitude, shift, position ;
+
+  if (bucket < HDR_SUB_COUNT)
+    return (uint64_t)bucket;
+  if (bucket == HDR_BUCKETS-1)
+    return UINT64_MAX;
+  position = bucket - HDR_SUB_COUNT ;
+  magnitude = HDR_SUB_BITS + position / (HDR_SUB_COUNT/2) ;
+  shift = magnitude - (HDR_SUB_BITS-1) ;
+  return ((uint64_t)(HDR_SUB_COUNT/2 + position % (HDR_SUB_COUNT/2) + 1) << shift) - 1 ;
+}
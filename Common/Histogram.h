@@ -0,0 +1,32 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include<stdint.h>
+
+#define HDR_SUB_BITS 7 // The values under 2^HDR_SUB_BITS are counted exactly, the larger ones with an error under 1/2^(HDR_SUB_BITS-1)
+#define HDR_MAX_MAGNITUDE 36 // Values up to 2^HDR_MAX_MAGNITUDE, any larger value is counted in the last bucket
+#define HDR_SUB_COUNT (1 << HDR_SUB_BITS)
+#define HDR_BUCKETS (HDR_SUB_COUNT + (HDR_MAX_MAGNITUDE - HDR_SUB_BITS) * (HDR_SUB_COUNT/2))
+
+// High dynamic range histogram, shared by the server and the load generator of the client: every power of two is split in HDR_SUB_COUNT/2 linear buckets, so the relative error is the same for small and large values.
+// Any thread can record values at the same time, each one costs a few relaxed atomic additions
+typedef struct hdr_h {
+    uint64_t counts[HDR_BUCKETS];
+    uint64_t total ; // Values recorded
+    uint64_t sum ; // Sum of the values recorded, to compute the mean
+    uint64_t max ; // Largest value recorded, exact
+} hdrHistogram ;
+
+// HISTOGRAM FUNCTIONS
+// Allocates an empty histogram. Returns NULL in case of error
+hdrHistogram* hdr_create();
+// Records a value. Lock free and thread safe
+void hdr_record(hdrHistogram* histogram, uint64_t value);
+// Copies the histogram inside *copy, while other threads may still record values. Thread safe
+void hdr_copy(const hdrHistogram* histogram, hdrHistogram* copy);
+// Smallest value v such that percentile% of the values recorded are not larger than v, up to the precision of the buckets. 0 if the histogram is empty. Not thread safe, meant for a copy
+uint64_t hdr_value_at_percentile(const hdrHistogram* histogram, double percentile);
+// Number of values not larger than value, up to the precision of the buckets. Not thread safe, meant for a copy
+uint64_t hdr_count_up_to(const hdrHistogram* histogram, uint64_t value);
+
+#endif
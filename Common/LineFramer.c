@@ -0,0 +1,88 @@
+#include<string.h>
+#include<unistd.h>
+#include<errno.h>
+#include "LineFramer.h"
+
+// LINE FRAMER FUNCTIONS
+// Initializes the framer over a storage of capacity+1 bytes. A framer over no storage (NULL and 0) returns no line and has no space, until it's initialized again
+void framer_init(lineFramer* framer, char* storage, int capacity){
+  framer->storage = storage ;
+  framer->capacity = capacity ;
+  framer_reset(framer);
+}
+
+// Returns where the next bytes received must be written, and how many of them fit in *space. Moves the unfinished line to the start of the storage when the end has been reached
+char* framer_write_space(lineFramer* framer, int* space){
+  // Everything has been consumed: the storage starts again from the beginning, without moving anything
+  if (framer->head == framer->tail){
+    framer->head = 0 ;
+    framer->tail = 0 ;
+  }else if (framer->tail == framer->capacity && framer->head > 0){
+    // Only the unfinished line is left, and it's shorter than the storage
+    memmove(framer->storage, framer->storage + framer->head, framer->tail - framer->head);
+    framer->tail -= framer->head ;
+    framer->head = 0 ;
+  }
+  *space = framer->capacity - framer->tail ;
+  return framer->storage + framer->tail ;
+}
+
+// Accounts for n bytes written at the position returned by framer_write_space
+void framer_commit(lineFramer* framer, int n){
+  framer->tail += n ;
+}
+
+// Reads from fd into the framer. Returns what read returns, or -1 with errno set to ENOBUFS if the framer is full
+ssize_t framer_read(lineFramer* framer, int fd){
+  int space ;
+  ssize_t n_read ;
+  char* write_position = framer_write_space(framer, &space);
+  if (space == 0){
+    errno = ENOBUFS ;
+    return -1;
+  }
+  n_read = read(fd, write_position, space);
+  if (n_read > 0)
+    framer_commit(framer, n_read);
+  return n_read;
+}
+
+// Returns the next complete line, newline included, and its length in *len. The line stays valid until the next framer_write_space or framer_read.
+// When the storage is full and holds no newline, its whole content is returned as a line without newline. Returns NULL if there is no complete line
+char* framer_next_line(lineFramer* framer, int* len){
+  char* line = framer->storage + framer->head ;
+  char* newline ;
+
+  if (framer->head == framer->tail)
+    return NULL;
+  newline = memchr(line + framer->scanned, '\n', framer->tail - framer->head - framer->scanned);
+  if (newline != NULL){
+    *len = newline - line + 1 ;
+  }else if (framer->head == 0 && framer->tail == framer->capacity){
+    // The line doesn't fit the storage, so it's cut
+    *len = framer->capacity ;
+  }else{
+    framer->scanned = framer->tail - framer->head ;
+    return NULL;
+  }
+  framer->head += *len ;
+  framer->scanned = 0 ;
+  return line;
+}
+
+// Number of bytes stored and not returned as a line yet
+int framer_pending(const lineFramer* framer){
+  return framer->tail - framer->head ;
+}
+
+// Returns the bytes stored and not returned as a line yet, framer_pending of them
+const char* framer_pending_bytes(const lineFramer* framer){
+  return framer->storage + framer->head ;
+}
+
+// Forgets every byte stored
+void framer_reset(lineFramer* framer){
+  framer->head = 0 ;
+  framer->tail = 0 ;
+  framer->scanned = 0 ;
+}
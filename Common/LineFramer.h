@@ -0,0 +1,36 @@
+#ifndef LINEFRAMER_H
+#define LINEFRAMER_H
+
+#include<sys/types.h>
+
+// Splits a byte stream into newline terminated lines, shared by the server and the client.
+// The bytes are appended at tail and consumed from head, inside a storage owned by the caller. When tail reaches the end of the storage,
+// the unfinished line is moved back to its start: complete lines never wrap, so each one is returned as a pointer inside the storage, without copies
+typedef struct line_fr {
+  char* storage ; // Holds the bytes received and not consumed yet. One more byte than capacity must be allocated, so a line can always be terminated in place
+  int capacity ; // Max bytes stored, and so the max length of a line. Longer lines are returned in pieces of capacity bytes
+  int head ; // Position of the first byte not consumed yet
+  int tail ; // Position after the last byte stored
+  int scanned ; // Bytes after head already searched for a newline, so every byte is scanned only once
+} lineFramer ;
+
+// LINE FRAMER FUNCTIONS
+// Initializes the framer over a storage of capacity+1 bytes. A framer over no storage (NULL and 0) returns no line and has no space, until it's initialized again
+void framer_init(lineFramer* framer, char* storage, int capacity);
+// Returns where the next bytes received must be written, and how many of them fit in *space. Moves the unfinished line to the start of the storage when the end has been reached
+char* framer_write_space(lineFramer* framer, int* space);
+// Accounts for n bytes written at the position returned by framer_write_space
+void framer_commit(lineFramer* framer, int n);
+// Reads from fd into the framer. Returns what read returns, or -1 with errno set to ENOBUFS if the framer is full
+ssize_t framer_read(lineFramer* framer, int fd);
+// Returns the next complete line, newline included, and its length in *len. The line stays valid until the next framer_write_space or framer_read.
+// When the storage is full and holds no newline, its whole content is returned as a line without newline. Returns NULL if there is no complete line
+char* framer_next_line(lineFramer* framer, int* len);
+// Number of bytes stored and not returned as a line yet
+int framer_pending(const lineFramer* framer);
+// Returns the bytes stored and not returned as a line yet, framer_pending of them
+const char* framer_pending_bytes(const lineFramer* framer);
+// Forgets every byte stored
+void framer_reset(lineFramer* framer);
+
+#endif
@@ -1,3 +1,3 @@
 #! /bin/bash
 
-gcc -pthread -Wall -o Server List.c Server.c ; ./Server
+gcc -pthread -Wall -o Server ../Common/LineFramer.c ../Common/Histogram.c TimerWheel.c WorkerPool.c List.c Rooms.c Replies.c Parser.c Log.c Metrics.c Exporter.c Uring.c Shard.c Server.c ; ./Server
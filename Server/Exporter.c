@@ -0,0 +1,239 @@
+#define _GNU_SOURCE // Needed for accept4
+#include<sys/socket.h>
+#include<sys/un.h>
+#include<netinet/in.h>
+#include<arpa/inet.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<stdio.h>
+#include<stdarg.h>
+#include<string.h>
+#include<errno.h>
+#include<pthread.h>
+#include "Exporter.h"
+#include "Metrics.h"
+#include "Shard.h"
+#include "Log.h"
+
+static int exporter_socket = -1 ;
+static pthread_t exporter_thread ;
+static int stopping ; // Set by exporter_stop before it wakes up the accept
+// Allocated by the first scrape, once every room has been registered. Only the exporter thread uses it
+static char* page ;
+static int page_size ;
+// Snapshot taken by the previous scrape, the rates are computed since then. Only the exporter thread uses it
+static metricsSnapshot previous_snapshot ;
+static int has_previous_snapshot = 0 ;
+static hdrHistogram histogram_copy ; // Too big for the stack, only the exporter thread uses it
+static const double quantiles[3] = { 50, 99, 99.9 };
+static const char* quantile_names[3] = { "0.5", "0.99", "0.999" };
+
+static void* serve_scrapers(void* arg);
+static void serve_a_scraper(int scraper_sd);
+static void append(char* page, int size, int* len, const char* format, ...);
+
+// EXPORTER FUNCTIONS
+
+// Starts the thread serving the metrics page in the Prometheus text format. address is either a port, bound on 127.0.0.1 only, or the path of a unix socket.
+// Returns -1 in case of error, 0 otherwise
+int exporter_init(const char* address){
+
+  struct sockaddr_in inet_address ;
+  struct sockaddr_un unix_address ;
+  char* end ;
+  long port = strtol(address, &end, 10);
+  int reuse = 1;
+
+  if (*address != '\0' && *end == '\0'){
+    // Only a port: the page is never reachable from another host
+    if (port <= 0 || port > 65535){
+      errno = EINVAL ;
+      return -1;
+    }
+    if ((exporter_socket = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      return -1;
+    setsockopt(exporter_socket, SOL_SOCKET, SO_REUSEADDR, (void *)&reuse, sizeof(int));
+    memset(&inet_address, 0, sizeof(inet_address));
+    inet_address.sin_family = AF_INET ;
+    inet_address.sin_port = htons(port);
+    inet_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(exporter_socket, (struct sockaddr*)&inet_address, sizeof(inet_address)) < 0)
+      goto errout;
+  }else{
+    if (strlen(address) >= sizeof(unix_address.sun_path)){
+      errno = ENAMETOOLONG ;
+      return -1;
+    }
+    if ((exporter_socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) < 0)
+      return -1;
+    memset(&unix_address, 0, sizeof(unix_address));
+    unix_address.sun_family = AF_UNIX ;
+    strcpy(unix_address.sun_path, address);
+    // The socket file left by a previous run would make bind fail
+    unlink(address);
+    if (bind(exporter_socket, (struct sockaddr*)&unix_address, sizeof(unix_address)) < 0)
+      goto errout;
+  }
+
+  if (listen(exporter_socket, 16) < 0)
+    goto errout;
+
+  // The page is served by its own thread, which only reads the counters: a slow scraper never slows down the chat
+  if ((errno = pthread_create(&exporter_thread, NULL, serve_scrapers, NULL)) != 0)
+    goto errout;
+  return 0;
+
+  errout:
+  close(exporter_socket);
+  exporter_socket = -1 ;
+  return -1;
+}
+
+// Stops the thread serving the metrics page, if it's running, and waits for it
+void exporter_stop(){
+
+  if (exporter_socket < 0)
+    return;
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  // A listening socket shut down makes the accept waiting on it fail
+  shutdown(exporter_socket, SHUT_RDWR);
+  pthread_join(exporter_thread, NULL);
+  close(exporter_socket);
+  exporter_socket = -1 ;
+}
+
+// Writes the metrics page inside page, at most size bytes: with several shards, the sums of every shard and the histograms of the running one. Returns the length of the page
+int exporter_format_page(char* page, int size){
+
+  metricsSnapshot snapshot ;
+  int len = 0 ;
+
+  metrics_snapshot(&snapshot);
+  // With several shards the page shows the sums of every shard, but the histograms of this shard only
+  shards_totals(&snapshot);
+
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    append(page, size, &len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", metric_info[i].name, metric_info[i].help, metric_info[i].name, metric_info[i].name, (unsigned long long)snapshot.counters[i]);
+  }
+
+  append(page, size, &len, "# HELP randomchat_users_connected Users connected\n# TYPE randomchat_users_connected gauge\nrandomchat_users_connected %ld\n", snapshot.users_connected);
+  append(page, size, &len, "# HELP randomchat_active_chats Conversations going on\n# TYPE randomchat_active_chats gauge\nrandomchat_active_chats %ld\n", snapshot.active_chats);
+  append(page, size, &len, "# HELP randomchat_buffer_bytes_in_use Bytes of the buffers held by the connections, beyond their records\n# TYPE randomchat_buffer_bytes_in_use gauge\nrandomchat_buffer_bytes_in_use %ld\n", snapshot.buffer_bytes_in_use);
+  append(page, size, &len, "# HELP randomchat_client_record_bytes Bytes of the record of a connection\n# TYPE randomchat_client_record_bytes gauge\nrandomchat_client_record_bytes %zu\n", client_pool.object_size);
+  append(page, size, &len, "# HELP randomchat_room_waiting Users inside the waitlist of a room\n# TYPE randomchat_room_waiting gauge\n");
+  for (int r = 0; r < snapshot.n_rooms; r++)
+    append(page, size, &len, "randomchat_room_waiting{room=\"%s\"} %d\n", snapshot.room_names[r], snapshot.room_waiting[r]);
+  append(page, size, &len, "# HELP randomchat_uptime_seconds Time since the server started\n# TYPE randomchat_uptime_seconds gauge\nrandomchat_uptime_seconds %.3f\n", snapshot.uptime_s);
+
+  // Rates since the previous scrape, or since the start for the first one
+  append(page, size, &len, "# HELP randomchat_accepts_per_second Connections accepted per second since the previous scrape\n# TYPE randomchat_accepts_per_second gauge\nrandomchat_accepts_per_second %.3f\n",
+         has_previous_snapshot ? metrics_rate(&previous_snapshot, &snapshot, METRIC_ACCEPTS) : (snapshot.uptime_s > 0 ? snapshot.counters[METRIC_ACCEPTS] / snapshot.uptime_s : 0));
+  append(page, size, &len, "# HELP randomchat_matches_per_second Conversations started per second since the previous scrape\n# TYPE randomchat_matches_per_second gauge\nrandomchat_matches_per_second %.3f\n",
+         has_previous_snapshot ? metrics_rate(&previous_snapshot, &snapshot, METRIC_MATCHES) : (snapshot.uptime_s > 0 ? snapshot.counters[METRIC_MATCHES] / snapshot.uptime_s : 0));
+  previous_snapshot = snapshot ;
+  has_previous_snapshot = 1 ;
+
+  // Prometheus buckets at every power of two microseconds, taken from the histogram of each room. They are cumulative in the Prometheus format
+  for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+    append(page, size, &len, "# HELP %s %s\n# TYPE %s histogram\n", histogram_info[h].name, histogram_info[h].help, histogram_info[h].name);
+    for (int r = 0; r < snapshot.n_rooms; r++) {
+      hdr_copy(metrics_histogram(h, r), &histogram_copy);
+      for (int b = 0; b < EXPORTER_BUCKETS; b++)
+        append(page, size, &len, "%s_bucket{room=\"%s\",le=\"%g\"} %llu\n", histogram_info[h].name, snapshot.room_names[r], (double)(1ULL << b) / 1e6, (unsigned long long)hdr_count_up_to(&histogram_copy, 1ULL << b));
+      append(page, size, &len, "%s_bucket{room=\"%s\",le=\"+Inf\"} %llu\n%s_sum{room=\"%s\"} %.6f\n%s_count{room=\"%s\"} %llu\n", histogram_info[h].name, snapshot.room_names[r], (unsigned long long)histogram_copy.total,
+             histogram_info[h].name, snapshot.room_names[r], histogram_copy.sum / 1e6, histogram_info[h].name, snapshot.room_names[r], (unsigned long long)histogram_copy.total);
+    }
+  }
+
+  // Percentiles computed by the server, more precise than what the buckets allow
+  for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+    append(page, size, &len, "# HELP %s_quantile %s, percentiles since the start\n# TYPE %s_quantile gauge\n", histogram_info[h].name, histogram_info[h].help, histogram_info[h].name);
+    for (int r = 0; r < snapshot.n_rooms; r++) {
+      hdr_copy(metrics_histogram(h, r), &histogram_copy);
+      for (int q = 0; q < 3; q++)
+        append(page, size, &len, "%s_quantile{room=\"%s\",quantile=\"%s\"} %.6f\n", histogram_info[h].name, snapshot.room_names[r], quantile_names[q], hdr_value_at_percentile(&histogram_copy, quantiles[q]) / 1e6);
+    }
+  }
+
+  return len;
+}
+
+// Accepts the scrapers one at a time, until exporter_stop is called
+static void* serve_scrapers(void* arg){
+
+  int scraper_sd ;
+
+  (void)arg ;
+
+  while (1) {
+    scraper_sd = accept4(exporter_socket, NULL, NULL, SOCK_CLOEXEC);
+    if (scraper_sd < 0){
+      if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE))
+        break;
+      if (errno != EINTR && errno != ECONNABORTED)
+        log_event(LOG_SYSTEM_ERROR, "accepting a metrics scraper", NULL, NULL, errno, 0, 0, 0);
+      continue;
+    }
+    serve_a_scraper(scraper_sd);
+    close(scraper_sd);
+  }
+  return NULL;
+}
+
+// Reads the HTTP request of a scraper and answers with the metrics page. Any path but /metrics and / gets a 404
+static void serve_a_scraper(int scraper_sd){
+
+  char request[1024];
+  char header[256];
+  metricsSnapshot snapshot ;
+  struct timeval timeout = { EXPORTER_TIMEOUT_MS / 1000, (EXPORTER_TIMEOUT_MS % 1000) * 1000 };
+  int n_read = 0, n, page_len, header_len ;
+
+  setsockopt(scraper_sd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(scraper_sd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+  // Only the request line matters, the headers are read and ignored
+  while (n_read < (int)sizeof(request)-1) {
+    n = recv(scraper_sd, request + n_read, sizeof(request)-1 - n_read, 0);
+    if (n <= 0)
+      return;
+    n_read += n ;
+    request[n_read] = '\0' ;
+    if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL)
+      break;
+  }
+
+  if (strncmp(request, "GET /metrics ", 13) != 0 && strncmp(request, "GET / ", 6) != 0){
+    header_len = sprintf(header, "HTTP/1.0 404 Not Found\r\nContent-Type: text/plain\r\nContent-Length: 10\r\nConnection: close\r\n\r\nNot found\n");
+    send(scraper_sd, header, header_len, MSG_NOSIGNAL);
+    return;
+  }
+
+  if (page == NULL){
+    metrics_snapshot(&snapshot);
+    page_size = EXPORTER_PAGE_SIZE + snapshot.n_rooms * EXPORTER_ROOM_PAGE_SIZE ;
+    if ((page = (char*)malloc(page_size)) == NULL){
+      log_event(LOG_SYSTEM_ERROR, "allocating the metrics page", NULL, NULL, errno, 0, 0, 0);
+      return;
+    }
+  }
+  page_len = exporter_format_page(page, page_size);
+  header_len = sprintf(header, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\nConnection: close\r\n\r\n", page_len);
+  if (send(scraper_sd, header, header_len, MSG_NOSIGNAL | MSG_MORE) == header_len)
+    send(scraper_sd, page, page_len, MSG_NOSIGNAL);
+}
+
+// Appends to page a formatted string, cutting it if the page is full
+static void append(char* page, int size, int* len, const char* format, ...){
+
+  va_list arguments ;
+  int n ;
+
+  if (*len >= size-1)
+    return;
+  va_start(arguments, format);
+  n = vsnprintf(page + *len, size - *len, format, arguments);
+  va_end(arguments);
+  if (n > 0)
+    *len = *len + n < size-1 ? *len + n : size-1 ;
+}
@@ -0,0 +1,18 @@
+#ifndef EXPORTER_H
+#define EXPORTER_H
+
+#define EXPORTER_PAGE_SIZE (64*1024) // Max size of the metrics page, without the lines of the rooms
+#define EXPORTER_ROOM_PAGE_SIZE (16*1024) // Max size of the lines of a room inside the metrics page
+#define EXPORTER_BUCKETS 32 // Prometheus buckets of a histogram, the bucket i counts the values up to 2^i microseconds
+#define EXPORTER_TIMEOUT_MS 1000 // A scraper which doesn't send its request or read the page for this long is disconnected
+
+// EXPORTER FUNCTIONS
+// Starts the thread serving the metrics page in the Prometheus text format. address is either a port, bound on 127.0.0.1 only, or the path of a unix socket.
+// Returns -1 in case of error, 0 otherwise
+int exporter_init(const char* address);
+// Stops the thread serving the metrics page, if it's running, and waits for it
+void exporter_stop();
+// Writes the metrics page inside page, at most size bytes: with several shards, the sums of every shard and the histograms of the running one. Returns the length of the page
+int exporter_format_page(char* page, int size);
+
+#endif
@@ -1,63 +1,288 @@
+#include<stdio.h>
 #include "List.h"
+#include "Metrics.h"
+
+#define INITIAL_CAPACITY 64 // Positions allocated by a new list
+#define POOL_COUNT (3 + BUFFER_CLASSES) // Number of pools, each one has its own cache inside every thread
+#define POOL_SLAB_OBJECTS 64 // Objects allocated together when a pool is empty
+#define POOL_CACHE_OBJECTS 32 // Max objects cached by a thread for each pool
+#define POOL_ALIGNMENT 16
+
+#define SIZED_POOL_INITIALIZER(pool_name, size, pool_id) { pool_name, ((size) + POOL_ALIGNMENT - 1) & ~(size_t)(POOL_ALIGNMENT - 1), pool_id, PTHREAD_MUTEX_INITIALIZER, NULL, 0, NULL, 0, 0, 0, 0, NULL, 0, 0 }
+#define OBJECT_POOL_INITIALIZER(pool_name, type, pool_id) SIZED_POOL_INITIALIZER(pool_name, sizeof(type), pool_id)
+#define BUFFER_CLASS_SIZE(class) (BUF_SIZE << (2*(class)))
+
+// Free objects cached by a thread for one pool. Gets and puts are counted here by the owner thread only, and summed up by pool_stats, so they cost no lock
+typedef struct pool_c {
+  void* objects[POOL_CACHE_OBJECTS];
+  int n_objects ;
+  long n_gets ;
+  long n_puts ;
+  int registered ; // 1 once the cache has been linked inside the pool
+  objectPool* pool ;
+  struct pool_c* next ; // Links the caches of the pool
+} poolCache ;
+
+objectPool client_pool = OBJECT_POOL_INITIALIZER("thread_arg", thread_arg, 0);
+objectPool node_pool = OBJECT_POOL_INITIALIZER("linkedListNode", linkedListNode, 1);
+objectPool conversation_pool = OBJECT_POOL_INITIALIZER("conversation_thread_arg", conversation_thread_arg, 2);
+objectPool buffer_pools[BUFFER_CLASSES] = {
+  SIZED_POOL_INITIALIZER("buffer 1 KB", BUFFER_CLASS_SIZE(0), 3),
+  SIZED_POOL_INITIALIZER("buffer 4 KB", BUFFER_CLASS_SIZE(1), 4),
+  SIZED_POOL_INITIALIZER("buffer 16 KB", BUFFER_CLASS_SIZE(2), 5)
+};
+
+// The caches of the running thread, one for each pool. When the thread ends they go back to their pools, see retire_caches
+static __thread poolCache thread_caches[POOL_COUNT];
+// Its destructor runs for every thread which registered a cache, before the storage of the thread is released
+static pthread_key_t caches_key ;
+static pthread_once_t caches_key_once = PTHREAD_ONCE_INIT ;
+
+// Gives the objects cached by an ending thread back to their pools, with its counters, and unlinks its caches. Destructor of caches_key
+static void retire_caches(void* caches){
+  poolCache* cache ;
+
+  for (int i = 0; i < POOL_COUNT; i++) {
+    cache = &((poolCache*)caches)[i] ;
+    if (!cache->registered)
+      continue;
+    pthread_mutex_lock(&cache->pool->semaphore);
+    while (cache->n_objects > 0) {
+      void* cached = cache->objects[--cache->n_objects] ;
+      *(void**)cached = cache->pool->free_objects ;
+      cache->pool->free_objects = cached ;
+      cache->pool->n_free++ ;
+    }
+    cache->pool->retired_gets += cache->n_gets ;
+    cache->pool->retired_puts += cache->n_puts ;
+    for (poolCache** link = &cache->pool->caches; *link != NULL; link = &(*link)->next) {
+      if (*link == cache){
+        *link = cache->next ;
+        break;
+      }
+    }
+    cache->registered = 0 ;
+    pthread_mutex_unlock(&cache->pool->semaphore);
+  }
+}
+
+// Creates caches_key
+static void create_caches_key(){
+  pthread_key_create(&caches_key, retire_caches);
+}
+
+// Links the cache of the running thread inside the pool, so pool_stats finds its counters. Called with the pool locked
+static void register_cache(objectPool* pool, poolCache* cache){
+  if (!cache->registered){
+    cache->registered = 1 ;
+    cache->pool = pool ;
+    cache->next = pool->caches ;
+    pool->caches = cache ;
+    // The caches go back to the pools when the thread ends
+    pthread_once(&caches_key_once, create_caches_key);
+    pthread_setspecific(caches_key, thread_caches);
+  }
+}
+
+// POOL FUNCTIONS
+// Returns a free object of the pool, or NULL if a new slab can't be allocated. The content of the object is undefined. Thread safe.
+void* pool_get(objectPool* pool){
+  poolCache* cache = &thread_caches[pool->id] ;
+
+  if (cache->n_objects == 0){
+    // Takes half a cache of objects, carving a new slab out of the heap only when the pool is empty
+    pthread_mutex_lock(&pool->semaphore);
+    if (pool->n_free < POOL_CACHE_OBJECTS/2){
+      char* slab = (char*)malloc(POOL_ALIGNMENT + POOL_SLAB_OBJECTS*pool->object_size);
+      if (slab != NULL){
+        *(void**)slab = pool->slabs ;
+        pool->slabs = slab ;
+        pool->n_slabs++ ;
+        pool->n_objects += POOL_SLAB_OBJECTS ;
+        for (int i = 0; i < POOL_SLAB_OBJECTS; i++) {
+          void* object = slab + POOL_ALIGNMENT + i*pool->object_size ;
+          *(void**)object = pool->free_objects ;
+          pool->free_objects = object ;
+        }
+        pool->n_free += POOL_SLAB_OBJECTS ;
+      }
+    }
+    while (cache->n_objects < POOL_CACHE_OBJECTS/2 && pool->free_objects != NULL) {
+      cache->objects[cache->n_objects++] = pool->free_objects ;
+      pool->free_objects = *(void**)pool->free_objects ;
+      pool->n_free-- ;
+    }
+    pool->n_refills++ ;
+    register_cache(pool, cache);
+    pthread_mutex_unlock(&pool->semaphore);
+    if (cache->n_objects == 0)
+      return NULL;
+  }
+  // Only this thread writes the counter, pool_stats may read it at any time
+  __atomic_store_n(&cache->n_gets, cache->n_gets + 1, __ATOMIC_RELAXED);
+  return cache->objects[--cache->n_objects];
+}
+
+// Gives back an object taken with pool_get from the same pool. Thread safe.
+void pool_put(objectPool* pool, void* object){
+  poolCache* cache = &thread_caches[pool->id] ;
+
+  if (object == NULL)
+    return;
+  // A thread which only gives objects back may never fill its cache, its puts must be counted anyway
+  if (!cache->registered){
+    pthread_mutex_lock(&pool->semaphore);
+    register_cache(pool, cache);
+    pthread_mutex_unlock(&pool->semaphore);
+  }
+  if (cache->n_objects == POOL_CACHE_OBJECTS){
+    // Gives back half of the cache, so the next puts and gets of this thread don't need the lock either
+    pthread_mutex_lock(&pool->semaphore);
+    while (cache->n_objects > POOL_CACHE_OBJECTS/2) {
+      void* cached = cache->objects[--cache->n_objects] ;
+      *(void**)cached = pool->free_objects ;
+      pool->free_objects = cached ;
+      pool->n_free++ ;
+    }
+    pool->n_flushes++ ;
+    pthread_mutex_unlock(&pool->semaphore);
+  }
+  __atomic_store_n(&cache->n_puts, cache->n_puts + 1, __ATOMIC_RELAXED);
+  cache->objects[cache->n_objects++] = object ;
+}
+
+// Fills *stats with the usage of the pool. Thread safe.
+void pool_stats(objectPool* pool, poolStats* stats){
+  pthread_mutex_lock(&pool->semaphore);
+  stats->n_gets = pool->retired_gets ;
+  stats->n_puts = pool->retired_puts ;
+  for (poolCache* cache = pool->caches; cache != NULL; cache = cache->next) {
+    stats->n_gets += __atomic_load_n(&cache->n_gets, __ATOMIC_RELAXED);
+    stats->n_puts += __atomic_load_n(&cache->n_puts, __ATOMIC_RELAXED);
+  }
+  stats->n_slabs = pool->n_slabs ;
+  stats->n_objects = pool->n_objects ;
+  stats->objects_free = pool->n_free ;
+  stats->n_refills = pool->n_refills ;
+  stats->n_flushes = pool->n_flushes ;
+  pthread_mutex_unlock(&pool->semaphore);
+  stats->objects_in_use = stats->n_gets - stats->n_puts ;
+}
+
+// Prints the usage of the pool on the standard output. Thread safe.
+void print_pool_stats(objectPool* pool){
+  poolStats stats ;
+  pool_stats(pool, &stats);
+  printf("\n-POOL %s :\nSlabs : %ld (%ld objects of %zu bytes)\nIn use : %ld\nFree inside the pool : %ld\nGets : %ld, puts : %ld\nCache refills : %ld, flushes : %ld\n",pool->name,stats.n_slabs,stats.n_objects,pool->object_size,stats.objects_in_use,stats.objects_free,stats.n_gets,stats.n_puts,stats.n_refills,stats.n_flushes);
+}
+
+
+// BUFFER FUNCTIONS
+// Lends a buffer of at least size bytes, from the pool of the smallest class holding them, and stores its real size in *capacity.
+// Sizes beyond the largest class come from the heap. Returns NULL if there's no memory. Thread safe.
+char* buffer_get(int size, int* capacity){
+
+  char* buffer = NULL ;
+
+  *capacity = size ;
+  for (int class = 0; class < BUFFER_CLASSES; class++) {
+    if (size <= BUFFER_CLASS_SIZE(class)){
+      *capacity = BUFFER_CLASS_SIZE(class) ;
+      buffer = (char*)pool_get(&buffer_pools[class]);
+      break;
+    }
+  }
+  if (*capacity == size && size > BUFFER_CLASS_SIZE(BUFFER_CLASSES-1))
+    buffer = (char*)malloc(size);
+  if (buffer != NULL)
+    metrics_add(METRIC_BUFFER_BYTES_LENT, *capacity);
+  return buffer;
+}
+
+// Gives back a buffer lent by buffer_get, with the capacity it had. Does nothing with NULL. Thread safe.
+void buffer_put(char* buffer, int capacity){
+
+  if (buffer == NULL)
+    return;
+  metrics_add(METRIC_BUFFER_BYTES_RETURNED, capacity);
+  // The buffers of a class have exactly its size, the ones from the heap are bigger than every class
+  for (int class = 0; class < BUFFER_CLASSES; class++) {
+    if (capacity == BUFFER_CLASS_SIZE(class)){
+      pool_put(&buffer_pools[class], buffer);
+      return;
+    }
+  }
+  free(buffer);
+}
+
 
 // LIST FUNCTIONS
 // Initializes the list like a default constructor would, allocating the needed resources. To be called one time, only when we declare and allocate a linked list to avoid seg_fault
 linkedList* createANewLinkedList(){
     linkedList* ret_list ;
     if ( (ret_list=(linkedList*)malloc(sizeof(linkedList)))!=NULL ){
-      ret_list->head = NULL ;
-      ret_list->size = 0 ;
+      if ( (ret_list->records=(linkedListNode**)malloc(INITIAL_CAPACITY*sizeof(linkedListNode*)))==NULL ){
+        free(ret_list);
+        return NULL;
+      }
+      __atomic_store_n(&ret_list->size, 0, __ATOMIC_RELAXED);
+      ret_list->capacity = INITIAL_CAPACITY ;
       pthread_mutex_init(&ret_list->semaphore,NULL);
     }
     return ret_list;
 }
-// Insert on top of the list the new node. Thread safe.
-void insert_element(linkedListNode* record, linkedList* list){
+// Insert at the end of the list the new node. Returns -1 if the list can't grow, 0 otherwise. O(1) amortized. Thread safe.
+int insert_element(linkedListNode* record, linkedList* list){
+  int ret_value=-1;
   if (record!=NULL && list!=NULL)  {
     pthread_mutex_lock(&list->semaphore);
-    record->next = list->head;
-    list->head = record ;
-    list->size++ ;
+    if (list->size == list->capacity){
+      linkedListNode** grown_records = (linkedListNode**)realloc(list->records, 2*list->capacity*sizeof(linkedListNode*));
+      if (grown_records == NULL){
+        pthread_mutex_unlock(&list->semaphore);
+        return ret_value;
+      }
+      list->records = grown_records ;
+      list->capacity *= 2 ;
+    }
+    record->index = list->size ;
+    list->records[list->size] = record ;
+    __atomic_store_n(&list->size, list->size + 1, __ATOMIC_RELAXED);
     pthread_mutex_unlock(&list->semaphore);
+    ret_value = 0;
   }
+  return ret_value;
 }
-// Removes the record (found with accessByIndex function) from the list if still present. Thread safe.
-void remove_element(linkedListNode* record, linkedList* list){
+// Removes the record from the list and gives it back to node_pool, if the record is inside the list and still holds data. Returns -1 if it's not, 0 otherwise. O(1). Thread safe.
+// A record taken by a matcher is not inside the list, and once the matcher gives it back to node_pool it may hold another client
+int remove_element(linkedListNode* record, thread_arg* data, linkedList* list){
+  int ret_value=-1;
   if (record!=NULL && list!=NULL)  {
       pthread_mutex_lock(&list->semaphore);
-      linkedListNode* iterator = list->head ;
-      linkedListNode* last_visited = NULL ;
-      while (iterator!=NULL && iterator!=record){
-        last_visited = iterator ;
-        iterator = iterator->next ;
-      }
-      if (iterator!=NULL){
-        if(last_visited!=NULL){
-          //rimuovi dal centro
-          last_visited->next = iterator->next ;
-        }else{
-          //rimuovi dalla testa
-          list->head = iterator->next ;
-        }
-        iterator->data = NULL ;
-        iterator->next = NULL ;
-        free(iterator);
-        list->size-- ;
+      int index = record->index ;
+      if (index >= 0 && index < list->size && list->records[index] == record && record->data == data){
+        // The last record takes the place of the removed one, so the array stays dense
+        linkedListNode* last_record = list->records[list->size-1] ;
+        list->records[index] = last_record ;
+        last_record->index = index ;
+        list->records[list->size-1] = NULL ;
+        __atomic_store_n(&list->size, list->size - 1, __ATOMIC_RELAXED);
+        record->data = NULL ;
+        record->index = -1 ;
+        pool_put(&node_pool, record);
+        ret_value = 0;
       }
       pthread_mutex_unlock(&list->semaphore);
   }
+  return ret_value;
 }
-// Access to the ith element of the linkedList. If index is bigger than the dimension or smaller than zero, it returns NULL. Thread Safe.
+// Access to the ith element of the linkedList. If index is bigger than the dimension or smaller than zero, it returns NULL. O(1). Thread Safe.
 linkedListNode* accessByIndex(int index, linkedList* list){
   linkedListNode* ret_value = NULL ;
   if (list!=NULL){
     pthread_mutex_lock(&list->semaphore);
-    linkedListNode* iterator = list->head ;
     if (index < list->size && index>=0){
-      for (int i = 0; i < index; i++) {
-        iterator = iterator->next ;
-      }
-      ret_value = iterator ;
+      ret_value = list->records[index] ;
     }
     pthread_mutex_unlock(&list->semaphore);
   }
@@ -73,19 +298,71 @@ int sizeOfTheList(linkedList* list){
   }
   return ret_value;
 }
-
+// Returns the size of a list without locking it, so the value may be a little old. Thread safe, never waits for the threads using the list.
+int peekSizeOfTheList(linkedList* list){
+  if (list==NULL)
+    return -1;
+  return __atomic_load_n(&list->size, __ATOMIC_RELAXED);
+}
+// Exchanges the array of the list with *records, whose allocated positions are *capacity, leaving the list empty. The records are handed to the caller in O(1).
+// Returns the number of records taken, -1 in case of error. Thread safe.
+int takeAllElements(linkedList* list, linkedListNode*** records, int* capacity){
+  int ret_value=-1;
+  if (list!=NULL && records!=NULL && *records!=NULL && capacity!=NULL && *capacity>0){
+    linkedListNode** list_records ;
+    int list_capacity ;
+    pthread_mutex_lock(&list->semaphore);
+    list_records = list->records ;
+    list_capacity = list->capacity ;
+    ret_value = list->size ;
+    list->records = *records ;
+    list->capacity = *capacity ;
+    __atomic_store_n(&list->size, 0, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&list->semaphore);
+    // The records keep their old positions: remove_element doesn't find them there anymore, since the array of the list is another one
+    *records = list_records ;
+    *capacity = list_capacity ;
+  }
+  return ret_value;
+}
+// Puts back at the end of the list n_records records taken with takeAllElements. Unlike insert_element it doesn't wake up the matcher. Returns -1 if the list can't grow, 0 otherwise. Thread safe.
+int giveBackElements(linkedList* list, linkedListNode** records, int n_records){
+  int ret_value=-1;
+  if (list!=NULL && records!=NULL && n_records>=0){
+    pthread_mutex_lock(&list->semaphore);
+    int needed_capacity = list->capacity ;
+    while (needed_capacity < list->size+n_records)
+      needed_capacity *= 2 ;
+    if (needed_capacity != list->capacity){
+      linkedListNode** grown_records = (linkedListNode**)realloc(list->records, needed_capacity*sizeof(linkedListNode*));
+      if (grown_records == NULL){
+        pthread_mutex_unlock(&list->semaphore);
+        return ret_value;
+      }
+      list->records = grown_records ;
+      list->capacity = needed_capacity ;
+    }
+    for (int i = 0; i < n_records; i++) {
+      records[i]->index = list->size ;
+      list->records[list->size] = records[i] ;
+      __atomic_store_n(&list->size, list->size + 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&list->semaphore);
+    ret_value = 0;
+  }
+  return ret_value;
+}
 void destroy_list(linkedList* list){
   if (list!=NULL){
-    linkedListNode* iterator = list->head ;
-    while (iterator!=NULL){
-      list->head = list->head->next ;
-      iterator->next = NULL;
-      free(iterator->data);
-      iterator->data = NULL;
-      free(iterator);
-      iterator = list->head ;
+    for (int i = 0; i < list->size; i++) {
+      pool_put(&client_pool, list->records[i]->data);
+      list->records[i]->data = NULL;
+      pool_put(&node_pool, list->records[i]);
+      list->records[i] = NULL;
     }
-    list->head = NULL;
+    free(list->records);
+    list->records = NULL;
+    __atomic_store_n(&list->size, 0, __ATOMIC_RELAXED);
     pthread_mutex_destroy(&list->semaphore);
     free(list) ;
   }
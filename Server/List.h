@@ -2,26 +2,93 @@
 #define LIST_H
 
 #include<stdlib.h>
+#include<stdint.h>
 #include<pthread.h>
+#include<time.h>
+#include "../Common/LineFramer.h"
+#include "TimerWheel.h"
+
+#define BUF_SIZE 1024
+#define BUFFER_CLASSES 3 // Size classes of the buffers lent to the connections: BUF_SIZE, and every class 4 times the previous one (1, 4 and 16 KB)
+
+// States of the per-connection state machine driven by the reactor
+typedef enum client_st {
+    STATE_NICKNAME, // Just connected, the client still has to send //command:NICKNAME<...>
+    STATE_LOBBY, // Nickname set, the client can ask for USERS, ROOMS, HELP or START a chat
+    STATE_WAITING, // Inside a room waitlist, nobody reads the socket until a matcher pairs the client. A hangup still takes the client out of the waitlist at once
+    STATE_IN_CONVERSATION, // Paired with another user, whatever the client writes is relayed to the partner
+    STATE_LEAVING, // Asked for a room owned by another shard: nobody reads the socket, which moves there once the requests of the ring pointing to the client have completed
+    STATE_CLOSED // Socket closed, the record is released by the reactor at the end of the current batch of events
+} client_state ;
 
 // Client informations
 typedef struct client_inf {
     char IP_address[32]; // Holds the client IP address
     char nickname[32]; // Holds the nickname chosen by the the user
+    int nickname_len ; // Length of nickname, so the replies holding it are assembled without strlen
     int client_sd ; // The socket_descriptor opened between client and server
     struct client_inf* last_chat ; // Pointer to the last user we chatted with. Usefull for avoiding two random chats in a row with the same user
+    client_state state ; // Current state of the connection. Only the reactor thread changes it
+    struct clients_inf* conversation ; // The conversation the client is taking part in, NULL outside of STATE_IN_CONVERSATION
+    lineFramer recv_framer ; // Splits what the client sends into requests or chat lines. Its storage is a buffer of BUF_SIZE bytes borrowed while the client has bytes not consumed yet, NULL otherwise
+    char relay_header[48]; // "-- <nickname> --" header, built once when the nickname is set and sent before every relayed message
+    int relay_header_len ;
+    int splice_pipe[2]; // Pipe used to splice big pastes to the partner, created on first use (-1 until then)
+    char* out_buff ; // Bytes the socket couldn't take yet, borrowed on the first partial write and given back once flushed
+    int out_capacity ; // Size of out_buff, never more than OUT_QUEUE_LIMIT
+    int out_start ; // Position of the first queued byte inside out_buff
+    int out_len ; // Number of queued bytes
+    struct timespec out_progress ; // Last time the queue started or the socket took some queued bytes
+    int out_unsent ; // Bytes still inside the kernel send buffer at the last stall check, a slow reader still makes them shrink
+    int out_closing ; // 1 once the client has been dropped because it doesn't read what we send
+    int reads_paused ; // 1 while the socket is not read because the partner's queue is above OUT_HIGH_WATER
+    struct client_inf* backlog_prev ; // Links the record inside the reactor's list of clients with queued bytes
+    struct client_inf* backlog_next ;
+    uint64_t out_flushed ; // Bytes written from the queue since the client connected: the position of the queue inside what we send to the client
+    uint64_t out_timed_end ; // Position where the relay timed through the queue ends, 0 if no relay is timed. One at a time, the others are not measured
+    struct timespec out_timed_read_at ; // When the lines of the timed relay were read from the partner
+    int out_timed_room ; // Room whose histogram gets the relay latency
+    struct timespec waiting_since ; // When the client entered the waitlist (CLOCK_MONOTONIC), used to measure the enqueue-to-match latency
+    struct reactor_inf* reactor ; // The reactor serving the connection, NULL while the client moves to another reactor. Written atomically by the reactor owning the client, read atomically by the others
+    struct timespec moving_since ; // When the client left its reactor for the reactor of its conversation (CLOCK_MONOTONIC), used to measure the migration latency
+    struct client_inf* next ; // Links the record inside the reactor's list of closed clients
+    wheelTimer timer ; // Next timeout or heartbeat of the client, inside the timer wheel of its reactor
+    uint64_t state_tick ; // Tick of the wheels when the client entered its current state
+    uint64_t active_tick ; // Tick of the wheels when something was last read from the client
+    uint64_t heartbeat_tick ; // Tick of the wheels when the last heartbeat was sent to the client
+    struct room_inf* room ; // The room whose waitlist holds the client, in STATE_WAITING
+    struct node* waiting_node ; // The record of the client inside that waitlist, in STATE_WAITING
+    int hung_up ; // 1 once the client closed its connection while waiting. Set by the reactor, read by the matchers, which don't pair it
+    // Used by the reactors running on io_uring only, see run_uring_reactor
+    int recv_armed ; // 1 while the multishot recv of the socket is armed on the ring of the reactor
+    int recv_cancelled ; // 1 once that recv has been asked to stop
+    int recv_done ; // 1 once the ring found the end of the stream, or the error in recv_error: reading the client returns it after the bytes received
+    int recv_error ;
+    int recv_unread ; // Bytes the ring put in recv_framer and reading the client has not returned yet
+    char* spill_buff ; // Bytes received which don't fit recv_framer yet, borrowed only when it's full
+    int spill_capacity ;
+    int spill_start ;
+    int spill_len ;
+    char* out_sending ; // Buffer read by the send in flight, NULL if there's none. An out_buff replaced while it was sending is given back when the send completes
+    int out_sending_capacity ;
+    int uring_requests ; // Requests of the ring pointing to the record: the recv and the send. The record is released only once all of them have completed
+    int send_listed ; // 1 while the client is in the reactor's list of clients whose queue is sent at the end of the turn
+    struct client_inf* send_next ;
+    struct clients_inf* handover ; // Conversation waiting for the requests of the client to complete, before the client moves to the reactor of the conversation
 } thread_arg ;
 
-// Node used by the linked list
+// Record stored inside the list. It keeps track of its own position, so it can be removed without searching for it
 typedef struct node {
   thread_arg* data ;
-  struct node* next ;
+  int index ; // Position of the record inside the array of the list, -1 before it enters a list. A record taken by a matcher keeps the position it had
 } linkedListNode ;
 
 // A simple thread_safe data structure which will holds the different rooms' clients that are waiting to chat with a random stranger. Can't be allocated statically, and the pointer must be initialized with createANewLinkedList() function defined below
+// The records are kept in a dense array (positions 0 to size-1 are all used): insertion, access by index and removal (swap with the last record and pop) are O(1)
 typedef struct linked_l {
-  linkedListNode* head ;
-  int size ;
+  linkedListNode** records ; // Dense array of the records
+  int size ; // Written atomically under the lock, since peekSizeOfTheList reads it without the lock
+  int capacity ; // Number of positions allocated in records, doubled when they are all used
   pthread_mutex_t semaphore ;
 } linkedList ;
 
@@ -29,20 +96,85 @@ typedef struct linked_l {
 typedef struct clients_inf {
     thread_arg* firstUserInfo; // Holds first user information
     thread_arg* secondUserInfo; // Holds second user information
-    linkedList* waitlist; // Holds the waitlist in which put the clients when conversation has ended
+    struct room_inf* room; // Holds the room whose waitlist gets the clients when conversation has ended
+    struct reactor_inf* reactor; // The reactor which serves the conversation, both users are moved to it before it starts
+    struct clients_inf* next; // Used by the reactor mailbox, which queues the conversations matched but not started yet
 } conversation_thread_arg ;
 
+// Pool of objects of the same size, allocated in slabs of POOL_SLAB_OBJECTS and never given back to the heap.
+// Every thread keeps a cache of free objects and exchanges them with the pool POOL_CACHE_OBJECTS/2 at a time, so most requests take no lock at all
+typedef struct object_p {
+  const char* name ;
+  size_t object_size ; // Rounded up so that every object of a slab stays aligned
+  int id ; // Position of the thread caches of this pool, less than POOL_COUNT
+  pthread_mutex_t semaphore ;
+  void* free_objects ; // Objects given back by the thread caches, linked through their first bytes
+  int n_free ; // Objects inside free_objects
+  void* slabs ; // Every slab allocated, linked through their first bytes
+  long n_slabs ;
+  long n_objects ; // Objects allocated in slabs, free or in use
+  long n_refills ; // Times a thread cache took objects from the pool
+  long n_flushes ; // Times a thread cache gave objects back to the pool
+  struct pool_c* caches ; // The caches of every running thread which used the pool, where gets and puts are counted
+  long retired_gets ; // Gets and puts counted by the caches of the threads ended
+  long retired_puts ;
+} objectPool ;
+
+// Usage of a pool
+typedef struct pool_s {
+  long n_slabs ;
+  long n_objects ;
+  long objects_in_use ;
+  long objects_free ; // Only those inside the pool, not the ones cached by the threads
+  long n_refills ;
+  long n_flushes ;
+  long n_gets ;
+  long n_puts ;
+} poolStats ;
+
+// Pools of the records allocated and released at every state change: on accept, enqueue and match
+extern objectPool client_pool ; // thread_arg
+extern objectPool node_pool ; // linkedListNode
+extern objectPool conversation_pool ; // conversation_thread_arg
+// Pools of the buffers lent to the connections only while they have bytes to hold, one for each size class. See buffer_get
+extern objectPool buffer_pools[BUFFER_CLASSES];
+
+// POOL FUNCTIONS
+// Returns a free object of the pool, or NULL if a new slab can't be allocated. The content of the object is undefined. Thread safe.
+void* pool_get(objectPool* pool);
+// Gives back an object taken with pool_get from the same pool. Thread safe.
+void pool_put(objectPool* pool, void* object);
+// Fills *stats with the usage of the pool. Thread safe.
+void pool_stats(objectPool* pool, poolStats* stats);
+// Prints the usage of the pool on the standard output. Thread safe.
+void print_pool_stats(objectPool* pool);
+
+// BUFFER FUNCTIONS
+// Lends a buffer of at least size bytes, from the pool of the smallest class holding them, and stores its real size in *capacity.
+// Sizes beyond the largest class come from the heap. Returns NULL if there's no memory. Thread safe.
+char* buffer_get(int size, int* capacity);
+// Gives back a buffer lent by buffer_get, with the capacity it had. Does nothing with NULL. Thread safe.
+void buffer_put(char* buffer, int capacity);
+
 // LIST FUNCTIONS
 // Initializes the list like a default constructor would, allocating the needed resources. To be called one time, only when we declare and allocate a linked list to avoid seg_fault
 linkedList* createANewLinkedList();
-// Insert on top of the list the new node. Thread safe.
-void insert_element(linkedListNode* record, linkedList* list);
-// Removes the record from the list if present. Thread safe.
-void remove_element(linkedListNode* record, linkedList* list);
-// Access to the ith element of the linkedList. If index is bigger than the dimension or smaller than zero, it returns NULL. Thread Safe.
+// Insert at the end of the list the new node. Returns -1 if the list can't grow, 0 otherwise. O(1) amortized. Thread safe.
+int insert_element(linkedListNode* record, linkedList* list);
+// Removes the record from the list and gives it back to node_pool, if the record is inside the list and still holds data. Returns -1 if it's not, 0 otherwise. O(1). Thread safe.
+// A record taken by a matcher is not inside the list, and once the matcher gives it back to node_pool it may hold another client
+int remove_element(linkedListNode* record, thread_arg* data, linkedList* list);
+// Access to the ith element of the linkedList. If index is bigger than the dimension or smaller than zero, it returns NULL. O(1). Thread Safe.
 linkedListNode* accessByIndex(int index, linkedList* list);
 // Returns the size of a list. Thread safe.
 int sizeOfTheList(linkedList* list);
+// Returns the size of a list without locking it, so the value may be a little old. Thread safe, never waits for the threads using the list.
+int peekSizeOfTheList(linkedList* list);
+// Exchanges the array of the list with *records, whose allocated positions are *capacity, leaving the list empty. The records are handed to the caller in O(1).
+// Returns the number of records taken, -1 in case of error. Thread safe.
+int takeAllElements(linkedList* list, linkedListNode*** records, int* capacity);
+// Puts back at the end of the list n_records records taken with takeAllElements. Unlike insert_element it doesn't wake up the matcher. Returns -1 if the list can't grow, 0 otherwise. Thread safe.
+int giveBackElements(linkedList* list, linkedListNode** records, int n_records);
 // Like an object oriented destructor
 void destroy_list(linkedList* list);
 
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE // Needed for the GNU strerror_r
+#include<unistd.h>
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<strings.h>
+#include<errno.h>
+#include<pthread.h>
+#include<time.h>
+#include "Log.h"
+#include "Parser.h"
+
+#define LOG_RING_RECORDS 4096 // Slots of the ring, a power of two
+#define LOG_FLUSH_INTERVAL_MS 10 // How long the flusher sleeps when the ring is empty
+#define LOG_OUTPUT_SIZE (64*1024) // The flusher formats many records before a single write
+#define LOG_OUTPUT_RECORDS 4096 // Max records formatted before a write
+#define LOG_DEFAULT_LEVEL LOG_INFO
+
+// Level, sampling and name of an event. With sample_every = n only one event out of n is logged
+typedef struct log_d {
+  const char* name ;
+  logLevel level ;
+  unsigned int sample_every ;
+} logEventInfo ;
+
+static logEventInfo event_info[LOG_EVENT_COUNT] = {
+  [LOG_CLIENT_CONNECTED] = { "CLIENT_CONNECTED", LOG_INFO, 1 },
+  [LOG_CLIENT_REQUEST] = { "CLIENT_REQUEST", LOG_INFO, 1 },
+  [LOG_REQUEST_REJECTED] = { "REQUEST_REJECTED", LOG_INFO, 1 },
+  [LOG_CLIENT_DISCONNECTED] = { "CLIENT_DISCONNECTED", LOG_INFO, 1 },
+  [LOG_SLOW_CLIENT] = { "SLOW_CLIENT", LOG_WARNING, 1 },
+  [LOG_CLIENT_TIMEOUT] = { "CLIENT_TIMEOUT", LOG_INFO, 1 },
+  [LOG_NEW_MATCH] = { "NEW_MATCH", LOG_INFO, 1 },
+  [LOG_MATCHING_BATCH] = { "MATCHING_BATCH", LOG_INFO, 1 },
+  [LOG_CLIENT_HANDED_OVER] = { "CLIENT_HANDED_OVER", LOG_INFO, 1 },
+  [LOG_SYSTEM_ERROR] = { "SYSTEM_ERROR", LOG_ERROR, 1 },
+  [LOG_BROKEN_PIPE] = { "BROKEN_PIPE", LOG_WARNING, 1 },
+};
+
+// Bounded multi producer single consumer ring. A slot whose sequence equals the position of a producer is free for it,
+// a slot whose sequence equals the position of the flusher plus one holds a record ready to be written
+static logRecord ring[LOG_RING_RECORDS];
+static uint64_t enqueue_position ; // Next position reserved by a producer, advanced with a compare and swap
+static uint64_t dequeue_position ; // Next position read by the flusher, only the flusher uses it
+static uint64_t dropped_records ; // Records the ring had no room for, and records a failing write lost
+static logLevel minimum_level = LOG_DEFAULT_LEVEL ;
+static int stopping ;
+static pthread_t flusher_thread ;
+static int flusher_started ;
+
+// Counts the events seen by each thread, so sampling doesn't share a counter between threads
+static __thread unsigned int sample_counters[LOG_EVENT_COUNT];
+
+// Entrypoint of the thread which formats the records and writes them on the standard output
+static void* flush_log(void* arg);
+// Formats a record at the end of output. Returns the number of bytes written
+static int format_record(const logRecord* record, char* output, int space);
+// Writes the n_records records formatted inside output, the record i ending at ends[i], on the standard output. Short writes and EINTR are retried,
+// while the records a failing write doesn't finish are counted as dropped
+static void write_output(const char* output, const int* ends, int n_records);
+// Applies the configuration found in the environment
+static void read_configuration();
+
+// LOG FUNCTIONS
+// Reads the configuration (RANDOMCHAT_LOG_LEVEL and RANDOMCHAT_LOG_SAMPLING) and starts the flusher thread. Returns -1 in case of error, 0 otherwise
+int log_init(){
+  read_configuration();
+  for (uint64_t i = 0; i < LOG_RING_RECORDS; i++)
+    ring[i].sequence = i ;
+  // What has been printed before the flusher starts must come first
+  fflush(stdout);
+  if (pthread_create(&flusher_thread, NULL, &flush_log, NULL) != 0)
+    return -1;
+  flusher_started = 1 ;
+  return 0;
+}
+
+// Returns a record of the ring reserved for event, or NULL if the event is filtered by level or sampling, or the ring is full. Lock free, thread safe and async signal safe.
+// The record must be filled and then published with log_commit
+logRecord* log_begin(logEvent event){
+  logRecord* record ;
+  uint64_t position, sequence ;
+  struct timespec now ;
+
+  if (event_info[event].level < minimum_level)
+    return NULL;
+  if (event_info[event].sample_every > 1 && sample_counters[event]++ % event_info[event].sample_every != 0)
+    return NULL;
+
+  position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+  while (1) {
+    record = &ring[position & (LOG_RING_RECORDS-1)] ;
+    sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == position){
+      // The slot is free: it's ours if no other producer took the position meanwhile
+      if (__atomic_compare_exchange_n(&enqueue_position, &position, position+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        break;
+    }else if (sequence < position){
+      // The flusher is a whole ring behind: the record is dropped rather than making the caller wait
+      __atomic_fetch_add(&dropped_records, 1, __ATOMIC_RELAXED);
+      return NULL;
+    }else{
+      position = __atomic_load_n(&enqueue_position, __ATOMIC_RELAXED);
+    }
+  }
+
+  clock_gettime(CLOCK_REALTIME, &now);
+  record->timestamp_ns = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec ;
+  record->event = event ;
+  record->level = event_info[event].level ;
+  for (int i = 0; i < LOG_TEXTS; i++)
+    record->texts[i][0] = '\0' ;
+  return record;
+}
+
+// Copies at most len bytes of text, or the whole string if len < 0, inside the string number index of the record
+void log_text(logRecord* record, int index, const char* text, int len){
+  if (text == NULL)
+    return;
+  if (len < 0 || len > LOG_TEXT_SIZE-1)
+    len = strnlen(text, LOG_TEXT_SIZE-1);
+  memcpy(record->texts[index], text, len);
+  record->texts[index][len] = '\0' ;
+}
+
+// Publishes a record obtained with log_begin
+void log_commit(logRecord* record){
+  // The position of the record is its current sequence, the flusher waits for position + 1
+  __atomic_store_n(&record->sequence, record->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Logs an event with up to three strings (NULL if unused) and four numbers in a single call
+void log_event(logEvent event, const char* text0, const char* text1, const char* text2, long number0, long number1, long number2, long number3){
+  logRecord* record = log_begin(event);
+  if (record == NULL)
+    return;
+  log_text(record, 0, text0, -1);
+  log_text(record, 1, text1, -1);
+  log_text(record, 2, text2, -1);
+  record->numbers[0] = number0 ;
+  record->numbers[1] = number1 ;
+  record->numbers[2] = number2 ;
+  record->numbers[3] = number3 ;
+  log_commit(record);
+}
+
+// Number of records dropped so far because the ring was full, or because the standard output failed to take them
+uint64_t log_dropped(){
+  return __atomic_load_n(&dropped_records, __ATOMIC_RELAXED);
+}
+
+// Waits until the flusher has written every record, then stops it. Records logged afterwards are lost
+void log_shutdown(){
+  if (!flusher_started)
+    return;
+  __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(flusher_thread, NULL);
+  flusher_started = 0 ;
+}
+
+// Entrypoint of the thread which formats the records and writes them on the standard output
+static void* flush_log(void* arg){
+
+  static char output[LOG_OUTPUT_SIZE];
+  static int record_ends[LOG_OUTPUT_RECORDS];
+  int output_len = 0, n_records = 0, idle, last_round = 0 ;
+  uint64_t sequence, reported_drops = 0, drops ;
+  logRecord* record ;
+  struct timespec pause = { 0, LOG_FLUSH_INTERVAL_MS * 1000000L };
+
+  (void)arg ;
+  while (1) {
+    idle = 1 ;
+    record = &ring[dequeue_position & (LOG_RING_RECORDS-1)] ;
+    sequence = __atomic_load_n(&record->sequence, __ATOMIC_ACQUIRE);
+    if (sequence == dequeue_position + 1){
+      // Leaves room for the longest record, so a record is never cut
+      if (output_len > LOG_OUTPUT_SIZE - 1024 || n_records == LOG_OUTPUT_RECORDS){
+        write_output(output, record_ends, n_records);
+        output_len = 0 ;
+        n_records = 0 ;
+      }
+      output_len += format_record(record, output + output_len, LOG_OUTPUT_SIZE - output_len);
+      record_ends[n_records++] = output_len ;
+      // The slot goes back to the producers for the next lap of the ring
+      __atomic_store_n(&record->sequence, dequeue_position + LOG_RING_RECORDS, __ATOMIC_RELEASE);
+      dequeue_position++ ;
+      idle = 0 ;
+    }
+
+    if (idle){
+      drops = log_dropped();
+      if (drops != reported_drops && n_records < LOG_OUTPUT_RECORDS){
+        output_len += snprintf(output + output_len, LOG_OUTPUT_SIZE - output_len, "\n-LOG :\nRecords dropped because the log was full or couldn't be written : %lu (%lu since the start)\n", (unsigned long)(drops - reported_drops), (unsigned long)drops);
+        record_ends[n_records++] = output_len ;
+        reported_drops = drops ;
+      }
+      // Nothing more to format: whatever has been formatted goes out now
+      write_output(output, record_ends, n_records);
+      output_len = 0 ;
+      n_records = 0 ;
+      // The ring has been emptied once more after the stop request, so every record logged before it has been written
+      if (last_round)
+        return NULL;
+      if (__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)){
+        last_round = 1 ;
+        continue;
+      }
+      nanosleep(&pause, NULL);
+    }
+  }
+}
+
+// Writes the n_records records formatted inside output, the record i ending at ends[i], on the standard output. Short writes and EINTR are retried,
+// while the records a failing write doesn't finish are counted as dropped
+static void write_output(const char* output, const int* ends, int n_records){
+
+  int len = n_records > 0 ? ends[n_records-1] : 0, written = 0, first_lost = 0 ;
+  ssize_t n_written ;
+
+  while (written < len) {
+    n_written = write(STDOUT_FILENO, output + written, len - written);
+    if (n_written > 0){
+      written += n_written ;
+      continue;
+    }
+    if (n_written < 0 && errno == EINTR)
+      continue;
+    while (ends[first_lost] <= written)
+      first_lost++ ;
+    __atomic_add_fetch(&dropped_records, n_records - first_lost, __ATOMIC_RELAXED);
+    return;
+  }
+}
+
+// Formats a record at the end of output. Returns the number of bytes written
+static int format_record(const logRecord* record, char* output, int space){
+
+  char time_string[16], error_string[128];
+  const char* rejection ;
+  const long* n = record->numbers ;
+  const char (*t)[LOG_TEXT_SIZE] = record->texts ;
+  time_t seconds = record->timestamp_ns / 1000000000ULL ;
+  struct tm local_time ;
+  int len ;
+
+  localtime_r(&seconds, &local_time);
+  len = strftime(time_string, sizeof(time_string), "%H:%M:%S", &local_time);
+  snprintf(time_string + len, sizeof(time_string) - len, ".%03d", (int)(record->timestamp_ns / 1000000ULL % 1000));
+
+  switch (record->event) {
+    case LOG_CLIENT_CONNECTED:
+      return snprintf(output, space, "\n-NEW CLIENT CONNECTED (%s) :\nSocket Descriptor : %ld\nIP ADDRESS : %s\n", time_string, n[0], t[0]);
+    case LOG_CLIENT_REQUEST:
+      return snprintf(output, space, "\n-NEW REQUEST FROM CLIENT (%s) :\nNickname : %s\nSocket Descriptor : %ld\nIP ADDRESS : %s\nRequest : %s\n", time_string, t[0], n[0], t[1], t[2]);
+    case LOG_REQUEST_REJECTED:
+      if (n[0] == REQUEST_INVALID)
+        rejection = "because of the wrong syntax !" ;
+      else if (n[0] == REQUEST_NO_ROOM)
+        rejection = "because there's no room with such name" ;
+      else
+        rejection = "! No command found !" ;
+      return snprintf(output, space, "The request can't be executed by the server %s\n", rejection);
+    case LOG_CLIENT_DISCONNECTED:
+      return snprintf(output, space, "\n-A CLIENT DISCONNECTED (%s) :\nNickname : %s\nSocket Descriptor : %ld\nIP ADDRESS : %s\n", time_string, t[0], n[0], t[1]);
+    case LOG_SLOW_CLIENT:
+      return snprintf(output, space, "\n-A CLIENT IS TOO SLOW (%s) :\nNickname : %s\nSocket Descriptor : %ld\nIP ADDRESS : %s\nReason : %s\n", time_string, t[0], n[0], t[1], t[2]);
+    case LOG_CLIENT_TIMEOUT:
+      return snprintf(output, space, "\n-A CLIENT TIMED OUT (%s) :\nNickname : %s\nSocket Descriptor : %ld\nIP ADDRESS : %s\nTimeout : %s\n", time_string, t[0], n[0], t[1], t[2]);
+    case LOG_NEW_MATCH:
+      return snprintf(output, space, "\n-NEW MATCH (%s) :\nFirst user : %s (waited %ld ms)\nSecond user : %s (waited %ld ms)\nLongest wait in this room : %ld ms\n", time_string, t[0], n[0], t[1], n[1], n[2]);
+    case LOG_MATCHING_BATCH:
+      return snprintf(output, space, "\n-MATCHING BATCH (%s) :\nUsers in the batch : %ld\nPairs formed : %ld\nUsers left waiting : %ld\nPairs per batch : %.2f on average, %ld at most (%ld batches)\n", time_string, n[0], n[1], n[2], n[4] > 0 ? (double)n[3]/n[4] : 0.0, n[5], n[4]);
+    case LOG_CLIENT_HANDED_OVER:
+      return snprintf(output, space, "\n-A CLIENT MOVED TO ANOTHER SHARD (%s) :\nNickname : %s\nSocket Descriptor : %ld\nIP ADDRESS : %s\nRoom : %s (shard %ld)\n", time_string, t[0], n[0], t[1], t[2], n[1]);
+    case LOG_SYSTEM_ERROR:
+      return snprintf(output, space, "Error %s : %s (%s)\n", t[0], strerror_r((int)n[0], error_string, sizeof(error_string)), time_string);
+    case LOG_BROKEN_PIPE:
+      return snprintf(output, space, "Error trying to send response to the client... (%s)\n\n", time_string);
+  }
+  return 0;
+}
+
+// Applies the configuration found in the environment.
+// RANDOMCHAT_LOG_LEVEL is one of debug, info, warning, error or off. RANDOMCHAT_LOG_SAMPLING is a list like NEW_MATCH=100,CLIENT_REQUEST=10
+static void read_configuration(){
+
+  const char* level_names[] = { "debug", "info", "warning", "error", "off" };
+  char sampling[256];
+  char *rule, *save_pointer, *equal ;
+  const char* value ;
+
+  if ((value = getenv("RANDOMCHAT_LOG_LEVEL")) != NULL){
+    for (int i = LOG_DEBUG; i <= LOG_OFF; i++) {
+      if (strcasecmp(value, level_names[i]) == 0)
+        minimum_level = (logLevel)i ;
+    }
+  }
+
+  if ((value = getenv("RANDOMCHAT_LOG_SAMPLING")) != NULL){
+    strncpy(sampling, value, sizeof(sampling)-1);
+    sampling[sizeof(sampling)-1] = '\0' ;
+    for (rule = strtok_r(sampling, ",", &save_pointer); rule != NULL; rule = strtok_r(NULL, ",", &save_pointer)) {
+      if ((equal = strchr(rule, '=')) == NULL)
+        continue;
+      *equal = '\0' ;
+      for (int i = 0; i < LOG_EVENT_COUNT; i++) {
+        if (strcasecmp(rule, event_info[i].name) == 0 && atoi(equal+1) > 0)
+          event_info[i].sample_every = atoi(equal+1) ;
+      }
+    }
+  }
+}
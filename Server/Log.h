@@ -0,0 +1,61 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include<stdint.h>
+
+#define LOG_TEXTS 3 // Strings carried by a record
+#define LOG_TEXT_SIZE 48 // Bytes of each string, longer strings are cut
+#define LOG_NUMBERS 6 // Numbers carried by a record
+
+typedef enum log_l {
+    LOG_DEBUG,
+    LOG_INFO,
+    LOG_WARNING,
+    LOG_ERROR,
+    LOG_OFF // Used only as minimum level, to turn the log off
+} logLevel ;
+
+// Events the server logs. Each one has its own level, sampling rate and output format, see the table inside Log.c
+typedef enum log_e {
+    LOG_CLIENT_CONNECTED, // text: IP address. numbers: socket descriptor
+    LOG_CLIENT_REQUEST, // text: nickname, IP address, request. numbers: socket descriptor
+    LOG_REQUEST_REJECTED, // numbers: the request_type which can't be executed
+    LOG_CLIENT_DISCONNECTED, // text: nickname, IP address. numbers: socket descriptor
+    LOG_SLOW_CLIENT, // text: nickname, IP address, reason. numbers: socket descriptor
+    LOG_CLIENT_TIMEOUT, // text: nickname, IP address, which timeout expired. numbers: socket descriptor
+    LOG_NEW_MATCH, // text: the two nicknames. numbers: their waits and the longest wait of the room, in ms
+    LOG_MATCHING_BATCH, // numbers: users in the batch, pairs formed, users left, pairs since the start, batches since the start, most pairs in a batch
+    LOG_CLIENT_HANDED_OVER, // text: nickname, IP address, room. numbers: socket descriptor, shard owning the room
+    LOG_SYSTEM_ERROR, // text: what failed. numbers: errno
+    LOG_BROKEN_PIPE, // No data: a write hit a closed connection
+    LOG_EVENT_COUNT
+} logEvent ;
+
+// Binary record stored inside the ring. Strings are copied, everything else is formatted by the flusher thread
+typedef struct log_r {
+    uint64_t sequence ; // Tells producers and the flusher whose turn it is to use the slot
+    uint64_t timestamp_ns ; // CLOCK_REALTIME
+    uint16_t event ;
+    uint8_t level ;
+    long numbers[LOG_NUMBERS];
+    char texts[LOG_TEXTS][LOG_TEXT_SIZE];
+} logRecord ;
+
+// LOG FUNCTIONS
+// Reads the configuration (RANDOMCHAT_LOG_LEVEL and RANDOMCHAT_LOG_SAMPLING) and starts the flusher thread. Returns -1 in case of error, 0 otherwise
+int log_init();
+// Returns a record of the ring reserved for event, or NULL if the event is filtered by level or sampling, or the ring is full. Lock free, thread safe and async signal safe.
+// The record must be filled and then published with log_commit
+logRecord* log_begin(logEvent event);
+// Copies at most len bytes of text, or the whole string if len < 0, inside the string number index of the record
+void log_text(logRecord* record, int index, const char* text, int len);
+// Publishes a record obtained with log_begin
+void log_commit(logRecord* record);
+// Logs an event with up to three strings (NULL if unused) and four numbers in a single call
+void log_event(logEvent event, const char* text0, const char* text1, const char* text2, long number0, long number1, long number2, long number3);
+// Number of records dropped so far because the ring was full, or because the standard output failed to take them
+uint64_t log_dropped();
+// Waits until the flusher has written every record, then stops it. Records logged afterwards are lost
+void log_shutdown();
+
+#endif
@@ -0,0 +1,147 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include "Metrics.h"
+
+const metricInfo metric_info[METRIC_COUNT] = {
+  [METRIC_ACCEPTS] = { "randomchat_accepts_total", "Connections accepted" },
+  [METRIC_DISCONNECTS] = { "randomchat_disconnects_total", "Connections closed" },
+  [METRIC_REQUESTS] = { "randomchat_requests_total", "Requests served in the lobby" },
+  [METRIC_MATCHES] = { "randomchat_matches_total", "Conversations started" },
+  [METRIC_CONVERSATIONS_ENDED] = { "randomchat_conversations_ended_total", "Conversations ended by STOP, REROLL or a disconnection" },
+  [METRIC_MESSAGES_RELAYED] = { "randomchat_messages_relayed_total", "Chat lines and pastes relayed to a partner" },
+  [METRIC_BYTES_IN] = { "randomchat_bytes_in_total", "Bytes read from the clients" },
+  [METRIC_BYTES_OUT] = { "randomchat_bytes_out_total", "Bytes written to the clients" },
+  [METRIC_HANDSHAKE_TIMEOUTS] = { "randomchat_handshake_timeouts_total", "Clients disconnected because they didn't choose a nickname in time" },
+  [METRIC_IDLE_TIMEOUTS] = { "randomchat_idle_timeouts_total", "Clients which sent nothing for too long" },
+  [METRIC_WAITING_TIMEOUTS] = { "randomchat_waiting_timeouts_total", "Users sent back to the lobby because nobody was paired with them in time" },
+  [METRIC_HEARTBEATS] = { "randomchat_heartbeats_total", "Heartbeats sent to silent clients" },
+  [METRIC_WAITING_HANGUPS] = { "randomchat_waiting_hangups_total", "Users who closed their connection while waiting for a match" },
+  [METRIC_IO_SYSCALLS] = { "randomchat_io_syscalls_total", "System calls of the reactors waiting for events, accepting, reading and writing the connections" },
+  [METRIC_BUFFER_BYTES_LENT] = { "randomchat_buffer_bytes_lent_total", "Bytes of the buffers lent to the connections" },
+  [METRIC_BUFFER_BYTES_RETURNED] = { "randomchat_buffer_bytes_returned_total", "Bytes of the buffers given back by the connections" },
+  [METRIC_TASKS_RUN] = { "randomchat_tasks_run_total", "Tasks run by the workers, one for every matching round of a room" },
+  [METRIC_TASKS_STOLEN] = { "randomchat_tasks_stolen_total", "Tasks a worker took from the deque of another one" },
+  [METRIC_MIGRATIONS] = { "randomchat_migrations_total", "Users moved to the reactor of their conversation" },
+  [METRIC_SHARD_HANDOVERS_SENT] = { "randomchat_shard_handovers_sent_total", "Connections handed over to the shard owning the room they asked for" },
+  [METRIC_SHARD_HANDOVERS_RECEIVED] = { "randomchat_shard_handovers_received_total", "Connections handed over by another shard" },
+};
+
+const metricInfo histogram_info[HISTOGRAM_COUNT] = {
+  [HISTOGRAM_MATCH_LATENCY] = { "randomchat_match_latency_seconds", "Time spent in the waitlist before being matched" },
+  [HISTOGRAM_RELAY_LATENCY] = { "randomchat_relay_latency_seconds", "Time from reading chat lines to writing them on the partner's socket" },
+  [HISTOGRAM_MIGRATION_LATENCY] = { "randomchat_migration_latency_seconds", "Time from a user leaving its reactor to being served by the reactor of its conversation" },
+};
+
+__thread metricsShard* metrics_local_shard = NULL ;
+
+static metricsShard shards[METRICS_MAX_SHARDS];
+static int n_shards ; // Shards given to a thread so far, may go beyond METRICS_MAX_SHARDS
+static int n_rooms ;
+static const char* room_names[METRICS_MAX_ROOMS];
+static linkedList* room_waitlists[METRICS_MAX_ROOMS];
+static hdrHistogram* room_histograms[METRICS_MAX_ROOMS][HISTOGRAM_COUNT];
+static struct timespec start_time ; // Set by the first registration of a thread, before any counter is updated
+
+// Order in which the counters are read by metrics_snapshot: the ones subtracted from another counter come first.
+// A disconnection is always counted after its accept, the end of a conversation after its match and a buffer given back after it was lent, so the later reads can't miss them
+static const metricId read_order[METRIC_COUNT] = {
+  METRIC_DISCONNECTS, METRIC_CONVERSATIONS_ENDED, METRIC_BUFFER_BYTES_RETURNED, METRIC_ACCEPTS, METRIC_MATCHES, METRIC_BUFFER_BYTES_LENT,
+  METRIC_REQUESTS, METRIC_MESSAGES_RELAYED, METRIC_BYTES_IN, METRIC_BYTES_OUT,
+  METRIC_HANDSHAKE_TIMEOUTS, METRIC_IDLE_TIMEOUTS, METRIC_WAITING_TIMEOUTS, METRIC_HEARTBEATS, METRIC_WAITING_HANGUPS,
+  METRIC_IO_SYSCALLS, METRIC_TASKS_RUN, METRIC_TASKS_STOLEN, METRIC_MIGRATIONS,
+  METRIC_SHARD_HANDOVERS_SENT, METRIC_SHARD_HANDOVERS_RECEIVED
+};
+
+// METRICS FUNCTIONS
+// Gives a shard to the running thread. Thread safe
+metricsShard* metrics_register_thread(){
+  int index = __atomic_fetch_add(&n_shards, 1, __ATOMIC_ACQ_REL);
+  if (index == 0)
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+  if (index >= METRICS_MAX_SHARDS-1){
+    // The last shard is shared by every thread which didn't get one of its own
+    index = METRICS_MAX_SHARDS-1 ;
+    __atomic_store_n(&shards[index].shared, 1, __ATOMIC_RELEASE);
+  }
+  metrics_local_shard = &shards[index] ;
+  return metrics_local_shard;
+}
+
+// Adds a room to the snapshots and allocates its histograms. Returns the position of the room, which identifies it in the other calls,
+// or -1 if there are already METRICS_MAX_ROOMS rooms or in case of error. To be called before the threads of the server start
+int metrics_register_room(const char* name, linkedList* waitlist){
+  if (n_rooms == METRICS_MAX_ROOMS)
+    return -1;
+  for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+    if ((room_histograms[n_rooms][h] = hdr_create()) == NULL){
+      while (h-- > 0)
+        free(room_histograms[n_rooms][h]);
+      return -1;
+    }
+  }
+  room_names[n_rooms] = name ;
+  room_waitlists[n_rooms] = waitlist ;
+  return n_rooms++;
+}
+
+// Fills *snapshot with the current value of every metric. Takes no lock and never slows down the threads updating the counters
+void metrics_snapshot(metricsSnapshot* snapshot){
+  int used_shards = __atomic_load_n(&n_shards, __ATOMIC_ACQUIRE);
+  if (used_shards > METRICS_MAX_SHARDS)
+    used_shards = METRICS_MAX_SHARDS ;
+
+  clock_gettime(CLOCK_MONOTONIC, &snapshot->taken_at);
+  snapshot->uptime_s = used_shards > 0 ? (snapshot->taken_at.tv_sec - start_time.tv_sec) + (snapshot->taken_at.tv_nsec - start_time.tv_nsec) / 1e9 : 0 ;
+
+  for (int i = 0; i < METRIC_COUNT; i++) {
+    metricId id = read_order[i] ;
+    snapshot->counters[id] = 0 ;
+    for (int s = 0; s < used_shards; s++)
+      snapshot->counters[id] += __atomic_load_n(&shards[s].values[id], __ATOMIC_ACQUIRE);
+  }
+  snapshot->users_connected = (long)(snapshot->counters[METRIC_ACCEPTS] - snapshot->counters[METRIC_DISCONNECTS]) ;
+  snapshot->active_chats = (long)(snapshot->counters[METRIC_MATCHES] - snapshot->counters[METRIC_CONVERSATIONS_ENDED]) ;
+  snapshot->buffer_bytes_in_use = (long)(snapshot->counters[METRIC_BUFFER_BYTES_LENT] - snapshot->counters[METRIC_BUFFER_BYTES_RETURNED]) ;
+
+  snapshot->n_rooms = n_rooms ;
+  for (int r = 0; r < n_rooms; r++) {
+    snapshot->room_names[r] = room_names[r] ;
+    snapshot->room_waiting[r] = peekSizeOfTheList(room_waitlists[r]);
+  }
+}
+
+// Per second rate of a counter between two snapshots
+double metrics_rate(const metricsSnapshot* from, const metricsSnapshot* to, metricId id){
+  double seconds = (to->taken_at.tv_sec - from->taken_at.tv_sec) + (to->taken_at.tv_nsec - from->taken_at.tv_nsec) / 1e9 ;
+  if (seconds <= 0)
+    return 0;
+  return (double)(to->counters[id] - from->counters[id]) / seconds ;
+}
+
+// Histogram of a room, to be copied with hdr_copy before reading it. NULL if the room doesn't exist
+hdrHistogram* metrics_histogram(histogramId id, int room){
+  if (room < 0 || room >= n_rooms)
+    return NULL;
+  return room_histograms[room][id];
+}
+
+// Records a latency of value_us microseconds in the histogram of a room. Lock free and thread safe
+void metrics_observe(histogramId id, int room, uint64_t value_us){
+  if (room >= 0 && room < n_rooms)
+    hdr_record(room_histograms[room][id], value_us);
+}
+
+// Prints count, mean, p50, p99, p99.9 and max of every histogram of every room on the standard output
+void print_latency_histograms(){
+  static const char* titles[HISTOGRAM_COUNT] = { "MATCH LATENCY", "RELAY LATENCY", "MIGRATION LATENCY" };
+  hdrHistogram copy ;
+  for (int r = 0; r < n_rooms; r++) {
+    for (int h = 0; h < HISTOGRAM_COUNT; h++) {
+      hdr_copy(room_histograms[r][h], &copy);
+      printf("\n-%s \"%s\" (ms) :\nCount : %llu, mean : %.3f\np50 : %.3f, p99 : %.3f, p99.9 : %.3f, max : %.3f\n", titles[h], room_names[r],
+             (unsigned long long)copy.total, copy.total > 0 ? copy.sum / 1e3 / copy.total : 0,
+             hdr_value_at_percentile(&copy, 50) / 1e3, hdr_value_at_percentile(&copy, 99) / 1e3, hdr_value_at_percentile(&copy, 99.9) / 1e3, copy.max / 1e3);
+    }
+  }
+  fflush(stdout);
+}
@@ -0,0 +1,106 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include<stdint.h>
+#include<time.h>
+#include "List.h"
+#include "Rooms.h"
+#include "../Common/Histogram.h"
+
+#define METRICS_MAX_SHARDS 64 // Threads with a shard of their own. Any further thread shares the last one
+#define METRICS_MAX_ROOMS ROOMS_MAX // Rooms whose waitlist is part of the snapshot
+
+// Counters of the server. They only grow: the gauges are differences between two of them, see metricsSnapshot
+typedef enum metric_i {
+    METRIC_ACCEPTS, // Connections accepted
+    METRIC_DISCONNECTS, // Connections closed
+    METRIC_REQUESTS, // Requests served in the lobby
+    METRIC_MATCHES, // Conversations started by the matchers
+    METRIC_CONVERSATIONS_ENDED, // Conversations ended by STOP, REROLL or a disconnection
+    METRIC_MESSAGES_RELAYED, // Chat lines, or pastes, relayed to a partner
+    METRIC_BYTES_IN, // Bytes read from the clients
+    METRIC_BYTES_OUT, // Bytes written to the clients
+    METRIC_HANDSHAKE_TIMEOUTS, // Clients disconnected because they didn't choose a nickname in time
+    METRIC_IDLE_TIMEOUTS, // Clients which sent nothing for too long: taken out of their conversation, or disconnected from the lobby
+    METRIC_WAITING_TIMEOUTS, // Users sent back to the lobby because nobody was paired with them in time
+    METRIC_HEARTBEATS, // Heartbeats sent to silent clients
+    METRIC_WAITING_HANGUPS, // Users who closed their connection while waiting for a match
+    METRIC_IO_SYSCALLS, // System calls of the reactors waiting for events, accepting, reading and writing the connections
+    METRIC_BUFFER_BYTES_LENT, // Bytes of the buffers lent to the connections
+    METRIC_BUFFER_BYTES_RETURNED, // Bytes of the buffers given back by the connections
+    METRIC_TASKS_RUN, // Tasks run by the workers, one for every matching round of a room
+    METRIC_TASKS_STOLEN, // Tasks a worker took from the deque of another one
+    METRIC_MIGRATIONS, // Users moved to the reactor of their conversation
+    METRIC_SHARD_HANDOVERS_SENT, // Connections handed over to the shard owning the room they asked for
+    METRIC_SHARD_HANDOVERS_RECEIVED, // Connections handed over by another shard
+    METRIC_COUNT
+} metricId ;
+
+// Latencies recorded in a histogram of each room, in microseconds
+typedef enum histogram_i {
+    HISTOGRAM_MATCH_LATENCY, // Time spent in the waitlist before being matched
+    HISTOGRAM_RELAY_LATENCY, // Time from reading chat lines to writing them on the partner's socket
+    HISTOGRAM_MIGRATION_LATENCY, // Time from a user leaving its reactor to being served by the reactor of its conversation
+    HISTOGRAM_COUNT
+} histogramId ;
+
+// Counters written by a single thread, on their own cache lines so that threads never write the same line
+typedef struct metrics_sh {
+    uint64_t values[METRIC_COUNT];
+    int shared ; // 1 for the shard used by the threads beyond METRICS_MAX_SHARDS, which must update it atomically
+} __attribute__((aligned(64))) metricsShard ;
+
+// Name and description of a metric, for the exporters
+typedef struct metric_inf {
+    const char* name ;
+    const char* help ;
+} metricInfo ;
+
+// Values of every metric at a given time. A counter is always read after the counters that are subtracted from it,
+// so users_connected and active_chats are never negative, even if the snapshot is taken while the other threads update them
+typedef struct metrics_sn {
+    struct timespec taken_at ; // CLOCK_MONOTONIC
+    double uptime_s ;
+    uint64_t counters[METRIC_COUNT];
+    long users_connected ; // accepts - disconnects
+    long active_chats ; // matches - conversations ended
+    long buffer_bytes_in_use ; // buffer bytes lent - returned: what the connections hold beyond their records
+    int n_rooms ;
+    const char* room_names[METRICS_MAX_ROOMS];
+    int room_waiting[METRICS_MAX_ROOMS]; // Users inside the waitlist of each room
+} metricsSnapshot ;
+
+extern const metricInfo metric_info[METRIC_COUNT];
+extern const metricInfo histogram_info[HISTOGRAM_COUNT];
+// Shard of the running thread, NULL until the thread updates its first counter
+extern __thread metricsShard* metrics_local_shard ;
+
+// METRICS FUNCTIONS
+// Gives a shard to the running thread. Thread safe
+metricsShard* metrics_register_thread();
+// Adds a room to the snapshots and allocates its histograms. Returns the position of the room, which identifies it in the other calls,
+// or -1 if there are already METRICS_MAX_ROOMS rooms or in case of error. To be called before the threads of the server start
+int metrics_register_room(const char* name, linkedList* waitlist);
+// Histogram of a room, to be copied with hdr_copy before reading it. NULL if the room doesn't exist
+hdrHistogram* metrics_histogram(histogramId id, int room);
+// Records a latency of value_us microseconds in the histogram of a room. Lock free and thread safe
+void metrics_observe(histogramId id, int room, uint64_t value_us);
+// Prints count, mean, p50, p99, p99.9 and max of every histogram of every room on the standard output
+void print_latency_histograms();
+// Fills *snapshot with the current value of every metric. Takes no lock and never slows down the threads updating the counters
+void metrics_snapshot(metricsSnapshot* snapshot);
+// Per second rate of a counter between two snapshots
+double metrics_rate(const metricsSnapshot* from, const metricsSnapshot* to, metricId id);
+
+// Adds n to a counter. Lock free: each thread only writes its own shard
+static inline void metrics_add(metricId id, uint64_t n){
+  metricsShard* shard = metrics_local_shard ;
+  if (shard == NULL)
+    shard = metrics_register_thread();
+  if (shard->shared)
+    __atomic_fetch_add(&shard->values[id], n, __ATOMIC_RELEASE);
+  else
+    __atomic_store_n(&shard->values[id], shard->values[id] + n, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,75 @@
+#include<string.h>
+#include "Parser.h"
+
+#define MAX_VERB_LEN 8 // Length of the longest verb, NICKNAME
+
+// Matches the argument of a command without verb, //command:<...>. Length and first char tell every known command apart, so a single memcmp confirms it
+static request_type match_command(const char* arg, int arg_len){
+  switch (arg_len) {
+    case 4:
+      if (arg[0] == 'H' && memcmp(arg, "HELP", 4) == 0)
+        return REQUEST_HELP;
+      if (arg[0] == 'S' && memcmp(arg, "STOP", 4) == 0)
+        return REQUEST_STOP;
+      break;
+    case 5:
+      if (arg[0] == 'U' && memcmp(arg, "USERS", 5) == 0)
+        return REQUEST_USERS;
+      if (arg[0] == 'R' && memcmp(arg, "ROOMS", 5) == 0)
+        return REQUEST_ROOMS;
+      break;
+    case 6:
+      if (memcmp(arg, "REROLL", 6) == 0)
+        return REQUEST_REROLL;
+      break;
+  }
+  return REQUEST_UNKNOWN;
+}
+
+// PARSER FUNCTIONS
+// Parses a line of len bytes, with or without its newline. The line doesn't need to be terminated by '\0'.
+// A line which doesn't start with //command: is rejected after the first bytes. The argument between '<' and '>' is returned in *arg and *arg_len when they are not NULL
+request_type parse_request(const char* line, int len, const char** arg, int* arg_len){
+
+  const char *verb, *less, *major ;
+  int verb_len, argument_len ;
+
+  // Chat lines almost never start with "//", so they are rejected by the first comparison
+  if (len < COMMAND_PREFIX_LEN + 2 || line[0] != '/' || line[1] != '/' || memcmp(line, COMMAND_PREFIX, COMMAND_PREFIX_LEN) != 0)
+    return REQUEST_INVALID;
+  // The newline is not part of the request
+  if (line[len-1] == '\n')
+    len-- ;
+
+  // The verb is at most MAX_VERB_LEN chars long, so '<' is searched only there
+  verb = line + COMMAND_PREFIX_LEN ;
+  less = memchr(verb, '<', len - COMMAND_PREFIX_LEN < MAX_VERB_LEN + 1 ? len - COMMAND_PREFIX_LEN : MAX_VERB_LEN + 1);
+  if (less == NULL)
+    return REQUEST_INVALID;
+  verb_len = less - verb ;
+  // '>' must be the last char of the request
+  major = line + len - 1 ;
+  if (*major != '>' || major <= less || memchr(less + 1, '>', major - less - 1) != NULL)
+    return REQUEST_INVALID;
+  argument_len = major - less - 1 ;
+
+  if (arg != NULL)
+    *arg = less + 1 ;
+  if (arg_len != NULL)
+    *arg_len = argument_len ;
+
+  switch (verb_len) {
+    case 0:
+      return match_command(less + 1, argument_len);
+    case 5:
+      // The room is looked up by the server, inside the registry of the rooms
+      if (memcmp(verb, "START", 5) == 0)
+        return REQUEST_START;
+      break;
+    case 8:
+      if (memcmp(verb, "NICKNAME", 8) == 0)
+        return REQUEST_NICKNAME;
+      break;
+  }
+  return REQUEST_INVALID;
+}
@@ -0,0 +1,26 @@
+#ifndef PARSER_H
+#define PARSER_H
+
+#define COMMAND_PREFIX "//command:"
+#define COMMAND_PREFIX_LEN 10
+
+// Types of request, with the same values returned by the old parse_client_request. The rooms are not known by the parser: every START is REQUEST_START
+typedef enum request_t {
+    REQUEST_NO_ROOM = -2, // //command:START<...> with a room which doesn't exist, found by the server looking for the room
+    REQUEST_INVALID = -1, // Not a command, or a command with the wrong syntax
+    REQUEST_UNKNOWN = 0, // //command:<...> with a command which doesn't exist
+    REQUEST_USERS = 1, // //command:<USERS>
+    REQUEST_START = 2, // //command:START<room name>, the argument is the name of the room
+    REQUEST_REROLL = 5, // //command:<REROLL>
+    REQUEST_STOP = 6, // //command:<STOP>
+    REQUEST_ROOMS = 7, // //command:<ROOMS>
+    REQUEST_HELP = 8, // //command:<HELP>
+    REQUEST_NICKNAME = 9 // //command:NICKNAME<nickname>
+} request_type ;
+
+// PARSER FUNCTIONS
+// Parses a line of len bytes, with or without its newline. The line doesn't need to be terminated by '\0'.
+// A line which doesn't start with //command: is rejected after the first bytes. The argument between '<' and '>' is returned in *arg and *arg_len when they are not NULL
+request_type parse_request(const char* line, int len, const char** arg, int* arg_len);
+
+#endif
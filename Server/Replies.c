@@ -0,0 +1,27 @@
+#include "Replies.h"
+
+// Every reply is laid out at compile time: the server never formats them nor measures them
+
+const replyFragment reply_wrong_syntax = REPLY_FRAGMENT("\nThe request can't be executed by the server because of the wrong syntax !\nExpected : //command:<...> OR //command:START<room name>\n");
+const replyFragment reply_no_command = REPLY_FRAGMENT("\nThe request can't be executed by the server ! No command found !\n");
+const replyFragment reply_nickname_first = REPLY_FRAGMENT("\nChoose a nickname before starting a chat : //command:NICKNAME<nickname>\n");
+const replyFragment reply_no_room = REPLY_FRAGMENT("\nThe request can't be executed by the server because there's no room with such name\n");
+const replyFragment reply_help = REPLY_FRAGMENT("--- LISTA DEI COMANDI DISPONIBILI ---\n* Visualizza numero di utenti per ogni stanza a tema             : //command:<USERS> \n* Visualizza quante e quali sono le stanze a tema disponibili    : //command:<ROOMS> \n* Avvia una chat casuale con un altro host all'interno di <room> : //command:START<room name> \n* Terminare immediatamente il programma in esecuzione            : Ctrl+D or Ctrl-C \n\n");
+const replyFragment reply_stopped = REPLY_FRAGMENT("\nYou have closed the conversation and stopped rolling...\n\n***** BENVENUTI IN RANDOMCHAT ! *****\n\n--- Digitare //command:<HELP> per conoscere i comandi disponibili ---\n\n");
+const replyFragment reply_rerolled = REPLY_FRAGMENT("\nConversation is ended ... Looking for someone else ...\nCtrl+C to exit ...\n");
+const replyFragment reply_idle_conversation = REPLY_FRAGMENT("\nYou have been idle for too long, the conversation is closed.\n\n--- Digitare //command:<HELP> per conoscere i comandi disponibili ---\n\n");
+const replyFragment reply_idle_lobby = REPLY_FRAGMENT("\nYou have been idle for too long, the connection is closed.\n");
+const replyFragment reply_no_nickname = REPLY_FRAGMENT("\nNo nickname has been chosen in time, the connection is closed.\n");
+const replyFragment reply_heartbeat = REPLY_FRAGMENT("//command:<HEARTBEAT>\n");
+const replyFragment reply_accept_error = REPLY_FRAGMENT("Error from the server accepting connection, please restart the client !\n");
+
+const replyFragment fragment_nickname_set = REPLY_FRAGMENT("Nickname impostato correttamente come : <");
+const replyFragment fragment_nickname_set_end = REPLY_FRAGMENT(">\n");
+const replyFragment fragment_looking = REPLY_FRAGMENT("\nLooking for someone to chat with in the \"");
+const replyFragment fragment_looking_end = REPLY_FRAGMENT("\" room ...\nCtrl+C to exit ...\n");
+const replyFragment fragment_nobody_came = REPLY_FRAGMENT("\nNobody to chat with in the \"");
+const replyFragment fragment_nobody_came_end = REPLY_FRAGMENT("\" room, you are back in the lobby.\nTry again with //command:START<room name>\n");
+const replyFragment fragment_new_match = REPLY_FRAGMENT("\nA NEW MATCH HAS BEEN FOUND !\n\nPress //command:<STOP> or //command:<REROLL> or Ctrl+C to exit\n\nSAY HI TO : ");
+const replyFragment fragment_new_match_end = REPLY_FRAGMENT("\n\n");
+const replyFragment fragment_partner_left = REPLY_FRAGMENT("\n");
+const replyFragment fragment_partner_left_end = REPLY_FRAGMENT(" has closed the conversation\nLooking for someone else ...\nCtrl+C to exit ...\n");
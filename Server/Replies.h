@@ -0,0 +1,68 @@
+#ifndef REPLIES_H
+#define REPLIES_H
+
+#include<sys/uio.h>
+
+#define REPLY_MAX_FRAGMENTS 8 // Fragments of a reply assembled by a replyBuilder
+
+// A constant reply, or a constant fragment of a reply, whose length is known at compile time
+typedef struct reply_f {
+    const char* text ;
+    int len ;
+} replyFragment ;
+
+// Initializer of a replyFragment from a string literal
+#define REPLY_FRAGMENT(literal) { literal, sizeof(literal)-1 }
+
+// A reply assembled from constant fragments and slices of the records of the server (nicknames, room names), without formatting or copying them.
+// It's handed to sendv_to_client as it is, so the fragments are written with a single writev
+typedef struct reply_b {
+    struct iovec fragments[REPLY_MAX_FRAGMENTS];
+    int n_fragments ;
+} replyBuilder ;
+
+// Constant replies of the server, and the fragments of the replies holding a nickname or a room name
+extern const replyFragment reply_wrong_syntax ;
+extern const replyFragment reply_no_command ;
+extern const replyFragment reply_nickname_first ;
+extern const replyFragment reply_no_room ;
+extern const replyFragment reply_help ;
+extern const replyFragment reply_stopped ; // With the welcome banner of the lobby
+extern const replyFragment reply_rerolled ;
+extern const replyFragment reply_idle_conversation ;
+extern const replyFragment reply_idle_lobby ;
+extern const replyFragment reply_no_nickname ;
+extern const replyFragment reply_heartbeat ;
+extern const replyFragment reply_accept_error ;
+extern const replyFragment fragment_nickname_set ; // nickname
+extern const replyFragment fragment_nickname_set_end ;
+extern const replyFragment fragment_looking ; // room name
+extern const replyFragment fragment_looking_end ;
+extern const replyFragment fragment_nobody_came ; // room name
+extern const replyFragment fragment_nobody_came_end ;
+extern const replyFragment fragment_new_match ; // nickname of the partner
+extern const replyFragment fragment_new_match_end ;
+extern const replyFragment fragment_partner_left ; // nickname of the partner
+extern const replyFragment fragment_partner_left_end ;
+
+// REPLY FUNCTIONS
+// Empties the builder
+static inline void reply_begin(replyBuilder* reply){
+  reply->n_fragments = 0 ;
+}
+
+// Appends len bytes at text, which must stay valid until the reply is sent. Bytes beyond REPLY_MAX_FRAGMENTS fragments are left out
+static inline void reply_add(replyBuilder* reply, const char* text, int len){
+  if (reply->n_fragments == REPLY_MAX_FRAGMENTS)
+    return;
+  reply->fragments[reply->n_fragments].iov_base = (void*)text ;
+  reply->fragments[reply->n_fragments].iov_len = len ;
+  reply->n_fragments++ ;
+}
+
+// Appends a constant fragment
+static inline void reply_add_fragment(replyBuilder* reply, const replyFragment* fragment){
+  reply_add(reply, fragment->text, fragment->len);
+}
+
+#endif
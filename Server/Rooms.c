@@ -0,0 +1,224 @@
+#include<stdio.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include "Rooms.h"
+
+#define ROOMS_TABLE_SIZE (2*ROOMS_MAX) // Slots of the hash table, a power of two: with at most half of them used the probes stay short
+#define ROOMS_LINE_SIZE 512 // Longest line of the rooms file
+
+static roomInfo rooms[ROOMS_MAX];
+static int n_rooms ;
+// Open addressing with linear probing: every slot holds the position of a room, or -1. Only written while loading
+static int table[ROOMS_TABLE_SIZE];
+static char* list_reply ;
+static int list_reply_len ;
+
+// Rooms of the server before the registry existed
+static const char* default_rooms[3][2] = {
+  { "Climate change", "Greta would be proud of you" },
+  { "Travel related", "Do you enjoy going around the world ?" },
+  { "Horror movies", "Creepy topics around here" },
+};
+
+// FNV-1a hash of a name
+static uint32_t hash_name(const char* name, int name_len);
+// Adds a room to the registry and to the hash table. Returns -1 with the reason inside *error, 0 otherwise
+static int add_room(const char* name, int name_len, const char* description, int description_len, const char** error);
+// Builds the reply to //command:<ROOMS>. Returns -1 in case of error, 0 otherwise
+static int build_list_reply();
+// Removes the blanks at both ends of s, len bytes long. Returns the new length and moves *s to the first char kept
+static int trim(const char** s, int len);
+
+// ROOMS FUNCTIONS
+
+// Loads the registry from the file at path: one room per line as "name | description", blank lines and lines starting with '#' are skipped.
+// A name can't hold '<', '>', '"' or '\\', and names must be unique. Prints the reason and returns -1 if the file can't be read or holds no valid room, otherwise the number of rooms.
+// To be called once, before the threads of the server start: from then on the registry is read only
+int rooms_load(const char* path){
+
+  char line[ROOMS_LINE_SIZE];
+  const char *name, *description, *separator, *error ;
+  int line_number = 0, len, name_len, description_len ;
+  FILE* file ;
+
+  if ((file = fopen(path, "r")) == NULL){
+    printf("Error opening the rooms file %s : %s\n", path, strerror(errno));
+    return -1;
+  }
+  memset(table, -1, sizeof(table));
+  n_rooms = 0 ;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+    line_number++ ;
+    len = strlen(line);
+    if (len == sizeof(line)-1 && line[len-1] != '\n'){
+      error = "line too long" ;
+      goto bad_line;
+    }
+    name = line ;
+    len = trim(&name, len);
+    if (len == 0 || name[0] == '#')
+      continue;
+
+    // Without a separator the whole line is the name
+    if ((separator = memchr(name, '|', len)) == NULL)
+      separator = name + len ;
+    name_len = trim(&name, separator - name);
+    description = separator < name + len ? separator + 1 : separator ;
+    description_len = trim(&description, (line + strlen(line)) - description);
+    if (add_room(name, name_len, description, description_len, &error) < 0)
+      goto bad_line;
+  }
+  fclose(file);
+
+  if (n_rooms == 0){
+    printf("Error in the rooms file %s : no room found\n", path);
+    return -1;
+  }
+  if (build_list_reply() < 0){
+    printf("Error allocating the list of the rooms\n");
+    return -1;
+  }
+  return n_rooms;
+
+  bad_line:
+  printf("Error in the rooms file %s, line %d : %s\n", path, line_number, error);
+  fclose(file);
+  return -1;
+}
+
+// Loads the three rooms the server has always had, used when there is no rooms file. Returns the number of rooms
+int rooms_load_defaults(){
+
+  const char* error ;
+
+  memset(table, -1, sizeof(table));
+  n_rooms = 0 ;
+  for (int i = 0; i < 3; i++)
+    add_room(default_rooms[i][0], strlen(default_rooms[i][0]), default_rooms[i][1], strlen(default_rooms[i][1]), &error);
+  if (build_list_reply() < 0)
+    return -1;
+  return n_rooms;
+}
+
+// Looks for the room called name, name_len bytes not terminated by '\0'. Returns NULL if there's no such room. O(1), thread safe
+roomInfo* rooms_find(const char* name, int name_len){
+
+  uint32_t slot ;
+
+  if (name_len <= 0 || name_len >= ROOM_NAME_SIZE)
+    return NULL;
+  for (slot = hash_name(name, name_len) & (ROOMS_TABLE_SIZE-1); table[slot] >= 0; slot = (slot+1) & (ROOMS_TABLE_SIZE-1)) {
+    roomInfo* room = &rooms[table[slot]] ;
+    if (room->name_len == name_len && memcmp(room->name, name, name_len) == 0)
+      return room;
+  }
+  return NULL;
+}
+
+// Number of rooms of the registry
+int rooms_count(){
+  return n_rooms;
+}
+
+// The room at position id, NULL if id is out of range
+roomInfo* rooms_get(int id){
+  if (id < 0 || id >= n_rooms)
+    return NULL;
+  return &rooms[id];
+}
+
+// Reply to //command:<ROOMS>, built once when the registry is loaded. Its length is stored in *len
+const char* rooms_list_reply(int* len){
+  *len = list_reply_len ;
+  return list_reply;
+}
+
+// FNV-1a hash of a name
+static uint32_t hash_name(const char* name, int name_len){
+  uint32_t hash = 2166136261u ;
+  for (int i = 0; i < name_len; i++) {
+    hash ^= (unsigned char)name[i] ;
+    hash *= 16777619u ;
+  }
+  return hash;
+}
+
+// Adds a room to the registry and to the hash table. Returns -1 with the reason inside *error, 0 otherwise
+static int add_room(const char* name, int name_len, const char* description, int description_len, const char** error){
+
+  uint32_t slot ;
+  roomInfo* room ;
+
+  if (n_rooms == ROOMS_MAX){
+    *error = "too many rooms" ;
+    return -1;
+  }
+  if (name_len <= 0){
+    *error = "empty room name" ;
+    return -1;
+  }
+  if (name_len >= ROOM_NAME_SIZE){
+    *error = "room name too long" ;
+    return -1;
+  }
+  // The name goes inside //command:START<...> and inside the labels of the metrics page
+  for (int i = 0; i < name_len; i++) {
+    if (name[i] == '<' || name[i] == '>' || name[i] == '"' || name[i] == '\\' || (unsigned char)name[i] < ' '){
+      *error = "a room name can't hold '<', '>', '\"', '\\' or control chars" ;
+      return -1;
+    }
+  }
+  if (rooms_find(name, name_len) != NULL){
+    *error = "duplicate room name" ;
+    return -1;
+  }
+
+  room = &rooms[n_rooms] ;
+  room->id = n_rooms ;
+  memcpy(room->name, name, name_len);
+  room->name[name_len] = '\0' ;
+  room->name_len = name_len ;
+  if (description_len < 0)
+    description_len = 0 ;
+  if (description_len >= ROOM_DESCRIPTION_SIZE)
+    description_len = ROOM_DESCRIPTION_SIZE-1 ;
+  memcpy(room->description, description, description_len);
+  room->description[description_len] = '\0' ;
+  room->waitlist = NULL ;
+
+  for (slot = hash_name(name, name_len) & (ROOMS_TABLE_SIZE-1); table[slot] >= 0; slot = (slot+1) & (ROOMS_TABLE_SIZE-1))
+    ;
+  table[slot] = n_rooms ;
+  n_rooms++ ;
+  return 0;
+}
+
+// Builds the reply to //command:<ROOMS>. Returns -1 in case of error, 0 otherwise
+static int build_list_reply(){
+
+  int size = 64 ;
+
+  for (int i = 0; i < n_rooms; i++)
+    size += rooms[i].name_len + strlen(rooms[i].description) + 16 ;
+  free(list_reply);
+  if ((list_reply = (char*)malloc(size)) == NULL)
+    return -1;
+  list_reply_len = sprintf(list_reply, "\n*** AVAILABLE ROOMS ***\n");
+  for (int i = 0; i < n_rooms; i++)
+    list_reply_len += sprintf(list_reply + list_reply_len, "-\"%s\" room : %s \n", rooms[i].name, rooms[i].description);
+  list_reply_len += sprintf(list_reply + list_reply_len, "\n");
+  return 0;
+}
+
+// Removes the blanks at both ends of s, len bytes long. Returns the new length and moves *s to the first char kept
+static int trim(const char** s, int len){
+  while (len > 0 && (**s == ' ' || **s == '\t')){
+    (*s)++ ;
+    len-- ;
+  }
+  while (len > 0 && ((*s)[len-1] == ' ' || (*s)[len-1] == '\t' || (*s)[len-1] == '\n' || (*s)[len-1] == '\r'))
+    len-- ;
+  return len;
+}
@@ -0,0 +1,36 @@
+#ifndef ROOMS_H
+#define ROOMS_H
+
+#include "List.h"
+
+#define ROOMS_MAX 1024 // Max number of rooms of the registry
+#define ROOM_NAME_SIZE 64 // Bytes of a room name, '\0' included
+#define ROOM_DESCRIPTION_SIZE 128 // Bytes of a room description, '\0' included
+#define ROOMS_DEFAULT_FILE "rooms.conf" // Read from the working directory when RANDOMCHAT_ROOMS_FILE is not set
+
+// A room of the registry. Every room has its own waitlist and its own matcher, run by the workers of the server
+typedef struct room_inf {
+    int id ; // Position inside the registry, the same the room has inside the metrics
+    char name[ROOM_NAME_SIZE];
+    int name_len ;
+    char description[ROOM_DESCRIPTION_SIZE];
+    linkedList* waitlist ; // Users waiting for a match, allocated by the server once the registry is loaded
+} roomInfo ;
+
+// ROOMS FUNCTIONS
+// Loads the registry from the file at path: one room per line as "name | description", blank lines and lines starting with '#' are skipped.
+// A name can't hold '<', '>', '"' or '\\', and names must be unique. Prints the reason and returns -1 if the file can't be read or holds no valid room, otherwise the number of rooms.
+// To be called once, before the threads of the server start: from then on the registry is read only
+int rooms_load(const char* path);
+// Loads the three rooms the server has always had, used when there is no rooms file. Returns the number of rooms
+int rooms_load_defaults();
+// Looks for the room called name, name_len bytes not terminated by '\0'. Returns NULL if there's no such room. O(1), thread safe
+roomInfo* rooms_find(const char* name, int name_len);
+// Number of rooms of the registry
+int rooms_count();
+// The room at position id, NULL if id is out of range
+roomInfo* rooms_get(int id);
+// Reply to //command:<ROOMS>, built once when the registry is loaded. Its length is stored in *len
+const char* rooms_list_reply(int* len);
+
+#endif
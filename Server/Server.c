@@ -1,63 +1,367 @@
+#define _GNU_SOURCE // Needed for accept4
 #include<sys/socket.h>
+#include<sys/epoll.h>
+#include<sys/eventfd.h>
+#include<sys/resource.h>
+#include<sys/uio.h>
+#include<sys/ioctl.h>
+#include<linux/sockios.h>
 #include<unistd.h>
 #include<stdlib.h>
 #include<stdio.h>
+#include<stdint.h>
 #include<netinet/ip.h>
 #include<netinet/tcp.h>
 #include<string.h>
 #include<errno.h>
+#include<fcntl.h>
 #include<pthread.h>
 #include<arpa/inet.h>
 #include<signal.h>
 #include<time.h>
 #include "List.h"
+#include "Parser.h"
+#include "Log.h"
+#include "Metrics.h"
+#include "Exporter.h"
+#include "Rooms.h"
+#include "Replies.h"
+#include "Uring.h"
+#include "WorkerPool.h"
+#include "Shard.h"
 
 #define MYPORT 23456
-#define BUF_SIZE 1024
+#define MAX_EVENTS 256 // Max number of readiness events served by a single epoll_wait call
+#define MAX_REACTORS 64 // Max number of reactor threads, each one with its own listening socket
+#define DEFAULT_LISTEN_BACKLOG 4096 // Connections queued by the kernel on each listening socket, the kernel caps it at net.core.somaxconn
+#define DEFAULT_ACCEPT_BATCH 64 // Connections accepted in a row before a reactor serves its other events, 0 accepts until the queue is empty
+#define MATCHER_RETRY_MS 1000 // How long the matcher of a room waits when its users can't be paired, unless somebody new comes
+#define MATCHER_BATCH_CAPACITY 64 // Initial positions of the array a matcher exchanges with its waitlist
+#define MATCHER_WINDOW 8 // How many of the following users of the shuffled batch are tried as partner of a user
+#define USE_SPLICE_RELAY 1 // When 1, big pastes are relayed with splice through a pipe instead of read and write
+#define SPLICE_THRESHOLD 4096 // Minimum number of bytes pending on a socket to relay them with splice
+#define OUT_QUEUE_LIMIT (256*1024) // Max bytes queued for a client: a client exceeding it is dropped
+#define OUT_HIGH_WATER (32*1024) // Above these queued bytes the partner of the client is no longer read
+#define OUT_LOW_WATER (8*1024) // Under these queued bytes the partner of the client is read again
+#define OUT_STALL_TIMEOUT_MS 30000 // A client whose queue makes no progress for this long is dropped
+#define OUT_STALL_CHECK_MS 1000 // How often the reactor looks for stalled clients, while some client has queued bytes
+#define DEFAULT_HANDSHAKE_TIMEOUT_S 30 // A client which doesn't choose a nickname in this time is disconnected
+#define DEFAULT_IDLE_TIMEOUT_S 600 // A client which sends nothing for this long leaves its conversation, or the server if it's in the lobby
+#define DEFAULT_WAITING_TIMEOUT_S 600 // A user nobody has been paired with for this long goes back to the lobby
+#define DEFAULT_HEARTBEAT_INTERVAL_S 30 // A client which sends nothing for this long gets a heartbeat, so a dead connection has unacknowledged data
+#define TCP_USER_TIMEOUT_MS 30000 // Data left unacknowledged by a client for this long closes its connection. Set on the listening sockets, the clients inherit it
+#define MIGRATION_MIN_IMBALANCE 16 // Conversations a reactor must have beyond twice the ones of the least loaded reactor, before new conversations move both their users there
+#define WAITING_RETRY_MS 1000 // A waiting user whose timeout expires while a matcher holds it is looked at again after this long
+#define URING_SQ_ENTRIES 1024 // Requests a reactor running on io_uring prepares between two io_uring_enter, beyond them they are submitted on the way
+#define URING_CQ_ENTRIES 8192 // Completions a reactor finds at once, the kernel keeps the others until there's room
+#define URING_BUFFERS 1024 // Buffers provided to the recvs of a reactor, a power of two. A buffer goes back to the kernel as soon as its bytes are copied
+#define URING_BUFFER_SIZE 2048
+#define URING_BUFFER_GROUP 0
+#define URING_SPILL_LIMIT (16*1024) // Bytes received from a client and not consumed yet above which its recv is stopped, like a socket nobody reads
+#define URING_OP_RECV 1 // Kind of request of the ring, inside the 3 low bits of its user_data. The other bits point to the client, or to the reactor for the accept and the mailbox
+#define URING_OP_SEND 2
+#define URING_OP_ACCEPT 3
+#define URING_OP_MAILBOX 4
+#define URING_OP_CANCEL 5
+#define URING_OP_MASK 7
 
 /* DEFINED INSIDE List.h
 // Client informations
 typedef struct client_inf {
     char IP_address[32]; // Holds the client IP address
     char nickname[32]; // Holds the nickname chosen by the the user
+    int nickname_len ; // Length of nickname, so the replies holding it are assembled without strlen
     int client_sd ; // The socket_descriptor opened between client and server
     struct client_inf* last_chat ; // Pointer to the last user we chatted with. Usefull for avoiding two random chats in a row with the same user
+    client_state state ; // Current state of the connection. Only the reactor thread changes it
+    struct clients_inf* conversation ; // The conversation the client is taking part in, NULL outside of STATE_IN_CONVERSATION
+    lineFramer recv_framer ; // Splits what the client sends into requests or chat lines. Its storage is a buffer of BUF_SIZE bytes borrowed while the client has bytes not consumed yet, NULL otherwise
+    char relay_header[48]; // "-- <nickname> --" header, built once when the nickname is set and sent before every relayed message
+    int relay_header_len ;
+    int splice_pipe[2]; // Pipe used to splice big pastes to the partner, created on first use (-1 until then)
+    char* out_buff ; // Bytes the socket couldn't take yet, borrowed on the first partial write and given back once flushed
+    int out_capacity ; // Size of out_buff, never more than OUT_QUEUE_LIMIT
+    int out_start ; // Position of the first queued byte inside out_buff
+    int out_len ; // Number of queued bytes
+    struct timespec out_progress ; // Last time the queue started or the socket took some queued bytes
+    int out_unsent ; // Bytes still inside the kernel send buffer at the last stall check, a slow reader still makes them shrink
+    int out_closing ; // 1 once the client has been dropped because it doesn't read what we send
+    int reads_paused ; // 1 while the socket is not read because the partner's queue is above OUT_HIGH_WATER
+    struct client_inf* backlog_prev ; // Links the record inside the reactor's list of clients with queued bytes
+    struct client_inf* backlog_next ;
+    uint64_t out_flushed ; // Bytes written from the queue since the client connected: the position of the queue inside what we send to the client
+    uint64_t out_timed_end ; // Position where the relay timed through the queue ends, 0 if no relay is timed. One at a time, the others are not measured
+    struct timespec out_timed_read_at ; // When the lines of the timed relay were read from the partner
+    int out_timed_room ; // Room whose histogram gets the relay latency
+    struct timespec waiting_since ; // When the client entered the waitlist (CLOCK_MONOTONIC), used to measure the enqueue-to-match latency
+    struct reactor_inf* reactor ; // The reactor serving the connection, NULL while the client moves to another reactor. Written atomically by the reactor owning the client, read atomically by the others
+    struct timespec moving_since ; // When the client left its reactor for the reactor of its conversation (CLOCK_MONOTONIC), used to measure the migration latency
+    struct client_inf* next ; // Links the record inside the reactor's list of closed clients
+    wheelTimer timer ; // Next timeout or heartbeat of the client, inside the timer wheel of its reactor
+    uint64_t state_tick ; // Tick of the wheels when the client entered its current state
+    uint64_t active_tick ; // Tick of the wheels when something was last read from the client
+    uint64_t heartbeat_tick ; // Tick of the wheels when the last heartbeat was sent to the client
+    struct room_inf* room ; // The room whose waitlist holds the client, in STATE_WAITING
+    struct node* waiting_node ; // The record of the client inside that waitlist, in STATE_WAITING
+    int hung_up ; // 1 once the client closed its connection while waiting. Set by the reactor, read by the matchers, which don't pair it
+    // Used by the reactors running on io_uring only, see run_uring_reactor
+    int recv_armed ; // 1 while the multishot recv of the socket is armed on the ring of the reactor
+    int recv_cancelled ; // 1 once that recv has been asked to stop
+    int recv_done ; // 1 once the ring found the end of the stream, or the error in recv_error: reading the client returns it after the bytes received
+    int recv_error ;
+    int recv_unread ; // Bytes the ring put in recv_framer and reading the client has not returned yet
+    char* spill_buff ; // Bytes received which don't fit recv_framer yet, borrowed only when it's full
+    int spill_capacity ;
+    int spill_start ;
+    int spill_len ;
+    char* out_sending ; // Buffer read by the send in flight, NULL if there's none. An out_buff replaced while it was sending is given back when the send completes
+    int out_sending_capacity ;
+    int uring_requests ; // Requests of the ring pointing to the record: the recv and the send. The record is released only once all of them have completed
+    int send_listed ; // 1 while the client is in the reactor's list of clients whose queue is sent at the end of the turn
+    struct client_inf* send_next ;
+    struct clients_inf* handover ; // Conversation waiting for the requests of the client to complete, before the client moves to the reactor of the conversation
 } thread_arg ;*/
 
+// A reactor: an event loop running on its own thread, with its own listening socket and its own connections.
+// Every field but the mailbox is used by the reactor thread only
+typedef struct reactor_inf {
+  int id ; // Position inside reactors
+  int server_socket ; // The listening socket, non blocking. Every reactor binds the same port with SO_REUSEPORT and the kernel spreads the connections among them
+  int epoll_descriptor ; // The epoll instance watching the listening socket, the mailbox and every client socket of the reactor
+  int mailbox_descriptor ; // eventfd written every time a conversation is posted to the reactor
+  // Conversations posted by the matchers or by the other reactors, not served yet (FIFO)
+  conversation_thread_arg* mailbox_head ;
+  conversation_thread_arg* mailbox_tail ;
+  // Connections handed over by the other shards, not served yet (FIFO). Guarded by the mailbox mutex too
+  shardMessage* arrivals_head ;
+  shardMessage* arrivals_tail ;
+  pthread_mutex_t mailbox_mutex ;
+  // Clients disconnected during the current batch of events. They are freed only when the whole batch has been served, since a later event of the same batch could still point to them
+  thread_arg* closed_clients ;
+  // Clients with bytes queued, in the order they started queueing
+  thread_arg* backlogged_clients ;
+  int accept_pending ; // 1 if the last call to accept_new_clients stopped after accept_batch connections, with more of them still queued
+  timerWheel timers ; // Timeouts and heartbeats of the clients of the reactor
+  // Used when the reactor runs on io_uring only, see run_uring_reactor
+  uringRing ring ;
+  thread_arg* sending_clients ; // Clients whose queue is handed to a send at the end of the turn
+  int accept_armed ; // 1 while the multishot accept of the listening socket is armed
+  // Conversations given to the reactor and not ended yet: raised by the matchers when they pick the reactor, lowered by the reactor when they end
+  long n_conversations __attribute__((aligned(64))) ;
+  pthread_t thread ; // Joined by close_server, if running is 1
+  int running ; // 1 once the thread of the reactor has been created
+} reactorInfo ;
+
+// Matching state of a room. Its task is run by the workers every time somebody enters the waitlist, one round at a time, so a room is never matched by two workers at once
+typedef struct room_m {
+  workTask task ;
+  roomInfo* room ;
+  linkedListNode** batch ; // Exchanged with the array of the waitlist at every round, see takeAllElements
+  int batch_capacity ;
+  uint64_t rng_state ; // Every matcher owns the state of its generator, so shuffling doesn't share anything between rooms
+  long long max_waiting_ms ; // Longest enqueue-to-match latency seen in this room
+  long n_batches ; // Batches which formed at least one pair
+  long n_pairs ; // Pairs formed since the start
+  int max_batch_pairs ;
+} roomMatcher ;
+
 // GENERAL FUNCTIONS
 // Initializes socket, binds the special address INADDR_ANY to the socket, and put the socket in a listen state with backlog = qlen. Returns a socket descriptor or -1 in case there will be any error
 int initServerSocket(int type, const struct sockaddr *addr, socklen_t alen, int qlen);
-// Creates and allocate all necessaries threads and data structures to allow the server operations
+// Creates the waitlist and the matcher of every room of the registry, and starts the workers which run the matchers
 void initServerMatchingEngine();
-// Handler of signals
+// Creates the epoll instance and the mailbox of a reactor, and registers its listening socket. Returns -1 in case of error, 0 otherwise
+int initServerReactor(reactorInfo* reactor);
+// Reads an integer setting from the environment variable name. Returns default_value if it's not set, or not a number between min_value and max_value
+int config_from_env(const char* name, int default_value, int min_value, int max_value);
+// Waits for SIGINT and SIGUSR1 on the main thread, the only one taking them: prints the latency histograms for SIGUSR1, and closes the server for SIGINT. Never returns
+void wait_for_signals(const sigset_t* signals);
+// Stops the reactors, the workers and the other threads of the server, then writes the log, prints the statistics and frees the waitlists
+void close_server();
+// Handler of the signal SIGPIPE
 void signalHandler (int numSignal);
-// Returns -1 for unknown or extraneous requests, a positive number which will indicates the type of request otherwise
-int parse_client_request(const char* request_buffer);
-// Entrypoint of the thread that will manage one client at time
-void *manage_a_single_client(void *arg);
-// Entrypoint of the thread that will pair clients in a chatroom waitlist who looks for a conversation
-void *pair_clients(void *arg);
-// Entrypoint of the thread that will manage a conversations between two clients. Launched by pair_clients
-void *manage_a_conversation(void *arg);
-
-//GLOBAL LISTS OF CONNECTED USERS WAITING TO CHAT
-linkedList* climate_change_room;
-linkedList* travel_related_room;
-linkedList* horror_movies_room;
-
-// Counters of active conversations
-int totalNumberOfActiveChats, totalNumberOfUsers ;
-
 
-pthread_mutex_t n_total_active_chats_mutex = PTHREAD_MUTEX_INITIALIZER;
-pthread_mutex_t n_total_users_mutex = PTHREAD_MUTEX_INITIALIZER;
+// REACTOR FUNCTIONS
+// Event loop of a reactor. Waits for readiness events and dispatches them to the state machine of each connection. Returns once the server is closing
+void run_reactor(reactorInfo* reactor);
+// Entrypoint of the thread of a reactor
+void *reactor_thread(void *arg);
+// Accepts the connections pending on the (non blocking) listening socket of the reactor, at most accept_batch of them
+void accept_new_clients(reactorInfo* reactor);
+// Prepares the record of a connection just accepted, and starts serving it. address is NULL if the reactor didn't get it from accept.
+// Returns the record, NULL if the client has been disconnected
+thread_arg* welcome_client(reactorInfo* reactor, int client_socket, struct sockaddr_in* address);
+// Takes every conversation and every connection posted to the mailbox of the reactor, and serves them in order
+void serve_mailbox(reactorInfo* reactor);
+// Timeout of the wait for events: until the next tick with timers, or the next check for stalled clients while some client has queued bytes
+int reactor_timeout_ms(reactorInfo* reactor, const struct timespec* now);
+// Releases the clients disconnected during the turn, now that no event of the turn can point to them. With io_uring, the ones still pointed to by requests of the ring wait for their completions
+void release_closed_clients(reactorInfo* reactor);
+// Serves a conversation found inside the mailbox of the reactor. The users of a conversation must be served by the same reactor, so the conversation
+// goes through the mailboxes of the reactors of both users, which hand them over to its reactor, before it starts there
+void serve_posted_conversation(reactorInfo* reactor, conversation_thread_arg* conversation_info);
+// Serves a readable client socket according to the state of the connection, until the socket is drained or the client leaves
+void serve_client(thread_arg* client_info);
+// Serves a client in STATE_NICKNAME or STATE_LOBBY. Returns 1 if the client changed state and the socket must be served again, 0 otherwise
+int manage_a_single_client(thread_arg* client_info);
+// Moves what the client sent into its framer: read from the socket with epoll, taken from what the ring received with io_uring. Returns like framer_read
+ssize_t read_client(thread_arg* client_info);
+// Lends the framer of the client a buffer, if it has none. Returns -1 if there's no memory, 0 otherwise
+int borrow_recv_buffer(thread_arg* client_info);
+// Gives back the buffer of the framer of the client once every byte inside it has been consumed
+void return_recv_buffer(thread_arg* client_info);
+// Sends the reply to //command:<USERS> : the users waiting in every room, the active chats and the users connected
+void send_users_reply(thread_arg* client_info);
+// Relays what a client in STATE_IN_CONVERSATION writes to its partner. Returns 1 if the client changed state and the socket must be served again, 0 otherwise
+int manage_a_conversation(thread_arg* client_info);
+#if USE_SPLICE_RELAY
+// Relays with splice the data pending on the socket of client_info, if they are at least SPLICE_THRESHOLD bytes and don't start with a command. The paste is relayed as it is, without looking for lines inside it.
+// Returns 1 if the data has been relayed, 0 if it has to be read the usual way
+int splice_a_paste(thread_arg* client_info, thread_arg* partner_info);
+#endif
+// Starts a conversation matched by match_room, once both users are served by the reactor of the conversation
+void start_a_conversation(conversation_thread_arg* conversation_info);
+// Ends the conversation of client_info and puts the partner back in the waitlist. Gives conversation_info back to conversation_pool
+void end_a_conversation(thread_arg* client_info);
+// Inserts the client inside the waitlist of the room and moves it to STATE_WAITING. Returns -1 if the node can't be allocated
+int put_in_waitlist(thread_arg* client_info, roomInfo* room);
+// Answers a START : puts the client inside the waitlist of the room and tells it. Returns -1 if the node can't be allocated
+int enter_room(thread_arg* client_info, roomInfo* room);
+// Closes the socket and releases every resource held by a client
+void disconnect_client(thread_arg* client_info);
+// Closes the descriptor of the client and releases its record at the end of the turn, without touching the connection itself
+void release_client(thread_arg* client_info);
+// Takes a waiting client which closed its connection out of the waitlist in O(1), and disconnects it. If a matcher holds the client right now,
+// the client is marked as hung up: its timer tries again on the next tick, unless the matcher pairs it and the reactor of the conversation finds the mark first
+void drop_hung_up_client(thread_arg* client_info);
+
+// TIMER FUNCTIONS
+// Arms the timer of the client for its next timeout or heartbeat, according to its state. To be called whenever the client changes state
+void schedule_client_timer(thread_arg* client_info);
+// Called by the timer wheel of the reactor when the timer of a client expires: applies the timeout of its state, or sends a heartbeat
+void expire_client_timer(wheelTimer* timer, void* context);
+// Disconnects a client whose timeout expired, after telling it why
+void disconnect_timed_out_client(thread_arg* client_info, const replyFragment* message, const char* timeout, metricId metric);
+
+// OUTPUT FUNCTIONS
+// Sends len bytes to the client, queueing what the socket can't take now. Returns -1 if the client is gone or has been dropped, 0 otherwise
+int send_to_client(thread_arg* client_info, const char* data, int len);
+// Same as send_to_client, for iovcnt buffers sent in order with a single writev
+int sendv_to_client(thread_arg* client_info, const struct iovec* iov, int iovcnt);
+// Sends the reply assembled inside the builder with a single writev
+int send_reply(thread_arg* client_info, const replyBuilder* reply);
+// Tells the partner that left_info has left the conversation, and that it's looking for someone else
+void send_partner_left(thread_arg* partner_info, thread_arg* left_info);
+// Tells the client it has been matched with partner_info
+void send_new_match(thread_arg* client_info, thread_arg* partner_info);
+// Builds the "-- <nickname> --" header of the relayed messages of the client, from its current nickname
+void set_relay_header(thread_arg* client_info);
+// Writes the bytes queued for a writable client. Resumes its partner once the queue goes under OUT_LOW_WATER
+void flush_client(thread_arg* client_info);
+// Accounts for n_written bytes taken from the head of the queue by the socket
+void account_flushed_bytes(thread_arg* client_info, int n_written);
+// Releases the memory of an empty queue, and resumes the partner of the client once the queue is under OUT_LOW_WATER
+void release_flushed_queue(thread_arg* client_info);
+// Shuts down a client which doesn't read what we send. The reactor then finds the socket closed and disconnects it the usual way
+void drop_slow_client(thread_arg* client_info, const char* reason);
+// Drops the clients of the reactor whose queue made no progress for OUT_STALL_TIMEOUT_MS. Bytes leaving the kernel send buffer count as progress
+void drop_stalled_clients(reactorInfo* reactor, const struct timespec* now);
+// Adds a client to the list of clients with queued bytes of its reactor
+void link_backlogged_client(thread_arg* client_info);
+// Removes a client from the list of clients with queued bytes of its reactor
+void unlink_backlogged_client(thread_arg* client_info);
+// Records the latency of a relay just handed to sendv_to_client, now if the socket took it all, otherwise when flush_client writes its last byte
+void time_a_relay(thread_arg* partner_info, const struct timespec* read_at, int room);
+
+// MATCHING FUNCTIONS
+// Task of the matcher of a room, arg is its roomMatcher: pairs the clients inside the waitlist of the room who look for a conversation.
+// Returns MATCHER_RETRY_MS if some users are left that another shuffle may pair, 0 otherwise
+int match_room(void *arg);
+// Has the matcher of the room run, now or as soon as its round in progress ends. Thread safe
+void wake_matcher(roomInfo* room);
+// Hands a chain of conversations (linked through next) to a reactor and wakes it up once. Thread safe, called by match_room and by the reactors
+void post_conversations_to_reactor(reactorInfo* reactor, conversation_thread_arg* first_conversation, conversation_thread_arg* last_conversation);
+// Returns 1 if the two users can be paired: none of them has hung up and, unless one of them never chatted, they must not have just chatted together
+int can_chat(thread_arg* firstUserInfo, thread_arg* secondUserInfo);
+// Picks the reactor which serves the conversation of two users, and counts the conversation in its load. Thread safe
+reactorInfo* pick_conversation_reactor(thread_arg* firstUserInfo, thread_arg* secondUserInfo);
+// Fast generator used by the matchers to shuffle their batches (xorshift64*). Not thread safe, every matcher owns its state
+uint64_t next_random(uint64_t* state);
+// Milliseconds elapsed between two instants taken with the monotonic clock
+long long elapsed_ms(const struct timespec* from, const struct timespec* to);
+// Microseconds elapsed between two instants taken with the monotonic clock
+long long elapsed_us(const struct timespec* from, const struct timespec* to);
+
+// SHARD FUNCTIONS
+// Called by the receiver of the shard for every connection handed over by another shard: posts it to the mailbox of a reactor, in turn. Thread safe
+void deliver_handover(shardMessage* message);
+// Serves a connection handed over by another shard: the client gets a record of this reactor, and enters the room it asked for. Frees the message
+void adopt_handed_over_client(reactorInfo* reactor, shardMessage* message);
+// Moves a client which asked for a room of another shard there, with what it holds. With io_uring the move waits for the requests of the ring pointing to the client
+void leave_for_shard(thread_arg* client_info, roomInfo* room);
+// Hands the connection of a client in STATE_LEAVING over to the shard owning its room, and releases it. If the shard can't take it, the client enters the room here
+void finish_shard_handover(thread_arg* client_info);
+
+// IO_URING FUNCTIONS
+// Returns 0 if the kernel has every io_uring feature the reactors use, -1 with errno set otherwise
+int probe_io_uring();
+// Event loop of a reactor running on io_uring: accepts, receives and sends through the ring, with one io_uring_enter for each turn. Returns once the server is closing
+void run_uring_reactor(reactorInfo* reactor);
+// Serves a completion of the ring of the reactor
+void uring_complete(reactorInfo* reactor, const struct io_uring_cqe* cqe);
+// Serves a completion of the multishot recv of a client: copies the bytes received and serves the client
+void uring_complete_recv(reactorInfo* reactor, thread_arg* client_info, const struct io_uring_cqe* cqe);
+// Serves a completion of the send of a client: accounts for the bytes sent and sends the rest of the queue
+void uring_complete_send(reactorInfo* reactor, thread_arg* client_info, const struct io_uring_cqe* cqe);
+// Arms the multishot accept of the listening socket of the reactor
+void uring_arm_accept(reactorInfo* reactor);
+// Arms the multishot poll of the mailbox of the reactor
+void uring_arm_mailbox(reactorInfo* reactor);
+// Arms the multishot recv of the client, unless it's armed already, the stream has ended, the client is moving to another reactor or shard or too many bytes wait to be consumed
+void uring_arm_recv(thread_arg* client_info);
+// Asks the ring to stop the multishot recv of the client
+void uring_cancel_recv(thread_arg* client_info);
+// Appends len bytes received from the client to its framer, or behind it when the framer is full. Stops the recv above URING_SPILL_LIMIT bytes
+void uring_store_received(thread_arg* client_info, const char* data, int len);
+// Reading the client on io_uring: returns the bytes the ring put in the framer, then the ones kept behind it, then the end of the stream. EAGAIN when there's nothing else
+ssize_t uring_read_client(thread_arg* client_info);
+// Adds the client to the list of clients whose queue is sent at the end of the turn, unless a send of the client is in flight already
+void uring_queue_send(thread_arg* client_info);
+// Hands the queue of every client of the list to a send
+void uring_submit_sends(reactorInfo* reactor);
+// Before a user moves to another reactor, the requests of the ring pointing to it must complete. Returns 1 if some user of the conversation still has requests in flight:
+// their recvs are cancelled, and the last completion serves the conversation again. Returns 0 if the users can move now
+int uring_hold_handover(reactorInfo* reactor, conversation_thread_arg* conversation_info);
+
+
+// REACTORS
+reactorInfo* reactors ; // Each one runs on its own thread, the main thread waits for the signals
+int server_stopping ; // Set by close_server: every reactor returns at its next turn
+int n_reactors ; // Set by RANDOMCHAT_REACTORS, one for each online CPU by default
+int accept_batch ; // Set by RANDOMCHAT_ACCEPT_BATCH
+int use_io_uring ; // 1 if the reactors run on io_uring: asked for with RANDOMCHAT_IO_URING=1, and supported by the kernel. epoll otherwise
+struct timespec wheels_epoch ; // Tick 0 of the timer wheel of every reactor: the ticks of a client mean the same on any reactor
+
+// MATCHING
+workerPool matching_workers ; // Runs the matchers of every room. Set by RANDOMCHAT_WORKERS, one for each online CPU by default
+roomMatcher* matchers ; // The matcher of every room, at the position of the room inside the registry
+
+// TIMEOUTS, in ticks of the timer wheels. 0 turns the timeout off
+uint64_t handshake_ticks ; // Set by RANDOMCHAT_HANDSHAKE_TIMEOUT, in seconds
+uint64_t idle_ticks ; // Set by RANDOMCHAT_IDLE_TIMEOUT, in seconds
+uint64_t waiting_ticks ; // Set by RANDOMCHAT_WAITING_TIMEOUT, in seconds
+uint64_t heartbeat_ticks ; // Set by RANDOMCHAT_HEARTBEAT_INTERVAL, in seconds
 
 
 // Main Entrypoint
-int main(int argc, char* argv[]){
+int main(void){
 
-  int server_socket ;
   struct sockaddr_in server_address ;
+  struct rlimit fd_limit ;
+  const char* metrics_address ;
+  const char* rooms_file ;
+  sigset_t signals ;
+  int listen_backlog, n_workers, n_cpus, err ;
 
   // Ignoring the SIGPIPE generated when writing on a socket which connection has crashed
   if(signal(SIGPIPE,signalHandler) == SIG_ERR ){
@@ -65,10 +369,27 @@ int main(int argc, char* argv[]){
       return (-2) ;
   }
 
-  // Ignoring the SIGPIPE generated when writing on a socket which connection has crashed
-  if(signal(SIGINT,signalHandler) == SIG_ERR ){
-      perror("Signal error ");
-      return (-3) ;
+  // Every connected client holds a socket descriptor, so we raise the soft limit as much as we are allowed to
+  if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur < fd_limit.rlim_max){
+    fd_limit.rlim_cur = fd_limit.rlim_max ;
+    if (setrlimit(RLIMIT_NOFILE, &fd_limit) < 0)
+      printf("Error calling setrlimit : %s\n", strerror(errno));
+  }
+
+  // The rooms come from RANDOMCHAT_ROOMS_FILE, or from ROOMS_DEFAULT_FILE if it exists. Without any file the server has its three usual rooms
+  rooms_file = getenv("RANDOMCHAT_ROOMS_FILE");
+  if (rooms_file == NULL && access(ROOMS_DEFAULT_FILE, F_OK) < 0)
+    rooms_load_defaults();
+  else if (rooms_load(rooms_file != NULL ? rooms_file : ROOMS_DEFAULT_FILE) < 0){
+    printf("Fix the rooms file and restart the server.\n");
+    return (-6) ;
+  }
+
+  // With RANDOMCHAT_SHARDS=n the rooms are spread among n processes, each one a whole server with its own listening sockets.
+  // From here on the code runs inside a shard: the process which started them is their coordinator, and never gets here
+  if (shards_start(config_from_env("RANDOMCHAT_SHARDS", 1, 1, SHARDS_MAX)) < 0){
+    printf("Error starting the shards : %s\nRestart the server.\n", strerror(errno));
+    return (-7) ;
   }
 
   // Preparing the server address
@@ -77,74 +398,91 @@ int main(int argc, char* argv[]){
   server_address.sin_port = htons(MYPORT);
   server_address.sin_addr.s_addr = htonl(INADDR_ANY);
 
-  while( (server_socket = initServerSocket(SOCK_STREAM,(struct sockaddr*)&server_address,sizeof(server_address),10)) < 0 ){
-    printf("Error during init. of the server ... \n");
-    printf("Wait for another try or press Ctrl-C to terminate ... \n");
-    sleep(3);
+  // One reactor for each CPU by default: each one accepts on its own listening socket, so bursts of connections are accepted in parallel.
+  // The shards share the CPUs
+  if ((n_cpus = sysconf(_SC_NPROCESSORS_ONLN) / shard_count()) < 1)
+    n_cpus = 1 ;
+  n_reactors = config_from_env("RANDOMCHAT_REACTORS", n_cpus < MAX_REACTORS ? n_cpus : MAX_REACTORS, 1, MAX_REACTORS);
+  listen_backlog = config_from_env("RANDOMCHAT_LISTEN_BACKLOG", DEFAULT_LISTEN_BACKLOG, 1, 1 << 20);
+  accept_batch = config_from_env("RANDOMCHAT_ACCEPT_BATCH", DEFAULT_ACCEPT_BATCH, 0, 1 << 20);
+  handshake_ticks = WHEEL_TICKS(config_from_env("RANDOMCHAT_HANDSHAKE_TIMEOUT", DEFAULT_HANDSHAKE_TIMEOUT_S, 0, 86400) * 1000LL);
+  idle_ticks = WHEEL_TICKS(config_from_env("RANDOMCHAT_IDLE_TIMEOUT", DEFAULT_IDLE_TIMEOUT_S, 0, 86400) * 1000LL);
+  waiting_ticks = WHEEL_TICKS(config_from_env("RANDOMCHAT_WAITING_TIMEOUT", DEFAULT_WAITING_TIMEOUT_S, 0, 86400) * 1000LL);
+  n_workers = config_from_env("RANDOMCHAT_WORKERS", n_cpus < WORKERS_MAX ? n_cpus : WORKERS_MAX, 1, WORKERS_MAX);
+  heartbeat_ticks = WHEEL_TICKS(config_from_env("RANDOMCHAT_HEARTBEAT_INTERVAL", DEFAULT_HEARTBEAT_INTERVAL_S, 0, 86400) * 1000LL);
+  clock_gettime(CLOCK_MONOTONIC, &wheels_epoch);
+  // io_uring only when asked for, and only if the kernel has everything the reactors use. epoll otherwise
+  if (config_from_env("RANDOMCHAT_IO_URING", 0, 0, 1) == 1){
+    if (probe_io_uring() == 0)
+      use_io_uring = 1 ;
+    else
+      printf("io_uring is not available (%s), the reactors use epoll\n", strerror(errno));
+  }
+  if ((reactors = (reactorInfo*)calloc(n_reactors, sizeof(reactorInfo))) == NULL){
+    printf("Error allocating the reactors\nRestart the server.\n");
+    return (-4) ;
   }
 
-  initServerMatchingEngine();
-
-  // Parameters for the accept
-  int client_socket;
-  struct sockaddr_in client_address ;
-  socklen_t client_addr_size = sizeof(client_address);
-
-  // Needed for printing the IP address of a client in a human readable format
-  const char* address_dot_format ;
-  char buffer_address_dot_format[INET_ADDRSTRLEN];
-
-  // Parameters for launching threads
-  pthread_t tinfo;
-  int err;
-  pthread_attr_t  t_attr;
-  thread_arg* client_info;
-
-  // Server main cycle
-  while(1){
-
-    client_socket = accept(server_socket, (struct sockaddr *)&client_address, &client_addr_size);
-
-    if(client_socket>0){
+  for (int i = 0; i < n_reactors; i++) {
+    reactors[i].id = i ;
+    while( (reactors[i].server_socket = initServerSocket(SOCK_STREAM,(struct sockaddr*)&server_address,sizeof(server_address),listen_backlog)) < 0 ){
+      printf("Error during init. of the server ... \n");
+      printf("Wait for another try or press Ctrl-C to terminate ... \n");
+      sleep(3);
+    }
 
-        // LOGGING NEW CONNECTIONS
-        address_dot_format = inet_ntop(AF_INET, &client_address.sin_addr, buffer_address_dot_format, INET_ADDRSTRLEN);
-        printf("\n-NEW CLIENT CONNECTED :\nSocket Descriptor : %d\nIP ADDRESS : %s\n",client_socket,address_dot_format);
+    if (initServerReactor(&reactors[i]) < 0){
+      printf("Error during init. of the reactor : %s\nRestart the server.\n", strerror(errno));
+      return (-4) ;
+    }
+  }
 
-        /* Mutex needed because increasing the totalNumberOfUsers variable can lead to a race condition with another thread
-         * that wants to do the opposite for a user who is logging out.
-         */
-        pthread_mutex_lock(&n_total_users_mutex);
-        totalNumberOfUsers++;
-        pthread_mutex_unlock(&n_total_users_mutex);
+  // SIGINT and SIGUSR1 are blocked before the first thread starts, so every thread inherits the mask and only the main thread takes them, see wait_for_signals.
+  // Until now they stop the process as usual
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGUSR1);
+  if ((err = pthread_sigmask(SIG_BLOCK, &signals, NULL)) != 0){
+    printf("Error blocking the signals : %s\nRestart the server.\n", strerror(err));
+    return (-3) ;
+  }
 
-        // Preparing the struct to pass for every new "manage_a_single_client" thread
-        client_info = (thread_arg *)malloc(sizeof(thread_arg));
-        client_info->client_sd = client_socket ;
-        strcpy(client_info->IP_address, address_dot_format) ;
-        memset(client_info->nickname, '\0', sizeof(client_info->nickname));
-        client_info->last_chat = NULL ;
+  // From now on the threads of the server log through the ring, and printing never blocks them
+  if (log_init() < 0){
+    printf("Error starting the log : %s\nRestart the server.\n", strerror(errno));
+    return (-5) ;
+  }
 
+  if (workers_init(&matching_workers, n_workers) < 0){
+    printf("Error creating the workers : %s\nRestart the server.\n", strerror(errno));
+    return (-4) ;
+  }
+  initServerMatchingEngine();
 
+  // The clients asking for a room of this shard come from the other shards too
+  if (shard_count() > 1 && shards_receive(deliver_handover) < 0){
+    printf("Error starting the receiver of the shard : %s\nRestart the server.\n", strerror(errno));
+    return (-7) ;
+  }
 
-        err = pthread_attr_init(&t_attr);
-        if (err != 0)
-            printf("Error pthread_attr_init : %s\n", strerror(err));
-        err = pthread_attr_setdetachstate(&t_attr, PTHREAD_CREATE_DETACHED);
+  // The metrics page is served only when an address is configured, see exporter_init. With several shards only the first one serves it:
+  // its counters and gauges are the sums of every shard, while its latency histograms are those of the first shard only
+  if (shard_self() == 0 && (metrics_address = getenv("RANDOMCHAT_METRICS_ADDRESS")) != NULL && exporter_init(metrics_address) < 0)
+    printf("Error starting the metrics page on %s : %s\nThe server runs without it.\n", metrics_address, strerror(errno));
 
-        // Threads creation. They need to be detached so performance won't deteriorate during time cause of zombies
-        if(err == 0){
-          if ( (err=pthread_create(&tinfo, &t_attr, manage_a_single_client, (void*)client_info) ) ) {
-            char threadErrorMessage[128] = "Error from the server accepting connection, please restart the client !\n\0";
-            printf("Error calling pthread_create : %s\n", strerror(err));
-            write(client_socket,threadErrorMessage,128);
-            free(client_info);
-          }
-        }
-        pthread_attr_destroy(&t_attr);
+  // If there is any error launching the reactor threads the server will crash and needs to be restarted
+  for (int i = 0; i < n_reactors; i++) {
+    if ( (err=pthread_create(&reactors[i].thread, NULL, reactor_thread, (void*)&reactors[i]) ) ) {
+      log_event(LOG_SYSTEM_ERROR, "calling pthread_create reactor_thread", NULL, NULL, err, 0, 0, 0);
+      kill(getpid(),SIGINT);
+      break;
     }
+    reactors[i].running = 1 ;
   }
 
+  // The main thread only waits for the signals from now on
+  wait_for_signals(&signals);
+
   return 0 ;
 }
 
@@ -165,23 +503,17 @@ int initServerSocket(int type, const struct sockaddr *addr, socklen_t alen, int
                goto errout;
            }
 
-           int flags = 10;
-           if (setsockopt(fd, SOL_TCP, TCP_KEEPIDLE, (void *)&flags, sizeof(flags))){
-               printf("ERROR: setsocketopt(), SO_KEEPIDLE");
+           // Every reactor binds its own socket on the same port, and the kernel spreads the incoming connections among them
+           if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, (void *)&reuse, sizeof(int)) < 0){
+               printf("Error calling setsockopt(), SO_REUSEPORT \n");
                goto errout;
-
            }
 
-           flags = 5;
-           if (setsockopt(fd, SOL_TCP, TCP_KEEPCNT, (void *)&flags, sizeof(flags))){
-               printf("ERROR: setsocketopt(), SO_KEEPCNT");
-               goto errout;
-
-           }
-
-           flags = 5;
-           if (setsockopt(fd, SOL_TCP, TCP_KEEPINTVL, (void *)&flags, sizeof(flags))){
-               printf("ERROR: setsocketopt(), SO_KEEPINTVL");
+           // Dead connections are found by the heartbeats: once one of them stays unacknowledged for too long the kernel closes the connection.
+           // The accepted sockets inherit the option, so it costs no system call for each client
+           int flags = TCP_USER_TIMEOUT_MS;
+           if (setsockopt(fd, SOL_TCP, TCP_USER_TIMEOUT, (void *)&flags, sizeof(flags))){
+               printf("ERROR: setsocketopt(), TCP_USER_TIMEOUT");
                goto errout;
            }
 
@@ -203,623 +535,2234 @@ int initServerSocket(int type, const struct sockaddr *addr, socklen_t alen, int
     return(-1);
 }
 
-// Creates and allocate all necessaries threads and data structures to allow the server operations
+// Creates the waitlist and the matcher of every room of the registry, and starts the workers which run the matchers
 void initServerMatchingEngine(){
 
-  // Initialization of rooms' waiting lists
-  climate_change_room = createANewLinkedList();
-  travel_related_room = createANewLinkedList();
-  horror_movies_room = createANewLinkedList();
-  // If there is any error allocating the lists the server will crash and needs to be restarted
-  if (climate_change_room == NULL || travel_related_room == NULL || horror_movies_room == NULL)
+  // If there is any error allocating the matchers the server will crash and needs to be restarted
+  if ((matchers = (roomMatcher*)calloc(rooms_count(), sizeof(roomMatcher))) == NULL){
+    log_event(LOG_SYSTEM_ERROR, "allocating the matchers", NULL, NULL, errno, 0, 0, 0);
     kill(getpid(),SIGINT);
+    return;
+  }
 
-  // Initialization of counters about active chats between users and connected users
-  totalNumberOfActiveChats = 0;
-  totalNumberOfUsers = 0 ;
+  for (int i = 0; i < rooms_count(); i++) {
+    roomInfo* room = rooms_get(i);
+    roomMatcher* matcher = &matchers[i] ;
 
-  // Parameters for launching threads
-  pthread_t tinfo;
-  int err;
+    // If there is any error allocating the lists the server will crash and needs to be restarted
+    if ((room->waitlist = createANewLinkedList()) == NULL){
+      log_event(LOG_SYSTEM_ERROR, "allocating the waitlist of a room", NULL, NULL, errno, 0, 0, 0);
+      kill(getpid(),SIGINT);
+      return;
+    }
 
-  // If there is any error launching the pair_clients threads the server will crash and needs to be restarted
-  if ( (err=pthread_create(&tinfo, NULL, pair_clients, (void*)climate_change_room) ) ) {
-      printf("Error calling pthread_create pair_clients climate : %s\nRestart the server.\n", strerror(err));
+    // The size of the waitlists is part of the metrics snapshot, and the room has the same position in the metrics as in the registry
+    if (metrics_register_room(room->name, room->waitlist) != room->id){
+      log_event(LOG_SYSTEM_ERROR, "registering the metrics of a room", NULL, NULL, errno, 0, 0, 0);
       kill(getpid(),SIGINT);
-  }
+      return;
+    }
 
-  if ( (err=pthread_create(&tinfo, NULL, pair_clients, (void*)travel_related_room) ) ) {
-      printf("Error calling pthread_create pair_clients travel : %s\nRestart the server.\n", strerror(err));
+    matcher->room = room ;
+    matcher->batch_capacity = MATCHER_BATCH_CAPACITY ;
+    if ((matcher->batch = (linkedListNode**)malloc(matcher->batch_capacity*sizeof(linkedListNode*))) == NULL){
+      log_event(LOG_SYSTEM_ERROR, "allocating the batch of the matcher", NULL, NULL, errno, 0, 0, 0);
       kill(getpid(),SIGINT);
+      return;
+    }
+    matcher->rng_state = ((uint64_t)time(NULL) << 32) ^ (uint64_t)(uintptr_t)room->waitlist ^ 0x9E3779B97F4A7C15ULL ;
+    // The rooms are spread among the deques of the workers, and the idle workers steal the rooms queued behind a hot one
+    task_init(&matcher->task, match_room, matcher, i);
   }
 
-  if ( (err=pthread_create(&tinfo, NULL, pair_clients, (void*)horror_movies_room) ) ) {
-      printf("Error calling pthread_create pair_clients horror : %s\nRestart the server.\n", strerror(err));
-      kill(getpid(),SIGINT);
+  // The workers are the last threads created by the matching engine: from now on matching a room never creates a thread
+  if (workers_start(&matching_workers) < 0){
+    log_event(LOG_SYSTEM_ERROR, "calling pthread_create worker_thread", NULL, NULL, errno, 0, 0, 0);
+    kill(getpid(),SIGINT);
+  }
+}
+
+// Creates the epoll instance and the mailbox of a reactor, and registers its listening socket. Returns -1 in case of error, 0 otherwise
+int initServerReactor(reactorInfo* reactor){
+
+  struct epoll_event event ;
+
+  if ((errno = pthread_mutex_init(&reactor->mailbox_mutex, NULL)) != 0)
+    return(-1);
+
+  wheel_init(&reactor->timers, &wheels_epoch);
+
+  if ((reactor->mailbox_descriptor = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    return(-1);
+
+  // With io_uring the ring of the reactor is created by its own thread, which is the only one allowed to submit to it, see run_uring_reactor
+  reactor->epoll_descriptor = -1 ;
+  if (use_io_uring)
+    return 0;
+
+  if ((reactor->epoll_descriptor = epoll_create1(EPOLL_CLOEXEC)) < 0)
+    return(-1);
+
+  // The listening socket must not block, so a single readiness event can be used to accept every pending connection
+  if (fcntl(reactor->server_socket, F_SETFL, fcntl(reactor->server_socket, F_GETFL) | O_NONBLOCK) < 0)
+    return(-1);
+
+  // The data field tells the reactor which kind of descriptor is ready: the address of the two fields of the reactor for the listening socket and the mailbox, a thread_arg for the clients
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLET ;
+  event.data.ptr = &reactor->server_socket ;
+  if (epoll_ctl(reactor->epoll_descriptor, EPOLL_CTL_ADD, reactor->server_socket, &event) < 0)
+    return(-1);
+
+  event.events = EPOLLIN | EPOLLET ;
+  event.data.ptr = &reactor->mailbox_descriptor ;
+  if (epoll_ctl(reactor->epoll_descriptor, EPOLL_CTL_ADD, reactor->mailbox_descriptor, &event) < 0)
+    return(-1);
+
+  return 0;
+}
+
+// Reads an integer setting from the environment variable name. Returns default_value if it's not set, or not a number between min_value and max_value
+int config_from_env(const char* name, int default_value, int min_value, int max_value){
+
+  const char* value = getenv(name);
+  char* end ;
+  long number ;
+
+  if (value == NULL)
+    return default_value;
+  number = strtol(value, &end, 10);
+  if (*value == '\0' || *end != '\0' || number < min_value || number > max_value){
+    printf("Ignoring %s=%s : expected a number between %d and %d, using %d\n", name, value, min_value, max_value, default_value);
+    return default_value;
   }
+  return (int)number;
+}
 
+// Waits for SIGINT and SIGUSR1 on the main thread, the only one taking them: prints the latency histograms for SIGUSR1, and closes the server for SIGINT. Never returns
+void wait_for_signals(const sigset_t* signals){
+
+  int numSignal ;
+
+  while (1) {
+    if ((errno = sigwait(signals, &numSignal)) != 0){
+      log_event(LOG_SYSTEM_ERROR, "calling sigwait", NULL, NULL, errno, 0, 0, 0);
+      continue;
+    }
+    // SIGUSR1 prints the latency histograms without stopping the server
+    if (numSignal == SIGUSR1)
+      print_latency_histograms();
+    if (numSignal == SIGINT){
+      close_server();
+      exit(0);
+    }
+  }
 }
 
-// Handler of signals SIGPIPE when writing on a closed socket, and SIGINT for closing the server
-void signalHandler (int numSignal){
-  if (numSignal == SIGINT){
-    printf("\nClosing the server ...\n\n");
-    if (climate_change_room == NULL || travel_related_room == NULL || horror_movies_room == NULL)
+// Stops the reactors, the workers and the other threads of the server, then writes the log, prints the statistics and frees the waitlists
+void close_server(){
+
+  uint64_t one = 1 ;
+
+  // Every reactor is woken up through its mailbox, and returns at the end of the turn
+  __atomic_store_n(&server_stopping, 1, __ATOMIC_RELEASE);
+  for (int i = 0; i < n_reactors; i++) {
+    if (!reactors[i].running)
+      continue;
+    if (write(reactors[i].mailbox_descriptor, &one, sizeof(one)) < 0)
+      log_event(LOG_SYSTEM_ERROR, "writing the reactor mailbox", NULL, NULL, errno, 0, 0, 0);
+    pthread_join(reactors[i].thread, NULL);
+  }
+  // The matchers may still post conversations, which are never served
+  workers_stop(&matching_workers);
+  // The metrics read the size of the waitlists
+  exporter_stop();
+  shards_stop();
+
+  // Writes what has been logged so far, so it comes before the last messages
+  log_shutdown();
+  printf("\nClosing the server ...\n\n");
+  for (int i = 0; i < rooms_count(); i++) {
+    if (rooms_get(i)->waitlist == NULL){
       printf("\nThere has been an error allocating data structures, try to restart the server.\n\n");
-    else{
-      destroy_list(climate_change_room);
-      destroy_list(travel_related_room);
-      destroy_list(horror_movies_room);
+      break;
     }
-    exit(0);
+    destroy_list(rooms_get(i)->waitlist);
   }
+  print_pool_stats(&client_pool);
+  print_pool_stats(&node_pool);
+  print_pool_stats(&conversation_pool);
+  for (int i = 0; i < BUFFER_CLASSES; i++)
+    print_pool_stats(&buffer_pools[i]);
+  print_latency_histograms();
+}
+
+// Handler of the signal SIGPIPE
+void signalHandler (int numSignal){
   if (numSignal == SIGPIPE){
-    printf("Error trying to send response to the client...\n\n");
+    log_event(LOG_BROKEN_PIPE, NULL, NULL, NULL, 0, 0, 0, 0);
   }
 }
 
-// Returns -1 for unknown or extraneous requests, a positive number which will indicates the type of request otherwise
-int parse_client_request(const char* request_buffer){
+// REACTOR FUNCTIONS
 
-  size_t less_index, major_index ;
-  char *find_less; // Less is intended to be the char '<'
-  char *find_major; // Major instead '>'
+// Event loop of a reactor. Waits for readiness events and dispatches them to the state machine of each connection. Returns once the server is closing
+void run_reactor(reactorInfo* reactor){
 
-  find_less = strchr(request_buffer,'<');
-  find_major = strchr(request_buffer,'>');
-  if ( find_less != NULL && find_major != NULL ){
+  struct epoll_event events[MAX_EVENTS];
+  int n_events;
+  thread_arg* client_info ;
+  struct timespec now, last_stall_check ;
 
-    less_index = (size_t)(find_less - request_buffer);
-    major_index = (size_t)(find_major - request_buffer);
+  if (use_io_uring){
+    run_uring_reactor(reactor);
+    return;
+  }
 
-    // If after the '>' there is somethig else, then wrong syntax
-    if (request_buffer[major_index+1]!='\n' && request_buffer[major_index+1]!='\0')
-      goto invalidSyntax ;
+  clock_gettime(CLOCK_MONOTONIC, &last_stall_check);
+  now = last_stall_check ;
 
-    // If the request doesn't start with //command: or //command:START , then wrong syntax
-    if (strncmp(request_buffer,"//command:",less_index)!=0){ //&& strncmp(request_buffer,"//command:START",less_index)!=0)
-      if(strncmp(request_buffer,"//command:START",less_index)!=0){
-        if(strncmp(request_buffer,"//command:NICKNAME",less_index)!=0){
-          goto invalidSyntax;
-        }else{
-          return 9;
-        }
-      }else{
-        if (strncmp(find_less,"<Climate change>", major_index-less_index+1 )==0 ){
-          return 2;
-        }else if (strncmp(find_less,"<Travel related>", major_index-less_index+1 )==0 ){
-          return 3;
-        }else if (strncmp(find_less,"<Horror movies>", major_index-less_index+1 )==0 ){
-          return 4;
-        }else{
-          return -2;
-        }
+  while (1) {
 
-      }
-    }else{
-      if (strncmp(find_less,"<USERS>", major_index-less_index+1 )==0 ){
-        return 1;
-      }else if( strncmp(find_less,"<REROLL>", major_index-less_index+1 )==0 ){
-        return 5;
-      }else if (strncmp( find_less,"<STOP>", major_index-less_index+1 )==0 ){
-        return 6;
-      }else if (strncmp( find_less,"<ROOMS>", major_index-less_index+1 )==0 ){
-        return 7;
-      }else if (strncmp( find_less,"<HELP>", major_index-less_index+1 )==0 ){
-        return 8;
+    n_events = epoll_wait(reactor->epoll_descriptor, events, MAX_EVENTS, reactor_timeout_ms(reactor, &now));
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    // close_server wakes up the reactor through the mailbox
+    if (__atomic_load_n(&server_stopping, __ATOMIC_ACQUIRE))
+      return;
+    if (n_events < 0){
+      if (errno != EINTR)
+        log_event(LOG_SYSTEM_ERROR, "calling epoll_wait", NULL, NULL, errno, 0, 0, 0);
+      continue;
+    }
+
+    // Timeouts and heartbeats due by now. The wheel is advanced before the events, so its tick timestamps them.
+    // The clients disconnected here are freed at the end of the batch, like the others
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wheel_advance(&reactor->timers, &now, expire_client_timer, reactor);
+
+    for (int i = 0; i < n_events; i++) {
+      if (events[i].data.ptr == &reactor->server_socket){
+        // The new connections are accepted once the other events of the batch have been served
+        reactor->accept_pending = 1 ;
+      }else if (events[i].data.ptr == &reactor->mailbox_descriptor){
+        serve_mailbox(reactor);
       }else{
-        return 0;
+        client_info = (thread_arg*)events[i].data.ptr ;
+        // A client handed over to another reactor earlier in this batch belongs to that reactor now, which may be writing the field right now
+        if (__atomic_load_n(&client_info->reactor, __ATOMIC_ACQUIRE) != reactor)
+          continue;
+        if ((events[i].events & EPOLLOUT) && client_info->state != STATE_CLOSED)
+          flush_client(client_info);
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+          serve_client(client_info);
+        // Nobody reads a waiting client, so its hangup is known only from the event, which may also hold the requests that made it wait
+        if (client_info->state == STATE_WAITING && (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+          drop_hung_up_client(client_info);
       }
     }
 
-  }else{
-    goto invalidSyntax;
+    // At most accept_batch connections for each turn, so a burst of connections doesn't keep the reactor from serving its clients
+    if (reactor->accept_pending)
+      accept_new_clients(reactor);
+
+    // Clients which don't read what we send for too long are dropped
+    if (elapsed_ms(&last_stall_check, &now) >= OUT_STALL_CHECK_MS){
+      drop_stalled_clients(reactor, &now);
+      last_stall_check = now ;
+    }
+
+    release_closed_clients(reactor);
   }
+}
 
-  invalidSyntax:
-  return -1 ;
+// Entrypoint of the thread of a reactor
+void *reactor_thread(void *arg){
+  run_reactor((reactorInfo*)arg);
+  return NULL;
 }
 
-// Entrypoint of the thread that will take care of established connections
-void *manage_a_single_client(void *arg) {
+// Takes every conversation and every connection posted to the mailbox of the reactor, and serves them in order
+void serve_mailbox(reactorInfo* reactor){
+
+  conversation_thread_arg* conversation_info ;
+  conversation_thread_arg* next_conversation ;
+  shardMessage* arrival ;
+  shardMessage* next_arrival ;
+  uint64_t n_posted;
+
+  // Resets the eventfd counter and takes every conversation posted so far in one go
+  read(reactor->mailbox_descriptor, &n_posted, sizeof(n_posted));
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  pthread_mutex_lock(&reactor->mailbox_mutex);
+  conversation_info = reactor->mailbox_head ;
+  reactor->mailbox_head = NULL ;
+  reactor->mailbox_tail = NULL ;
+  arrival = reactor->arrivals_head ;
+  reactor->arrivals_head = NULL ;
+  reactor->arrivals_tail = NULL ;
+  pthread_mutex_unlock(&reactor->mailbox_mutex);
+  while (conversation_info != NULL){
+    next_conversation = conversation_info->next ;
+    conversation_info->next = NULL ;
+    serve_posted_conversation(reactor, conversation_info);
+    conversation_info = next_conversation ;
+  }
+  while (arrival != NULL){
+    next_arrival = arrival->next ;
+    adopt_handed_over_client(reactor, arrival);
+    arrival = next_arrival ;
+  }
+}
 
-  thread_arg* client_info = (thread_arg*)arg;
-	char recv_buff[BUF_SIZE];
-  char send_buff[BUF_SIZE];
-	int n_read_char, dim_recv_messagge = 0;
+// Timeout of the wait for events: until the next tick with timers, or the next check for stalled clients while some client has queued bytes
+int reactor_timeout_ms(reactorInfo* reactor, const struct timespec* now){
 
-  // Main cicle serving the client
-	while (1){
+  int timeout_ms = wheel_timeout_ms(&reactor->timers, now);
 
-    int flags = 1;
-    if (setsockopt(client_info->client_sd, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags))){
-      goto gone_client;
+  // The stall check also arms again an accept of the ring stopped by an error
+  if ((reactor->backlogged_clients != NULL || (use_io_uring && !reactor->accept_armed)) && (timeout_ms < 0 || timeout_ms > OUT_STALL_CHECK_MS))
+    timeout_ms = OUT_STALL_CHECK_MS ;
+  // Connections left in the accept queue don't wait at all
+  if (reactor->accept_pending)
+    timeout_ms = 0 ;
+  return timeout_ms;
+}
+
+// Releases the clients disconnected during the turn, now that no event of the turn can point to them. With io_uring, the ones still pointed to by requests of the ring wait for their completions
+void release_closed_clients(reactorInfo* reactor){
+
+  thread_arg** link = &reactor->closed_clients ;
+  thread_arg* closed_client ;
+
+  while (*link != NULL){
+    closed_client = *link ;
+    if (closed_client->uring_requests > 0){
+      link = &closed_client->next ;
+      continue;
     }
+    *link = closed_client->next ;
+    pool_put(&client_pool, closed_client);
+  }
+}
 
-    n_read_char = read(client_info->client_sd, recv_buff+dim_recv_messagge, BUF_SIZE-dim_recv_messagge-1);
+// Accepts the connections pending on the (non blocking) listening socket of the reactor, at most accept_batch of them
+void accept_new_clients(reactorInfo* reactor){
 
-    if(n_read_char < 0){
-  		printf("\n Error receiveing message from the client \n");
-  	}else if(n_read_char > 0){
-      dim_recv_messagge += n_read_char;
-      // If the space in the buffer has finished, or newline appears in the string then we can try to process the request
-      if(dim_recv_messagge >= BUF_SIZE-1 || recv_buff[dim_recv_messagge-1] == '\n'){
-
-        if(dim_recv_messagge < BUF_SIZE-1)
-          recv_buff[dim_recv_messagge]='\0';
-        else // buffer is full and we truncate the read string
-          recv_buff[BUF_SIZE-1]='\0';
-
-        // LOGGING A NEW REQUEST
-        printf("\n-NEW REQUEST FROM CLIENT :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\nRequest : %s",client_info->nickname,client_info->client_sd,client_info->IP_address,recv_buff);
-
-        int request_type = parse_client_request(recv_buff);
-        if (request_type<0){ // Invalid syntax
-          if (request_type==-1){
-            sprintf(send_buff, "\nThe request can't be executed by the server because of the wrong syntax !\nExpected : //command:<...> OR //command:START<room name>\n");
-            printf("The request can't be executed by the server because of the wrong syntax !\n");
-          }
-          if (request_type==-2){
-            sprintf(send_buff, "\nThe request can't be executed by the server because there's no room with such name\n");
-            printf("The request can't be executed by the server because there's no room with such name\n");
-          }
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-        } else if ( request_type == 0 ){ // Syntax is right but the command has not been found
-          sprintf(send_buff, "\nThe request can't be executed by the server ! No command found !\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-          printf("The request can't be executed by the server ! No command found !\n");
-        } else if (request_type == 1){ // request : //command:<numberOfUsers>
-          int totalClimate = sizeOfTheList(climate_change_room);
-
-          int totalTravel = sizeOfTheList(travel_related_room);
-
-          int totalHorror = sizeOfTheList(horror_movies_room);
-
-          pthread_mutex_lock(&n_total_active_chats_mutex);
-          pthread_mutex_lock(&n_total_users_mutex);
-          sprintf(send_buff, "\n*** NUMBER OF USERS ***\n- Waiting in the \"Climate change\" room : %d \n- Waiting in the \"Travel related\" room : %d \n- Waiting in the \"Horror movies\" room : %d \n*** TOTAL NUMBER OF ACTIVE CHATS BETWEEN USERS : %d ***\n*** TOTAL NUMBER OF USERS CONNECTED : %d ***\n", totalClimate,totalTravel,totalHorror,totalNumberOfActiveChats,totalNumberOfUsers);
-          pthread_mutex_unlock(&n_total_active_chats_mutex);
-          pthread_mutex_unlock(&n_total_users_mutex);
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-        } else if (request_type == 2){
-          // if command:START<Climate change> add user info into the list of choice
-          linkedListNode* new_node ;
-          if ( (new_node=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-            new_node->data = client_info ;
-            new_node->next = NULL ;
-          }
-          insert_element(new_node,climate_change_room);
-          sprintf(send_buff, "\nLooking for someone to chat with in the \"Climate change\" room ...\nCtrl+C to exit ...\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-          return 0;
-          // exit this thread
-        } else if (request_type == 3){
-          // if command:START<Travel related> add user info into the list of choice
-          linkedListNode* new_node ;
-          if ( (new_node=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-            new_node->data = client_info ;
-            new_node->next = NULL ;
-          }
-          insert_element(new_node,travel_related_room);
-          sprintf(send_buff, "\nLooking for someone to chat with in the \"Travel related\" room ...\nCtrl+C to exit ...\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-          return 0;
-          // exit this thread
-        } else if (request_type == 4){
-          // if command:START<Horror movies> add user info into the list of choice
-          linkedListNode* new_node ;
-          if ( (new_node=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-            new_node->data = client_info ;
-            new_node->next = NULL ;
-          }
-          insert_element(new_node,horror_movies_room);
-          sprintf(send_buff, "\nLooking for someone to chat with in the \"Horror movies\" room ...\nCtrl+C to exit ...\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-          return 0;
-          // exit this thread
-        } else if (request_type == 7){
-          sprintf(send_buff, "\n*** AVAILABLE ROOMS ***\n-\"Climate change\" room : Greta would be proud of you \n-\"Travel related\" room : Do you enjoy going around the world ?  \n-\"Horror movies\" room : Creepy topics around here \n\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-        } else if (request_type == 8){
-          sprintf(send_buff, "--- LISTA DEI COMANDI DISPONIBILI ---\n* Visualizza numero di utenti per ogni stanza a tema             : //command:<USERS> \n* Visualizza quante e quali sono le stanze a tema disponibili    : //command:<ROOMS> \n* Avvia una chat casuale con un altro host all'interno di <room> : //command:START<room name> \n* Terminare immediatamente il programma in esecuzione            : Ctrl+D or Ctrl-C \n\n");
-          write(client_info->client_sd,send_buff,strlen(send_buff));
-        } else if (request_type == 9){
-
-          recv_buff[strlen(recv_buff)-1]='\0';// Removes '\n'
-          recv_buff[strlen(recv_buff)-1]='\0';// and '>' from the nickname
-          strcpy(client_info->nickname,recv_buff+19);
-
-          sprintf(send_buff, "Nickname impostato correttamente come : <%s>\n",client_info->nickname);
-          write(client_info->client_sd,send_buff,strlen(send_buff));
+  // Parameters for the accept
+  int client_socket;
+  struct sockaddr_in client_address ;
+  socklen_t client_addr_size ;
+  int n_accepted = 0 ;
+
+  while (accept_batch == 0 || n_accepted < accept_batch) {
 
+    client_addr_size = sizeof(client_address);
+    client_socket = accept4(reactor->server_socket, (struct sockaddr *)&client_address, &client_addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+
+    if (client_socket < 0){
+      // With an edge triggered listening socket we have to accept until the queue is empty, no new event would signal the connections left
+      if (errno == EAGAIN || errno == EWOULDBLOCK){
+        reactor->accept_pending = 0 ;
+        return;
+      }
+      if (errno == EINTR || errno == ECONNABORTED)
+        continue;
+      log_event(LOG_SYSTEM_ERROR, "calling accept", NULL, NULL, errno, 0, 0, 0);
+      // Out of descriptors or memory: the reactor tries again on the next connection
+      reactor->accept_pending = 0 ;
+      return;
+    }
+    n_accepted++ ;
+    welcome_client(reactor, client_socket, &client_address);
+  }
+}
+
+// Prepares the record of a connection just accepted, and starts serving it. address is NULL if the reactor didn't get it from accept.
+// Returns the record, NULL if the client has been disconnected
+thread_arg* welcome_client(reactorInfo* reactor, int client_socket, struct sockaddr_in* address){
+
+  struct sockaddr_in peer_address ;
+  socklen_t peer_address_size = sizeof(peer_address) ;
+
+  // Needed for printing the IP address of a client in a human readable format
+  const char* address_dot_format ;
+  char buffer_address_dot_format[INET_ADDRSTRLEN];
+
+  thread_arg* client_info;
+  struct epoll_event event ;
+
+  // A multishot accept of the ring doesn't give the addresses of the connections
+  if (address == NULL){
+    memset(&peer_address, 0, sizeof(peer_address));
+    getpeername(client_socket, (struct sockaddr *)&peer_address, &peer_address_size);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    address = &peer_address ;
+  }
+
+  // LOGGING NEW CONNECTIONS
+  address_dot_format = inet_ntop(AF_INET, &address->sin_addr, buffer_address_dot_format, INET_ADDRSTRLEN);
+  log_event(LOG_CLIENT_CONNECTED, address_dot_format, NULL, NULL, client_socket, 0, 0, 0);
+
+  // Preparing the record which will follow the client through every state
+  if ( (client_info = (thread_arg *)pool_get(&client_pool)) == NULL ){
+    log_event(LOG_SYSTEM_ERROR, "allocating a new client", NULL, NULL, errno, 0, 0, 0);
+    write(client_socket,reply_accept_error.text,reply_accept_error.len);
+    close(client_socket);
+    return NULL;
+  }
+
+  // Counted before anything can disconnect the client, so the number of connected users is never negative
+  metrics_add(METRIC_ACCEPTS, 1);
+
+  client_info->client_sd = client_socket ;
+  strcpy(client_info->IP_address, address_dot_format) ;
+  memset(client_info->nickname, '\0', sizeof(client_info->nickname));
+  client_info->nickname_len = 0 ;
+  client_info->last_chat = NULL ;
+  client_info->state = STATE_NICKNAME ;
+  client_info->conversation = NULL ;
+  // An idle client holds no buffer: the framer borrows one when there's something to read
+  framer_init(&client_info->recv_framer, NULL, 0);
+  set_relay_header(client_info);
+  client_info->splice_pipe[0] = -1 ;
+  client_info->splice_pipe[1] = -1 ;
+  client_info->out_buff = NULL ;
+  client_info->out_capacity = 0 ;
+  client_info->out_start = 0 ;
+  client_info->out_len = 0 ;
+  client_info->out_closing = 0 ;
+  client_info->out_flushed = 0 ;
+  client_info->out_timed_end = 0 ;
+  client_info->reads_paused = 0 ;
+  client_info->backlog_prev = NULL ;
+  client_info->backlog_next = NULL ;
+  __atomic_store_n(&client_info->reactor, reactor, __ATOMIC_RELEASE);
+  client_info->next = NULL ;
+  client_info->room = NULL ;
+  client_info->waiting_node = NULL ;
+  client_info->hung_up = 0 ;
+  client_info->recv_armed = 0 ;
+  client_info->recv_cancelled = 0 ;
+  client_info->recv_done = 0 ;
+  client_info->recv_error = 0 ;
+  client_info->recv_unread = 0 ;
+  client_info->spill_buff = NULL ;
+  client_info->spill_capacity = 0 ;
+  client_info->spill_start = 0 ;
+  client_info->spill_len = 0 ;
+  client_info->out_sending = NULL ;
+  client_info->out_sending_capacity = 0 ;
+  client_info->uring_requests = 0 ;
+  client_info->send_listed = 0 ;
+  client_info->send_next = NULL ;
+  client_info->handover = NULL ;
+  // The handshake timeout starts now
+  timer_init(&client_info->timer, client_info);
+  client_info->state_tick = wheel_now(&reactor->timers) ;
+  client_info->active_tick = client_info->state_tick ;
+  client_info->heartbeat_tick = client_info->state_tick ;
+  schedule_client_timer(client_info);
+
+  // With io_uring the socket is read by a multishot recv, and written by the sends the reactor submits at the end of each turn
+  if (use_io_uring){
+    uring_arm_recv(client_info);
+    return client_info;
+  }
+
+  // Edge triggered: the reactor is woken up once for every new burst of data, and the handlers read until EAGAIN.
+  // EPOLLOUT is reported only when a full socket gets space again, which is when its queue can be flushed
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET ;
+  event.data.ptr = client_info ;
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  if (epoll_ctl(reactor->epoll_descriptor, EPOLL_CTL_ADD, client_socket, &event) < 0){
+    log_event(LOG_SYSTEM_ERROR, "calling epoll_ctl", NULL, NULL, errno, 0, 0, 0);
+    disconnect_client(client_info);
+    return NULL;
+  }
+  return client_info;
+}
+
+// Serves a conversation found inside the mailbox of the reactor. The users of a conversation must be served by the same reactor, so the conversation
+// goes through the mailboxes of the reactors of both users, which hand them over to its reactor, before it starts there
+void serve_posted_conversation(reactorInfo* reactor, conversation_thread_arg* conversation_info){
+
+  thread_arg* users[2] = { conversation_info->firstUserInfo, conversation_info->secondUserInfo };
+  reactorInfo* owner ;
+  struct epoll_event event ;
+  struct timespec now ;
+  int n_failed = 0 ;
+
+  if (reactor != conversation_info->reactor){
+    // With io_uring the users move once no request of the ring points to them anymore
+    if (use_io_uring && uring_hold_handover(reactor, conversation_info))
+      return;
+    // Once out of the epoll instance and the backlog, nothing of this reactor points to the user. Its reactor stays NULL until the reactor of the conversation takes it.
+    // The field is written only by the reactor owning the user, this one here and the reactor of the conversation later, while the other reactors may read it at any time
+    for (int i = 0; i < 2; i++) {
+      if (__atomic_load_n(&users[i]->reactor, __ATOMIC_ACQUIRE) == reactor){
+        if (!use_io_uring){
+          epoll_ctl(reactor->epoll_descriptor, EPOLL_CTL_DEL, users[i]->client_sd, NULL);
+          metrics_add(METRIC_IO_SYSCALLS, 1);
         }
-        dim_recv_messagge = 0;
+        if (users[i]->out_len > 0)
+          unlink_backlogged_client(users[i]);
+        // The conversation arms the timer again on the new reactor
+        wheel_cancel(&reactor->timers, &users[i]->timer);
+        // Read without a lock by the events of this batch, see run_reactor
+        __atomic_store_n(&users[i]->reactor, NULL, __ATOMIC_RELEASE);
+        clock_gettime(CLOCK_MONOTONIC, &users[i]->moving_since);
       }
+    }
+    post_conversations_to_reactor(conversation_info->reactor, conversation_info, conversation_info);
+    return;
+  }
 
+  // A waiting user can only be handed over by its own reactor, which may be storing the field right now
+  for (int i = 0; i < 2; i++) {
+    owner = __atomic_load_n(&users[i]->reactor, __ATOMIC_ACQUIRE) ;
+    if (owner != NULL && owner != reactor){
+      post_conversations_to_reactor(owner, conversation_info, conversation_info);
+      return;
+    }
+  }
+
+  for (int i = 0; i < 2; i++) {
+    if (__atomic_load_n(&users[i]->reactor, __ATOMIC_ACQUIRE) != NULL)
+      continue;
+    __atomic_store_n(&users[i]->reactor, reactor, __ATOMIC_RELEASE);
+    // The migration costs the time the user spent without a reactor, going through the mailboxes
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metrics_add(METRIC_MIGRATIONS, 1);
+    metrics_observe(HISTOGRAM_MIGRATION_LATENCY, conversation_info->room->id, elapsed_us(&users[i]->moving_since, &now));
+    if (users[i]->out_len > 0)
+      link_backlogged_client(users[i]);
+    // The recv goes on on the ring of this reactor, with what was received so far already inside the record
+    if (use_io_uring){
+      uring_arm_recv(users[i]);
+      if (users[i]->out_len > 0)
+        uring_queue_send(users[i]);
+      continue;
+    }
+    // Registering the socket again reports what is already pending on it, like a new edge
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET ;
+    event.data.ptr = users[i] ;
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    if (epoll_ctl(reactor->epoll_descriptor, EPOLL_CTL_ADD, users[i]->client_sd, &event) < 0){
+      log_event(LOG_SYSTEM_ERROR, "calling epoll_ctl", NULL, NULL, errno, 0, 0, 0);
+      disconnect_client(users[i]);
+      n_failed++ ;
+    }
+  }
+
+  // A user who hung up while the matcher was pairing it never gets to chat
+  for (int i = 0; i < 2; i++) {
+    if (users[i]->state != STATE_CLOSED && users[i]->hung_up){
+      metrics_add(METRIC_WAITING_HANGUPS, 1);
+      disconnect_client(users[i]);
+      n_failed++ ;
+    }
+  }
+
+  if (n_failed > 0){
+    // The conversation never starts: it's counted as ended, and the user left goes back to the waitlist
+    metrics_add(METRIC_CONVERSATIONS_ENDED, 1);
+    __atomic_sub_fetch(&reactor->n_conversations, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < 2; i++) {
+      if (users[i]->state != STATE_CLOSED && put_in_waitlist(users[i], conversation_info->room) < 0)
+        disconnect_client(users[i]);
+    }
+    conversation_info->firstUserInfo = NULL;
+    conversation_info->secondUserInfo = NULL;
+    conversation_info->room = NULL;
+    pool_put(&conversation_pool, conversation_info);
+    return;
+  }
+
+  start_a_conversation(conversation_info);
+}
+
+// Serves a readable client socket according to the state of the connection, until the socket is drained or the client leaves
+void serve_client(thread_arg* client_info){
+
+  int state_changed = 1;
+
+  // When a request moves the client to another state, the rest of the data already in the socket belongs to the new state
+  while (state_changed) {
+    switch (client_info->state) {
+      case STATE_NICKNAME:
+      case STATE_LOBBY:
+        state_changed = manage_a_single_client(client_info);
+        break;
+      case STATE_IN_CONVERSATION:
+        state_changed = manage_a_conversation(client_info);
+        break;
+      default:
+        // Nobody reads the socket of a waiting client: what it sends stays in the kernel and it's served once the client has been paired
+        state_changed = 0;
+    }
+  }
+
+  // Every line read has been served: between two bursts the client holds nothing but its record
+  return_recv_buffer(client_info);
+}
+
+// Serves a client in STATE_NICKNAME or STATE_LOBBY. Returns 1 if the client changed state and the socket must be served again, 0 otherwise
+int manage_a_single_client(thread_arg* client_info) {
+
+  lineFramer* framer = &client_info->recv_framer ;
+  char* recv_buff ;
+  replyBuilder reply ;
+  const char* argument ;
+  logRecord* record ;
+  roomInfo* room ;
+  int n_read_char, request_len, argument_len, reply_len ;
+
+  // Reads until the socket is drained, as required by the edge triggered registration
+  while (1){
+
+    // Several requests may arrive in the same segment: every complete one is served before reading again
+    while ((recv_buff = framer_next_line(framer, &request_len)) != NULL) {
+
+      // LOGGING A NEW REQUEST
+      if ((record = log_begin(LOG_CLIENT_REQUEST)) != NULL){
+        log_text(record, 0, client_info->nickname, -1);
+        log_text(record, 1, client_info->IP_address, -1);
+        log_text(record, 2, recv_buff, recv_buff[request_len-1] == '\n' ? request_len-1 : request_len);
+        record->numbers[0] = client_info->client_sd ;
+        log_commit(record);
+      }
+
+      request_type request = parse_request(recv_buff, request_len, &argument, &argument_len);
+      metrics_add(METRIC_REQUESTS, 1);
+      if (request<0){ // Invalid syntax
+        log_event(LOG_REQUEST_REJECTED, NULL, NULL, NULL, request, 0, 0, 0);
+        send_to_client(client_info,reply_wrong_syntax.text,reply_wrong_syntax.len);
+      } else if ( request == REQUEST_UNKNOWN ){ // Syntax is right but the command has not been found
+        send_to_client(client_info,reply_no_command.text,reply_no_command.len);
+        log_event(LOG_REQUEST_REJECTED, NULL, NULL, NULL, request, 0, 0, 0);
+      } else if (request == REQUEST_USERS){ // request : //command:<numberOfUsers>
+        send_users_reply(client_info);
+      } else if (request == REQUEST_START && client_info->state == STATE_NICKNAME){
+        send_to_client(client_info,reply_nickname_first.text,reply_nickname_first.len);
+      } else if (request == REQUEST_START && (room = rooms_find(argument, argument_len)) == NULL){
+        log_event(LOG_REQUEST_REJECTED, NULL, NULL, NULL, REQUEST_NO_ROOM, 0, 0, 0);
+        send_to_client(client_info,reply_no_room.text,reply_no_room.len);
+      } else if (request == REQUEST_START && shard_of_room(room->id) != shard_self()){
+        // Another shard matches the users of this room: the connection moves there, with the bytes that follow the request
+        leave_for_shard(client_info, room);
+        return 1;
+      } else if (request == REQUEST_START){
+        // if command:START<room name> add user info into the waitlist of the room
+        if (enter_room(client_info,room) < 0)
+          goto gone_client;
+        return 1;
+      } else if (request == REQUEST_ROOMS){
+        // Built once, when the rooms are loaded
+        const char* rooms_reply = rooms_list_reply(&reply_len);
+        send_to_client(client_info,rooms_reply,reply_len);
+      } else if (request == REQUEST_HELP){
+        send_to_client(client_info,reply_help.text,reply_help.len);
+      } else if (request == REQUEST_NICKNAME){
+
+        // The nickname is the argument of the request, cut to the size of the field
+        if (argument_len > (int)sizeof(client_info->nickname)-1)
+          argument_len = (int)sizeof(client_info->nickname)-1 ;
+        memcpy(client_info->nickname,argument,argument_len);
+        client_info->nickname[argument_len] = '\0' ;
+        client_info->nickname_len = argument_len ;
+        set_relay_header(client_info);
+        client_info->state = STATE_LOBBY ;
+        client_info->state_tick = wheel_now(&client_info->reactor->timers) ;
+        schedule_client_timer(client_info);
+
+        reply_begin(&reply);
+        reply_add_fragment(&reply, &fragment_nickname_set);
+        reply_add(&reply, client_info->nickname, client_info->nickname_len);
+        reply_add_fragment(&reply, &fragment_nickname_set_end);
+        send_reply(client_info, &reply);
+
+      }
+    }
+
+    n_read_char = read_client(client_info);
+    if (n_read_char > 0){
+      metrics_add(METRIC_BYTES_IN, n_read_char);
+      // The timer is not moved: when it expires it finds the client active, and looks at the next deadline
+      client_info->active_tick = wheel_now(&client_info->reactor->timers) ;
+    }
+
+    if(n_read_char < 0){
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      if (errno == EINTR)
+        continue;
+      log_event(LOG_SYSTEM_ERROR, "receiving a message from the client", NULL, NULL, errno, 0, 0, 0);
+      goto gone_client;
     }else if(n_read_char == 0){
       // If read returns 0 the socket with the client and the connection has been closed
       goto gone_client;
     }
+  }
 
+  gone_client:
+  disconnect_client(client_info);
+  return 0;
+}
 
+// Moves what the client sent into its framer: read from the socket with epoll, taken from what the ring received with io_uring. Returns like framer_read
+ssize_t read_client(thread_arg* client_info){
+  if (borrow_recv_buffer(client_info) < 0){
+    errno = ENOMEM ;
+    return -1;
   }
+  if (use_io_uring)
+    return uring_read_client(client_info);
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  return framer_read(&client_info->recv_framer, client_info->client_sd);
+}
+
+// Lends the framer of the client a buffer, if it has none. Returns -1 if there's no memory, 0 otherwise
+int borrow_recv_buffer(thread_arg* client_info){
 
-   gone_client:
-   // LOGGING DISCONNECTIONS
-   printf("\n-A CLIENT DISCONNECTED :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\n",client_info->nickname,client_info->client_sd,client_info->IP_address);
-   close(client_info->client_sd);
-   free(client_info);
-   pthread_mutex_lock(&n_total_users_mutex);
-   totalNumberOfUsers--;
-   pthread_mutex_unlock(&n_total_users_mutex);
-   return 0; // Implicit call to pthread_exit
+  char* buffer ;
+  int capacity ;
 
+  if (client_info->recv_framer.storage != NULL)
+    return 0;
+  if ((buffer = buffer_get(BUF_SIZE, &capacity)) == NULL){
+    log_event(LOG_SYSTEM_ERROR, "lending a buffer to a client", NULL, NULL, errno, 0, 0, 0);
+    return -1;
+  }
+  // One byte is left for terminating a line in place
+  framer_init(&client_info->recv_framer, buffer, BUF_SIZE-1);
+  return 0;
 }
 
-// Entrypoint of the thread that will pair clients which look out for a conversation
-void *pair_clients(void *arg){
+// Gives back the buffer of the framer of the client once every byte inside it has been consumed
+void return_recv_buffer(thread_arg* client_info){
+  if (client_info->recv_framer.storage == NULL || framer_pending(&client_info->recv_framer) > 0)
+    return;
+  buffer_put(client_info->recv_framer.storage, BUF_SIZE);
+  framer_init(&client_info->recv_framer, NULL, 0);
+}
 
-  linkedList* waitlist = (linkedList*)arg;
+// Sends the reply to //command:<USERS> : the users waiting in every room, the active chats and the users connected
+void send_users_reply(thread_arg* client_info){
+
+  // Snapshot of the sharded counters : no lock is taken, so a USERS request never waits for the matchers
+  metricsSnapshot snapshot ;
+  char* reply ;
+  int len ;
+
+  metrics_snapshot(&snapshot);
+  // With several shards the counts of this one are only a part: the coordinator sums them up
+  shards_totals(&snapshot);
+  // A line for each room, so the reply grows with the registry
+  if ((reply = (char*)malloc(256 + snapshot.n_rooms * (ROOM_NAME_SIZE + 48))) == NULL){
+    log_event(LOG_SYSTEM_ERROR, "allocating the reply to USERS", NULL, NULL, errno, 0, 0, 0);
+    return;
+  }
+  len = sprintf(reply, "\n*** NUMBER OF USERS ***\n");
+  for (int r = 0; r < snapshot.n_rooms; r++)
+    len += sprintf(reply + len, "- Waiting in the \"%s\" room : %d \n", snapshot.room_names[r], snapshot.room_waiting[r]);
+  len += sprintf(reply + len, "*** TOTAL NUMBER OF ACTIVE CHATS BETWEEN USERS : %ld ***\n*** TOTAL NUMBER OF USERS CONNECTED : %ld ***\n", snapshot.active_chats, snapshot.users_connected);
+  send_to_client(client_info, reply, len);
+  free(reply);
+}
+
+// Relays what a client in STATE_IN_CONVERSATION writes to its partner. Returns 1 if the client changed state and the socket must be served again, 0 otherwise
+int manage_a_conversation(thread_arg* client_info){
+
+  conversation_thread_arg* conversation_info = client_info->conversation ;
+  thread_arg* partner_info ;
+  roomInfo* room_info = conversation_info->room ;
+  lineFramer* framer = &client_info->recv_framer ;
+  struct iovec relay[2];
+  char* line ;
+  request_type request ;
+  int n_read_char, line_len ;
+  struct timespec read_at ;
+  int timed = 0 ; // 1 once read_at holds the time of the last read, the lines read before this call are not timed
+  int room = conversation_info->room->id ;
+
+  if (conversation_info->firstUserInfo == client_info)
+    partner_info = conversation_info->secondUserInfo ;
+  else
+    partner_info = conversation_info->firstUserInfo ;
+
+  // The header with the nickname is built once, when the nickname is set
+  relay[0].iov_base = client_info->relay_header ;
+  relay[0].iov_len = client_info->relay_header_len ;
+  relay[1].iov_len = 0 ;
 
+  // Reads until the socket is drained, as required by the edge triggered registration
   while (1) {
-    int listSize = sizeOfTheList(waitlist);
-    if (listSize>1) {
-      // Tirare fuori due indici random
-      srand(time(NULL));
-      int firstUser = rand()%listSize;
-      int secondUser = rand()%listSize;
-      // Controllare che gli indici siano diversi, in caso contrario, sommare ad uno dei due 1 e fare modulo listSize
-      if (firstUser == secondUser){
-        secondUser = (secondUser+1)%listSize ;
+
+    // Backpressure: while the partner doesn't read, the client isn't read either. flush_client resumes it
+    if (partner_info->out_len > OUT_HIGH_WATER){
+      client_info->reads_paused = 1 ;
+      return 0;
+    }
+
+    // The complete lines are contiguous inside the framer, so all of them are relayed with a single writev, up to the first REROLL or STOP
+    while ((line = framer_next_line(framer, &line_len)) != NULL) {
+      // Any other command is relayed as chat
+      request = parse_request(line, line_len, NULL, NULL);
+      if (request == REQUEST_REROLL || request == REQUEST_STOP){
+        // The lines before the command are relayed before the conversation ends
+        if (relay[1].iov_len > 0 && sendv_to_client(partner_info,relay,2) == 0 && timed)
+          time_a_relay(partner_info, &read_at, room);
+        if (request == REQUEST_REROLL)
+          goto reroll ;
+        goto user_stopped ;
       }
-      // accediamo via accessByIndex
-      linkedListNode* firstUserNode = accessByIndex(firstUser,waitlist);
-      linkedListNode* secondUserNode = accessByIndex(secondUser,waitlist);
-
-      thread_arg* firstUserInfo = NULL ;
-      thread_arg* secondUserInfo = NULL ;
-      if (firstUserNode!=NULL && secondUserNode!=NULL){
-        firstUserInfo = firstUserNode->data;
-        secondUserInfo = secondUserNode->data;
+      if (relay[1].iov_len == 0)
+        relay[1].iov_base = line ;
+      relay[1].iov_len += line_len ;
+      metrics_add(METRIC_MESSAGES_RELAYED, 1);
+    }
+    if (relay[1].iov_len > 0){
+      // The latency of a run of lines is measured from the read which completed them
+      if (sendv_to_client(partner_info,relay,2) == 0 && timed)
+        time_a_relay(partner_info, &read_at, room);
+      relay[1].iov_len = 0 ;
+      continue;
+    }
+
+#if USE_SPLICE_RELAY
+    // Large pastes go from socket to socket through a pipe, without being copied in user space. With io_uring the ring has already read them
+    if (!use_io_uring && splice_a_paste(client_info, partner_info) > 0)
+      continue;
+#endif
+
+    n_read_char = read_client(client_info);
+    if (n_read_char > 0){
+      metrics_add(METRIC_BYTES_IN, n_read_char);
+      clock_gettime(CLOCK_MONOTONIC, &read_at);
+      timed = 1 ;
+      client_info->active_tick = wheel_now(&client_info->reactor->timers) ;
+    }
+
+    if (n_read_char < 0){
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+        return 0;
+      if (errno == EINTR)
+        continue;
+      goto user_disconnected;
+    }else if (n_read_char == 0){
+      // Reading 0 means the client has disconnected
+      goto user_disconnected;
+    }
+  }
+
+  user_stopped:
+  // Comunica al partner che è finita la conversazione
+  send_partner_left(partner_info, client_info);
+  send_to_client(client_info,reply_stopped.text,reply_stopped.len);
+
+  // Il partner torna in attesa di chattare, mentre chi ha chiuso torna nella lobby
+  end_a_conversation(client_info);
+  return 1;
+
+  user_disconnected:
+  // Comunica al partner che è finita la conversazione
+  send_partner_left(partner_info, client_info);
+
+  end_a_conversation(client_info);
+  disconnect_client(client_info);
+  return 0;
+
+  reroll:
+  send_to_client(client_info,reply_rerolled.text,reply_rerolled.len);
+  send_to_client(partner_info,reply_rerolled.text,reply_rerolled.len);
+
+  end_a_conversation(client_info);
+  if (put_in_waitlist(client_info, room_info) < 0){
+    disconnect_client(client_info);
+    return 0;
+  }
+  return 1;
+}
+
+#if USE_SPLICE_RELAY
+// Relays with splice the data pending on the socket of client_info, if they are at least SPLICE_THRESHOLD bytes and don't start with a command. The paste is relayed as it is, without looking for lines inside it.
+// Returns 1 if the data has been relayed, 0 if it has to be read the usual way
+int splice_a_paste(thread_arg* client_info, thread_arg* partner_info){
+
+  int pending, n_peeked, drain_capacity = 0 ;
+  ssize_t n_moved, n_sent ;
+  char peek_buff[COMMAND_PREFIX_LEN];
+  char* drain_buff = NULL ; // Borrowed only if the pipe has to be drained
+
+  // Bytes already queued for the partner, or already read from the client, must go out first: splice is used only when both are empty
+  if (partner_info->out_len > 0 || framer_pending(&client_info->recv_framer) > 0)
+    return 0;
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  if (ioctl(client_info->client_sd, FIONREAD, &pending) < 0 || pending < SPLICE_THRESHOLD)
+    return 0;
+  // Commands must be parsed, so anything that may be one is read the usual way
+  n_peeked = recv(client_info->client_sd, peek_buff, COMMAND_PREFIX_LEN, MSG_PEEK);
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  if (n_peeked <= 0 || strncmp(peek_buff, COMMAND_PREFIX, n_peeked) == 0)
+    return 0;
+  // The pipe is created the first time the client pastes something big, and kept until it disconnects
+  if (client_info->splice_pipe[0] < 0 && pipe2(client_info->splice_pipe, O_NONBLOCK | O_CLOEXEC) < 0)
+    return 0;
+
+  if (send_to_client(partner_info, client_info->relay_header, client_info->relay_header_len) < 0)
+    return 0;
+  metrics_add(METRIC_MESSAGES_RELAYED, 1);
+
+  // Once something has been queued for the partner, the rest of the paste is read the usual way to keep the order
+  while (pending > 0 && partner_info->out_len == 0) {
+    n_moved = splice(client_info->client_sd, NULL, client_info->splice_pipe[1], NULL, pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    if (n_moved <= 0)
+      break;
+    pending -= n_moved ;
+    metrics_add(METRIC_BYTES_IN, n_moved);
+    client_info->active_tick = wheel_now(&client_info->reactor->timers) ;
+    while (n_moved > 0) {
+      n_sent = splice(client_info->splice_pipe[0], NULL, partner_info->client_sd, NULL, n_moved, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      metrics_add(METRIC_IO_SYSCALLS, 1);
+      if (n_sent <= 0)
+        break;
+      n_moved -= n_sent ;
+      metrics_add(METRIC_BYTES_OUT, n_sent);
+    }
+    // The partner's socket is full: the pipe must be emptied anyway, so what is left goes to the partner's queue
+    while (n_moved > 0) {
+      if (drain_buff == NULL && (drain_buff = buffer_get(BUF_SIZE, &drain_capacity)) == NULL){
+        log_event(LOG_SYSTEM_ERROR, "lending a buffer to drain a pipe", NULL, NULL, errno, 0, 0, 0);
+        break;
       }
+      n_sent = read(client_info->splice_pipe[0], drain_buff, n_moved < drain_capacity ? n_moved : drain_capacity);
+      metrics_add(METRIC_IO_SYSCALLS, 1);
+      if (n_sent <= 0)
+        break;
+      send_to_client(partner_info, drain_buff, n_sent);
+      n_moved -= n_sent ;
+    }
+  }
+  buffer_put(drain_buff, drain_capacity);
+  return 1;
+}
+#endif
+
+// Starts a conversation matched by match_room, once both users are served by the reactor of the conversation
+void start_a_conversation(conversation_thread_arg* conversation_info){
+
+  thread_arg* firstUserInfo = conversation_info->firstUserInfo ;
+  thread_arg* secondUserInfo = conversation_info->secondUserInfo ;
+
+  firstUserInfo->state = STATE_IN_CONVERSATION ;
+  firstUserInfo->conversation = conversation_info ;
+  firstUserInfo->state_tick = wheel_now(&firstUserInfo->reactor->timers) ;
+  schedule_client_timer(firstUserInfo);
+  secondUserInfo->state = STATE_IN_CONVERSATION ;
+  secondUserInfo->conversation = conversation_info ;
+  secondUserInfo->state_tick = wheel_now(&secondUserInfo->reactor->timers) ;
+  schedule_client_timer(secondUserInfo);
+
+  send_new_match(firstUserInfo, secondUserInfo);
+  send_new_match(secondUserInfo, firstUserInfo);
+
+  // Whatever the two clients sent while waiting is still inside the sockets, and no new edge will signal it
+  serve_client(firstUserInfo);
+  // The first user may have already closed the conversation, moving the second one back to the waitlist
+  if (secondUserInfo->state == STATE_IN_CONVERSATION)
+    serve_client(secondUserInfo);
+}
 
-      if(firstUserInfo!=NULL && secondUserInfo!=NULL){
-
-        // Invariante : gli utenti sono diversi, pertanto se uno dei due non è mai stato accoppiato con nessun altro (last_chat==NULL) oppure entrambi hanno parlato con due persone diverse procediamo
-        if (firstUserInfo->last_chat==NULL || secondUserInfo->last_chat==NULL || (firstUserInfo->last_chat!=(struct client_inf*)secondUserInfo && secondUserInfo->last_chat!=(struct client_inf*)firstUserInfo)){
-          // aggiorna le due last chat
-          firstUserInfo->last_chat=(struct client_inf*)secondUserInfo;
-          secondUserInfo->last_chat=(struct client_inf*)firstUserInfo;
-          // rimuovere i due utenti dalla waitlist
-          remove_element(firstUserNode, waitlist);
-          remove_element(secondUserNode, waitlist);
-          // Tiene conto della nuova conversazione avviata
-          pthread_mutex_lock(&n_total_active_chats_mutex);
-          totalNumberOfActiveChats++;
-          pthread_mutex_unlock(&n_total_active_chats_mutex);
-
-          // lancia conversazione
-          conversation_thread_arg* conversation_info = (conversation_thread_arg*)malloc(sizeof(conversation_thread_arg));
-          conversation_info->firstUserInfo = firstUserInfo;
-          conversation_info->secondUserInfo = secondUserInfo;
-          conversation_info->waitlist = waitlist;
-          pthread_t tinfo;
-          int err;
-
-          // If there is any error launching the manage_a_conversation thread the server will put both users in the waitlist
-          if ( (err=pthread_create(&tinfo, NULL, manage_a_conversation, (void*)conversation_info) ) ) {
-              printf("Error calling pthread_create manage_a_conversation : %s\n", strerror(err));
-
-              firstUserInfo->last_chat=NULL;
-              secondUserInfo->last_chat=NULL;
-
-              linkedListNode* new_node ;
-              if ( (new_node=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-                new_node->data = firstUserInfo ;
-                new_node->next = NULL ;
-              }
-              insert_element(new_node,waitlist);
-              if ( (new_node=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-                new_node->data = secondUserInfo ;
-                new_node->next = NULL ;
-              }
-              insert_element(new_node,waitlist);
+// Ends the conversation of client_info and puts the partner back in the waitlist. Gives conversation_info back to conversation_pool
+void end_a_conversation(thread_arg* client_info){
 
-              pthread_mutex_lock(&n_total_active_chats_mutex);
-              totalNumberOfActiveChats--;
-              pthread_mutex_unlock(&n_total_active_chats_mutex);
+  conversation_thread_arg* conversation_info = client_info->conversation ;
+  thread_arg* partner_info ;
 
-              conversation_info->firstUserInfo = NULL;
-              conversation_info->secondUserInfo = NULL;
-              conversation_info->waitlist = NULL;
-              free (conversation_info);
-           }
-           if(!err){
-            pthread_detach(tinfo);
-          }
+  if (conversation_info->firstUserInfo == client_info)
+    partner_info = conversation_info->secondUserInfo ;
+  else
+    partner_info = conversation_info->firstUserInfo ;
+
+  metrics_add(METRIC_CONVERSATIONS_ENDED, 1);
+  __atomic_sub_fetch(&conversation_info->reactor->n_conversations, 1, __ATOMIC_RELAXED);
+
+  client_info->state = STATE_LOBBY ;
+  client_info->conversation = NULL ;
+  client_info->reads_paused = 0 ;
+  client_info->state_tick = wheel_now(&client_info->reactor->timers) ;
+  schedule_client_timer(client_info);
+  partner_info->conversation = NULL ;
+  partner_info->reads_paused = 0 ;
+
+  // Fa ritornare il partner in attesa di chattare
+  if (put_in_waitlist(partner_info, conversation_info->room) < 0)
+    disconnect_client(partner_info);
+
+  conversation_info->firstUserInfo = NULL;
+  conversation_info->secondUserInfo = NULL;
+  conversation_info->room = NULL;
+  pool_put(&conversation_pool, conversation_info);
+}
+
+// Inserts the client inside the waitlist of the room and moves it to STATE_WAITING. Returns -1 if the node can't be allocated or inserted
+int put_in_waitlist(thread_arg* client_info, roomInfo* room){
+
+  linkedListNode* new_node ;
+  client_state previous_state = client_info->state ;
+
+  if ( (new_node=(linkedListNode*)pool_get(&node_pool)) == NULL ){
+    log_event(LOG_SYSTEM_ERROR, "allocating a waitlist node", NULL, NULL, errno, 0, 0, 0);
+    return -1;
+  }
+  new_node->data = client_info ;
+  new_node->index = -1 ;
+  // The state has to change before the insertion, since from now on the matcher can pair the client at any time
+  client_info->state = STATE_WAITING ;
+  client_info->room = room ;
+  client_info->waiting_node = new_node ;
+  clock_gettime(CLOCK_MONOTONIC, &client_info->waiting_since);
+  if (insert_element(new_node,room->waitlist) < 0){
+    log_event(LOG_SYSTEM_ERROR, "growing the waitlist", NULL, NULL, errno, 0, 0, 0);
+    client_info->state = previous_state ;
+    client_info->waiting_node = NULL ;
+    pool_put(&node_pool, new_node);
+    return -1;
+  }
+  wake_matcher(room);
+  // The waiting timeout starts now
+  client_info->state_tick = wheel_now(&client_info->reactor->timers) ;
+  schedule_client_timer(client_info);
+  return 0;
+}
+
+// Answers a START : puts the client inside the waitlist of the room and tells it. Returns -1 if the node can't be allocated
+int enter_room(thread_arg* client_info, roomInfo* room){
+
+  replyBuilder reply ;
+
+  if (put_in_waitlist(client_info,room) < 0)
+    return -1;
+  reply_begin(&reply);
+  reply_add_fragment(&reply, &fragment_looking);
+  reply_add(&reply, room->name, room->name_len);
+  reply_add_fragment(&reply, &fragment_looking_end);
+  send_reply(client_info, &reply);
+  return 0;
+}
+
+// Closes the socket and releases every resource held by a client
+void disconnect_client(thread_arg* client_info){
+
+  // LOGGING DISCONNECTIONS
+  log_event(LOG_CLIENT_DISCONNECTED, client_info->nickname, client_info->IP_address, NULL, client_info->client_sd, 0, 0, 0);
+  // The requests of the ring keep the socket open after close: once it's shut down they complete, and then the record can be released.
+  // Everything is queued with io_uring, so the last reply is written now, as epoll would have done
+  if (use_io_uring){
+    if (client_info->out_len > 0 && client_info->out_sending == NULL){
+      send(client_info->client_sd, client_info->out_buff + client_info->out_start, client_info->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+      metrics_add(METRIC_IO_SYSCALLS, 1);
+    }
+    shutdown(client_info->client_sd, SHUT_RDWR);
+  }
+  release_client(client_info);
+}
+
+// Closes the descriptor of the client and releases its record at the end of the turn, without touching the connection itself
+void release_client(thread_arg* client_info){
+
+  // Closing the descriptor removes it from the epoll instance too, unless another process holds the connection
+  close(client_info->client_sd);
+  if (client_info->splice_pipe[0] >= 0){
+    close(client_info->splice_pipe[0]);
+    close(client_info->splice_pipe[1]);
+  }
+  // The bytes still queued are lost together with the connection, or have been copied for the shard taking it
+  if (client_info->out_len > 0)
+    unlink_backlogged_client(client_info);
+  wheel_cancel(&client_info->reactor->timers, &client_info->timer);
+  // A buffer read by a send in flight is given back when the send completes
+  if (client_info->out_buff != client_info->out_sending)
+    buffer_put(client_info->out_buff, client_info->out_capacity);
+  client_info->out_buff = NULL ;
+  client_info->out_len = 0 ;
+  buffer_put(client_info->spill_buff, client_info->spill_capacity);
+  client_info->spill_buff = NULL ;
+  client_info->spill_len = 0 ;
+  buffer_put(client_info->recv_framer.storage, BUF_SIZE);
+  framer_init(&client_info->recv_framer, NULL, 0);
+  client_info->state = STATE_CLOSED ;
+  client_info->next = client_info->reactor->closed_clients ;
+  client_info->reactor->closed_clients = client_info ;
+
+  // A connection handed over to another shard is counted there from now on
+  metrics_add(METRIC_DISCONNECTS, 1);
+}
+
+// Takes a waiting client which closed its connection out of the waitlist in O(1), and disconnects it. If a matcher holds the client right now,
+// the client is marked as hung up: its timer tries again on the next tick, unless the matcher pairs it and the reactor of the conversation finds the mark first
+void drop_hung_up_client(thread_arg* client_info){
+
+  // From now on the matchers leave the client in the waitlist
+  __atomic_store_n(&client_info->hung_up, 1, __ATOMIC_RELAXED);
+  if (remove_element(client_info->waiting_node, client_info, client_info->room->waitlist) < 0){
+    wheel_arm(&client_info->reactor->timers, &client_info->timer, wheel_now(&client_info->reactor->timers));
+    return;
+  }
+  client_info->waiting_node = NULL ;
+  metrics_add(METRIC_WAITING_HANGUPS, 1);
+  disconnect_client(client_info);
+}
+
+// TIMER FUNCTIONS
+
+// Arms the timer of the client for its next timeout or heartbeat, according to its state. To be called whenever the client changes state
+void schedule_client_timer(thread_arg* client_info){
+
+  uint64_t next_tick = UINT64_MAX ;
+  // A client is idle since its last read or, if it came later, since it entered its state
+  uint64_t idle_since = client_info->active_tick > client_info->state_tick ? client_info->active_tick : client_info->state_tick ;
+
+  switch (client_info->state) {
+    case STATE_NICKNAME:
+      if (handshake_ticks > 0)
+        next_tick = client_info->state_tick + handshake_ticks ;
+      break;
+    case STATE_WAITING:
+      if (waiting_ticks > 0)
+        next_tick = client_info->state_tick + waiting_ticks ;
+      break;
+    case STATE_LOBBY:
+    case STATE_IN_CONVERSATION:
+      if (idle_ticks > 0)
+        next_tick = idle_since + idle_ticks ;
+      break;
+    default:
+      wheel_cancel(&client_info->reactor->timers, &client_info->timer);
+      return;
+  }
+  // The heartbeats start once the client has a nickname
+  if (heartbeat_ticks > 0 && client_info->state != STATE_NICKNAME){
+    uint64_t heartbeat_since = client_info->heartbeat_tick > idle_since ? client_info->heartbeat_tick : idle_since ;
+    if (heartbeat_since + heartbeat_ticks < next_tick)
+      next_tick = heartbeat_since + heartbeat_ticks ;
+  }
+
+  if (next_tick == UINT64_MAX)
+    wheel_cancel(&client_info->reactor->timers, &client_info->timer);
+  else
+    wheel_arm(&client_info->reactor->timers, &client_info->timer, next_tick);
+}
+
+// Called by the timer wheel of the reactor when the timer of a client expires: applies the timeout of its state, or sends a heartbeat
+void expire_client_timer(wheelTimer* timer, void* context){
+
+  thread_arg* client_info = (thread_arg*)timer->owner ;
+  reactorInfo* reactor = (reactorInfo*)context ;
+  uint64_t now_tick = wheel_now(&reactor->timers) ;
+  uint64_t idle_since = client_info->active_tick > client_info->state_tick ? client_info->active_tick : client_info->state_tick ;
+  uint64_t heartbeat_since = client_info->heartbeat_tick > idle_since ? client_info->heartbeat_tick : idle_since ;
+  replyBuilder reply ;
+  thread_arg* partner_info ;
+
+  switch (client_info->state) {
+    case STATE_NICKNAME:
+      if (handshake_ticks > 0 && now_tick >= client_info->state_tick + handshake_ticks){
+        disconnect_timed_out_client(client_info, &reply_no_nickname, "no nickname chosen", METRIC_HANDSHAKE_TIMEOUTS);
+        return;
+      }
+      break;
+    case STATE_LOBBY:
+      if (idle_ticks > 0 && now_tick >= idle_since + idle_ticks){
+        disconnect_timed_out_client(client_info, &reply_idle_lobby, "idle in the lobby", METRIC_IDLE_TIMEOUTS);
+        return;
+      }
+      break;
+    case STATE_IN_CONVERSATION:
+      if (idle_ticks > 0 && now_tick >= idle_since + idle_ticks){
+        // Like a STOP: the partner looks for someone else, the idle client goes back to the lobby, where it has a whole idle timeout again
+        log_event(LOG_CLIENT_TIMEOUT, client_info->nickname, client_info->IP_address, "idle in a conversation", client_info->client_sd, 0, 0, 0);
+        metrics_add(METRIC_IDLE_TIMEOUTS, 1);
+        partner_info = client_info->conversation->firstUserInfo == client_info ? client_info->conversation->secondUserInfo : client_info->conversation->firstUserInfo ;
+        send_partner_left(partner_info, client_info);
+        send_to_client(client_info,reply_idle_conversation.text,reply_idle_conversation.len);
+        end_a_conversation(client_info);
+        return;
+      }
+      break;
+    case STATE_WAITING:
+      if (client_info->hung_up){
+        drop_hung_up_client(client_info);
+        return;
+      }
+      if (waiting_ticks > 0 && now_tick >= client_info->state_tick + waiting_ticks){
+        // A matcher holding the user may be pairing it right now: the user can leave only if it's still inside the waitlist
+        if (remove_element(client_info->waiting_node, client_info, client_info->room->waitlist) < 0){
+          wheel_arm(&reactor->timers, &client_info->timer, now_tick + WHEEL_TICKS(WAITING_RETRY_MS));
+          return;
         }
+        log_event(LOG_CLIENT_TIMEOUT, client_info->nickname, client_info->IP_address, "nobody to chat with", client_info->client_sd, 0, 0, 0);
+        metrics_add(METRIC_WAITING_TIMEOUTS, 1);
+        client_info->waiting_node = NULL ;
+        client_info->state = STATE_LOBBY ;
+        client_info->state_tick = now_tick ;
+        reply_begin(&reply);
+        reply_add_fragment(&reply, &fragment_nobody_came);
+        reply_add(&reply, client_info->room->name, client_info->room->name_len);
+        reply_add_fragment(&reply, &fragment_nobody_came_end);
+        send_reply(client_info, &reply);
+        schedule_client_timer(client_info);
+        // Whatever the client sent while waiting is still inside the socket, and no new edge will signal it
+        serve_client(client_info);
+        return;
       }
+      break;
+    default:
+      return;
+  }
+
+  if (heartbeat_ticks > 0 && client_info->state != STATE_NICKNAME && now_tick >= heartbeat_since + heartbeat_ticks){
+    client_info->heartbeat_tick = now_tick ;
+    metrics_add(METRIC_HEARTBEATS, 1);
+    send_to_client(client_info, reply_heartbeat.text, reply_heartbeat.len);
+  }
+  schedule_client_timer(client_info);
+}
+
+// Disconnects a client whose timeout expired, after telling it why
+void disconnect_timed_out_client(thread_arg* client_info, const replyFragment* message, const char* timeout, metricId metric){
+  log_event(LOG_CLIENT_TIMEOUT, client_info->nickname, client_info->IP_address, timeout, client_info->client_sd, 0, 0, 0);
+  metrics_add(metric, 1);
+  send_to_client(client_info, message->text, message->len);
+  disconnect_client(client_info);
+}
+
+// OUTPUT FUNCTIONS
+
+// Sends len bytes to the client, queueing what the socket can't take now. Returns -1 if the client is gone or has been dropped, 0 otherwise
+int send_to_client(thread_arg* client_info, const char* data, int len){
+  struct iovec message ;
+  message.iov_base = (void*)data ;
+  message.iov_len = len ;
+  return sendv_to_client(client_info, &message, 1);
+}
+
+// Sends the reply assembled inside the builder with a single writev
+int send_reply(thread_arg* client_info, const replyBuilder* reply){
+  return sendv_to_client(client_info, reply->fragments, reply->n_fragments);
+}
+
+// Tells the partner that left_info has left the conversation, and that it's looking for someone else
+void send_partner_left(thread_arg* partner_info, thread_arg* left_info){
+  replyBuilder reply ;
+  reply_begin(&reply);
+  reply_add_fragment(&reply, &fragment_partner_left);
+  reply_add(&reply, left_info->nickname, left_info->nickname_len);
+  reply_add_fragment(&reply, &fragment_partner_left_end);
+  send_reply(partner_info, &reply);
+}
+
+// Tells the client it has been matched with partner_info
+void send_new_match(thread_arg* client_info, thread_arg* partner_info){
+  replyBuilder reply ;
+  reply_begin(&reply);
+  reply_add_fragment(&reply, &fragment_new_match);
+  reply_add(&reply, partner_info->nickname, partner_info->nickname_len);
+  reply_add_fragment(&reply, &fragment_new_match_end);
+  send_reply(client_info, &reply);
+}
+
+// Builds the "-- <nickname> --" header of the relayed messages of the client, from its current nickname
+void set_relay_header(thread_arg* client_info){
+  char* header = client_info->relay_header ;
+  memcpy(header, "\n-- <", 5);
+  memcpy(header + 5, client_info->nickname, client_info->nickname_len);
+  memcpy(header + 5 + client_info->nickname_len, "> --\n", 5);
+  client_info->relay_header_len = client_info->nickname_len + 10 ;
+}
+
+// Same as send_to_client, for iovcnt buffers sent in order with a single writev
+int sendv_to_client(thread_arg* client_info, const struct iovec* iov, int iovcnt){
+
+  ssize_t n_written = 0 ;
+  int total = 0 ;
+
+  if (client_info->state == STATE_CLOSED || client_info->out_closing)
+    return -1;
+
+  for (int i = 0; i < iovcnt; i++)
+    total += iov[i].iov_len ;
+  if (total == 0)
+    return 0;
+
+  // Writing directly is allowed only when nothing is queued, otherwise the bytes would overtake the queue.
+  // With io_uring everything is queued, and the queue goes out with one send at the end of the turn
+  if (client_info->out_len == 0 && !use_io_uring){
+    do {
+      n_written = writev(client_info->client_sd, iov, iovcnt);
+      metrics_add(METRIC_IO_SYSCALLS, 1);
+    } while (n_written < 0 && errno == EINTR);
+    if (n_written < 0){
+      // A broken socket is found and disconnected by the read side
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+        return -1;
+      n_written = 0 ;
+    }
+    metrics_add(METRIC_BYTES_OUT, n_written);
+    if (n_written == total)
+      return 0;
+  }
+
+  if (client_info->out_len + total - n_written > OUT_QUEUE_LIMIT){
+    drop_slow_client(client_info, "too many bytes queued");
+    return -1;
+  }
+
+  // Makes room at the end of the queue, first moving the queued bytes to the start of the buffer, then to a bigger buffer of the pools.
+  // A send in flight reads the buffer, so the queued bytes can't move inside it: they go to another buffer, and the old one is given back when the send completes
+  if (client_info->out_start + client_info->out_len + total - n_written > client_info->out_capacity){
+    if (client_info->out_start > 0 && client_info->out_len + total - n_written <= client_info->out_capacity && client_info->out_buff != client_info->out_sending){
+      memmove(client_info->out_buff, client_info->out_buff + client_info->out_start, client_info->out_len);
+      client_info->out_start = 0 ;
+    }else{
+      int new_capacity = client_info->out_capacity > 0 ? client_info->out_capacity : BUF_SIZE ;
+      while (new_capacity < client_info->out_len + total - n_written)
+        new_capacity *= 2 ;
+      if (new_capacity > OUT_QUEUE_LIMIT)
+        new_capacity = OUT_QUEUE_LIMIT ;
+      char* new_buff = buffer_get(new_capacity, &new_capacity);
+      if (new_buff == NULL){
+        drop_slow_client(client_info, "no memory for its queue");
+        return -1;
+      }
+      if (client_info->out_len > 0)
+        memcpy(new_buff, client_info->out_buff + client_info->out_start, client_info->out_len);
+      if (client_info->out_buff != client_info->out_sending)
+        buffer_put(client_info->out_buff, client_info->out_capacity);
+      client_info->out_buff = new_buff ;
+      client_info->out_capacity = new_capacity ;
+      client_info->out_start = 0 ;
+    }
+  }
+
+  // Copies what the socket didn't take, skipping the n_written bytes already sent
+  char* tail = client_info->out_buff + client_info->out_start + client_info->out_len ;
+  for (int i = 0; i < iovcnt; i++) {
+    if (n_written >= (ssize_t)iov[i].iov_len){
+      n_written -= iov[i].iov_len ;
+      continue;
+    }
+    memcpy(tail, (char*)iov[i].iov_base + n_written, iov[i].iov_len - n_written);
+    tail += iov[i].iov_len - n_written ;
+    n_written = 0 ;
+  }
+
+  // The client enters the backlog when its queue starts
+  if (client_info->out_len == 0){
+    clock_gettime(CLOCK_MONOTONIC, &client_info->out_progress);
+    client_info->out_unsent = -1 ;
+    link_backlogged_client(client_info);
+  }
+  client_info->out_len = tail - (client_info->out_buff + client_info->out_start) ;
+  if (use_io_uring)
+    uring_queue_send(client_info);
+  return 0;
+}
+
+// Writes the bytes queued for a writable client. Resumes its partner once the queue goes under OUT_LOW_WATER
+void flush_client(thread_arg* client_info){
+
+  ssize_t n_written ;
+
+  while (client_info->out_len > 0) {
+    n_written = write(client_info->client_sd, client_info->out_buff + client_info->out_start, client_info->out_len);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    if (n_written < 0){
+      if (errno == EINTR)
+        continue;
+      // EAGAIN: we'll be called again on the next EPOLLOUT. Other errors are found by the read side
+      break;
+    }
+    account_flushed_bytes(client_info, n_written);
+  }
+
+  release_flushed_queue(client_info);
+}
+
+// Accounts for n_written bytes taken from the head of the queue by the socket
+void account_flushed_bytes(thread_arg* client_info, int n_written){
+  client_info->out_start += n_written ;
+  client_info->out_len -= n_written ;
+  client_info->out_flushed += n_written ;
+  metrics_add(METRIC_BYTES_OUT, n_written);
+  clock_gettime(CLOCK_MONOTONIC, &client_info->out_progress);
+  // The timed relay has left the queue
+  if (client_info->out_timed_end != 0 && client_info->out_flushed >= client_info->out_timed_end){
+    metrics_observe(HISTOGRAM_RELAY_LATENCY, client_info->out_timed_room, elapsed_us(&client_info->out_timed_read_at, &client_info->out_progress));
+    client_info->out_timed_end = 0 ;
+  }
+}
+
+// Releases the memory of an empty queue, and resumes the partner of the client once the queue is under OUT_LOW_WATER
+void release_flushed_queue(thread_arg* client_info){
+
+  thread_arg* partner_info ;
+
+  // An empty queue doesn't hold any memory
+  if (client_info->out_len == 0 && client_info->out_buff != NULL){
+    unlink_backlogged_client(client_info);
+    buffer_put(client_info->out_buff, client_info->out_capacity);
+    client_info->out_buff = NULL ;
+    client_info->out_capacity = 0 ;
+    client_info->out_start = 0 ;
+  }
+
+  // The partner's data is still inside its socket, and no new edge will signal it
+  if (client_info->state == STATE_IN_CONVERSATION && client_info->out_len <= OUT_LOW_WATER){
+    if (client_info->conversation->firstUserInfo == client_info)
+      partner_info = client_info->conversation->secondUserInfo ;
+    else
+      partner_info = client_info->conversation->firstUserInfo ;
+    if (partner_info->reads_paused){
+      partner_info->reads_paused = 0 ;
+      serve_client(partner_info);
+    }
+  }
+}
+
+// Shuts down a client which doesn't read what we send. The reactor then finds the socket closed and disconnects it the usual way
+void drop_slow_client(thread_arg* client_info, const char* reason){
+
+  log_event(LOG_SLOW_CLIENT, client_info->nickname, client_info->IP_address, reason, client_info->client_sd, 0, 0, 0);
+  client_info->out_closing = 1 ;
+  // Reading the socket now returns 0 and epoll reports it, so the state machine goes through its usual disconnection path.
+  // Nothing is served from here: the caller may be in the middle of the conversation of this client
+  shutdown(client_info->client_sd, SHUT_RDWR);
+  // The recv of the ring may have been stopped by the bytes the client sent, it must find the end of the stream
+  if (use_io_uring)
+    uring_arm_recv(client_info);
+}
+
+// Drops the clients of the reactor whose queue made no progress for OUT_STALL_TIMEOUT_MS. Bytes leaving the kernel send buffer count as progress
+void drop_stalled_clients(reactorInfo* reactor, const struct timespec* now){
+
+  thread_arg* client_info = reactor->backlogged_clients ;
+  thread_arg* next_client ;
+  int unsent ;
+
+  while (client_info != NULL) {
+    next_client = client_info->backlog_next ;
+    // The socket takes nothing from the queue until half of its send buffer is free, so a client reading slowly looks stalled.
+    // The bytes it reads out of the kernel buffer count as progress
+    if (ioctl(client_info->client_sd, SIOCOUTQ, &unsent) == 0){
+      if (client_info->out_unsent >= 0 && unsent < client_info->out_unsent)
+        client_info->out_progress = *now ;
+      client_info->out_unsent = unsent ;
+    }
+    if (!client_info->out_closing && elapsed_ms(&client_info->out_progress, now) >= OUT_STALL_TIMEOUT_MS)
+      drop_slow_client(client_info, "its queue made no progress");
+    client_info = next_client ;
+  }
+}
+
+// Adds a client to the list of clients with queued bytes of its reactor
+void link_backlogged_client(thread_arg* client_info){
+  client_info->backlog_prev = NULL ;
+  client_info->backlog_next = client_info->reactor->backlogged_clients ;
+  if (client_info->backlog_next != NULL)
+    client_info->backlog_next->backlog_prev = client_info ;
+  client_info->reactor->backlogged_clients = client_info ;
+}
+
+// Removes a client from the list of clients with queued bytes of its reactor
+void unlink_backlogged_client(thread_arg* client_info){
+  if (client_info->backlog_prev != NULL)
+    client_info->backlog_prev->backlog_next = client_info->backlog_next ;
+  else
+    client_info->reactor->backlogged_clients = client_info->backlog_next ;
+  if (client_info->backlog_next != NULL)
+    client_info->backlog_next->backlog_prev = client_info->backlog_prev ;
+  client_info->backlog_prev = NULL ;
+  client_info->backlog_next = NULL ;
+}
+
+// Records the latency of a relay just handed to sendv_to_client, now if the socket took it all, otherwise when flush_client writes its last byte
+void time_a_relay(thread_arg* partner_info, const struct timespec* read_at, int room){
+
+  struct timespec now ;
+
+  if (partner_info->out_len == 0){
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    metrics_observe(HISTOGRAM_RELAY_LATENCY, room, elapsed_us(read_at, &now));
+  }else if (partner_info->out_timed_end == 0){
+    // The relay is the last thing queued
+    partner_info->out_timed_end = partner_info->out_flushed + partner_info->out_len ;
+    partner_info->out_timed_read_at = *read_at ;
+    partner_info->out_timed_room = room ;
+  }
+}
+
+// MATCHING FUNCTIONS
+
+// Task of the matcher of a room, arg is its roomMatcher: pairs the clients inside the waitlist of the room who look for a conversation.
+// Returns MATCHER_RETRY_MS if some users are left that another shuffle may pair, 0 otherwise
+// Every round takes the whole waitlist in one go, shuffles it and pairs as many users as it can
+int match_room(void *arg){
+
+  roomMatcher* matcher = (roomMatcher*)arg;
+  roomInfo* room_info = matcher->room;
+  linkedList* waitlist = room_info->waitlist;
+  linkedListNode** batch ;
+  int room = room_info->id ;
+  int batch_size ;
+  int retry_ms = 0 ; // MATCHER_RETRY_MS only for a batch which left pairable users behind
+  struct timespec now ;
+  logRecord* record ;
+  // New conversations of the batch, chained for each reactor, so every reactor is woken up once per batch
+  conversation_thread_arg* first_conversations[MAX_REACTORS] = { NULL };
+  conversation_thread_arg* last_conversations[MAX_REACTORS] = { NULL };
+
+  // Nobody to pair: the matcher runs again when somebody new comes, so an idle room costs no CPU at all
+  if (sizeOfTheList(waitlist) < 2)
+    return 0;
+
+  // A single lock for the whole round: from now on the batch belongs to this worker
+  batch_size = takeAllElements(waitlist, &matcher->batch, &matcher->batch_capacity);
+  if (batch_size < 0)
+    return 0;
+  batch = matcher->batch ;
+
+  // Mescola il batch (Fisher-Yates), così le coppie restano casuali
+  for (int i = batch_size-1; i > 0; i--) {
+    int j = (int)(next_random(&matcher->rng_state) % (uint64_t)(i+1)) ;
+    linkedListNode* swap = batch[i] ;
+    batch[i] = batch[j] ;
+    batch[j] = swap ;
+  }
+
+  int batch_pairs = 0, n_left = 0, i = 0 ;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while (i < batch_size) {
+    thread_arg* firstUserInfo = batch[i]->data ;
+    thread_arg* secondUserInfo = NULL ;
+    conversation_thread_arg* conversation_info = NULL ;
+    int j ;
+
+    // Looks for a partner among the next MATCHER_WINDOW users of the shuffled batch
+    for (j = i+1; j < batch_size && j <= i+MATCHER_WINDOW; j++) {
+      if (can_chat(firstUserInfo, batch[j]->data))
+        break;
+    }
+    if (j < batch_size && j <= i+MATCHER_WINDOW)
+      conversation_info = (conversation_thread_arg*)pool_get(&conversation_pool);
+
+    // Nobody fits (or there is no memory for the conversation): the user goes back to the waitlist. Leftovers are compacted at the start of the batch
+    if (conversation_info == NULL){
+      batch[n_left++] = batch[i] ;
+      i++ ;
+      continue;
+    }
+
+    linkedListNode* swap = batch[i+1] ;
+    batch[i+1] = batch[j] ;
+    batch[j] = swap ;
+    secondUserInfo = batch[i+1]->data ;
+
+    // aggiorna le due last chat
+    firstUserInfo->last_chat=(struct client_inf*)secondUserInfo;
+    secondUserInfo->last_chat=(struct client_inf*)firstUserInfo;
+    // The nodes have already been taken out of the waitlist
+    pool_put(&node_pool, batch[i]);
+    pool_put(&node_pool, batch[i+1]);
+    i += 2 ;
+
+    // LOGGING NEW MATCHES, with the time both users spent in the waitlist
+    long long first_waiting_ms = elapsed_ms(&firstUserInfo->waiting_since, &now);
+    long long second_waiting_ms = elapsed_ms(&secondUserInfo->waiting_since, &now);
+    if (first_waiting_ms > matcher->max_waiting_ms)
+      matcher->max_waiting_ms = first_waiting_ms ;
+    if (second_waiting_ms > matcher->max_waiting_ms)
+      matcher->max_waiting_ms = second_waiting_ms ;
+    log_event(LOG_NEW_MATCH, firstUserInfo->nickname, secondUserInfo->nickname, NULL, first_waiting_ms, second_waiting_ms, matcher->max_waiting_ms, 0);
+    metrics_observe(HISTOGRAM_MATCH_LATENCY, room, elapsed_us(&firstUserInfo->waiting_since, &now));
+    metrics_observe(HISTOGRAM_MATCH_LATENCY, room, elapsed_us(&secondUserInfo->waiting_since, &now));
+
+    conversation_info->firstUserInfo = firstUserInfo;
+    conversation_info->secondUserInfo = secondUserInfo;
+    conversation_info->room = room_info;
+    // The conversation is served by a single reactor, which takes from their reactors the users it doesn't serve yet
+    conversation_info->reactor = pick_conversation_reactor(firstUserInfo, secondUserInfo);
+    conversation_info->next = NULL;
+    int r = conversation_info->reactor->id ;
+    if (last_conversations[r] == NULL)
+      first_conversations[r] = conversation_info ;
+    else
+      last_conversations[r]->next = conversation_info ;
+    last_conversations[r] = conversation_info ;
+    batch_pairs++ ;
+  }
+
+  // Chi non è stato accoppiato torna in attesa
+  if (giveBackElements(waitlist, batch, n_left) < 0)
+    log_event(LOG_SYSTEM_ERROR, "giving back users to the waitlist", NULL, NULL, errno, 0, 0, 0);
+  // The leftovers may still fit with a different shuffle, but the matcher retries only when somebody new comes or after the timeout
+  if (n_left > 1)
+    retry_ms = MATCHER_RETRY_MS ;
+
+  if (batch_pairs > 0){
+    // Tiene conto delle nuove conversazioni avviate
+    metrics_add(METRIC_MATCHES, batch_pairs);
+
+    // lancia tutte le conversazioni del batch : every reactor will start its own as soon as it reads the mailbox
+    for (int r = 0; r < n_reactors; r++) {
+      if (first_conversations[r] != NULL)
+        post_conversations_to_reactor(&reactors[r], first_conversations[r], last_conversations[r]);
+      first_conversations[r] = NULL ;
+      last_conversations[r] = NULL ;
+    }
+
+    matcher->n_batches++ ;
+    matcher->n_pairs += batch_pairs ;
+    if (batch_pairs > matcher->max_batch_pairs)
+      matcher->max_batch_pairs = batch_pairs ;
+    if ((record = log_begin(LOG_MATCHING_BATCH)) != NULL){
+      record->numbers[0] = batch_size ;
+      record->numbers[1] = batch_pairs ;
+      record->numbers[2] = n_left ;
+      record->numbers[3] = matcher->n_pairs ;
+      record->numbers[4] = matcher->n_batches ;
+      record->numbers[5] = matcher->max_batch_pairs ;
+      log_commit(record);
+    }
+  }
+
+  return retry_ms;
+}
+
+// Has the matcher of the room run, now or as soon as its round in progress ends. Thread safe
+void wake_matcher(roomInfo* room){
+  workers_wake(&matching_workers, &matchers[room->id].task);
+}
+
+// Returns 1 if the two users can be paired: none of them has hung up and, unless one of them never chatted, they must not have just chatted together
+int can_chat(thread_arg* firstUserInfo, thread_arg* secondUserInfo){
+  // A user who hung up goes back to the waitlist, where its reactor takes it out
+  if (__atomic_load_n(&firstUserInfo->hung_up, __ATOMIC_RELAXED) || __atomic_load_n(&secondUserInfo->hung_up, __ATOMIC_RELAXED))
+    return 0;
+  // Invariante : gli utenti sono diversi, pertanto se uno dei due non è mai stato accoppiato con nessun altro (last_chat==NULL) oppure entrambi hanno parlato con due persone diverse procediamo
+  return firstUserInfo->last_chat==NULL || secondUserInfo->last_chat==NULL || (firstUserInfo->last_chat!=(struct client_inf*)secondUserInfo && secondUserInfo->last_chat!=(struct client_inf*)firstUserInfo) ;
+}
+
+// Picks the reactor which serves the conversation of two users, and counts the conversation in its load. Thread safe
+reactorInfo* pick_conversation_reactor(thread_arg* firstUserInfo, thread_arg* secondUserInfo){
+
+  reactorInfo* chosen = __atomic_load_n(&firstUserInfo->reactor, __ATOMIC_ACQUIRE) ;
+  reactorInfo* second = __atomic_load_n(&secondUserInfo->reactor, __ATOMIC_ACQUIRE) ;
+  reactorInfo* least = &reactors[0] ;
+  long chosen_load, least_load ;
+
+  // A user moves only if the users are on different reactors, and then the one on the busier reactor moves
+  if (second != chosen && __atomic_load_n(&second->n_conversations, __ATOMIC_RELAXED) < __atomic_load_n(&chosen->n_conversations, __ATOMIC_RELAXED))
+    chosen = second ;
+  chosen_load = __atomic_load_n(&chosen->n_conversations, __ATOMIC_RELAXED) ;
+
+  // Moving both users costs twice as much: it's worth it only when the least loaded reactor has far less conversations
+  least_load = __atomic_load_n(&least->n_conversations, __ATOMIC_RELAXED) ;
+  for (int r = 1; r < n_reactors; r++) {
+    long load = __atomic_load_n(&reactors[r].n_conversations, __ATOMIC_RELAXED) ;
+    if (load < least_load){
+      least = &reactors[r] ;
+      least_load = load ;
     }
   }
+  if (chosen_load > 2*least_load + MIGRATION_MIN_IMBALANCE)
+    chosen = least ;
+
+  __atomic_add_fetch(&chosen->n_conversations, 1, __ATOMIC_RELAXED);
+  return chosen;
+}
+
+// Fast generator used by the matchers to shuffle their batches (xorshift64*). Not thread safe, every matcher owns its state
+uint64_t next_random(uint64_t* state){
+  *state ^= *state >> 12 ;
+  *state ^= *state << 25 ;
+  *state ^= *state >> 27 ;
+  return *state * 0x2545F4914F6CDD1DULL ;
 }
 
-// Entrypoint of the thread that will manage a conversations between two clients. Launched by pair_clients
-void *manage_a_conversation(void *arg){
+// Milliseconds elapsed between two instants taken with the monotonic clock
+long long elapsed_ms(const struct timespec* from, const struct timespec* to){
+  return (long long)(to->tv_sec - from->tv_sec) * 1000LL + (to->tv_nsec - from->tv_nsec) / 1000000L ;
+}
 
-  conversation_thread_arg* conversation_info = (conversation_thread_arg*)arg ;
+// Microseconds elapsed between two instants taken with the monotonic clock
+long long elapsed_us(const struct timespec* from, const struct timespec* to){
+  return (long long)(to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_nsec - from->tv_nsec) / 1000L ;
+}
 
-  int firstUserSD = conversation_info->firstUserInfo->client_sd;
-  int secondUserSD = conversation_info->secondUserInfo->client_sd ;
-  char recv_buff[BUF_SIZE-64];
-  char send_buff[BUF_SIZE];
-  int n_read_char;
+// Hands a chain of conversations (linked through next) to a reactor and wakes it up once. Thread safe, called by match_room and by the reactors
+void post_conversations_to_reactor(reactorInfo* reactor, conversation_thread_arg* first_conversation, conversation_thread_arg* last_conversation){
 
-  sprintf(send_buff, "\nA NEW MATCH HAS BEEN FOUND !\n\nPress //command:<STOP> or //command:<REROLL> or Ctrl+C to exit\n\nSAY HI TO : %s\n\n",conversation_info->secondUserInfo->nickname);
-  write(firstUserSD,send_buff,strlen(send_buff));
-  sprintf(send_buff, "\nA NEW MATCH HAS BEEN FOUND !\n\nPress //command:<STOP> or //command:<REROLL> or Ctrl+C to exit\n\nSAY HI TO : %s\n\n",conversation_info->firstUserInfo->nickname);
-  write(secondUserSD,send_buff,strlen(send_buff));
+  uint64_t one = 1;
 
+  pthread_mutex_lock(&reactor->mailbox_mutex);
+  if (reactor->mailbox_tail == NULL)
+    reactor->mailbox_head = first_conversation ;
+  else
+    reactor->mailbox_tail->next = first_conversation ;
+  reactor->mailbox_tail = last_conversation ;
+  pthread_mutex_unlock(&reactor->mailbox_mutex);
 
-  int maxD;
-  fd_set read_fds;
-  int num_descriptors;
+  // Adding 1 to the eventfd counter makes the mailbox readable, which wakes up the epoll_wait of the reactor
+  if (write(reactor->mailbox_descriptor, &one, sizeof(one)) < 0)
+    log_event(LOG_SYSTEM_ERROR, "writing the reactor mailbox", NULL, NULL, errno, 0, 0, 0);
+}
 
-  if(firstUserSD>=secondUserSD)
-    maxD = firstUserSD+1;
+// SHARD FUNCTIONS
+
+// Called by the receiver of the shard for every connection handed over by another shard: posts it to the mailbox of a reactor, in turn. Thread safe
+void deliver_handover(shardMessage* message){
+
+  static unsigned int next_reactor ;
+  reactorInfo* reactor = &reactors[__atomic_fetch_add(&next_reactor, 1, __ATOMIC_RELAXED) % n_reactors] ;
+  uint64_t one = 1;
+
+  message->next = NULL ;
+  pthread_mutex_lock(&reactor->mailbox_mutex);
+  if (reactor->arrivals_tail == NULL)
+    reactor->arrivals_head = message ;
   else
-    maxD = secondUserSD+1;
+    reactor->arrivals_tail->next = message ;
+  reactor->arrivals_tail = message ;
+  pthread_mutex_unlock(&reactor->mailbox_mutex);
+
+  if (write(reactor->mailbox_descriptor, &one, sizeof(one)) < 0)
+    log_event(LOG_SYSTEM_ERROR, "writing the reactor mailbox", NULL, NULL, errno, 0, 0, 0);
+}
+
+// Serves a connection handed over by another shard: the client gets a record of this reactor, and enters the room it asked for. Frees the message
+void adopt_handed_over_client(reactorInfo* reactor, shardMessage* message){
+
+  const shardHandover* header = &message->header ;
+  thread_arg* client_info ;
+  char* write_position ;
+  int space ;
+
+  // The socket is still non blocking: the flag belongs to the connection, which the other shard has already closed
+  if ((client_info = welcome_client(reactor, message->client_sd, NULL)) == NULL)
+    goto done;
+  metrics_add(METRIC_SHARD_HANDOVERS_RECEIVED, 1);
+
+  // The client keeps the nickname it chose on the other shard
+  memcpy(client_info->nickname, header->nickname, header->nickname_len);
+  client_info->nickname[header->nickname_len] = '\0' ;
+  client_info->nickname_len = header->nickname_len ;
+  set_relay_header(client_info);
+  client_info->state = STATE_LOBBY ;
+
+  // What the other shard couldn't send yet goes out first. What the client sent after the START is served once it's paired, like on its own shard
+  if (header->out_len > 0)
+    send_to_client(client_info, message->data, header->out_len);
+  if (header->in_len > 0){
+    if (use_io_uring){
+      uring_store_received(client_info, message->data + header->out_len, header->in_len);
+    }else if (borrow_recv_buffer(client_info) == 0){
+      // The other shard never holds more than its framer
+      write_position = framer_write_space(&client_info->recv_framer, &space);
+      if (space > header->in_len)
+        space = header->in_len ;
+      memcpy(write_position, message->data + header->out_len, space);
+      framer_commit(&client_info->recv_framer, space);
+    }
+  }
+  if (client_info->state != STATE_CLOSED && enter_room(client_info, rooms_get(header->room)) < 0)
+    disconnect_client(client_info);
+
+  done:
+  free(message);
+}
+
+// Moves a client which asked for a room of another shard there, with what it holds. With io_uring the move waits for the requests of the ring pointing to the client
+void leave_for_shard(thread_arg* client_info, roomInfo* room){
+
+  // Nobody reads the client from now on, and its timeouts start again on the other shard
+  client_info->state = STATE_LEAVING ;
+  client_info->room = room ;
+  wheel_cancel(&client_info->reactor->timers, &client_info->timer);
+
+  // What's queued goes out now and the recv stops: the last of their completions finishes the handover
+  if (use_io_uring){
+    if (client_info->send_listed)
+      uring_submit_sends(client_info->reactor);
+    uring_cancel_recv(client_info);
+    if (client_info->uring_requests > 0)
+      return;
+  }
+  finish_shard_handover(client_info);
+}
+
+// Hands the connection of a client in STATE_LEAVING over to the shard owning its room, and releases it. If the shard can't take it, the client enters the room here
+void finish_shard_handover(thread_arg* client_info){
+
+  roomInfo* room = client_info->room ;
+  int shard = shard_of_room(room->id) ;
+  lineFramer* framer = &client_info->recv_framer ;
+  shardHandover header ;
+  struct iovec data[3];
+
+  // The queue, then what the client sent and nobody consumed yet: the bytes inside the framer come before the ones kept behind it
+  memset(&header, 0, sizeof(header));
+  header.room = room->id ;
+  header.nickname_len = client_info->nickname_len ;
+  memcpy(header.nickname, client_info->nickname, client_info->nickname_len);
+  header.out_len = client_info->out_len ;
+  header.in_len = framer_pending(framer) + client_info->spill_len ;
+  data[0].iov_base = client_info->out_buff != NULL ? client_info->out_buff + client_info->out_start : NULL ;
+  data[0].iov_len = client_info->out_len ;
+  data[1].iov_base = framer->storage != NULL ? (void*)framer_pending_bytes(framer) : NULL ;
+  data[1].iov_len = framer_pending(framer) ;
+  data[2].iov_base = client_info->spill_buff != NULL ? client_info->spill_buff + client_info->spill_start : NULL ;
+  data[2].iov_len = client_info->spill_len ;
+
+  metrics_add(METRIC_IO_SYSCALLS, 1);
+  if (shards_hand_over(shard, &header, data, 3, client_info->client_sd) < 0){
+    // The shard is gone, or too busy to take the connection: the client waits inside the room here, for the users who fell back like it
+    log_event(LOG_SYSTEM_ERROR, "handing a client over to another shard", NULL, NULL, errno, 0, 0, 0);
+    client_info->state = STATE_LOBBY ;
+    if (enter_room(client_info, room) < 0){
+      disconnect_client(client_info);
+      return;
+    }
+    if (use_io_uring)
+      uring_arm_recv(client_info);
+    return;
+  }
+
+  metrics_add(METRIC_SHARD_HANDOVERS_SENT, 1);
+  log_event(LOG_CLIENT_HANDED_OVER, client_info->nickname, client_info->IP_address, room->name, client_info->client_sd, shard, 0, 0);
+  // The other shard holds the connection too, so closing the descriptor doesn't take it out of the epoll instance
+  if (!use_io_uring){
+    epoll_ctl(client_info->reactor->epoll_descriptor, EPOLL_CTL_DEL, client_info->client_sd, NULL);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+  }
+  release_client(client_info);
+}
+
+// IO_URING FUNCTIONS
+
+// Returns 0 if the kernel has every io_uring feature the reactors use, -1 with errno set otherwise
+int probe_io_uring(){
+
+  uringRing ring ;
+
+  if (uring_init(&ring, 8, 16, 8, 64, URING_BUFFER_GROUP) < 0)
+    return -1;
+  uring_exit(&ring);
+  return 0;
+}
+
+// Event loop of a reactor running on io_uring: accepts, receives and sends through the ring, with one io_uring_enter for each turn. Returns once the server is closing
+void run_uring_reactor(reactorInfo* reactor){
+
+  struct io_uring_cqe* cqe ;
+  struct io_uring_cqe completion ;
+  struct timespec now, last_stall_check ;
+
+  // With IORING_SETUP_SINGLE_ISSUER only the thread creating the ring may submit to it
+  if (uring_init(&reactor->ring, URING_SQ_ENTRIES, URING_CQ_ENTRIES, URING_BUFFERS, URING_BUFFER_SIZE, URING_BUFFER_GROUP) < 0){
+    log_event(LOG_SYSTEM_ERROR, "creating the io_uring of the reactor", NULL, NULL, errno, 0, 0, 0);
+    kill(getpid(),SIGINT);
+    return;
+  }
+  uring_arm_accept(reactor);
+  uring_arm_mailbox(reactor);
+
+  clock_gettime(CLOCK_MONOTONIC, &last_stall_check);
+  now = last_stall_check ;
 
   while (1) {
 
-    int flags = 1;
-    setsockopt(firstUserSD, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
-    flags = 1;
-    setsockopt(secondUserSD, SOL_SOCKET, SO_KEEPALIVE, (void *)&flags, sizeof(flags));
+    // Submits the requests prepared during the last turn and waits for completions with the same system call
+    if (uring_enter(&reactor->ring, 1, reactor_timeout_ms(reactor, &now)) < 0 && errno != ETIME && errno != EINTR && errno != EBUSY)
+      log_event(LOG_SYSTEM_ERROR, "calling io_uring_enter", NULL, NULL, errno, 0, 0, 0);
+    metrics_add(METRIC_IO_SYSCALLS, 1);
+    // close_server wakes up the reactor through the mailbox
+    if (__atomic_load_n(&server_stopping, __ATOMIC_ACQUIRE))
+      return;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    wheel_advance(&reactor->timers, &now, expire_client_timer, reactor);
+
+    // The slot of a completion goes back to the kernel before the completion is served, which may prepare new requests
+    while ((cqe = uring_peek_cqe(&reactor->ring)) != NULL){
+      completion = *cqe ;
+      uring_cqe_seen(&reactor->ring);
+      uring_complete(reactor, &completion);
+    }
 
-    FD_ZERO(&read_fds);
-    FD_SET(firstUserSD,&read_fds);
-    FD_SET(secondUserSD,&read_fds);
+    if (elapsed_ms(&last_stall_check, &now) >= OUT_STALL_CHECK_MS){
+      drop_stalled_clients(reactor, &now);
+      // An accept stopped by an error, like the lack of descriptors, is tried again
+      if (!reactor->accept_armed)
+        uring_arm_accept(reactor);
+      last_stall_check = now ;
+    }
 
-    num_descriptors = select(maxD,&read_fds,NULL,NULL,NULL);
-    if (num_descriptors<0){
-      printf("Error calling select : %s\nConversation has ended\n", strerror(num_descriptors));
-      // Mettere entrambi in attesa di una nuova chat
-      goto reroll ;
-    }else{
+    // The sends are prepared once the whole turn has queued its bytes: one send for each client, whatever it got during the turn
+    uring_submit_sends(reactor);
+    release_closed_clients(reactor);
+  }
+}
 
-      if (FD_ISSET(firstUserSD, &read_fds)){
-        if ( (n_read_char = read(firstUserSD, recv_buff, BUF_SIZE-64)) != 0){
-          if(n_read_char < 0){
-            sprintf(send_buff, "\nError sending the message. Try again !\n");
-            write(firstUserSD,send_buff,strlen(send_buff));
-        	}else{
-            recv_buff[n_read_char]='\0';
-            // Se non si tratta del comando di exit o di next_chat inoltra al secondo utente
-            int result_parsing_request = parse_client_request(recv_buff);
-            if ( result_parsing_request!=5 && result_parsing_request!=6 ){
-              sprintf(send_buff, "\n-- <%s> --\n%s",conversation_info->firstUserInfo->nickname,recv_buff);
-              write(secondUserSD,send_buff,strlen(send_buff));
-            }else{
-              if ( result_parsing_request==5 ){
-                goto reroll ;
-              }
-              else {
-                // DA FARE
-                goto user1_stopped;
-              }
-            }
-          }
-        }else{
-          // Reading 0 means the client "firstUserSD" has disconnected
-          goto user1_disconnected;
-        }
+// Serves a completion of the ring of the reactor
+void uring_complete(reactorInfo* reactor, const struct io_uring_cqe* cqe){
+
+  void* owner = (void*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK) ;
+
+  switch (cqe->user_data & URING_OP_MASK) {
+    case URING_OP_RECV:
+      uring_complete_recv(reactor, (thread_arg*)owner, cqe);
+      break;
+    case URING_OP_SEND:
+      uring_complete_send(reactor, (thread_arg*)owner, cqe);
+      break;
+    case URING_OP_ACCEPT:
+      if (cqe->res >= 0)
+        welcome_client(reactor, cqe->res, NULL);
+      else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED && cqe->res != -EAGAIN)
+        log_event(LOG_SYSTEM_ERROR, "calling accept", NULL, NULL, -cqe->res, 0, 0, 0);
+      // Out of descriptors or memory: the accept is armed again by the next stall check
+      if (!(cqe->flags & IORING_CQE_F_MORE)){
+        reactor->accept_armed = 0 ;
+        if (cqe->res >= 0)
+          uring_arm_accept(reactor);
       }
+      break;
+    case URING_OP_MAILBOX:
+      serve_mailbox(reactor);
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+        uring_arm_mailbox(reactor);
+      break;
+    default:
+      // The result of a cancellation is found by the request cancelled
+      break;
+  }
+}
 
-      if (FD_ISSET(secondUserSD, &read_fds)){
-        if ( (n_read_char = read(secondUserSD, recv_buff, BUF_SIZE-64)) != 0){
-          if(n_read_char < 0){
-            sprintf(send_buff, "\nError sending the message. Try again !\n");
-            write(secondUserSD,send_buff,strlen(send_buff));
-        	}else{
-            recv_buff[n_read_char]='\0';
-            // Se non si tratta del comando di exit o di next_chat inoltra al primo utente
-            int result_parsing_request = parse_client_request(recv_buff);
-            if ( result_parsing_request!=5 && result_parsing_request!=6 ){
-              sprintf(send_buff, "\n-- <%s> --\n%s",conversation_info->secondUserInfo->nickname,recv_buff);
-              write(firstUserSD,send_buff,strlen(send_buff));
-            }else{
-              if ( result_parsing_request==5 ){
-                goto reroll ;
-              }
-              else{
-                // DA FARE
-                goto user2_stopped ;
-              }
-            }
-          }
-        }else{
-          // Reading 0 means the client "secondUserSD" has disconnected
-          goto user2_disconnected;
+// Serves a completion of the multishot recv of a client: copies the bytes received and serves the client
+void uring_complete_recv(reactorInfo* reactor, thread_arg* client_info, const struct io_uring_cqe* cqe){
 
-        }
-      }
+  conversation_thread_arg* conversation_info ;
+  unsigned buffer_id ;
 
+  // The buffer goes back to the kernel as soon as its bytes are copied
+  if (cqe->flags & IORING_CQE_F_BUFFER){
+    buffer_id = cqe->flags >> IORING_CQE_BUFFER_SHIFT ;
+    if (cqe->res > 0 && client_info->state != STATE_CLOSED)
+      uring_store_received(client_info, uring_buffer(&reactor->ring, buffer_id), cqe->res);
+    uring_recycle_buffer(&reactor->ring, buffer_id);
+  }
 
+  // The recv is over: at the end of the stream, after an error, or because it was cancelled or the buffers ran out
+  if (!(cqe->flags & IORING_CQE_F_MORE)){
+    client_info->recv_armed = 0 ;
+    client_info->recv_cancelled = 0 ;
+    client_info->uring_requests-- ;
+    if (cqe->res == 0){
+      client_info->recv_done = 1 ;
+    }else if (cqe->res < 0 && cqe->res != -ECANCELED && cqe->res != -ENOBUFS){
+      client_info->recv_done = 1 ;
+      client_info->recv_error = -cqe->res ;
     }
   }
 
-  user1_stopped:
-  // Comunica al secondo utente che è finita la conversazione
-  sprintf(send_buff, "\n%s has closed the conversation\nLooking for someone else ...\nCtrl+C to exit ...\n",conversation_info->firstUserInfo->nickname);
-  write(secondUserSD,send_buff,strlen(send_buff));
-  sprintf(send_buff, "\nYou have closed the conversation and stopped rolling...\n\n***** BENVENUTI IN RANDOMCHAT ! *****\n\n--- Digitare //command:<HELP> per conoscere i comandi disponibili ---\n\n");
-  write(firstUserSD,send_buff,strlen(send_buff));
+  if (client_info->state == STATE_CLOSED)
+    return;
 
-  pthread_mutex_lock(&n_total_active_chats_mutex);
-  totalNumberOfActiveChats--;
-  pthread_mutex_unlock(&n_total_active_chats_mutex);
+  // A client moving to another shard goes once the last of its requests has completed. Whatever the recv got meanwhile goes with it
+  if (client_info->state == STATE_LEAVING){
+    if (client_info->uring_requests == 0)
+      finish_shard_handover(client_info);
+    return;
+  }
 
-  // Fa ritornare il secondo utente in attesa di chattare
-  linkedListNode* new_node_user1_stop ;
-  if ( (new_node_user1_stop=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_user1_stop->data = conversation_info->secondUserInfo ;
-    new_node_user1_stop->next = NULL ;
+  // A user moving to another reactor is served there. The last of its requests to complete lets it go
+  if (client_info->handover != NULL){
+    if (client_info->uring_requests == 0){
+      conversation_info = client_info->handover ;
+      client_info->handover = NULL ;
+      serve_posted_conversation(reactor, conversation_info);
+    }
+    return;
   }
-  insert_element(new_node_user1_stop,conversation_info->waitlist);
 
-  // Affida la gestione del primo utente al thread "manage_a_single_client", e nel caso ci sia un errore, effettua la disconnessione.
-  pthread_t t1_info;
-  int err1 ;
-  if ( (err1=pthread_create(&t1_info, NULL, manage_a_single_client, (void*)conversation_info->firstUserInfo) ) ) {
-    char threadErrorMessage[128] = "Error from the server, please restart the client !\n\0";
-    write(firstUserSD,threadErrorMessage,128);
+  uring_arm_recv(client_info);
+  serve_client(client_info);
+  // Nobody reads a waiting client, but the ring has found its hangup
+  if (client_info->state == STATE_WAITING && client_info->recv_done)
+    drop_hung_up_client(client_info);
+}
+
+// Serves a completion of the send of a client: accounts for the bytes sent and sends the rest of the queue
+void uring_complete_send(reactorInfo* reactor, thread_arg* client_info, const struct io_uring_cqe* cqe){
+
+  conversation_thread_arg* conversation_info ;
 
-    // LOGGING DISCONNECTION
-    printf("\n-A CLIENT DISCONNECTED :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\n",conversation_info->firstUserInfo->nickname,firstUserSD,conversation_info->firstUserInfo->IP_address);
-    close(firstUserSD);
-    free(conversation_info->firstUserInfo);
-    pthread_mutex_lock(&n_total_users_mutex);
-    totalNumberOfUsers--;
-    pthread_mutex_unlock(&n_total_users_mutex);
+  client_info->uring_requests-- ;
+  // A queue moved to a new buffer during the send, or the queue of a client gone meanwhile
+  if (client_info->out_sending != client_info->out_buff)
+    buffer_put(client_info->out_sending, client_info->out_sending_capacity);
+  client_info->out_sending = NULL ;
+
+  if (client_info->state == STATE_CLOSED)
+    return;
+
+  if (cqe->res > 0){
+    account_flushed_bytes(client_info, cqe->res);
+    release_flushed_queue(client_info);
   }else{
-    pthread_detach(t1_info);
+    // The connection is broken: like a failed write, it's found and disconnected by the read side
+    client_info->out_closing = 1 ;
+    uring_arm_recv(client_info);
   }
 
-  conversation_info->firstUserInfo = NULL;
-  conversation_info->secondUserInfo = NULL;
-  conversation_info->waitlist = NULL;
-  free (conversation_info);
-  return 0;
+  if (client_info->state == STATE_CLOSED)
+    return;
 
-  user1_disconnected:
-  // Comunica al secondo utente che è finita la conversazione
-  sprintf(send_buff, "\n%s has closed the conversation\nLooking for someone else ...\nCtrl+C to exit ...\n",conversation_info->firstUserInfo->nickname);
-  write(secondUserSD,send_buff,strlen(send_buff));
+  // What the socket didn't take goes with the client
+  if (client_info->state == STATE_LEAVING){
+    if (client_info->uring_requests == 0)
+      finish_shard_handover(client_info);
+    return;
+  }
 
-  // LOGGING DISCONNECTIONS
-  printf("\n-A CLIENT DISCONNECTED :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\n",conversation_info->firstUserInfo->nickname,firstUserSD,conversation_info->firstUserInfo->IP_address);
-  close(firstUserSD);
-  free(conversation_info->firstUserInfo);
+  if (client_info->handover != NULL){
+    if (client_info->uring_requests == 0){
+      conversation_info = client_info->handover ;
+      client_info->handover = NULL ;
+      serve_posted_conversation(reactor, conversation_info);
+    }
+    return;
+  }
+
+  // What the socket didn't take, and what was queued during the send, goes out with the next one
+  if (client_info->out_len > 0 && !client_info->out_closing)
+    uring_queue_send(client_info);
+}
 
-  pthread_mutex_lock(&n_total_active_chats_mutex);
-  totalNumberOfActiveChats--;
-  pthread_mutex_unlock(&n_total_active_chats_mutex);
+// Arms the multishot accept of the listening socket of the reactor
+void uring_arm_accept(reactorInfo* reactor){
 
-  pthread_mutex_lock(&n_total_users_mutex);
-  totalNumberOfUsers--;
-  pthread_mutex_unlock(&n_total_users_mutex);
+  struct io_uring_sqe* sqe = uring_get_sqe(&reactor->ring) ;
 
-  // Fa ritornare il secondo utente in attesa di chattare
-  linkedListNode* new_node_user1 ;
-  if ( (new_node_user1=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_user1->data = conversation_info->secondUserInfo ;
-    new_node_user1->next = NULL ;
+  if (sqe == NULL){
+    log_event(LOG_SYSTEM_ERROR, "arming the accept of the ring", NULL, NULL, EBUSY, 0, 0, 0);
+    return;
   }
-  insert_element(new_node_user1,conversation_info->waitlist);
-  conversation_info->firstUserInfo = NULL;
-  conversation_info->secondUserInfo = NULL;
-  conversation_info->waitlist = NULL;
-  free (conversation_info);
-  return 0;
+  uring_prep_multishot_accept(sqe, reactor->server_socket, (uint64_t)(uintptr_t)reactor | URING_OP_ACCEPT);
+  reactor->accept_armed = 1 ;
+}
 
-  user2_stopped:
-  // Comunica al primo utente che è finita la conversazione
-  sprintf(send_buff, "\n%s has closed the conversation\nLooking for someone else ...\nCtrl+C to exit ...\n",conversation_info->secondUserInfo->nickname);
-  write(firstUserSD,send_buff,strlen(send_buff));
-  sprintf(send_buff, "\nYou have closed the conversation and stopped rolling...\n\n***** BENVENUTI IN RANDOMCHAT ! *****\n\n--- Digitare //command:<HELP> per conoscere i comandi disponibili ---\n\n");
-  write(secondUserSD,send_buff,strlen(send_buff));
-
-  pthread_mutex_lock(&n_total_active_chats_mutex);
-  totalNumberOfActiveChats--;
-  pthread_mutex_unlock(&n_total_active_chats_mutex);
-
-  // Fa ritornare il primo utente in attesa di chattare
-  linkedListNode* new_node_user2_stop ;
-  if ( (new_node_user2_stop=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_user2_stop->data = conversation_info->firstUserInfo ;
-    new_node_user2_stop->next = NULL ;
-  }
-  insert_element(new_node_user2_stop,conversation_info->waitlist);
-
-  // Affida la gestione del secondo utente al thread "manage_a_single_client", e nel caso ci sia un errore, effettua la disconnessione.
-  pthread_t t2_info;
-  int err2 ;
-  if ( (err2=pthread_create(&t2_info, NULL, manage_a_single_client, (void*)conversation_info->secondUserInfo) ) ) {
-    char threadErrorMessage[128] = "Error from the server, please restart the client !\n\0";
-    write(firstUserSD,threadErrorMessage,128);
-
-    // LOGGING DISCONNECTION
-    printf("\n-A CLIENT DISCONNECTED :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\n",conversation_info->firstUserInfo->nickname,firstUserSD,conversation_info->firstUserInfo->IP_address);
-    close(firstUserSD);
-    free(conversation_info->firstUserInfo);
-    pthread_mutex_lock(&n_total_users_mutex);
-    totalNumberOfUsers--;
-    pthread_mutex_unlock(&n_total_users_mutex);
-  }else{
-    pthread_detach(t2_info);
+// Arms the multishot poll of the mailbox of the reactor
+void uring_arm_mailbox(reactorInfo* reactor){
+
+  struct io_uring_sqe* sqe = uring_get_sqe(&reactor->ring) ;
+
+  if (sqe == NULL){
+    log_event(LOG_SYSTEM_ERROR, "arming the mailbox of the ring", NULL, NULL, EBUSY, 0, 0, 0);
+    return;
   }
+  uring_prep_multishot_poll(sqe, reactor->mailbox_descriptor, (uint64_t)(uintptr_t)reactor | URING_OP_MAILBOX);
+}
 
-  conversation_info->firstUserInfo = NULL;
-  conversation_info->secondUserInfo = NULL;
-  conversation_info->waitlist = NULL;
-  free (conversation_info);
-  return 0;
+// Arms the multishot recv of the client, unless it's armed already, the stream has ended, the client is moving to another reactor or shard or too many bytes wait to be consumed
+void uring_arm_recv(thread_arg* client_info){
 
-  user2_disconnected:
-  // Comunica al primo utente che è finita la conversazione
-  sprintf(send_buff, "\n%s has closed the conversation\nLooking for someone else ...\nCtrl+C to exit ...\n",conversation_info->secondUserInfo->nickname);
-  write(firstUserSD,send_buff,strlen(send_buff));
+  struct io_uring_sqe* sqe ;
 
-  pthread_mutex_lock(&n_total_active_chats_mutex);
-  totalNumberOfActiveChats--;
-  pthread_mutex_unlock(&n_total_active_chats_mutex);
+  if (client_info->recv_armed || client_info->recv_done || client_info->state == STATE_CLOSED || client_info->state == STATE_LEAVING || client_info->reactor == NULL || client_info->handover != NULL)
+    return;
+  // A dropped client must get to the end of its stream, however much it sent
+  if (client_info->spill_len >= URING_SPILL_LIMIT && !client_info->out_closing)
+    return;
+  if ((sqe = uring_get_sqe(&client_info->reactor->ring)) == NULL){
+    log_event(LOG_SYSTEM_ERROR, "arming the recv of a client", NULL, NULL, EBUSY, 0, 0, 0);
+    return;
+  }
+  uring_prep_multishot_recv(sqe, client_info->client_sd, URING_BUFFER_GROUP, (uint64_t)(uintptr_t)client_info | URING_OP_RECV);
+  client_info->recv_armed = 1 ;
+  client_info->recv_cancelled = 0 ;
+  client_info->uring_requests++ ;
+}
 
-  // LOGGING DISCONNECTIONS
-  printf("\n-A CLIENT DISCONNECTED :\nNickname : %s\nSocket Descriptor : %d\nIP ADDRESS : %s\n",conversation_info->secondUserInfo->nickname,secondUserSD,conversation_info->secondUserInfo->IP_address);
-  close(secondUserSD);
-  free(conversation_info->secondUserInfo);
+// Asks the ring to stop the multishot recv of the client
+void uring_cancel_recv(thread_arg* client_info){
 
-  pthread_mutex_lock(&n_total_users_mutex);
-  totalNumberOfUsers--;
-  pthread_mutex_unlock(&n_total_users_mutex);
+  struct io_uring_sqe* sqe ;
 
-  // Fa ritornare il primo utente in attesa di chattare
-  linkedListNode* new_node_user2 ;
-  if ( (new_node_user2=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_user2->data = conversation_info->firstUserInfo ;
-    new_node_user2->next = NULL ;
+  if (!client_info->recv_armed || client_info->recv_cancelled)
+    return;
+  if ((sqe = uring_get_sqe(&client_info->reactor->ring)) == NULL){
+    log_event(LOG_SYSTEM_ERROR, "cancelling the recv of a client", NULL, NULL, EBUSY, 0, 0, 0);
+    return;
   }
-  insert_element(new_node_user2,conversation_info->waitlist);
-  conversation_info->firstUserInfo = NULL;
-  conversation_info->secondUserInfo = NULL;
-  conversation_info->waitlist = NULL;
-  free (conversation_info);
-  return 0;
+  uring_prep_cancel(sqe, (uint64_t)(uintptr_t)client_info | URING_OP_RECV, (uint64_t)(uintptr_t)client_info | URING_OP_CANCEL);
+  client_info->recv_cancelled = 1 ;
+}
 
-  reroll:
+// Appends len bytes received from the client to its framer, or behind it when the framer is full. Stops the recv above URING_SPILL_LIMIT bytes
+void uring_store_received(thread_arg* client_info, const char* data, int len){
+
+  char* write_position ;
+  char* new_spill ;
+  int space, n_copied, new_capacity ;
+
+  // Bytes already kept behind the framer come first
+  if (client_info->spill_len == 0 && borrow_recv_buffer(client_info) == 0){
+    write_position = framer_write_space(&client_info->recv_framer, &space);
+    n_copied = len < space ? len : space ;
+    memcpy(write_position, data, n_copied);
+    framer_commit(&client_info->recv_framer, n_copied);
+    client_info->recv_unread += n_copied ;
+    data += n_copied ;
+    len -= n_copied ;
+  }
+  if (len == 0)
+    return;
+
+  if (client_info->spill_start > 0 && client_info->spill_start + client_info->spill_len + len > client_info->spill_capacity){
+    memmove(client_info->spill_buff, client_info->spill_buff + client_info->spill_start, client_info->spill_len);
+    client_info->spill_start = 0 ;
+  }
+  if (client_info->spill_len + len > client_info->spill_capacity){
+    new_capacity = client_info->spill_capacity > 0 ? client_info->spill_capacity : URING_BUFFER_SIZE ;
+    while (new_capacity < client_info->spill_len + len)
+      new_capacity *= 2 ;
+    if ((new_spill = buffer_get(new_capacity, &new_capacity)) == NULL){
+      // Like a failed read: the client is disconnected once it has consumed what it has
+      log_event(LOG_SYSTEM_ERROR, "allocating the bytes received from a client", NULL, NULL, errno, 0, 0, 0);
+      client_info->recv_done = 1 ;
+      client_info->recv_error = ENOMEM ;
+      uring_cancel_recv(client_info);
+      return;
+    }
+    if (client_info->spill_len > 0)
+      memcpy(new_spill, client_info->spill_buff + client_info->spill_start, client_info->spill_len);
+    buffer_put(client_info->spill_buff, client_info->spill_capacity);
+    client_info->spill_buff = new_spill ;
+    client_info->spill_capacity = new_capacity ;
+    client_info->spill_start = 0 ;
+  }
+  memcpy(client_info->spill_buff + client_info->spill_start + client_info->spill_len, data, len);
+  client_info->spill_len += len ;
+
+  // A client nobody reads, waiting or paused by its partner, sends no more than this: the rest stays inside the kernel
+  if (client_info->spill_len >= URING_SPILL_LIMIT && !client_info->out_closing)
+    uring_cancel_recv(client_info);
+}
 
-  sprintf(send_buff, "\nConversation is ended ... Looking for someone else ...\nCtrl+C to exit ...\n");
-  write(firstUserSD,send_buff,strlen(send_buff));
-  write(secondUserSD,send_buff,strlen(send_buff));
+// Reading the client on io_uring: returns the bytes the ring put in the framer, then the ones kept behind it, then the end of the stream. EAGAIN when there's nothing else
+ssize_t uring_read_client(thread_arg* client_info){
 
-  pthread_mutex_lock(&n_total_active_chats_mutex);
-  totalNumberOfActiveChats--;
-  pthread_mutex_unlock(&n_total_active_chats_mutex);
+  char* write_position ;
+  int space, n_read ;
 
-  linkedListNode* new_node_reroll ;
-  if ( (new_node_reroll=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_reroll->data = conversation_info->firstUserInfo ;
-    new_node_reroll->next = NULL ;
+  if (client_info->recv_unread > 0){
+    n_read = client_info->recv_unread ;
+    client_info->recv_unread = 0 ;
+    return n_read;
   }
-  insert_element(new_node_reroll,conversation_info->waitlist);
-  if ( (new_node_reroll=(linkedListNode*)malloc(sizeof(linkedListNode))) != NULL ){
-    new_node_reroll->data = conversation_info->secondUserInfo ;
-    new_node_reroll->next = NULL ;
+
+  if (client_info->spill_len > 0){
+    write_position = framer_write_space(&client_info->recv_framer, &space);
+    if (space == 0){
+      errno = ENOBUFS ;
+      return -1;
+    }
+    n_read = client_info->spill_len < space ? client_info->spill_len : space ;
+    memcpy(write_position, client_info->spill_buff + client_info->spill_start, n_read);
+    framer_commit(&client_info->recv_framer, n_read);
+    client_info->spill_start += n_read ;
+    client_info->spill_len -= n_read ;
+    if (client_info->spill_len == 0){
+      buffer_put(client_info->spill_buff, client_info->spill_capacity);
+      client_info->spill_buff = NULL ;
+      client_info->spill_capacity = 0 ;
+      client_info->spill_start = 0 ;
+    }
+    // Back under the limit, the recv stopped by the bytes kept can go on
+    uring_arm_recv(client_info);
+    return n_read;
   }
-  insert_element(new_node_reroll,conversation_info->waitlist);
-  conversation_info->firstUserInfo = NULL;
-  conversation_info->secondUserInfo = NULL;
-  conversation_info->waitlist = NULL;
-  free (conversation_info);
-  return 0;
+
+  if (client_info->recv_done){
+    if (client_info->recv_error == 0)
+      return 0;
+    errno = client_info->recv_error ;
+    return -1;
+  }
+  errno = EAGAIN ;
+  return -1;
+}
+
+// Adds the client to the list of clients whose queue is sent at the end of the turn, unless a send of the client is in flight already
+void uring_queue_send(thread_arg* client_info){
+  if (client_info->send_listed || client_info->out_sending != NULL || client_info->handover != NULL || client_info->reactor == NULL || client_info->state == STATE_CLOSED)
+    return;
+  client_info->send_listed = 1 ;
+  client_info->send_next = client_info->reactor->sending_clients ;
+  client_info->reactor->sending_clients = client_info ;
+}
+
+// Hands the queue of every client of the list to a send
+void uring_submit_sends(reactorInfo* reactor){
+
+  thread_arg* client_info ;
+  struct io_uring_sqe* sqe ;
+
+  while ((client_info = reactor->sending_clients) != NULL){
+    reactor->sending_clients = client_info->send_next ;
+    client_info->send_next = NULL ;
+    client_info->send_listed = 0 ;
+    if (client_info->state == STATE_CLOSED || client_info->out_len == 0 || client_info->out_sending != NULL || client_info->out_closing)
+      continue;
+    // The bytes stay queued: the stall check drops the client if they never leave
+    if ((sqe = uring_get_sqe(&reactor->ring)) == NULL){
+      log_event(LOG_SYSTEM_ERROR, "sending to a client", NULL, NULL, EBUSY, 0, 0, 0);
+      continue;
+    }
+    // The bytes queued after the submission are appended behind the ones being sent, which never move until the send completes
+    uring_prep_send(sqe, client_info->client_sd, client_info->out_buff + client_info->out_start, client_info->out_len, (uint64_t)(uintptr_t)client_info | URING_OP_SEND);
+    client_info->out_sending = client_info->out_buff ;
+    client_info->out_sending_capacity = client_info->out_capacity ;
+    client_info->uring_requests++ ;
+  }
+}
+
+// Before a user moves to another reactor, the requests of the ring pointing to it must complete. Returns 1 if some user of the conversation still has requests in flight:
+// their recvs are cancelled, and the last completion serves the conversation again. Returns 0 if the users can move now
+int uring_hold_handover(reactorInfo* reactor, conversation_thread_arg* conversation_info){
+
+  thread_arg* users[2] = { conversation_info->firstUserInfo, conversation_info->secondUserInfo };
+  int held = 0 ;
+
+  // The other user may belong to another reactor, which writes its reactor field: it's read atomically, see serve_posted_conversation
+  for (int i = 0; i < 2; i++) {
+    // The list of sends must not point to a user of another reactor: what it queued goes out now
+    if (__atomic_load_n(&users[i]->reactor, __ATOMIC_ACQUIRE) == reactor && users[i]->send_listed)
+      uring_submit_sends(reactor);
+  }
+  for (int i = 0; i < 2; i++) {
+    if (__atomic_load_n(&users[i]->reactor, __ATOMIC_ACQUIRE) == reactor && users[i]->uring_requests > 0){
+      users[i]->handover = conversation_info ;
+      uring_cancel_recv(users[i]);
+      held = 1 ;
+    }
+  }
+  return held;
 }
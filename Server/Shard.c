@@ -0,0 +1,379 @@
+#include<sys/socket.h>
+#include<sys/mman.h>
+#include<sys/prctl.h>
+#include<sys/wait.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<stdio.h>
+#include<string.h>
+#include<errno.h>
+#include<signal.h>
+#include<pthread.h>
+#include<time.h>
+#include "Shard.h"
+#include "Rooms.h"
+#include "Log.h"
+
+// Memory shared by the coordinator and the shards, mapped before the fork. Every field is read and written atomically
+typedef struct shard_b {
+  shardCounts shards[SHARDS_MAX]; // Each one written by its shard, read by the coordinator
+  shardCounts total ; // Written by the coordinator, read by every shard
+} shardBoard ;
+
+static shardBoard* board ;
+static int n_shards = 1 ;
+static int self = 0 ;
+static pid_t shard_pids[SHARDS_MAX]; // Used by the coordinator only
+static volatile sig_atomic_t stopping ; // Set by the coordinator once it forwarded a SIGINT to the shards
+// Every shard has a datagram socket pair: it reads from the first end, the other shards write on the second one, inherited through the fork
+static int channels[SHARDS_MAX][2];
+static void (*deliver_handover)(shardMessage* message);
+static pthread_t receiver_thread ;
+static int receiving ; // 1 while the receiver thread runs, lowered by shards_stop
+
+// Main loop of the coordinator: sums up the counts of the shards and, once a shard exits, stops the others. Never returns
+static void run_coordinator();
+// Handler of SIGINT and SIGUSR1 inside the coordinator: the shards get them too
+static void forward_signal(int numSignal);
+// Sums up the counts published by every shard into the total of the board
+static void sum_counts();
+// Publishes the counts of the running shard on the board
+static void publish_counts();
+// Entrypoint of the thread receiving the connections handed over by the other shards, until shards_stop is called. Publishes the counts of the shard every SHARD_PUBLISH_MS too
+static void* receive_handovers(void* arg);
+// Returns the descriptor carried by a message received, -1 if there is none
+static int received_descriptor(struct msghdr* message);
+// Milliseconds elapsed between two instants taken with the monotonic clock
+static long long elapsed_ms(const struct timespec* from, const struct timespec* to);
+
+// SHARD FUNCTIONS
+
+// Splits the server into n_shards processes, each one owning the rooms whose id modulo n_shards is its own id. With a single shard it does nothing.
+// Otherwise the calling process becomes the coordinator: it sums up the counts of the shards and never returns, while every shard returns 0 and runs a whole server.
+// To be called once the registry is loaded, before any thread starts. Returns -1 with errno set in case of error
+int shards_start(int n){
+
+  pid_t coordinator = getpid();
+  pid_t pid ;
+
+  if (n < 1 || n > SHARDS_MAX){
+    errno = EINVAL ;
+    return -1;
+  }
+  n_shards = n ;
+  if (n_shards == 1)
+    return 0;
+
+  if ((board = (shardBoard*)mmap(NULL, sizeof(shardBoard), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    return -1;
+  for (int i = 0; i < n_shards; i++) {
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, channels[i]) < 0)
+      return -1;
+  }
+
+  // What has been printed so far would be printed again by every shard
+  fflush(stdout);
+  for (int i = 0; i < n_shards; i++) {
+    if ((pid = fork()) < 0){
+      for (int j = 0; j < i; j++)
+        kill(shard_pids[j], SIGINT);
+      return -1;
+    }
+    if (pid == 0){
+      // A shard never outlives the coordinator, which may have died before the request
+      prctl(PR_SET_PDEATHSIG, SIGINT);
+      if (getppid() != coordinator)
+        exit(1);
+      self = i ;
+      for (int j = 0; j < n_shards; j++)
+        close(channels[j][j == self ? 1 : 0]);
+      return 0;
+    }
+    shard_pids[i] = pid ;
+  }
+
+  for (int i = 0; i < n_shards; i++) {
+    close(channels[i][0]);
+    close(channels[i][1]);
+  }
+  run_coordinator();
+  return 0;
+}
+
+// Id of the running shard, 0 with a single shard
+int shard_self(){
+  return self;
+}
+
+// Number of shards
+int shard_count(){
+  return n_shards;
+}
+
+// Id of the shard owning the room
+int shard_of_room(int room){
+  return room % n_shards ;
+}
+
+// Starts the thread receiving the connections handed over by the other shards, which calls deliver for every one of them, and publishing the counts of this shard.
+// deliver owns the message, which it frees. Returns -1 with errno set in case of error, 0 otherwise
+int shards_receive(void (*deliver)(shardMessage* message)){
+
+  struct timeval timeout = { 0, SHARD_PUBLISH_MS * 1000 };
+
+  deliver_handover = deliver ;
+  // The receiver wakes up at least this often, to publish the counts
+  if (setsockopt(channels[self][0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+    return -1;
+  receiving = 1 ;
+  if ((errno = pthread_create(&receiver_thread, NULL, receive_handovers, NULL)) != 0){
+    receiving = 0 ;
+    return -1;
+  }
+  return 0;
+}
+
+// Stops the thread started by shards_receive, if any, and waits for it. The connections handed over from then on are lost
+void shards_stop(){
+
+  if (!receiving)
+    return;
+  // The receiver sees it within SHARD_PUBLISH_MS, the timeout of its receive
+  __atomic_store_n(&receiving, 0, __ATOMIC_RELEASE);
+  pthread_join(receiver_thread, NULL);
+}
+
+// Hands the socket client_sd over to the given shard, with the header and the n_data buffers of data. Never blocks.
+// Returns -1 with errno set if the shard can't take it now, 0 otherwise: from then on the socket belongs to the other shard too, and this one must close it without shutting it down
+int shards_hand_over(int shard, const shardHandover* header, const struct iovec* data, int n_data, int client_sd){
+
+  struct msghdr message ;
+  struct iovec iov[8];
+  union {
+    struct cmsghdr align ;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control ;
+  struct cmsghdr* descriptor ;
+  int total = 0 ;
+  ssize_t n_sent ;
+
+  if (shard < 0 || shard >= n_shards || shard == self || n_data < 0 || n_data >= 8){
+    errno = EINVAL ;
+    return -1;
+  }
+  iov[0].iov_base = (void*)header ;
+  iov[0].iov_len = sizeof(shardHandover) ;
+  for (int i = 0; i < n_data; i++) {
+    iov[i+1] = data[i] ;
+    total += data[i].iov_len ;
+  }
+  if (total > SHARD_HANDOVER_BYTES){
+    errno = EMSGSIZE ;
+    return -1;
+  }
+
+  memset(&message, 0, sizeof(message));
+  memset(&control, 0, sizeof(control));
+  message.msg_iov = iov ;
+  message.msg_iovlen = n_data + 1 ;
+  message.msg_control = control.buffer ;
+  message.msg_controllen = sizeof(control.buffer) ;
+  descriptor = CMSG_FIRSTHDR(&message);
+  descriptor->cmsg_level = SOL_SOCKET ;
+  descriptor->cmsg_type = SCM_RIGHTS ;
+  descriptor->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(descriptor), &client_sd, sizeof(int));
+
+  // A datagram goes out whole or not at all: a full receiver makes it fail at once, and the caller keeps the connection
+  do {
+    n_sent = sendmsg(channels[shard][1], &message, MSG_DONTWAIT | MSG_NOSIGNAL);
+  } while (n_sent < 0 && errno == EINTR);
+  return n_sent < 0 ? -1 : 0;
+}
+
+// Replaces the counters, the users connected, the active chats and the users waiting in every room of the snapshot with the sums of every shard,
+// as of the last publication of the coordinator. A connection handed over is counted by both shards, as an accept and a disconnect. The histograms are left as they are
+void shards_totals(metricsSnapshot* snapshot){
+  if (n_shards == 1)
+    return;
+  for (int i = 0; i < METRIC_COUNT; i++)
+    snapshot->counters[i] = __atomic_load_n(&board->total.counters[i], __ATOMIC_RELAXED);
+  snapshot->buffer_bytes_in_use = (long)(snapshot->counters[METRIC_BUFFER_BYTES_LENT] - snapshot->counters[METRIC_BUFFER_BYTES_RETURNED]) ;
+  snapshot->users_connected = __atomic_load_n(&board->total.users_connected, __ATOMIC_RELAXED);
+  snapshot->active_chats = __atomic_load_n(&board->total.active_chats, __ATOMIC_RELAXED);
+  for (int r = 0; r < snapshot->n_rooms; r++)
+    snapshot->room_waiting[r] = __atomic_load_n(&board->total.room_waiting[r], __ATOMIC_RELAXED);
+}
+
+// Main loop of the coordinator: sums up the counts of the shards and, once a shard exits, stops the others. Never returns
+static void run_coordinator(){
+
+  struct timespec period = { 0, SHARD_PUBLISH_MS * 1000000L };
+  int status ;
+  pid_t pid ;
+
+  signal(SIGINT, forward_signal);
+  signal(SIGUSR1, forward_signal);
+  printf("Coordinator of %d shards running, the rooms are spread among them\n", n_shards);
+
+  while (1) {
+    nanosleep(&period, NULL);
+    sum_counts();
+
+    if ((pid = waitpid(-1, &status, WNOHANG)) <= 0)
+      continue;
+    // A server which lost some of its rooms can't go on: the other shards are closed too
+    for (int i = 0; i < n_shards; i++) {
+      if (shard_pids[i] == pid && !stopping)
+        printf("Shard %d exited, closing the other shards ...\n", i);
+      else
+        kill(shard_pids[i], SIGINT);
+    }
+    while (wait(NULL) > 0)
+      ;
+    exit(WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1);
+  }
+}
+
+// Handler of SIGINT and SIGUSR1 inside the coordinator: the shards get them too
+static void forward_signal(int numSignal){
+  if (numSignal == SIGINT)
+    stopping = 1 ;
+  for (int i = 0; i < n_shards; i++)
+    kill(shard_pids[i], numSignal);
+}
+
+// Sums up the counts published by every shard into the total of the board
+static void sum_counts(){
+
+  long users_connected = 0, active_chats = 0 ;
+  int n_rooms = 0, waiting ;
+  uint64_t counter ;
+
+  for (int c = 0; c < METRIC_COUNT; c++) {
+    counter = 0 ;
+    for (int i = 0; i < n_shards; i++)
+      counter += __atomic_load_n(&board->shards[i].counters[c], __ATOMIC_RELAXED);
+    __atomic_store_n(&board->total.counters[c], counter, __ATOMIC_RELAXED);
+  }
+  for (int i = 0; i < n_shards; i++) {
+    users_connected += __atomic_load_n(&board->shards[i].users_connected, __ATOMIC_RELAXED);
+    active_chats += __atomic_load_n(&board->shards[i].active_chats, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&board->shards[i].n_rooms, __ATOMIC_RELAXED) > n_rooms)
+      n_rooms = __atomic_load_n(&board->shards[i].n_rooms, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&board->total.users_connected, users_connected, __ATOMIC_RELAXED);
+  __atomic_store_n(&board->total.active_chats, active_chats, __ATOMIC_RELAXED);
+  __atomic_store_n(&board->total.n_rooms, n_rooms, __ATOMIC_RELAXED);
+  for (int r = 0; r < n_rooms && r < METRICS_MAX_ROOMS; r++) {
+    waiting = 0 ;
+    for (int i = 0; i < n_shards; i++)
+      waiting += __atomic_load_n(&board->shards[i].room_waiting[r], __ATOMIC_RELAXED);
+    __atomic_store_n(&board->total.room_waiting[r], waiting, __ATOMIC_RELAXED);
+  }
+}
+
+// Publishes the counts of the running shard on the board
+static void publish_counts(){
+
+  static metricsSnapshot snapshot ; // Too big for the stack, only the receiver thread uses it
+  shardCounts* counts = &board->shards[self] ;
+
+  metrics_snapshot(&snapshot);
+  for (int i = 0; i < METRIC_COUNT; i++)
+    __atomic_store_n(&counts->counters[i], snapshot.counters[i], __ATOMIC_RELAXED);
+  __atomic_store_n(&counts->users_connected, snapshot.users_connected, __ATOMIC_RELAXED);
+  __atomic_store_n(&counts->active_chats, snapshot.active_chats, __ATOMIC_RELAXED);
+  for (int r = 0; r < snapshot.n_rooms; r++)
+    __atomic_store_n(&counts->room_waiting[r], snapshot.room_waiting[r], __ATOMIC_RELAXED);
+  __atomic_store_n(&counts->n_rooms, snapshot.n_rooms, __ATOMIC_RELAXED);
+}
+
+// Entrypoint of the thread receiving the connections handed over by the other shards, until shards_stop is called. Publishes the counts of the shard every SHARD_PUBLISH_MS too
+static void* receive_handovers(void* arg){
+
+  shardMessage* handover = NULL ;
+  struct msghdr message ;
+  struct iovec iov[2];
+  union {
+    struct cmsghdr align ;
+    char buffer[CMSG_SPACE(sizeof(int))];
+  } control ;
+  struct timespec now, last_publish ;
+  ssize_t n_received ;
+  const shardHandover* header ;
+
+  (void)arg ;
+  clock_gettime(CLOCK_MONOTONIC, &last_publish);
+  publish_counts();
+
+  while (__atomic_load_n(&receiving, __ATOMIC_ACQUIRE)) {
+
+    // Every message is received into its own record, which goes to the reactor as it is
+    if (handover == NULL && (handover = (shardMessage*)malloc(sizeof(shardMessage))) == NULL){
+      log_event(LOG_SYSTEM_ERROR, "allocating a connection handed over", NULL, NULL, errno, 0, 0, 0);
+      nanosleep(&(struct timespec){ 0, SHARD_PUBLISH_MS * 1000000L }, NULL);
+      publish_counts();
+      continue;
+    }
+    iov[0].iov_base = &handover->header ;
+    iov[0].iov_len = sizeof(shardHandover) ;
+    iov[1].iov_base = handover->data ;
+    iov[1].iov_len = sizeof(handover->data) ;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = iov ;
+    message.msg_iovlen = 2 ;
+    message.msg_control = control.buffer ;
+    message.msg_controllen = sizeof(control.buffer) ;
+    n_received = recvmsg(channels[self][0], &message, MSG_CMSG_CLOEXEC);
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (elapsed_ms(&last_publish, &now) >= SHARD_PUBLISH_MS){
+      publish_counts();
+      last_publish = now ;
+    }
+
+    if (n_received < 0){
+      if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        log_event(LOG_SYSTEM_ERROR, "receiving a connection from another shard", NULL, NULL, errno, 0, 0, 0);
+      continue;
+    }
+
+    // Every shard runs the same program, so a message which doesn't add up is a bug: the connection is closed
+    header = &handover->header ;
+    handover->client_sd = received_descriptor(&message);
+    if (handover->client_sd < 0 || (message.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) || n_received < (ssize_t)sizeof(shardHandover) ||
+        header->nickname_len < 0 || header->nickname_len >= (int)sizeof(header->nickname) || header->out_len < 0 || header->in_len < 0 ||
+        header->out_len + header->in_len != n_received - (ssize_t)sizeof(shardHandover) ||
+        header->room < 0 || header->room >= rooms_count() || shard_of_room(header->room) != self){
+      log_event(LOG_SYSTEM_ERROR, "receiving a connection from another shard", NULL, NULL, EPROTO, 0, 0, 0);
+      if (handover->client_sd >= 0)
+        close(handover->client_sd);
+      continue;
+    }
+    deliver_handover(handover);
+    handover = NULL ;
+  }
+  free(handover);
+  return NULL;
+}
+
+// Returns the descriptor carried by a message received, -1 if there is none
+static int received_descriptor(struct msghdr* message){
+
+  struct cmsghdr* control ;
+  int descriptor ;
+
+  for (control = CMSG_FIRSTHDR(message); control != NULL; control = CMSG_NXTHDR(message, control)) {
+    if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SCM_RIGHTS && control->cmsg_len == CMSG_LEN(sizeof(int))){
+      memcpy(&descriptor, CMSG_DATA(control), sizeof(int));
+      return descriptor;
+    }
+  }
+  return -1;
+}
+
+// Milliseconds elapsed between two instants taken with the monotonic clock
+static long long elapsed_ms(const struct timespec* from, const struct timespec* to){
+  return (to->tv_sec - from->tv_sec) * 1000LL + (to->tv_nsec - from->tv_nsec) / 1000000 ;
+}
@@ -0,0 +1,62 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include<sys/uio.h>
+#include "Metrics.h"
+
+#define SHARDS_MAX 16 // Max number of server processes
+#define SHARD_PUBLISH_MS 100 // How often every shard publishes its counts, and the coordinator sums them
+#define SHARD_HANDOVER_BYTES (60*1024) // Max bytes a connection carries to the shard owning its room: its queue and what it sent after the START
+
+// Header of the message handing a connection over to the shard owning its room. It's followed by the bytes queued for the client,
+// then by the bytes received from the client and not consumed yet. The socket descriptor goes with the message, as SCM_RIGHTS
+typedef struct shard_h {
+    int room ; // Position of the room inside the registry, the same for every shard
+    int nickname_len ;
+    char nickname[32];
+    int out_len ;
+    int in_len ;
+} shardHandover ;
+
+// A connection received from another shard, with its own descriptor inside this process
+typedef struct shard_m {
+    struct shard_m* next ; // Used by the reactor mailbox, which queues the connections received but not served yet
+    int client_sd ;
+    shardHandover header ;
+    char data[SHARD_HANDOVER_BYTES]; // out_len bytes to send, then in_len bytes received
+} shardMessage ;
+
+// Counts a shard publishes for the coordinator, and the coordinator publishes for every shard once summed up.
+// The latency histograms stay inside each shard
+typedef struct shard_c {
+    uint64_t counters[METRIC_COUNT];
+    long users_connected ;
+    long active_chats ;
+    int n_rooms ;
+    int room_waiting[METRICS_MAX_ROOMS];
+} __attribute__((aligned(64))) shardCounts ;
+
+// SHARD FUNCTIONS
+// Splits the server into n_shards processes, each one owning the rooms whose id modulo n_shards is its own id. With a single shard it does nothing.
+// Otherwise the calling process becomes the coordinator: it sums up the counts of the shards and never returns, while every shard returns 0 and runs a whole server.
+// To be called once the registry is loaded, before any thread starts. Returns -1 with errno set in case of error
+int shards_start(int n_shards);
+// Id of the running shard, 0 with a single shard
+int shard_self();
+// Number of shards
+int shard_count();
+// Id of the shard owning the room
+int shard_of_room(int room);
+// Starts the thread receiving the connections handed over by the other shards, which calls deliver for every one of them, and publishing the counts of this shard.
+// deliver owns the message, which it frees. Returns -1 with errno set in case of error, 0 otherwise
+int shards_receive(void (*deliver)(shardMessage* message));
+// Stops the thread started by shards_receive, if any, and waits for it. The connections handed over from then on are lost
+void shards_stop();
+// Hands the socket client_sd over to the given shard, with the header and the n_data buffers of data. Never blocks.
+// Returns -1 with errno set if the shard can't take it now, 0 otherwise: from then on the socket belongs to the other shard too, and this one must close it without shutting it down
+int shards_hand_over(int shard, const shardHandover* header, const struct iovec* data, int n_data, int client_sd);
+// Replaces the counters, the users connected, the active chats and the users waiting in every room of the snapshot with the sums of every shard,
+// as of the last publication of the coordinator. A connection handed over is counted by both shards, as an accept and a disconnect. The histograms are left as they are
+void shards_totals(metricsSnapshot* snapshot);
+
+#endif
@@ -0,0 +1,185 @@
+#include<stddef.h>
+#include "TimerWheel.h"
+
+// Links the timer inside the slot matching its expiry: the lowest level whose span holds the distance from the current tick
+static void place_timer(timerWheel* wheel, wheelTimer* timer);
+// Moves the timers of the current slot of level down to the levels below, once the level below has completed its turn
+static void cascade(timerWheel* wheel, int level);
+// Ticks elapsed from the epoch of the wheel to now
+static uint64_t ticks_at(const timerWheel* wheel, const struct timespec* now);
+
+// TIMER WHEEL FUNCTIONS
+
+// Initializes an empty wheel whose tick 0 is at epoch
+void wheel_init(timerWheel* wheel, const struct timespec* epoch){
+  wheel->epoch = *epoch ;
+  wheel->tick = 0 ;
+  wheel->n_timers = 0 ;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    for (int slot = 0; slot < WHEEL_SLOTS; slot++) {
+      wheel->slots[level][slot].prev = &wheel->slots[level][slot] ;
+      wheel->slots[level][slot].next = &wheel->slots[level][slot] ;
+      wheel->slots[level][slot].owner = NULL ;
+    }
+  }
+}
+
+// Initializes a timer which is not armed, belonging to owner
+void timer_init(wheelTimer* timer, void* owner){
+  timer->prev = NULL ;
+  timer->next = NULL ;
+  timer->expires = 0 ;
+  timer->owner = owner ;
+}
+
+// Arms the timer to expire at the tick expires, cancelling it first if it was armed. A tick already past expires on the next wheel_advance. O(1)
+void wheel_arm(timerWheel* wheel, wheelTimer* timer, uint64_t expires){
+  wheel_cancel(wheel, timer);
+  timer->expires = expires ;
+  place_timer(wheel, timer);
+  wheel->n_timers++ ;
+}
+
+// Cancels the timer, if armed. O(1)
+void wheel_cancel(timerWheel* wheel, wheelTimer* timer){
+  if (timer->next == NULL)
+    return;
+  timer->prev->next = timer->next ;
+  timer->next->prev = timer->prev ;
+  timer->prev = NULL ;
+  timer->next = NULL ;
+  wheel->n_timers-- ;
+}
+
+// Current tick of the wheel, as of its last wheel_advance. Costs no system call, meant to timestamp frequent events
+uint64_t wheel_now(const timerWheel* wheel){
+  return wheel->tick;
+}
+
+// Expires every timer up to the time now, calling expire(timer, context) for each one with the timer already cancelled.
+// expire can arm and cancel any timer of the wheel, even the ones expiring in the same call. Returns the number of timers expired
+int wheel_advance(timerWheel* wheel, const struct timespec* now, void (*expire)(wheelTimer* timer, void* context), void* context){
+
+  uint64_t target = ticks_at(wheel, now);
+  wheelTimer expiring, *timer ;
+  int n_expired = 0, index ;
+
+  while (wheel->tick <= target) {
+    // An empty wheel has nothing to move down either, so it jumps straight to the present
+    if (wheel->n_timers == 0){
+      wheel->tick = target + 1 ;
+      break;
+    }
+
+    index = wheel->tick & (WHEEL_SLOTS-1) ;
+    if (index == 0)
+      cascade(wheel, 1);
+
+    // The slot is moved to a list of its own: the timers armed by expire for this same tick go to the next turn of the wheel, instead of this loop
+    if (wheel->slots[0][index].next == &wheel->slots[0][index]){
+      wheel->tick++ ;
+      continue;
+    }
+    expiring.next = wheel->slots[0][index].next ;
+    expiring.prev = wheel->slots[0][index].prev ;
+    expiring.next->prev = &expiring ;
+    expiring.prev->next = &expiring ;
+    wheel->slots[0][index].next = &wheel->slots[0][index] ;
+    wheel->slots[0][index].prev = &wheel->slots[0][index] ;
+    wheel->tick++ ;
+
+    // expire may cancel the timers still in the list, which unlinks them from it like from any slot
+    while (expiring.next != &expiring) {
+      timer = expiring.next ;
+      wheel_cancel(wheel, timer);
+      // A timer beyond the span of the whole wheel goes around it more than once
+      if (timer->expires >= wheel->tick){
+        place_timer(wheel, timer);
+        wheel->n_timers++ ;
+        continue;
+      }
+      n_expired++ ;
+      expire(timer, context);
+    }
+  }
+  return n_expired;
+}
+
+// Milliseconds from now to the next tick that has timers to expire or to move down, to be used as epoll_wait timeout. -1 if no timer is armed
+int wheel_timeout_ms(const timerWheel* wheel, const struct timespec* now){
+
+  uint64_t next_tick = wheel->tick ;
+  long long elapsed, timeout ;
+
+  if (wheel->n_timers == 0)
+    return -1;
+
+  // The level 0 is looked at up to the end of its turn, when the level 1 moves timers down to it
+  while ((next_tick & (WHEEL_SLOTS-1)) != 0 && wheel->slots[0][next_tick & (WHEEL_SLOTS-1)].next == &wheel->slots[0][next_tick & (WHEEL_SLOTS-1)])
+    next_tick++ ;
+
+  elapsed = (long long)(now->tv_sec - wheel->epoch.tv_sec) * 1000LL + (now->tv_nsec - wheel->epoch.tv_nsec) / 1000000L ;
+  timeout = (long long)next_tick * WHEEL_TICK_MS - elapsed ;
+  if (timeout < 0)
+    return 0;
+  return (int)timeout;
+}
+
+// Links the timer inside the slot matching its expiry: the lowest level whose span holds the distance from the current tick
+static void place_timer(timerWheel* wheel, wheelTimer* timer){
+
+  uint64_t expires = timer->expires < wheel->tick ? wheel->tick : timer->expires ;
+  uint64_t distance = expires - wheel->tick ;
+  wheelTimer* head ;
+  int level = 0 ;
+
+  while (level < WHEEL_LEVELS-1 && distance >= ((uint64_t)1 << (WHEEL_SLOT_BITS*(level+1))))
+    level++ ;
+  // Beyond the last level the timer waits in its farthest slot, and is placed again when that slot comes
+  if (distance >= ((uint64_t)1 << (WHEEL_SLOT_BITS*WHEEL_LEVELS)))
+    expires = wheel->tick + ((uint64_t)1 << (WHEEL_SLOT_BITS*WHEEL_LEVELS)) - 1 ;
+
+  head = &wheel->slots[level][(expires >> (WHEEL_SLOT_BITS*level)) & (WHEEL_SLOTS-1)] ;
+  timer->next = head ;
+  timer->prev = head->prev ;
+  head->prev->next = timer ;
+  head->prev = timer ;
+}
+
+// Moves the timers of the current slot of level down to the levels below, once the level below has completed its turn
+static void cascade(timerWheel* wheel, int level){
+
+  int index ;
+  wheelTimer moving, *timer ;
+
+  if (level == WHEEL_LEVELS)
+    return;
+  index = (wheel->tick >> (WHEEL_SLOT_BITS*level)) & (WHEEL_SLOTS-1) ;
+  // The level above moves down first, its timers may belong to the slot served now
+  if (index == 0)
+    cascade(wheel, level+1);
+
+  if (wheel->slots[level][index].next == &wheel->slots[level][index])
+    return;
+  moving.next = wheel->slots[level][index].next ;
+  moving.prev = wheel->slots[level][index].prev ;
+  moving.next->prev = &moving ;
+  moving.prev->next = &moving ;
+  wheel->slots[level][index].next = &wheel->slots[level][index] ;
+  wheel->slots[level][index].prev = &wheel->slots[level][index] ;
+
+  while (moving.next != &moving) {
+    timer = moving.next ;
+    moving.next = timer->next ;
+    timer->next->prev = &moving ;
+    place_timer(wheel, timer);
+  }
+}
+
+// Ticks elapsed from the epoch of the wheel to now
+static uint64_t ticks_at(const timerWheel* wheel, const struct timespec* now){
+  long long elapsed = (long long)(now->tv_sec - wheel->epoch.tv_sec) * 1000LL + (now->tv_nsec - wheel->epoch.tv_nsec) / 1000000L ;
+  if (elapsed < 0)
+    return 0;
+  return (uint64_t)elapsed / WHEEL_TICK_MS ;
+}
@@ -0,0 +1,50 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include<stdint.h>
+#include<time.h>
+
+#define WHEEL_TICK_MS 100 // Resolution of the wheel: a timer never expires early, and at most a tick late
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_SLOT_BITS) // Slots of each level, a power of two
+#define WHEEL_LEVELS 4 // Every level spans WHEEL_SLOTS times the level below: 6.4 s, 6.8 min, 7.3 h and 19 days with 100 ms ticks
+
+// Number of ticks covering ms milliseconds, rounded up
+#define WHEEL_TICKS(ms) (((uint64_t)(ms) + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS)
+
+// A timer, embedded inside the record it belongs to. Linked inside a slot of the wheel while armed
+typedef struct wheel_t {
+    struct wheel_t* prev ;
+    struct wheel_t* next ; // NULL while the timer is not armed
+    uint64_t expires ; // Tick at which the timer expires
+    void* owner ; // The record the timer belongs to, handed back when it expires
+} wheelTimer ;
+
+// Hierarchical timer wheel: arming and cancelling a timer is O(1), whatever the number of timers and their expiry.
+// The level 0 has a slot for each of the next WHEEL_SLOTS ticks, every upper level a slot for each turn of the level below:
+// when a level completes its turn, the next slot of the level above is moved down. Not thread safe, every reactor owns its wheel
+typedef struct timer_w {
+    struct timespec epoch ; // Time of tick 0 (CLOCK_MONOTONIC). Wheels with the same epoch count the same ticks
+    uint64_t tick ; // Next tick to expire: every timer expiring before it has been served
+    long n_timers ; // Timers armed
+    wheelTimer slots[WHEEL_LEVELS][WHEEL_SLOTS]; // Heads of the circular lists of timers of every slot
+} timerWheel ;
+
+// TIMER WHEEL FUNCTIONS
+// Initializes an empty wheel whose tick 0 is at epoch
+void wheel_init(timerWheel* wheel, const struct timespec* epoch);
+// Initializes a timer which is not armed, belonging to owner
+void timer_init(wheelTimer* timer, void* owner);
+// Arms the timer to expire at the tick expires, cancelling it first if it was armed. A tick already past expires on the next wheel_advance. O(1)
+void wheel_arm(timerWheel* wheel, wheelTimer* timer, uint64_t expires);
+// Cancels the timer, if armed. O(1)
+void wheel_cancel(timerWheel* wheel, wheelTimer* timer);
+// Current tick of the wheel, as of its last wheel_advance. Costs no system call, meant to timestamp frequent events
+uint64_t wheel_now(const timerWheel* wheel);
+// Expires every timer up to the time now, calling expire(timer, context) for each one with the timer already cancelled.
+// expire can arm and cancel any timer of the wheel, even the ones expiring in the same call. Returns the number of timers expired
+int wheel_advance(timerWheel* wheel, const struct timespec* now, void (*expire)(wheelTimer* timer, void* context), void* context);
+// Milliseconds from now to the next tick that has timers to expire or to move down, to be used as epoll_wait timeout. -1 if no timer is armed
+int wheel_timeout_ms(const timerWheel* wheel, const struct timespec* now);
+
+#endif
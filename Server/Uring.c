@@ -0,0 +1,230 @@
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/syscall.h>
+#include<unistd.h>
+#include<stdlib.h>
+#include<string.h>
+#include<errno.h>
+#include<poll.h>
+#include "Uring.h"
+
+// URING FUNCTIONS
+
+// Creates a ring with sq_entries submissions and cq_entries completions, and registers n_buffers buffers of buffer_size bytes as the group buffer_group.
+// n_buffers must be a power of two. Returns -1 with errno set if the kernel doesn't have every feature the reactors use (6.1 or later), 0 otherwise
+int uring_init(uringRing* ring, unsigned sq_entries, unsigned cq_entries, unsigned n_buffers, unsigned buffer_size, uint16_t buffer_group){
+
+  struct io_uring_params params ;
+  struct io_uring_buf_reg buffer_registration ;
+  size_t sq_size, cq_size ;
+  unsigned* sq_array ;
+  int saved_errno ;
+
+  memset(ring, 0, sizeof(uringRing));
+  ring->ring_fd = -1 ;
+  memset(&params, 0, sizeof(params));
+  // Completions are posted only when the reactor asks for them, by the reactor thread itself: no interrupt of the thread while it serves its clients
+  params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN ;
+  params.cq_entries = cq_entries ;
+  if ((ring->ring_fd = syscall(__NR_io_uring_setup, sq_entries, &params)) < 0)
+    return -1;
+  // Completions are never dropped, and uring_enter waits with a timeout
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP) || !(params.features & IORING_FEAT_EXT_ARG)){
+    errno = EOPNOTSUPP ;
+    goto error;
+  }
+
+  sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned) ;
+  cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe) ;
+  ring->ring_memory_size = sq_size > cq_size ? sq_size : cq_size ;
+  ring->ring_memory = mmap(NULL, ring->ring_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+  if (ring->ring_memory == MAP_FAILED){
+    ring->ring_memory = NULL ;
+    goto error;
+  }
+  ring->sqe_memory_size = params.sq_entries * sizeof(struct io_uring_sqe) ;
+  ring->sqe_memory = mmap(NULL, ring->sqe_memory_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqe_memory == MAP_FAILED){
+    ring->sqe_memory = NULL ;
+    goto error;
+  }
+
+  ring->sq_head = (unsigned*)((char*)ring->ring_memory + params.sq_off.head) ;
+  ring->sq_tail = (unsigned*)((char*)ring->ring_memory + params.sq_off.tail) ;
+  ring->sq_mask = *(unsigned*)((char*)ring->ring_memory + params.sq_off.ring_mask) ;
+  ring->sq_entries = params.sq_entries ;
+  ring->sqes = (struct io_uring_sqe*)ring->sqe_memory ;
+  ring->sq_local_tail = *ring->sq_tail ;
+  ring->sq_submitted = ring->sq_local_tail ;
+  // Every position of the ring points to the SQE with the same index, once and for all
+  sq_array = (unsigned*)((char*)ring->ring_memory + params.sq_off.array) ;
+  for (unsigned i = 0; i < params.sq_entries; i++)
+    sq_array[i] = i ;
+  ring->cq_head = (unsigned*)((char*)ring->ring_memory + params.cq_off.head) ;
+  ring->cq_tail = (unsigned*)((char*)ring->ring_memory + params.cq_off.tail) ;
+  ring->cq_mask = *(unsigned*)((char*)ring->ring_memory + params.cq_off.ring_mask) ;
+  ring->cqes = (struct io_uring_cqe*)((char*)ring->ring_memory + params.cq_off.cqes) ;
+
+  // The ring of provided buffers lives in memory of ours, registered with the kernel
+  ring->n_buffers = n_buffers ;
+  ring->buffer_size = buffer_size ;
+  ring->buffer_group = buffer_group ;
+  ring->buffer_ring_size = n_buffers * sizeof(struct io_uring_buf) ;
+  ring->buffer_ring = (struct io_uring_buf_ring*)mmap(NULL, ring->buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ring->buffer_ring == MAP_FAILED){
+    ring->buffer_ring = NULL ;
+    goto error;
+  }
+  if ((ring->buffers = (char*)malloc((size_t)n_buffers * buffer_size)) == NULL)
+    goto error;
+  memset(&buffer_registration, 0, sizeof(buffer_registration));
+  buffer_registration.ring_addr = (uint64_t)(uintptr_t)ring->buffer_ring ;
+  buffer_registration.ring_entries = n_buffers ;
+  buffer_registration.bgid = buffer_group ;
+  if (syscall(__NR_io_uring_register, ring->ring_fd, IORING_REGISTER_PBUF_RING, &buffer_registration, 1) < 0)
+    goto error;
+  ring->buffer_tail = 0 ;
+  for (unsigned id = 0; id < n_buffers; id++)
+    uring_recycle_buffer(ring, id);
+  return 0;
+
+  error:
+  saved_errno = errno ;
+  uring_exit(ring);
+  errno = saved_errno ;
+  return -1;
+}
+
+// Releases the ring and its buffers
+void uring_exit(uringRing* ring){
+  if (ring->ring_fd >= 0)
+    close(ring->ring_fd);
+  if (ring->ring_memory != NULL)
+    munmap(ring->ring_memory, ring->ring_memory_size);
+  if (ring->sqe_memory != NULL)
+    munmap(ring->sqe_memory, ring->sqe_memory_size);
+  if (ring->buffer_ring != NULL)
+    munmap(ring->buffer_ring, ring->buffer_ring_size);
+  free(ring->buffers);
+  memset(ring, 0, sizeof(uringRing));
+  ring->ring_fd = -1 ;
+}
+
+// Returns an empty SQE to prepare, submitting the prepared ones first if the ring is full. NULL only if the kernel takes none of them
+struct io_uring_sqe* uring_get_sqe(uringRing* ring){
+
+  struct io_uring_sqe* sqe ;
+
+  if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries){
+    uring_enter(ring, 0, 0);
+    if (ring->sq_local_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+      return NULL;
+  }
+  sqe = &ring->sqes[ring->sq_local_tail & ring->sq_mask] ;
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  ring->sq_local_tail++ ;
+  return sqe;
+}
+
+// Submits the prepared SQEs and, if wait is not 0, waits up to timeout_ms (-1 forever) for at least one completion. One system call.
+// Returns -1 with errno set in case of error (ETIME and EINTR just mean there's no completion), 0 otherwise
+int uring_enter(uringRing* ring, int wait, int timeout_ms){
+
+  struct io_uring_getevents_arg argument ;
+  struct __kernel_timespec timeout ;
+  // With IORING_SETUP_DEFER_TASKRUN the completions are posted inside this call only, so it always asks for them
+  unsigned flags = IORING_ENTER_GETEVENTS ;
+  void* extra = NULL ;
+  size_t extra_size = 0 ;
+  int n_submitted ;
+
+  __atomic_store_n(ring->sq_tail, ring->sq_local_tail, __ATOMIC_RELEASE);
+  if (wait && timeout_ms >= 0){
+    timeout.tv_sec = timeout_ms / 1000 ;
+    timeout.tv_nsec = (long long)(timeout_ms % 1000) * 1000000LL ;
+    memset(&argument, 0, sizeof(argument));
+    argument.ts = (uint64_t)(uintptr_t)&timeout ;
+    flags |= IORING_ENTER_EXT_ARG ;
+    extra = &argument ;
+    extra_size = sizeof(argument) ;
+  }
+  n_submitted = syscall(__NR_io_uring_enter, ring->ring_fd, ring->sq_local_tail - ring->sq_submitted, wait ? 1 : 0, flags, extra, extra_size);
+  if (n_submitted < 0)
+    return -1;
+  ring->sq_submitted += n_submitted ;
+  return 0;
+}
+
+// Returns the oldest completion not seen yet, NULL if there is none. Takes no system call
+struct io_uring_cqe* uring_peek_cqe(uringRing* ring){
+  unsigned head = *ring->cq_head ;
+  if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  return &ring->cqes[head & ring->cq_mask];
+}
+
+// Gives the completion returned by uring_peek_cqe back to the kernel
+void uring_cqe_seen(uringRing* ring){
+  __atomic_store_n(ring->cq_head, *ring->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// The provided buffer with the given id
+char* uring_buffer(uringRing* ring, unsigned id){
+  return ring->buffers + (size_t)id * ring->buffer_size ;
+}
+
+// Gives a provided buffer back to the kernel, once its bytes have been consumed
+void uring_recycle_buffer(uringRing* ring, unsigned id){
+  struct io_uring_buf* buffer = &ring->buffer_ring->bufs[ring->buffer_tail & (ring->n_buffers-1)] ;
+  buffer->addr = (uint64_t)(uintptr_t)uring_buffer(ring, id) ;
+  buffer->len = ring->buffer_size ;
+  buffer->bid = id ;
+  ring->buffer_tail++ ;
+  __atomic_store_n(&ring->buffer_ring->tail, ring->buffer_tail, __ATOMIC_RELEASE);
+}
+
+// Multishot accept: a completion for every connection accepted on the listening socket fd, the descriptor of the connection in res
+void uring_prep_multishot_accept(struct io_uring_sqe* sqe, int fd, uint64_t user_data){
+  sqe->opcode = IORING_OP_ACCEPT ;
+  sqe->fd = fd ;
+  sqe->accept_flags = SOCK_CLOEXEC ;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT ;
+  sqe->user_data = user_data ;
+}
+
+// Multishot recv into the provided buffers of the group: a completion for every segment received, IORING_CQE_F_BUFFER tells the buffer used
+void uring_prep_multishot_recv(struct io_uring_sqe* sqe, int fd, uint16_t buffer_group, uint64_t user_data){
+  sqe->opcode = IORING_OP_RECV ;
+  sqe->fd = fd ;
+  sqe->ioprio = IORING_RECV_MULTISHOT ;
+  sqe->flags = IOSQE_BUFFER_SELECT ;
+  sqe->buf_group = buffer_group ;
+  sqe->user_data = user_data ;
+}
+
+// Send of len bytes at buffer
+void uring_prep_send(struct io_uring_sqe* sqe, int fd, const void* buffer, unsigned len, uint64_t user_data){
+  sqe->opcode = IORING_OP_SEND ;
+  sqe->fd = fd ;
+  sqe->addr = (uint64_t)(uintptr_t)buffer ;
+  sqe->len = len ;
+  sqe->msg_flags = MSG_NOSIGNAL ;
+  sqe->user_data = user_data ;
+}
+
+// Multishot poll: a completion every time fd becomes readable
+void uring_prep_multishot_poll(struct io_uring_sqe* sqe, int fd, uint64_t user_data){
+  sqe->opcode = IORING_OP_POLL_ADD ;
+  sqe->fd = fd ;
+  sqe->poll32_events = POLLIN ;
+  sqe->len = IORING_POLL_ADD_MULTI ;
+  sqe->user_data = user_data ;
+}
+
+// Cancels the requests with user_data target
+void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t target, uint64_t user_data){
+  sqe->opcode = IORING_OP_ASYNC_CANCEL ;
+  sqe->fd = -1 ;
+  sqe->addr = target ;
+  sqe->user_data = user_data ;
+}
@@ -0,0 +1,73 @@
+#ifndef URING_H
+#define URING_H
+
+#include<stdint.h>
+#include<linux/io_uring.h>
+
+// A minimal io_uring interface over the raw system calls, without liburing: one ring for each reactor, and one group of buffers provided to its recvs.
+// Not thread safe, every ring is used by the thread which created it only (IORING_SETUP_SINGLE_ISSUER)
+
+// The ring of submissions and the ring of completions shared with the kernel, and the ring of buffers the kernel picks from for the recvs
+typedef struct uring_r {
+    int ring_fd ;
+    // Submission ring
+    unsigned* sq_head ;
+    unsigned* sq_tail ;
+    unsigned sq_mask ;
+    unsigned sq_entries ;
+    struct io_uring_sqe* sqes ;
+    unsigned sq_local_tail ; // Tail of the SQEs prepared so far, published to the kernel by uring_enter
+    unsigned sq_submitted ; // Tail of the SQEs taken by the kernel
+    // Completion ring
+    unsigned* cq_head ;
+    unsigned* cq_tail ;
+    unsigned cq_mask ;
+    struct io_uring_cqe* cqes ;
+    // Memory shared with the kernel
+    void* ring_memory ;
+    size_t ring_memory_size ;
+    void* sqe_memory ;
+    size_t sqe_memory_size ;
+    // Provided buffers: n_buffers of buffer_size bytes, the kernel fills the one at the head of buffer_ring and tells its id in the CQE
+    struct io_uring_buf_ring* buffer_ring ;
+    size_t buffer_ring_size ;
+    char* buffers ;
+    unsigned n_buffers ;
+    unsigned buffer_size ;
+    uint16_t buffer_tail ;
+    uint16_t buffer_group ;
+} uringRing ;
+
+// URING FUNCTIONS
+// Creates a ring with sq_entries submissions and cq_entries completions, and registers n_buffers buffers of buffer_size bytes as the group buffer_group.
+// n_buffers must be a power of two. Returns -1 with errno set if the kernel doesn't have every feature the reactors use (6.1 or later), 0 otherwise
+int uring_init(uringRing* ring, unsigned sq_entries, unsigned cq_entries, unsigned n_buffers, unsigned buffer_size, uint16_t buffer_group);
+// Releases the ring and its buffers
+void uring_exit(uringRing* ring);
+// Returns an empty SQE to prepare, submitting the prepared ones first if the ring is full. NULL only if the kernel takes none of them
+struct io_uring_sqe* uring_get_sqe(uringRing* ring);
+// Submits the prepared SQEs and, if wait is not 0, waits up to timeout_ms (-1 forever) for at least one completion. One system call.
+// Returns -1 with errno set in case of error (ETIME and EINTR just mean there's no completion), 0 otherwise
+int uring_enter(uringRing* ring, int wait, int timeout_ms);
+// Returns the oldest completion not seen yet, NULL if there is none. Takes no system call
+struct io_uring_cqe* uring_peek_cqe(uringRing* ring);
+// Gives the completion returned by uring_peek_cqe back to the kernel
+void uring_cqe_seen(uringRing* ring);
+// The provided buffer with the given id
+char* uring_buffer(uringRing* ring, unsigned id);
+// Gives a provided buffer back to the kernel, once its bytes have been consumed
+void uring_recycle_buffer(uringRing* ring, unsigned id);
+
+// SQE preparation, the fields not set are 0. user_data identifies the request inside its completions
+// Multishot accept: a completion for every connection accepted on the listening socket fd, the descriptor of the connection in res
+void uring_prep_multishot_accept(struct io_uring_sqe* sqe, int fd, uint64_t user_data);
+// Multishot recv into the provided buffers of the group: a completion for every segment received, IORING_CQE_F_BUFFER tells the buffer used
+void uring_prep_multishot_recv(struct io_uring_sqe* sqe, int fd, uint16_t buffer_group, uint64_t user_data);
+// Send of len bytes at buffer
+void uring_prep_send(struct io_uring_sqe* sqe, int fd, const void* buffer, unsigned len, uint64_t user_data);
+// Multishot poll: a completion every time fd becomes readable
+void uring_prep_multishot_poll(struct io_uring_sqe* sqe, int fd, uint64_t user_data);
+// Cancels the requests with user_data target
+void uring_prep_cancel(struct io_uring_sqe* sqe, uint64_t target, uint64_t user_data);
+
+#endif
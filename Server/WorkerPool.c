@@ -0,0 +1,307 @@
+#include<stdlib.h>
+#include<errno.h>
+#include<time.h>
+#include "WorkerPool.h"
+#include "Metrics.h"
+
+// The worker running on this thread, NULL outside of the pools
+static __thread workerInfo* current_worker ;
+
+// Entrypoint of a worker thread: runs its tasks, steals the tasks of the others, and sleeps when there is nothing left, until the pool stops
+static void* worker_thread(void* arg);
+// Links the task at the tail of the deque of the worker and wakes up a sleeping worker, if any
+static void queue_task(workerPool* pool, workerInfo* worker, workTask* task);
+// Takes the oldest task of the worker, or the newest one if stealing is not 0. NULL if the deque is empty
+static workTask* take_task(workerInfo* worker, int stealing);
+// Runs a task taken from a deque, then queues it again, delays it or leaves it idle, as its run and its wake ups ask
+static void run_task(workerPool* pool, workerInfo* worker, workTask* task);
+// Queues every delayed task whose time has come, and forgets the ones woken up in the meantime
+static void queue_due_tasks(workerPool* pool, workerInfo* worker, uint64_t now);
+// Milliseconds since an arbitrary point, CLOCK_MONOTONIC
+static uint64_t now_ms();
+
+// WORKER POOL FUNCTIONS
+
+// Initializes a pool of n_workers workers (at most WORKERS_MAX), without starting them. Returns -1 in case of error, 0 otherwise
+int workers_init(workerPool* pool, int n_workers){
+
+  pthread_condattr_t cond_attr ;
+
+  if (n_workers < 1 || n_workers > WORKERS_MAX){
+    errno = EINVAL ;
+    return -1;
+  }
+  pool->n_workers = n_workers ;
+  pool->n_started = 0 ;
+  pool->stopping = 0 ;
+  pool->n_queued = 0 ;
+  pool->n_sleeping = 0 ;
+  pool->delayed_head = NULL ;
+  pool->next_due_ms = UINT64_MAX ;
+  for (int i = 0; i < n_workers; i++) {
+    pool->workers[i].pool = pool ;
+    pool->workers[i].id = i ;
+    __atomic_store_n(&pool->workers[i].head, NULL, __ATOMIC_RELAXED);
+    pool->workers[i].tail = NULL ;
+    if ((errno = pthread_mutex_init(&pool->workers[i].mutex, NULL)) != 0)
+      return -1;
+  }
+  if ((errno = pthread_mutex_init(&pool->mutex, NULL)) != 0)
+    return -1;
+  // The sleeps until the next delayed task are measured on the monotonic clock, so they don't jump with the wall clock
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);
+  errno = pthread_cond_init(&pool->wake_up, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+  return errno != 0 ? -1 : 0;
+}
+
+// Starts the worker threads. Returns -1 with errno set if a thread can't be created, 0 otherwise
+int workers_start(workerPool* pool){
+
+  for (int i = 0; i < pool->n_workers; i++) {
+    if ((errno = pthread_create(&pool->workers[i].thread, NULL, worker_thread, (void*)&pool->workers[i])) != 0)
+      return -1;
+    pool->n_started++ ;
+  }
+  return 0;
+}
+
+// Stops the worker threads started and waits for them: a task running ends its run, the queued ones never run again
+void workers_stop(workerPool* pool){
+
+  // Set under the mutex, so a worker going to sleep either sees it or gets the broadcast
+  pthread_mutex_lock(&pool->mutex);
+  __atomic_store_n(&pool->stopping, 1, __ATOMIC_RELEASE);
+  pthread_cond_broadcast(&pool->wake_up);
+  pthread_mutex_unlock(&pool->mutex);
+  for (int i = 0; i < pool->n_started; i++)
+    pthread_join(pool->workers[i].thread, NULL);
+}
+
+// Initializes a task which is not queued. run(owner) is called by the workers, home picks the deque of the task
+void task_init(workTask* task, int (*run)(void* owner), void* owner, int home){
+  task->run = run ;
+  task->owner = owner ;
+  task->home = home ;
+  task->state = TASK_IDLE ;
+  task->prev = NULL ;
+  task->next = NULL ;
+  task->next_delayed = NULL ;
+  task->delayed = 0 ;
+  task->due_ms = 0 ;
+}
+
+// Makes sure the task runs after this call: queues it if it's idle or delayed, or has it run once more if it's running. Lock free unless it queues the task. Thread safe
+void workers_wake(workerPool* pool, workTask* task){
+
+  int state = __atomic_load_n(&task->state, __ATOMIC_ACQUIRE) ;
+  workerInfo* worker ;
+
+  while (1) {
+    switch (state) {
+      case TASK_IDLE:
+      case TASK_DELAYED:
+        // A delayed task stays linked among the delayed ones: queue_due_tasks forgets it, since it's not TASK_DELAYED anymore
+        if (__atomic_compare_exchange_n(&task->state, &state, TASK_QUEUED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+          // A worker keeps what it wakes up, the other threads hand the task to its home worker
+          worker = current_worker != NULL && current_worker->pool == pool ? current_worker : &pool->workers[task->home % pool->n_workers] ;
+          queue_task(pool, worker, task);
+          return;
+        }
+        break;
+      case TASK_RUNNING:
+        if (__atomic_compare_exchange_n(&task->state, &state, TASK_RUNNING_AGAIN, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+          return;
+        break;
+      default:
+        // Already queued, or already going to run again
+        return;
+    }
+  }
+}
+
+// Entrypoint of a worker thread: runs its tasks, steals the tasks of the others, and sleeps when there is nothing left, until the pool stops
+static void* worker_thread(void* arg){
+
+  workerInfo* worker = (workerInfo*)arg ;
+  workerPool* pool = worker->pool ;
+  workTask* task ;
+  struct timespec deadline ;
+  uint64_t now, due ;
+
+  current_worker = worker ;
+  while (!__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE)) {
+    now = now_ms() ;
+    if (__atomic_load_n(&pool->next_due_ms, __ATOMIC_RELAXED) <= now)
+      queue_due_tasks(pool, worker, now);
+
+    if ((task = take_task(worker, 0)) != NULL){
+      run_task(pool, worker, task);
+      continue;
+    }
+    // Nothing left here: the newest task of the first busy worker after this one
+    for (int i = 1; i < pool->n_workers && task == NULL; i++)
+      task = take_task(&pool->workers[(worker->id + i) % pool->n_workers], 1);
+    if (task != NULL){
+      metrics_add(METRIC_TASKS_STOLEN, 1);
+      run_task(pool, worker, task);
+      continue;
+    }
+
+    // Nothing anywhere: sleeps until a task is queued or the next delayed task is due.
+    // n_sleeping is raised before n_queued is read, and queue_task does the opposite, so either the worker sees the task or queue_task sees the worker
+    pthread_mutex_lock(&pool->mutex);
+    __atomic_add_fetch(&pool->n_sleeping, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&pool->n_queued, __ATOMIC_SEQ_CST) == 0 && !pool->stopping) {
+      due = pool->next_due_ms ;
+      if (due == UINT64_MAX){
+        pthread_cond_wait(&pool->wake_up, &pool->mutex);
+        continue;
+      }
+      if (due <= now_ms())
+        break;
+      deadline.tv_sec = due / 1000 ;
+      deadline.tv_nsec = (long)(due % 1000) * 1000000L ;
+      pthread_cond_timedwait(&pool->wake_up, &pool->mutex, &deadline);
+    }
+    __atomic_sub_fetch(&pool->n_sleeping, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+  return NULL;
+}
+
+// Links the task at the tail of the deque of the worker and wakes up a sleeping worker, if any
+static void queue_task(workerPool* pool, workerInfo* worker, workTask* task){
+
+  pthread_mutex_lock(&worker->mutex);
+  task->next = NULL ;
+  task->prev = worker->tail ;
+  if (worker->tail == NULL)
+    __atomic_store_n(&worker->head, task, __ATOMIC_RELAXED);
+  else
+    worker->tail->next = task ;
+  worker->tail = task ;
+  pthread_mutex_unlock(&worker->mutex);
+
+  __atomic_add_fetch(&pool->n_queued, 1, __ATOMIC_SEQ_CST);
+  // Any worker will do: if it's not the one of the deque, it steals the task
+  if (__atomic_load_n(&pool->n_sleeping, __ATOMIC_SEQ_CST) > 0){
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->wake_up);
+    pthread_mutex_unlock(&pool->mutex);
+  }
+}
+
+// Takes the oldest task of the worker, or the newest one if stealing is not 0. NULL if the deque is empty
+static workTask* take_task(workerInfo* worker, int stealing){
+
+  workTask* task ;
+
+  // Peeking without the lock spares the thieves the locks of the empty deques
+  if (__atomic_load_n(&worker->head, __ATOMIC_RELAXED) == NULL)
+    return NULL;
+  pthread_mutex_lock(&worker->mutex);
+  if ((task = stealing ? worker->tail : worker->head) != NULL){
+    if (task->prev == NULL)
+      __atomic_store_n(&worker->head, task->next, __ATOMIC_RELAXED);
+    else
+      task->prev->next = task->next ;
+    if (task->next == NULL)
+      worker->tail = task->prev ;
+    else
+      task->next->prev = task->prev ;
+    task->prev = NULL ;
+    task->next = NULL ;
+  }
+  pthread_mutex_unlock(&worker->mutex);
+  if (task != NULL)
+    __atomic_sub_fetch(&worker->pool->n_queued, 1, __ATOMIC_SEQ_CST);
+  return task;
+}
+
+// Runs a task taken from a deque, then queues it again, delays it or leaves it idle, as its run and its wake ups ask
+static void run_task(workerPool* pool, workerInfo* worker, workTask* task){
+
+  int expected = TASK_RUNNING ;
+  int retry_ms ;
+  uint64_t due ;
+
+  // Nobody changes a queued task but the worker that takes it
+  __atomic_store_n(&task->state, TASK_RUNNING, __ATOMIC_SEQ_CST);
+  retry_ms = task->run(task->owner) ;
+  metrics_add(METRIC_TASKS_RUN, 1);
+
+  if (retry_ms > 0){
+    // The delayed tasks change under the mutex of the pool only, so queue_due_tasks never sees a task half delayed
+    pthread_mutex_lock(&pool->mutex);
+    if (__atomic_compare_exchange_n(&task->state, &expected, TASK_DELAYED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+      due = now_ms() + retry_ms ;
+      task->due_ms = due ;
+      if (!task->delayed){
+        task->delayed = 1 ;
+        task->next_delayed = pool->delayed_head ;
+        pool->delayed_head = task ;
+      }
+      // A sleeping worker may be waiting for a later task
+      if (due < pool->next_due_ms){
+        __atomic_store_n(&pool->next_due_ms, due, __ATOMIC_RELAXED);
+        pthread_cond_signal(&pool->wake_up);
+      }
+      pthread_mutex_unlock(&pool->mutex);
+      return;
+    }
+    pthread_mutex_unlock(&pool->mutex);
+  }else if (__atomic_compare_exchange_n(&task->state, &expected, TASK_IDLE, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+    return;
+  }
+
+  // Woken up while running: it goes at the tail, behind the tasks queued in the meantime
+  __atomic_store_n(&task->state, TASK_QUEUED, __ATOMIC_SEQ_CST);
+  queue_task(pool, worker, task);
+}
+
+// Queues every delayed task whose time has come, and forgets the ones woken up in the meantime
+static void queue_due_tasks(workerPool* pool, workerInfo* worker, uint64_t now){
+
+  workTask** link ;
+  workTask* task ;
+  workTask* due_tasks = NULL ;
+  uint64_t next_due = UINT64_MAX ;
+  int expected ;
+
+  pthread_mutex_lock(&pool->mutex);
+  link = &pool->delayed_head ;
+  while ((task = *link) != NULL) {
+    expected = TASK_DELAYED ;
+    if (__atomic_load_n(&task->state, __ATOMIC_ACQUIRE) == TASK_DELAYED && task->due_ms > now){
+      if (task->due_ms < next_due)
+        next_due = task->due_ms ;
+      link = &task->next_delayed ;
+      continue;
+    }
+    *link = task->next_delayed ;
+    task->delayed = 0 ;
+    // Due, unless it has been woken up right now
+    if (__atomic_compare_exchange_n(&task->state, &expected, TASK_QUEUED, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)){
+      task->next_delayed = due_tasks ;
+      due_tasks = task ;
+    }
+  }
+  __atomic_store_n(&pool->next_due_ms, next_due, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&pool->mutex);
+
+  // Queued once the mutex of the pool is released, since queue_task may take it
+  while ((task = due_tasks) != NULL) {
+    due_tasks = task->next_delayed ;
+    task->next_delayed = NULL ;
+    queue_task(pool, worker, task);
+  }
+}
+
+// Milliseconds since an arbitrary point, CLOCK_MONOTONIC
+static uint64_t now_ms(){
+  struct timespec now ;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000ULL + (uint64_t)now.tv_nsec / 1000000ULL ;
+}
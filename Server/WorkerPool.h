@@ -0,0 +1,69 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include<pthread.h>
+#include<stdint.h>
+
+#define WORKERS_MAX 64 // Max number of workers of a pool
+
+// States of a task, changed atomically by the threads waking it up and by the worker running it
+typedef enum task_st {
+    TASK_IDLE, // Not queued: it runs again only when somebody wakes it up
+    TASK_QUEUED, // Inside the deque of a worker
+    TASK_RUNNING, // Run by a worker right now
+    TASK_RUNNING_AGAIN, // Woken up while running: queued again as soon as the run ends
+    TASK_DELAYED // Waiting for its retry time, unless somebody wakes it up first
+} task_state ;
+
+// A task, embedded inside the record it works on. A task is never queued twice, and never run by two workers at the same time
+typedef struct work_t {
+    int (*run)(void* owner); // Returns how many milliseconds to wait before running the task again, 0 to wait until it's woken up
+    void* owner ; // The record the task belongs to, handed to run
+    int home ; // Worker whose deque gets the task when it's woken up by a thread outside the pool
+    int state ; // task_state
+    struct work_t* prev ; // Links inside the deque
+    struct work_t* next ;
+    struct work_t* next_delayed ; // Link inside the delayed tasks of the pool
+    int delayed ; // 1 while linked inside the delayed tasks
+    uint64_t due_ms ; // When a delayed task runs again, CLOCK_MONOTONIC
+} workTask ;
+
+// A worker thread and its deque of tasks. The worker takes its tasks from the oldest one, so none of them waits behind tasks queued later,
+// while a thief takes the newest one, from the other end
+typedef struct worker_i {
+    struct worker_p* pool ;
+    int id ;
+    pthread_t thread ;
+    pthread_mutex_t mutex ;
+    workTask* head ; // Oldest task. Written atomically under the mutex, since the thieves peek at it without the lock
+    workTask* tail ; // Newest task
+} __attribute__((aligned(64))) workerInfo ;
+
+// Fixed set of worker threads, started once. Every worker runs the tasks of its own deque and, once it's empty, steals from the others,
+// so a worker busy with a hot task doesn't hold up the tasks queued behind it. Idle workers sleep on a single condition variable
+typedef struct worker_p {
+    int n_workers ;
+    int n_started ; // Worker threads created by workers_start, the ones joined by workers_stop
+    int stopping ; // Set by workers_stop under the mutex, read atomically by the workers
+    workerInfo workers[WORKERS_MAX];
+    long n_queued ; // Tasks inside the deques, read by the workers before sleeping
+    int n_sleeping ; // Workers sleeping on wake_up
+    pthread_mutex_t mutex ; // Guards the delayed tasks and the sleeps
+    pthread_cond_t wake_up ;
+    workTask* delayed_head ; // Delayed tasks, in no order
+    uint64_t next_due_ms ; // Earliest due_ms of the delayed tasks, UINT64_MAX if there is none
+} workerPool ;
+
+// WORKER POOL FUNCTIONS
+// Initializes a pool of n_workers workers (at most WORKERS_MAX), without starting them. Returns -1 in case of error, 0 otherwise
+int workers_init(workerPool* pool, int n_workers);
+// Starts the worker threads. Returns -1 with errno set if a thread can't be created, 0 otherwise
+int workers_start(workerPool* pool);
+// Stops the worker threads started and waits for them: a task running ends its run, the queued ones never run again
+void workers_stop(workerPool* pool);
+// Initializes a task which is not queued. run(owner) is called by the workers, home picks the deque of the task
+void task_init(workTask* task, int (*run)(void* owner), void* owner, int home);
+// Makes sure the task runs after this call: queues it if it's idle or delayed, or has it run once more if it's running. Lock free unless it queues the task. Thread safe
+void workers_wake(workerPool* pool, workTask* task);
+
+#endif